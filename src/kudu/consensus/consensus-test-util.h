@@ -503,6 +503,29 @@ class LocalTestPeerProxy : public TestPeerProxy {
                                            this, request, response)));
   }
 
+  void ReadIndexAsync(const ReadIndexRequestPB* /*request*/,
+                      ReadIndexResponsePB* response,
+                      rpc::RpcController* /*controller*/,
+                      const rpc::ResponseCallback& callback) override {
+    CHECK_OK(pool_->SubmitFunc([this, response, callback]() {
+      std::shared_ptr<RaftConsensus> peer;
+      Status s = peers_->GetPeerByUuid(peer_uuid_, &peer);
+      if (!s.ok()) {
+        SetResponseError(s, response);
+        callback();
+        return;
+      }
+      peer->LeaderReadIndexAsync([this, response, callback](const Status& s, int64_t read_index) {
+        if (s.ok()) {
+          response->set_read_index(read_index);
+        } else {
+          SetResponseError(s, response);
+        }
+        callback();
+      });
+    }));
+  }
+
   template<class Response>
   void SetResponseError(const Status& status, Response* response) {
     ServerErrorPB* error = response->mutable_error();
@@ -538,6 +561,9 @@ class LocalTestPeerProxy : public TestPeerProxy {
     // remains as close to the dist. impl. as possible.
     ConsensusRequestPB other_peer_req;
     other_peer_req.CopyFrom(*request);
+    // Like the RPC layer, pass the serialized request along, so that the
+    // other peer logs the ops from their received bytes.
+    const std::string serialized_req = other_peer_req.SerializeAsString();
 
     // Give the other peer a clean response object to write to.
     ConsensusResponsePB other_peer_resp;
@@ -545,7 +571,7 @@ class LocalTestPeerProxy : public TestPeerProxy {
     Status s = peers_->GetPeerByUuid(peer_uuid_, &peer);
 
     if (s.ok()) {
-      s = peer->Update(&other_peer_req, &other_peer_resp);
+      s = peer->Update(&other_peer_req, &other_peer_resp, Slice(serialized_req));
       if (s.ok() && !other_peer_resp.has_error()) {
         CHECK(other_peer_resp.has_status());
         CHECK(other_peer_resp.status().IsInitialized());
@@ -728,6 +754,24 @@ class TestTransactionFactory : public ConsensusRoundHandler {
 
   void FinishConsensusOnlyRound(ConsensusRound* /*round*/) override {}
 
+  void FinishCommittedRounds(const std::vector<scoped_refptr<ConsensusRound>>& rounds) override {
+    std::vector<int64_t> batch;
+    for (const auto& round : rounds) {
+      batch.push_back(round->id().index());
+    }
+    {
+      std::lock_guard<simple_spinlock> lock(lock_);
+      committed_batches_.emplace_back(std::move(batch));
+    }
+    ConsensusRoundHandler::FinishCommittedRounds(rounds);
+  }
+
+  // The indexes of the rounds passed to each FinishCommittedRounds() call.
+  std::vector<std::vector<int64_t>> committed_batches() const {
+    std::lock_guard<simple_spinlock> lock(lock_);
+    return committed_batches_;
+  }
+
   void ReplicateAsync(ConsensusRound* round) {
     CHECK_OK(consensus_->Replicate(round));
   }
@@ -749,6 +793,9 @@ class TestTransactionFactory : public ConsensusRoundHandler {
   gscoped_ptr<ThreadPool> pool_;
   RaftConsensus* consensus_;
   log::Log* log_;
+
+  mutable simple_spinlock lock_;
+  std::vector<std::vector<int64_t>> committed_batches_;
 };
 
 }  // namespace consensus
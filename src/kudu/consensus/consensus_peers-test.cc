@@ -21,12 +21,15 @@
 // out of Kudu into a fork known as kuduraft.
 // ********************************************************************
 
+#include <algorithm>
 #include <cstddef>
 #include <memory>
 #include <string>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
+#include <gflags/gflags_declare.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 
@@ -61,6 +64,9 @@
 #include "kudu/util/test_util.h"
 #include "kudu/util/threadpool.h"
 
+DECLARE_int32(consensus_max_batch_size_bytes);
+DECLARE_int32(consensus_max_inflight_requests_per_peer);
+
 METRIC_DECLARE_entity(tablet);
 
 namespace kudu {
@@ -74,6 +80,7 @@ using std::make_shared;
 using std::shared_ptr;
 using std::string;
 using std::unique_ptr;
+using std::vector;
 
 const char* kTabletId = "test-peers-tablet";
 const char* kLeaderUuid = "peer-0";
@@ -390,5 +397,279 @@ TEST_F(ConsensusPeersTest, TestDontSendOneRpcPerWriteWhenPeerIsDown) {
   ASSERT_LT(mock_proxy->update_count(), 5);
 }
 
+// A proxy which, like NoOpTestPeerProxy, accepts all requests that match its
+// log, but holds on to the responses until RespondToAll() is called, so that
+// requests pile up in flight.
+class HoldingPeerProxy : public PeerProxy {
+ public:
+  HoldingPeerProxy(ThreadPool* pool, RaftPeerPB peer_pb)
+      : pool_(pool),
+        peer_pb_(std::move(peer_pb)),
+        last_received_(MinimumOpId()),
+        max_in_flight_(0),
+        reject_index_(-1),
+        num_pipelined_(0) {
+  }
+
+  void UpdateAsync(const ConsensusRequestPB* request,
+                   ConsensusResponsePB* response,
+                   rpc::RpcController* /*controller*/,
+                   const rpc::ResponseCallback& callback) override {
+    std::lock_guard<simple_spinlock> l(lock_);
+    response->Clear();
+    const int64_t first_index = request->ops_size() > 0 ? request->ops(0).id().index() : -1;
+    if (first_index > 0) {
+      sent_first_indexes_.push_back(first_index);
+    }
+    if (request->pipelined()) {
+      num_pipelined_++;
+    }
+    if (OpIdLessThan(last_received_, request->preceding_id()) ||
+        (first_index > 0 && first_index == reject_index_)) {
+      ConsensusErrorPB* error = response->mutable_status()->mutable_error();
+      error->set_code(ConsensusErrorPB::PRECEDING_ENTRY_DIDNT_MATCH);
+      StatusToPB(Status::IllegalState(""), error->mutable_status());
+      if (first_index == reject_index_) {
+        reject_index_ = -1;
+      }
+    } else if (request->ops_size() > 0) {
+      last_received_ = request->ops(request->ops_size() - 1).id();
+    }
+    response->set_responder_uuid(peer_pb_.permanent_uuid());
+    response->set_responder_term(request->caller_term());
+    response->mutable_status()->mutable_last_received()->CopyFrom(last_received_);
+    response->mutable_status()->mutable_last_received_current_leader()->CopyFrom(
+        last_received_);
+    response->mutable_status()->set_last_committed_idx(last_received_.index());
+
+    pending_.emplace_back(first_index, callback);
+    max_in_flight_ = std::max<int>(max_in_flight_, pending_.size());
+  }
+
+  void RequestConsensusVoteAsync(const VoteRequestPB* /*request*/,
+                                 VoteResponsePB* /*response*/,
+                                 rpc::RpcController* /*controller*/,
+                                 const rpc::ResponseCallback& /*callback*/) override {
+    LOG(FATAL) << "Not implemented";
+  }
+
+  Status StartElection(const RunLeaderElectionRequestPB* /*request*/,
+                       RunLeaderElectionResponsePB* /*response*/,
+                       rpc::RpcController* /*controller*/) override {
+    return Status::OK();
+  }
+
+  std::string PeerName() const override {
+    return "HoldingPeerProxy";
+  }
+
+  // Runs the callbacks of all requests received so far. The callbacks run
+  // concurrently, so they may complete in any order.
+  void RespondToAll() {
+    vector<std::pair<int64_t, rpc::ResponseCallback>> callbacks;
+    {
+      std::lock_guard<simple_spinlock> l(lock_);
+      callbacks.swap(pending_);
+    }
+    for (const auto& cb : callbacks) {
+      ignore_result(pool_->SubmitFunc(cb.second));
+    }
+  }
+
+  // Runs the callback of the oldest request received so far, if any.
+  void RespondToOldest() {
+    rpc::ResponseCallback callback;
+    {
+      std::lock_guard<simple_spinlock> l(lock_);
+      if (pending_.empty()) {
+        return;
+      }
+      callback = pending_.front().second;
+      pending_.erase(pending_.begin());
+    }
+    ignore_result(pool_->SubmitFunc(callback));
+  }
+
+  // Rejects the request starting with the op at 'index', once, as if the ops
+  // before it were missing.
+  void RejectOnce(int64_t index) {
+    std::lock_guard<simple_spinlock> l(lock_);
+    reject_index_ = index;
+  }
+
+  // The index of the first op of the oldest request whose response is held,
+  // or -1 if it has no ops or no response is held.
+  int64_t oldest_pending_index() const {
+    std::lock_guard<simple_spinlock> l(lock_);
+    return pending_.empty() ? -1 : pending_.front().first;
+  }
+
+  // The index of the first op of each request with ops, in the order they
+  // were received.
+  vector<int64_t> sent_first_indexes() const {
+    std::lock_guard<simple_spinlock> l(lock_);
+    return sent_first_indexes_;
+  }
+
+  int num_in_flight() const {
+    std::lock_guard<simple_spinlock> l(lock_);
+    return pending_.size();
+  }
+
+  int max_in_flight() const {
+    std::lock_guard<simple_spinlock> l(lock_);
+    return max_in_flight_;
+  }
+
+  OpId last_received() const {
+    std::lock_guard<simple_spinlock> l(lock_);
+    return last_received_;
+  }
+
+  // The number of requests received which were marked as pipelined.
+  int num_pipelined() const {
+    std::lock_guard<simple_spinlock> l(lock_);
+    return num_pipelined_;
+  }
+
+ private:
+  ThreadPool* const pool_;
+  const RaftPeerPB peer_pb_;
+  mutable simple_spinlock lock_;
+  OpId last_received_;
+  // The held responses, with the index of the first op of their request.
+  vector<std::pair<int64_t, rpc::ResponseCallback>> pending_;
+  int max_in_flight_;
+  int64_t reject_index_;
+  vector<int64_t> sent_first_indexes_;
+  int num_pipelined_;
+};
+
+// Tests that with a window of several requests, the peer keeps that many
+// requests in flight while catching up a follower, and that the follower
+// ends up with all ops even though the responses complete out of order.
+TEST_F(ConsensusPeersTest, TestPipelinedRequests) {
+  const int kWindow = 4;
+  const int kNumOps = 40;
+  FLAGS_consensus_max_inflight_requests_per_peer = kWindow;
+  // Make each request carry a single op.
+  FLAGS_consensus_max_batch_size_bytes = 1500;
+
+  message_queue_->SetLeaderMode(kMinimumOpIdIndex,
+                                kMinimumTerm,
+                                BuildRaftConfigPBForTests(3));
+
+  auto proxy = make_shared<HoldingPeerProxy>(raft_pool_.get(), FakeRaftPeerPB(kFollowerUuid));
+  peer_proxy_pool_.Put(kFollowerUuid, proxy);
+  shared_ptr<Peer> peer;
+  ASSERT_OK(Peer::NewRemotePeer(FakeRaftPeerPB(kFollowerUuid),
+                                kTabletId,
+                                kLeaderUuid,
+                                message_queue_.get(),
+                                &peer_proxy_pool_,
+                                raft_pool_token_.get(),
+                                proxy,
+                                messenger_,
+                                &peer));
+
+  AppendReplicateMessagesToQueue(message_queue_.get(), clock_, 1, kNumOps, 1000);
+  ASSERT_OK(peer->SignalRequest(true));
+
+  // The first exchanges find out where the follower's log stands and aren't
+  // pipelined. Once the follower is known to be in sync, the window fills up.
+  ASSERT_EVENTUALLY([&]() {
+    proxy->RespondToAll();
+    SleepFor(MonoDelta::FromMilliseconds(100));
+    ASSERT_EQ(kWindow, proxy->num_in_flight());
+  });
+
+  ASSERT_EVENTUALLY([&]() {
+    proxy->RespondToAll();
+    ASSERT_GE(message_queue_->GetCommittedIndex(), kNumOps);
+  });
+  ASSERT_EQ(kNumOps, proxy->last_received().index());
+  ASSERT_EQ(kWindow, proxy->max_in_flight());
+  // The requests sent while others were in flight were marked as pipelined,
+  // so that the follower waits for their preceding ops if they're reordered.
+  ASSERT_GT(proxy->num_pipelined(), 0);
+  peer->Close();
+}
+
+// Tests that when a request in the middle of the window is rejected, the
+// requests pipelined behind it are discarded, nothing more is pipelined until
+// all of them have been answered, and sending then resumes from the end of the
+// follower's log.
+TEST_F(ConsensusPeersTest, TestPipelineStallsOnRejectedRequest) {
+  const int kWindow = 4;
+  const int kNumOps = 40;
+  const int64_t kRejectedIndex = 20;
+  FLAGS_consensus_max_inflight_requests_per_peer = kWindow;
+  // Make each request carry a single op.
+  FLAGS_consensus_max_batch_size_bytes = 1500;
+
+  message_queue_->SetLeaderMode(kMinimumOpIdIndex,
+                                kMinimumTerm,
+                                BuildRaftConfigPBForTests(3));
+
+  auto proxy = make_shared<HoldingPeerProxy>(raft_pool_.get(), FakeRaftPeerPB(kFollowerUuid));
+  proxy->RejectOnce(kRejectedIndex);
+  peer_proxy_pool_.Put(kFollowerUuid, proxy);
+  shared_ptr<Peer> peer;
+  ASSERT_OK(Peer::NewRemotePeer(FakeRaftPeerPB(kFollowerUuid),
+                                kTabletId,
+                                kLeaderUuid,
+                                message_queue_.get(),
+                                &peer_proxy_pool_,
+                                raft_pool_token_.get(),
+                                proxy,
+                                messenger_,
+                                &peer));
+
+  AppendReplicateMessagesToQueue(message_queue_.get(), clock_, 1, kNumOps, 1000);
+  ASSERT_OK(peer->SignalRequest(true));
+
+  // Answer the requests one at a time until the rejected one is the oldest in
+  // a full window.
+  ASSERT_EVENTUALLY([&]() {
+    if (proxy->oldest_pending_index() != kRejectedIndex) {
+      proxy->RespondToOldest();
+    }
+    SleepFor(MonoDelta::FromMilliseconds(10));
+    ASSERT_EQ(kRejectedIndex, proxy->oldest_pending_index());
+    ASSERT_EQ(kWindow, proxy->num_in_flight());
+  });
+  ASSERT_EQ(kRejectedIndex - 1, proxy->last_received().index());
+
+  // Once the rejection is handled, the window stalls: nothing is pipelined,
+  // although it has room.
+  proxy->RespondToOldest();
+  ASSERT_EVENTUALLY([&]() {
+    ASSERT_TRUE(peer->pipeline_stalled_for_tests());
+  });
+  SleepFor(MonoDelta::FromMilliseconds(100));
+  ASSERT_TRUE(peer->pipeline_stalled_for_tests());
+  ASSERT_EQ(kWindow - 1, proxy->num_in_flight());
+
+  // The follower rejected the requests behind the rejected one, as their
+  // preceding ops are missing. Once they've been answered, the next request
+  // starts where the follower's log ends.
+  const size_t num_sent = proxy->sent_first_indexes().size();
+  proxy->RespondToAll();
+  ASSERT_EVENTUALLY([&]() {
+    vector<int64_t> sent = proxy->sent_first_indexes();
+    ASSERT_GT(sent.size(), num_sent);
+    ASSERT_EQ(kRejectedIndex, sent[num_sent]);
+  });
+  ASSERT_EQ(kRejectedIndex - 1, proxy->last_received().index());
+
+  ASSERT_EVENTUALLY([&]() {
+    proxy->RespondToAll();
+    ASSERT_GE(message_queue_->GetCommittedIndex(), kNumOps);
+  });
+  ASSERT_FALSE(peer->pipeline_stalled_for_tests());
+  ASSERT_EQ(kNumOps, proxy->last_received().index());
+  peer->Close();
+}
+
 }  // namespace consensus
 }  // namespace kudu
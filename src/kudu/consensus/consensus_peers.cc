@@ -52,6 +52,7 @@
 #include "kudu/rpc/periodic.h"
 #include "kudu/rpc/response_callback.h"
 #include "kudu/rpc/rpc_controller.h"
+#include "kudu/rpc/rpc_sidecar.h"
 #ifdef FB_DO_NOT_REMOVE
 #include "kudu/tserver/tserver.pb.h"
 #endif
@@ -96,15 +97,39 @@ DEFINE_int32(raft_proxy_max_hops, 16,
              "Maximum proxy routing hops allowed. In other words, the proxy routing TTL");
 TAG_FLAG(raft_proxy_max_hops, advanced);
 
+DEFINE_bool(consensus_send_serialized_ops, true,
+            "Whether the leader sends the ops of UpdateConsensus requests using "
+            "their cached wire encoding, which is computed once per op and shared "
+            "by all peers, rather than serializing them again for every peer. "
+            "This keeps up to one extra copy of each cached op in memory.");
+TAG_FLAG(consensus_send_serialized_ops, advanced);
+TAG_FLAG(consensus_send_serialized_ops, runtime);
+
+DEFINE_int32(consensus_max_inflight_requests_per_peer, 1,
+             "Maximum number of UpdateConsensus requests the leader keeps in flight "
+             "to each peer. Values above 1 pipeline requests, so that peers behind "
+             "high latency links receive more than one batch of ops per round trip.");
+TAG_FLAG(consensus_max_inflight_requests_per_peer, advanced);
+TAG_FLAG(consensus_max_inflight_requests_per_peer, runtime);
+
+DEFINE_int64(consensus_max_inflight_bytes_per_peer, 32 * 1024 * 1024,
+             "No further UpdateConsensus requests are pipelined to a peer while the "
+             "requests in flight to it add up to at least this many bytes. Only "
+             "relevant if --consensus_max_inflight_requests_per_peer is above 1.");
+TAG_FLAG(consensus_max_inflight_bytes_per_peer, advanced);
+TAG_FLAG(consensus_max_inflight_bytes_per_peer, runtime);
+
 DECLARE_int32(raft_heartbeat_interval_ms);
 
 using kudu::pb_util::SecureShortDebugString;
 using kudu::rpc::Messenger;
 using kudu::rpc::PeriodicTimer;
 using kudu::rpc::RpcController;
+using kudu::rpc::RpcSidecar;
 //using kudu::tserver::TabletServerErrorPB;
 using std::shared_ptr;
 using std::string;
+using std::unique_ptr;
 using std::vector;
 using std::weak_ptr;
 using strings::Substitute;
@@ -183,9 +208,9 @@ Status Peer::SignalRequest(bool even_if_queue_empty) {
     return Status::IllegalState("Peer was closed.");
   }
 
-  // Only allow one request at a time. No sense waking up the
-  // raft thread pool if the task will just abort anyway.
-  if (request_pending_) {
+  // No sense waking up the raft thread pool if the task will just abort
+  // anyway.
+  if (!CanSendRequestUnlocked()) {
     return Status::OK();
   }
 
@@ -200,17 +225,45 @@ Status Peer::SignalRequest(bool even_if_queue_empty) {
   return Status::OK();
 }
 
+Status Peer::SignalHeartbeat() {
+  {
+    std::lock_guard<simple_spinlock> l(peer_lock_);
+    if (PREDICT_FALSE(closed_)) {
+      return Status::IllegalState("Peer was closed.");
+    }
+    if (heartbeat_requested_) {
+      return Status::OK();
+    }
+    heartbeat_requested_ = true;
+  }
+  return SignalRequest(true);
+}
+
+bool Peer::CanSendRequestUnlocked() const {
+  DCHECK(peer_lock_.is_locked());
+  if (in_flight_.empty()) {
+    return true;
+  }
+  return !pipeline_stalled_ &&
+      static_cast<int>(in_flight_.size()) < FLAGS_consensus_max_inflight_requests_per_peer &&
+      in_flight_bytes_ < FLAGS_consensus_max_inflight_bytes_per_peer;
+}
+
 void Peer::SendNextRequest(bool even_if_queue_empty) {
   std::unique_lock<simple_spinlock> l(peer_lock_);
   if (PREDICT_FALSE(closed_)) {
     return;
   }
 
-  // Only allow one request at a time.
-  if (request_pending_) {
+  // Only allow as many requests at a time as the pipeline permits.
+  if (!CanSendRequestUnlocked()) {
     return;
   }
 
+  // If requests are already in flight, this one is pipelined behind them and
+  // starts where the last one ends.
+  const bool pipelined = !in_flight_.empty();
+
   // For the first request sent by the peer, we send it even if the queue is empty,
   // which it will always appear to be for the first request, since this is the
   // negotiation round.
@@ -233,45 +286,58 @@ void Peer::SendNextRequest(bool even_if_queue_empty) {
     return;
   }
 
-  // The peer has no pending request nor is sending: send the request.
+  // There is room for another request: assemble it.
   bool needs_tablet_copy = false;
 
   // The next hop to route to to ship messages to this peer. This could be
   // different than the peer_uuid when proxy is enabled
   string next_hop_uuid;
-  int64_t commit_index_before = request_.has_committed_index() ?
-      request_.committed_index() : kMinimumOpIdIndex;
-  Status s = queue_->RequestForPeer(peer_pb_.permanent_uuid(), &request_,
-                                    &replicate_msg_refs_, &needs_tablet_copy,
-                                    &next_hop_uuid);
-  int64_t commit_index_after = request_.has_committed_index() ?
-      request_.committed_index() : kMinimumOpIdIndex;
-
-  if (PREDICT_FALSE(!s.ok())) {
-    // Incrementing failed_attempts_ prevents a RequestForPeer error to continually
-    // trigger an error on every actual write. The next attempt to RequestForPeer
-    // will now be restricted to Heartbeats, but because this is hard failure
-    // it will keep failing but only fail less often.
-    // TODO -
-    // Make empty heartbeats go through after a failure to send actual messages,
-    // without changing the cursor at all on peer, but still maintaining authority on
-    // it. Otherwise node keeps asking for votes, destabilizing cluster.
-    failed_attempts_++;
-    VLOG_WITH_PREFIX_UNLOCKED(1) << s.ToString();
-    return;
+  unique_ptr<InFlightRequest> req(new InFlightRequest);
+  if (pipelined) {
+    Status s = queue_->PipelinedRequestForPeer(peer_pb_.permanent_uuid(),
+                                               in_flight_.back()->next_index,
+                                               &req->request, &req->msg_refs,
+                                               &next_hop_uuid);
+    if (!s.ok()) {
+      // The peer isn't known to be in sync with us. The responses to the
+      // requests in flight will tell where to continue from.
+      VLOG_WITH_PREFIX_UNLOCKED(2) << "Not pipelining request: " << s.ToString();
+      return;
+    }
+    req->request.set_pipelined(true);
+  } else {
+    Status s = queue_->RequestForPeer(peer_pb_.permanent_uuid(), &req->request,
+                                      &req->msg_refs, &needs_tablet_copy,
+                                      &next_hop_uuid);
+    if (PREDICT_FALSE(!s.ok())) {
+      // Incrementing failed_attempts_ prevents a RequestForPeer error to continually
+      // trigger an error on every actual write. The next attempt to RequestForPeer
+      // will now be restricted to Heartbeats, but because this is hard failure
+      // it will keep failing but only fail less often.
+      // TODO -
+      // Make empty heartbeats go through after a failure to send actual messages,
+      // without changing the cursor at all on peer, but still maintaining authority on
+      // it. Otherwise node keeps asking for votes, destabilizing cluster.
+      failed_attempts_++;
+      VLOG_WITH_PREFIX_UNLOCKED(1) << s.ToString();
+      return;
+    }
   }
+  ConsensusRequestPB& request = req->request;
+  int64_t commit_index_after = request.has_committed_index() ?
+      request.committed_index() : kMinimumOpIdIndex;
 
 #ifdef FB_DO_NOT_REMOVE
   if (PREDICT_FALSE(needs_tablet_copy)) {
     Status s = PrepareTabletCopyRequest();
     if (s.ok()) {
-      controller_.Reset();
-      request_pending_ = true;
+      tc_controller_.Reset();
+      tablet_copy_pending_ = true;
       l.unlock();
       // Capture a shared_ptr reference into the RPC callback so that we're guaranteed
       // that this object outlives the RPC.
       shared_ptr<Peer> s_this = shared_from_this();
-      proxy_->StartTabletCopyAsync(&tc_request_, &tc_response_, &controller_,
+      proxy_->StartTabletCopyAsync(&tc_request_, &tc_response_, &tc_controller_,
                                    [s_this]() {
                                      s_this->ProcessTabletCopyResponse();
                                    });
@@ -283,16 +349,19 @@ void Peer::SendNextRequest(bool even_if_queue_empty) {
   }
 #endif
 
-  request_.set_tablet_id(tablet_id_);
-  request_.set_caller_uuid(leader_uuid_);
-  request_.set_dest_uuid(peer_pb_.permanent_uuid());
+  request.set_tablet_id(tablet_id_);
+  request.set_caller_uuid(leader_uuid_);
+  request.set_dest_uuid(peer_pb_.permanent_uuid());
 
-  bool req_has_ops = request_.ops_size() > 0 || (commit_index_after > commit_index_before);
+  bool req_has_ops = request.ops_size() > 0 ||
+      (commit_index_after > last_sent_committed_index_);
   // If the queue is empty, check if we were told to send a status-only
-  // message, if not just return.
-  if (PREDICT_FALSE(!req_has_ops && !even_if_queue_empty)) {
+  // message, if not just return. There is no point in pipelining status-only
+  // messages, as the requests in flight already serve as heartbeats.
+  if (PREDICT_FALSE(!req_has_ops && (pipelined || !even_if_queue_empty))) {
     return;
   }
+  heartbeat_requested_ = false;
 
   if (req_has_ops) {
     // If we're actually sending ops there's no need to heartbeat for a while.
@@ -303,21 +372,14 @@ void Peer::SendNextRequest(bool even_if_queue_empty) {
 
 
   VLOG_WITH_PREFIX_UNLOCKED(2) << "Sending to peer " << peer_pb().permanent_uuid() << ": "
-      << SecureShortDebugString(request_);
-  controller_.Reset();
+      << SecureShortDebugString(request);
 
-  request_pending_ = true;
-  l.unlock();
-  // Capture a shared_ptr reference into the RPC callback so that we're guaranteed
-  // that this object outlives the RPC.
-  shared_ptr<Peer> s_this = shared_from_this();
-
-  // TODO: Refactor this code. Ideally all fields in 'request_' related to
+  // TODO: Refactor this code. Ideally all fields in 'request' related to
   // proxying should be set inside PeerMessageQueue::RequestForPeer(). Move the
   // setting of 'proxy_hops_remaining' to PeerMessageQueue::RequestForPeer()
   if (next_hop_uuid != peer_pb().permanent_uuid()) {
     // If this is a proxy request, set the hops remaining value.
-    request_.set_proxy_hops_remaining(FLAGS_raft_proxy_max_hops);
+    request.set_proxy_hops_remaining(FLAGS_raft_proxy_max_hops);
   }
 
   shared_ptr<PeerProxy> next_hop_proxy = peer_proxy_pool_->Get(next_hop_uuid);
@@ -326,10 +388,53 @@ void Peer::SendNextRequest(bool even_if_queue_empty) {
                                     << " not found in peer proxy pool";
   }
 
-  next_hop_proxy->UpdateAsync(&request_, &response_, &controller_,
-                              [s_this]() {
-                                s_this->ProcessResponse();
-                              });
+  const bool sends_ops = request.ops_size() > 0;
+  req->next_index = sends_ops ?
+      request.ops(request.ops_size() - 1).id().index() + 1 :
+      request.preceding_id().index() + 1;
+  if (request.ops_size() > 0 && FLAGS_consensus_send_serialized_ops &&
+      next_hop_proxy->SendsSerializedOps()) {
+    AttachSerializedOps(req.get());
+  } else {
+    req->bytes = request.ByteSize();
+  }
+
+  last_sent_committed_index_ = commit_index_after;
+  req->proxy = std::move(next_hop_proxy);
+  in_flight_bytes_ += req->bytes;
+  in_flight_.emplace_back(std::move(req));
+  num_unsent_++;
+
+  // Requests must be handed to the proxy in the order they were assembled, or
+  // the peer would find gaps in the ops it receives. 'peer_lock_' can't be held
+  // across UpdateAsync(), since the callback may run synchronously. Rather than
+  // wait for its turn, a thread leaves its request to the thread sending
+  // already, if any.
+  if (!sending_) {
+    sending_ = true;
+    // Capture a shared_ptr reference into the RPC callback so that we're
+    // guaranteed that this object outlives the RPC.
+    shared_ptr<Peer> s_this = shared_from_this();
+    while (num_unsent_ > 0) {
+      InFlightRequest* sent = in_flight_[in_flight_.size() - num_unsent_].get();
+      num_unsent_--;
+      sent->send_time = MonoTime::Now();
+      l.unlock();
+      sent->proxy->UpdateAsync(&sent->request, &sent->response, &sent->controller,
+                               [s_this, sent]() {
+                                 s_this->ProcessResponse(sent);
+                               });
+      l.lock();
+    }
+    sending_ = false;
+  }
+  l.unlock();
+
+  // Fill the pipeline if there are more ops to send. This is a no-op if the
+  // window is full or there is nothing left to send.
+  if (sends_ops && FLAGS_consensus_max_inflight_requests_per_peer > 1) {
+    ignore_result(SignalRequest());
+  }
 }
 
 Status Peer::StartElection(RunLeaderElectionRequestPB req) {
@@ -340,51 +445,134 @@ Status Peer::StartElection(RunLeaderElectionRequestPB req) {
   RETURN_NOT_OK(proxy_->StartElection(&req, &resp, &controller));
   RETURN_NOT_OK(controller.status());
   if (resp.has_error()) {
-    return StatusFromPB(response_.error().status());
+    return StatusFromPB(resp.error().status());
   }
   return Status::OK();
 }
 
-void Peer::ProcessResponse() {
+void Peer::ProcessResponse(InFlightRequest* req) {
   // Note: This method runs on the reactor thread.
+  req->response_time = MonoTime::Now();
   std::unique_lock<simple_spinlock> lock(peer_lock_);
   if (closed_) {
     return;
   }
-  CHECK(request_pending_);
+  DCHECK(!in_flight_.empty());
 
   MAYBE_FAULT(FLAGS_fault_crash_after_leader_request_fraction);
 
+  // Responses are handled in the order the requests were sent. If this isn't
+  // the oldest request in flight, or responses are being handled already,
+  // this one is picked up once its predecessors have been handled.
+  req->done = true;
+  if (processing_responses_ || in_flight_.front().get() != req) {
+    return;
+  }
+  processing_responses_ = true;
+
+  // The queue's handling of the peer response may generate IO (reads against
+  // the WAL) and SendNextRequest() may do the same thing. So we run the rest
+  // of the response handling logic on our thread pool and not on the reactor
+  // thread.
+  //
+  // Capture a weak_ptr reference into the submitted functor so that we can
+  // safely handle the functor outliving its peer.
+  weak_ptr<Peer> w_this = shared_from_this();
+  Status s = raft_pool_token_->SubmitFunc([w_this]() {
+    if (auto p = w_this.lock()) {
+      p->DoProcessResponses();
+    }
+  });
+  if (PREDICT_FALSE(!s.ok())) {
+    LOG_WITH_PREFIX_UNLOCKED(WARNING) << "Unable to process peer response: " << s.ToString()
+        << ": " << SecureShortDebugString(req->response);
+    // Drop the finished requests; there is nobody left to process them.
+    while (!in_flight_.empty() && in_flight_.front()->done) {
+      in_flight_bytes_ -= in_flight_.front()->bytes;
+      in_flight_.pop_front();
+    }
+    pipeline_stalled_ = !in_flight_.empty();
+    processing_responses_ = false;
+  }
+}
+
+void Peer::DoProcessResponses() {
+  bool send_more_immediately = false;
+  bool heartbeat_due = false;
+  while (true) {
+    InFlightRequest* req;
+    {
+      std::lock_guard<simple_spinlock> lock(peer_lock_);
+      DCHECK(processing_responses_);
+      if (in_flight_.empty() || !in_flight_.front()->done) {
+        processing_responses_ = false;
+        // A heartbeat asked for while requests were in flight couldn't be
+        // sent then.
+        heartbeat_due = heartbeat_requested_ && in_flight_.empty();
+        break;
+      }
+      req = in_flight_.front().get();
+    }
+
+    // Only the thread handling responses touches the oldest request, so
+    // there's no need to hold the lock while handling it.
+    send_more_immediately = HandleResponse(*req);
+
+    unique_ptr<InFlightRequest> handled;
+    {
+      std::lock_guard<simple_spinlock> lock(peer_lock_);
+      handled = std::move(in_flight_.front());
+      in_flight_.pop_front();
+      in_flight_bytes_ -= handled->bytes;
+      if (in_flight_.empty()) {
+        // Whatever went wrong with the requests sent so far, the next request
+        // is assembled from what the peer last told us.
+        pipeline_stalled_ = false;
+      }
+    }
+  }
+
+  // We're OK to read the state_ without a lock here -- if we get a race,
+  // the worst thing that could happen is that we'll make one more request before
+  // noticing a close.
+  if (send_more_immediately || heartbeat_due) {
+    SendNextRequest(true);
+  }
+}
+
+bool Peer::HandleResponse(const InFlightRequest& req) {
+  const ConsensusResponsePB& response = req.response;
+
   // Process RpcController errors.
-  const auto controller_status = controller_.status();
+  const auto controller_status = req.controller.status();
   if (!controller_status.ok()) {
     auto ps = controller_status.IsRemoteError() ?
         PeerStatus::REMOTE_ERROR : PeerStatus::RPC_LAYER_ERROR;
     queue_->UpdatePeerStatus(peer_pb_.permanent_uuid(), ps, controller_status);
-    ProcessResponseError(controller_status);
-    return;
+    ProcessResponseError(response, controller_status);
+    return false;
   }
 
   // Process CANNOT_PREPARE.
   // TODO(todd): there is no integration test coverage of this code path. Likely a bug in
   // this path is responsible for KUDU-1779.
-  if (response_.status().has_error() &&
-      response_.status().error().code() == consensus::ConsensusErrorPB::CANNOT_PREPARE) {
-    Status response_status = StatusFromPB(response_.status().error().status());
+  if (response.status().has_error() &&
+      response.status().error().code() == consensus::ConsensusErrorPB::CANNOT_PREPARE) {
+    Status response_status = StatusFromPB(response.status().error().status());
     queue_->UpdatePeerStatus(peer_pb_.permanent_uuid(), PeerStatus::CANNOT_PREPARE,
                              response_status);
-    ProcessResponseError(response_status);
-    return;
+    ProcessResponseError(response, response_status);
+    return false;
   }
 
   // Process tserver-level errors.
-  if (response_.has_error()) {
-    Status response_status = StatusFromPB(response_.error().status());
+  if (response.has_error()) {
+    Status response_status = StatusFromPB(response.error().status());
     PeerStatus ps;
     ps = PeerStatus::REMOTE_ERROR;
 
-    ServerErrorPB resp_error = response_.error();
-    switch (response_.error().code()) {
+    ServerErrorPB resp_error = response.error();
+    switch (response.error().code()) {
       // We treat WRONG_SERVER_UUID as failed.
       case ServerErrorPB::WRONG_SERVER_UUID: FALLTHROUGH_INTENDED;
 #ifdef FB_DO_NOT_REMOVE
@@ -400,50 +588,28 @@ void Peer::ProcessResponse() {
         ps = PeerStatus::REMOTE_ERROR;
     }
     queue_->UpdatePeerStatus(peer_pb_.permanent_uuid(), ps, response_status);
-    ProcessResponseError(response_status);
-    return;
-  }
-
-  // The queue's handling of the peer response may generate IO (reads against
-  // the WAL) and SendNextRequest() may do the same thing. So we run the rest
-  // of the response handling logic on our thread pool and not on the reactor
-  // thread.
-  //
-  // Capture a weak_ptr reference into the submitted functor so that we can
-  // safely handle the functor outliving its peer.
-  weak_ptr<Peer> w_this = shared_from_this();
-  Status s = raft_pool_token_->SubmitFunc([w_this]() {
-    if (auto p = w_this.lock()) {
-      p->DoProcessResponse();
-
-    }
-  });
-  if (PREDICT_FALSE(!s.ok())) {
-    LOG_WITH_PREFIX_UNLOCKED(WARNING) << "Unable to process peer response: " << s.ToString()
-        << ": " << SecureShortDebugString(response_);
-    request_pending_ = false;
+    ProcessResponseError(response, response_status);
+    return false;
   }
-}
-
-void Peer::DoProcessResponse() {
 
   VLOG_WITH_PREFIX_UNLOCKED(2) << "Response from peer " << peer_pb().permanent_uuid() << ": "
-      << SecureShortDebugString(response_);
-
-  bool send_more_immediately = queue_->ResponseFromPeer(peer_pb_.permanent_uuid(), response_);
+      << SecureShortDebugString(response);
 
-  {
-    std::unique_lock<simple_spinlock> lock(peer_lock_);
-    CHECK(request_pending_);
-    failed_attempts_ = 0;
-    request_pending_ = false;
+  if (!response.status().has_error()) {
+    queue_->RecordPeerExchange(peer_pb_.permanent_uuid(), req.bytes,
+                               req.response_time - req.send_time);
   }
-  // We're OK to read the state_ without a lock here -- if we get a race,
-  // the worst thing that could happen is that we'll make one more request before
-  // noticing a close.
-  if (send_more_immediately) {
-    SendNextRequest(true);
+  bool send_more_immediately = queue_->ResponseFromPeer(peer_pb_.permanent_uuid(), response,
+                                                        req.send_time);
+
+  std::lock_guard<simple_spinlock> lock(peer_lock_);
+  failed_attempts_ = 0;
+  if (response.status().has_error()) {
+    // E.g. an LMP mismatch: the peer rejected this request, and will reject
+    // any request pipelined behind it too.
+    pipeline_stalled_ = true;
   }
+  return send_more_immediately;
 }
 
 #ifdef FB_DO_NOT_REMOVE
@@ -464,11 +630,11 @@ void Peer::ProcessTabletCopyResponse() {
   if (closed_) {
     return;
   }
-  CHECK(request_pending_);
-  request_pending_ = false;
+  CHECK(tablet_copy_pending_);
+  tablet_copy_pending_ = false;
 
   // If the response is OK, or ALREADY_INPROGRESS, then consider the RPC successful.
-  const auto controller_status = controller_.status();
+  const auto controller_status = tc_controller_.status();
   bool success =
     controller_status.ok() &&
     (!tc_response_.has_error() ||
@@ -489,20 +655,22 @@ void Peer::ProcessTabletCopyResponse() {
 }
 #endif
 
-void Peer::ProcessResponseError(const Status& status) {
+void Peer::ProcessResponseError(const ConsensusResponsePB& response, const Status& status) {
+  std::lock_guard<simple_spinlock> lock(peer_lock_);
   failed_attempts_++;
+  // Any requests pipelined behind the failed one were assembled assuming that
+  // it would succeed.
+  pipeline_stalled_ = true;
   string resp_err_info;
 
 #ifdef FB_DO_NOT_REMOVE
-  if (response_.has_error()) {
+  if (response.has_error()) {
     resp_err_info = Substitute(" Error code: $0 ($1).",
-                               TabletServerErrorPB::Code_Name(response_.error().code()),
-                               response_.error().code());
+                               TabletServerErrorPB::Code_Name(response.error().code()),
+                               response.error().code());
   }
 #endif
 
-  request_pending_ = false;
-
   if (status.IsIllegalState() &&
       status.ToString().find("Previous Rotate Event with") != std::string::npos) {
     // This is expected rotation delay. Do not log error and return early
@@ -518,6 +686,30 @@ void Peer::ProcessResponseError(const Status& status) {
       << " Already tried " << failed_attempts_ << " times.";
 }
 
+void Peer::AttachSerializedOps(InFlightRequest* req) {
+  DCHECK_EQ(req->request.ops_size(), req->msg_refs.size());
+  size_t total_size = 0;
+  bool payload_compressed = false;
+  // The encodings are shared with the other peers and the LogCache rather than
+  // copied: the transfer writes them out one after the other.
+  vector<unique_ptr<RpcSidecar>> ops;
+  ops.reserve(req->msg_refs.size());
+  for (const ReplicateRefPtr& msg : req->msg_refs) {
+    const shared_ptr<const string>& encoding = msg->ConsensusRequestOpEncoding();
+    total_size += encoding->size();
+    ops.emplace_back(RpcSidecar::FromSharedString(encoding));
+    payload_compressed |= msg->get()->write_payload().compression_codec() != NO_COMPRESSION;
+  }
+  // Compressing the ops again as part of the RPC transfer would cost CPU for
+  // little gain.
+  req->controller.set_compressible(!payload_compressed);
+  req->controller.SetOutboundSerializedFields(std::move(ops));
+  req->bytes = req->request.ByteSize() + total_size;
+
+  // The ops are owned by 'msg_refs', which outlives the call.
+  req->request.mutable_ops()->ExtractSubrange(0, req->request.ops_size(), nullptr);
+}
+
 string Peer::LogPrefixUnlocked() const {
   return Substitute("T $0 P $1 -> Peer $2 ($3:$4): ",
                     tablet_id_, leader_uuid_, peer_pb_.permanent_uuid(),
@@ -541,9 +733,11 @@ Peer::~Peer() {
   if (heartbeater_) {
     heartbeater_->Stop();
   }
+}
 
+Peer::InFlightRequest::~InFlightRequest() {
   // We don't own the ops (the queue does).
-  request_.mutable_ops()->ExtractSubrange(0, request_.ops_size(), nullptr);
+  request.mutable_ops()->ExtractSubrange(0, request.ops_size(), nullptr);
 }
 
 shared_ptr<PeerProxy> PeerProxyPool::Get(const string& uuid) const {
@@ -569,6 +763,17 @@ RpcPeerProxy::RpcPeerProxy(gscoped_ptr<HostPort> hostport,
   DCHECK(consensus_proxy_ != NULL);
 }
 
+void PeerProxy::ReadIndexAsync(const ReadIndexRequestPB* /*request*/,
+                               ReadIndexResponsePB* response,
+                               rpc::RpcController* /*controller*/,
+                               const rpc::ResponseCallback& callback) {
+  ServerErrorPB* error = response->mutable_error();
+  error->set_code(ServerErrorPB::UNKNOWN_ERROR);
+  StatusToPB(Status::NotSupported("ReadIndex is not supported by this proxy"),
+             error->mutable_status());
+  callback();
+}
+
 void RpcPeerProxy::UpdateAsync(const ConsensusRequestPB* request,
                                ConsensusResponsePB* response,
                                rpc::RpcController* controller,
@@ -584,6 +789,17 @@ Status RpcPeerProxy::StartElection(const RunLeaderElectionRequestPB* request,
   return consensus_proxy_->RunLeaderElection(*request, response, controller);
 }
 
+void RpcPeerProxy::ReadIndexAsync(const ReadIndexRequestPB* request,
+                                  ReadIndexResponsePB* response,
+                                  rpc::RpcController* controller,
+                                  const rpc::ResponseCallback& callback) {
+  // Callers may bound the read with a deadline of their own.
+  if (!controller->timeout().Initialized()) {
+    controller->set_timeout(MonoDelta::FromMilliseconds(FLAGS_consensus_rpc_timeout_ms));
+  }
+  consensus_proxy_->ReadIndexAsync(*request, response, controller, callback);
+}
+
 void RpcPeerProxy::RequestConsensusVoteAsync(const VoteRequestPB* request,
                                              VoteResponsePB* response,
                                              rpc::RpcController* controller,
@@ -25,6 +25,7 @@
 #define KUDU_CONSENSUS_CONSENSUS_PEERS_H_
 
 #include <cstdint>
+#include <deque>
 #include <memory>
 #include <ostream>
 #include <string>
@@ -35,10 +36,12 @@
 #include "kudu/consensus/consensus.pb.h"
 #include "kudu/consensus/consensus.proxy.h"
 #include "kudu/consensus/metadata.pb.h"
+#include "kudu/consensus/opid_util.h"
 #include "kudu/consensus/ref_counted_replicate.h"
 #include "kudu/rpc/response_callback.h"
 #include "kudu/rpc/rpc_controller.h"
 #include "kudu/util/locks.h"
+#include "kudu/util/monotime.h"
 #include "kudu/util/net/net_util.h"
 #include "kudu/util/status.h"
 
@@ -57,10 +60,15 @@ class PeerProxyPool;
 
 // A remote peer in consensus.
 //
-// Leaders use peers to update the remote replicas. Each peer
-// may have at most one outstanding request at a time. If a
-// request is signaled when there is already one outstanding,
-// the request will be generated once the outstanding one finishes.
+// Leaders use peers to update the remote replicas. Once a peer is known to be
+// in sync, it pipelines its requests: up to
+// --consensus_max_inflight_requests_per_peer requests, and
+// --consensus_max_inflight_bytes_per_peer bytes, may be outstanding at a time,
+// each starting where the one before it ends. Requests are sent, and their
+// responses handled, in order. If a request is signaled when the window is
+// full, it will be generated once an outstanding one finishes. After an error
+// or rejection, nothing more is pipelined until the outstanding requests have
+// been handled.
 //
 // Peers are owned by the consensus implementation and do not keep
 // state aside from the most recent request and response.
@@ -84,6 +92,12 @@ class Peer : public std::enable_shared_from_this<Peer> {
   // status-only requests.
   Status SignalRequest(bool even_if_queue_empty = false);
 
+  // Asks for a request to be sent to the peer soon, even if there is nothing
+  // to replicate, so that the peer acknowledges a request sent after this
+  // call. If requests are in flight, the new one is sent once they have been
+  // answered. Calls made before that request is sent share it.
+  Status SignalHeartbeat();
+
   // Synchronously starts a leader election on this peer.
   // This method is ad hoc, using this instance's PeerProxy to send the
   // StartElection request.
@@ -104,6 +118,13 @@ class Peer : public std::enable_shared_from_this<Peer> {
   // the ThreadPoolToken.
   void Close();
 
+  // Whether requests are being held back until the requests in flight have
+  // been handled, because one of them failed or was rejected.
+  bool pipeline_stalled_for_tests() const {
+    std::lock_guard<simple_spinlock> l(peer_lock_);
+    return pipeline_stalled_;
+  }
+
   ~Peer();
 
   // Creates a new remote peer and makes the queue track it.'
@@ -132,17 +153,60 @@ class Peer : public std::enable_shared_from_this<Peer> {
        std::shared_ptr<PeerProxy> proxy,
        std::shared_ptr<rpc::Messenger> messenger);
 
+  // An UpdateConsensus request sent to the peer whose response hasn't been
+  // handled yet.
+  struct InFlightRequest {
+    ~InFlightRequest();
+
+    ConsensusRequestPB request;
+    ConsensusResponsePB response;
+    rpc::RpcController controller;
+
+    // Reference-counted pointers to the ReplicateMsgs in 'request'. We may have
+    // loaded these messages from the LogCache, in which case we are potentially
+    // sharing the same object as other peers. Since the PB request itself can't
+    // hold reference counts, this holds them.
+    std::vector<ReplicateRefPtr> msg_refs;
+
+    // The index a request pipelined behind this one starts at, i.e. one past
+    // the last op in 'request'.
+    int64_t next_index = 0;
+
+    // Approximate size of 'request' on the wire.
+    int64_t bytes = 0;
+
+    // The proxy to the next hop towards the peer, which 'request' is sent to.
+    std::shared_ptr<PeerProxy> proxy;
+
+    // When 'request' was handed to the proxy, and when its response arrived.
+    MonoTime send_time;
+    MonoTime response_time;
+
+    // Set on the reactor thread once the RPC has completed.
+    bool done = false;
+  };
+
+  // Returns true if another request may be sent to the peer, given the
+  // requests already in flight.
+  bool CanSendRequestUnlocked() const;
+
   void SendNextRequest(bool even_if_queue_empty);
 
-  // Signals that a response was received from the peer.
+  // Signals that a response to 'req' was received from the peer.
   //
   // This method is called from the reactor thread and calls
-  // DoProcessResponse() on raft_pool_token_ to do any work that requires IO or
+  // DoProcessResponses() on raft_pool_token_ to do any work that requires IO or
   // lock-taking.
-  void ProcessResponse();
+  void ProcessResponse(InFlightRequest* req);
 
-  // Run on 'raft_pool_token'. Does response handling that requires IO or may block.
-  void DoProcessResponse();
+  // Run on 'raft_pool_token'. Handles the responses of completed requests, in
+  // the order the requests were sent, until it reaches a request which is still
+  // in flight. Does response handling that requires IO or may block.
+  void DoProcessResponses();
+
+  // Handles the response to 'req' and returns whether another request should
+  // be sent right away.
+  bool HandleResponse(const InFlightRequest& req);
 
 #ifndef FB_DO_NOT_REMOVE
   // Fetch the desired tablet copy request from the queue and set up
@@ -157,7 +221,12 @@ class Peer : public std::enable_shared_from_this<Peer> {
 #endif
 
   // Signals there was an error sending the request to the peer.
-  void ProcessResponseError(const Status& status);
+  void ProcessResponseError(const ConsensusResponsePB& response, const Status& status);
+
+  // Moves the ops out of 'req->request' and attaches their cached wire
+  // encoding to 'req->controller' instead, so that they are neither serialized
+  // again nor copied for this peer.
+  void AttachSerializedOps(InFlightRequest* req);
 
   std::string LogPrefixUnlocked() const;
 
@@ -174,24 +243,14 @@ class Peer : public std::enable_shared_from_this<Peer> {
   PeerProxyPool* peer_proxy_pool_;
   uint64_t failed_attempts_;
 
-  // The latest consensus update request and response.
-  ConsensusRequestPB request_;
-  ConsensusResponsePB response_;
-
 #ifdef FB_DO_NOT_REMOVE
   // The latest tablet copy request and response.
   StartTabletCopyRequestPB tc_request_;
   StartTabletCopyResponsePB tc_response_;
+  rpc::RpcController tc_controller_;
+  bool tablet_copy_pending_ = false;
 #endif
 
-  // Reference-counted pointers to any ReplicateMsgs which are in-flight to the peer. We
-  // may have loaded these messages from the LogCache, in which case we are potentially
-  // sharing the same object as other peers. Since the PB request_ itself can't hold
-  // reference counts, this holds them.
-  std::vector<ReplicateRefPtr> replicate_msg_refs_;
-
-  rpc::RpcController controller_;
-
   std::shared_ptr<rpc::Messenger> messenger_;
 
   // Thread pool token used to construct requests to this peer.
@@ -204,10 +263,42 @@ class Peer : public std::enable_shared_from_this<Peer> {
 
   // lock that protects Peer state changes, initialization, etc.
   mutable simple_spinlock peer_lock_;
-  bool request_pending_ = false;
   bool closed_ = false;
   bool has_sent_first_request_ = false;
 
+  // Whether SignalHeartbeat() was called since the last request was sent.
+  bool heartbeat_requested_ = false;
+
+  // The consensus update requests in flight to the peer, oldest first.
+  std::deque<std::unique_ptr<InFlightRequest>> in_flight_;
+
+  // The sum of 'bytes' over 'in_flight_'.
+  int64_t in_flight_bytes_ = 0;
+
+  // Set if a request failed or was rejected by the peer, in which case the
+  // requests behind it were assembled on a wrong assumption. Nothing is
+  // pipelined until all requests in flight have been handled. Since the peer
+  // handles the requests in flight in the order they arrive, it waits a little
+  // for reordered requests rather than reject them, so that a reorder on its
+  // side rarely stalls the pipeline (see
+  // RaftConsensus::WaitForPrecedingUpdate()).
+  bool pipeline_stalled_ = false;
+
+  // Set while a thread handles responses, so that they're handled one at a
+  // time and in order.
+  bool processing_responses_ = false;
+
+  // The committed index sent with the last request.
+  int64_t last_sent_committed_index_ = kMinimumOpIdIndex;
+
+  // The number of requests at the back of 'in_flight_' which haven't been
+  // handed to the proxy yet.
+  int num_unsent_ = 0;
+
+  // Set while a thread hands requests to the proxy, so that they're sent one
+  // at a time and in order (see SendNextRequest()).
+  bool sending_ = false;
+
 };
 
 // A proxy to another peer. Usually a thin wrapper around an rpc proxy but can
@@ -222,6 +313,12 @@ class PeerProxy {
                            rpc::RpcController* controller,
                            const rpc::ResponseCallback& callback) = 0;
 
+  // Returns true if UpdateAsync() sends the request over the wire using the
+  // RpcController. The caller may then remove the ops from the request and
+  // attach their cached wire encoding to the controller instead (see
+  // RpcController::SetOutboundSerializedFields()).
+  virtual bool SendsSerializedOps() const { return false; }
+
   // Sends a RequestConsensusVote to a remote peer.
   virtual void RequestConsensusVoteAsync(const VoteRequestPB* request,
                                          VoteResponsePB* response,
@@ -232,6 +329,13 @@ class PeerProxy {
                                RunLeaderElectionResponsePB* response,
                                rpc::RpcController* controller) = 0;
 
+  // Asks a remote leader for its read index, asynchronously. The default
+  // implementation responds with a NotSupported error.
+  virtual void ReadIndexAsync(const ReadIndexRequestPB* request,
+                              ReadIndexResponsePB* response,
+                              rpc::RpcController* controller,
+                              const rpc::ResponseCallback& callback);
+
 #ifdef FB_DO_NOT_REMOVE
   // Instructs a peer to begin a tablet copy session.
   virtual void StartTabletCopyAsync(const StartTabletCopyRequestPB* /*request*/,
@@ -289,6 +393,8 @@ class RpcPeerProxy : public PeerProxy {
                    rpc::RpcController* controller,
                    const rpc::ResponseCallback& callback) override;
 
+  bool SendsSerializedOps() const override { return true; }
+
   void RequestConsensusVoteAsync(const VoteRequestPB* request,
                                  VoteResponsePB* response,
                                  rpc::RpcController* controller,
@@ -298,6 +404,11 @@ class RpcPeerProxy : public PeerProxy {
                        RunLeaderElectionResponsePB* response,
                        rpc::RpcController* controller) override;
 
+  void ReadIndexAsync(const ReadIndexRequestPB* request,
+                      ReadIndexResponsePB* response,
+                      rpc::RpcController* controller,
+                      const rpc::ResponseCallback& callback) override;
+
 #ifdef FB_DO_NOT_REMOVE
   void StartTabletCopyAsync(const StartTabletCopyRequestPB* request,
                             StartTabletCopyResponsePB* response,
@@ -22,6 +22,7 @@
 // ********************************************************************
 #include <cstddef>
 #include <cstdint>
+#include <mutex>
 #include <ostream>
 #include <string>
 #include <vector>
@@ -58,6 +59,8 @@
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/util/async_util.h"
+#include "kudu/util/countdown_latch.h"
+#include "kudu/util/locks.h"
 #include "kudu/util/metrics.h"
 //METRIC_DEFINE_entity(tablet);
 #include "kudu/util/monotime.h"
@@ -67,6 +70,9 @@
 #include "kudu/util/test_util.h"
 #include "kudu/util/threadpool.h"
 
+DECLARE_bool(consensus_adaptive_batch_size);
+DECLARE_int32(consensus_adaptive_max_batch_size_bytes);
+DECLARE_int32(consensus_adaptive_min_batch_size_bytes);
 DECLARE_int32(consensus_max_batch_size_bytes);
 DECLARE_int32(follower_unavailable_considered_failed_sec);
 
@@ -1044,5 +1050,133 @@ TEST(ConsensusQueueUnitTest, PeerHealthStatus) {
   EXPECT_EQ(HealthReportPB::FAILED_UNRECOVERABLE, PeerMessageQueue::PeerHealthStatus(peer));
 }
 
+// Test that the batch size chosen for a peer converges on the bandwidth-delay
+// product of its link, within the configured bounds.
+TEST_F(ConsensusQueueTest, TestAdaptiveBatchSize) {
+  FLAGS_consensus_adaptive_batch_size = true;
+  FLAGS_consensus_max_batch_size_bytes = 1024 * 1024;
+  FLAGS_consensus_adaptive_min_batch_size_bytes = 64 * 1024;
+  FLAGS_consensus_adaptive_max_batch_size_bytes = 4 * 1024 * 1024;
+  queue_->SetLeaderMode(kMinimumOpIdIndex, kMinimumTerm, BuildRaftConfigPBForTests(3));
+  queue_->TrackPeer(MakePeer(kPeerUuid, RaftPeerPB::VOTER));
+  ASSERT_EQ(1024 * 1024, queue_->GetTrackedPeerForTests(kPeerUuid).batch_size_bytes);
+
+  // Simulates sending full batches, interleaved with heartbeats, over a link
+  // with the given propagation delay and bandwidth, and returns the batch size
+  // the queue settles on.
+  auto simulate = [&](const MonoDelta& delay, double bytes_per_sec) {
+    for (int i = 0; i < 50; i++) {
+      int64_t batch_size = queue_->GetTrackedPeerForTests(kPeerUuid).batch_size_bytes;
+      MonoDelta rtt = MonoDelta::FromNanoseconds(
+          delay.ToNanoseconds() + batch_size * 1e9 / bytes_per_sec);
+      queue_->RecordPeerExchange(kPeerUuid, batch_size, rtt);
+      queue_->RecordPeerExchange(kPeerUuid, 100, delay);
+    }
+    return queue_->GetTrackedPeerForTests(kPeerUuid).batch_size_bytes;
+  };
+
+  // 50ms at 10MB/s: the bandwidth-delay product is 500KB.
+  const double kBandwidth = 10 * 1024 * 1024;
+  int64_t batch_size = simulate(MonoDelta::FromMilliseconds(50), kBandwidth);
+  ASSERT_GT(batch_size, 480 * 1024);
+  ASSERT_LT(batch_size, 540 * 1024);
+
+  PeerMessageQueue::TrackedPeer peer = queue_->GetTrackedPeerForTests(kPeerUuid);
+  ASSERT_EQ(50, peer.min_rtt.ToMilliseconds());
+  ASSERT_GT(peer.goodput_bytes_per_sec, kBandwidth / 3);
+  ASSERT_LT(peer.goodput_bytes_per_sec, kBandwidth);
+
+  // Heartbeats and other small requests don't drag the goodput estimate down.
+  for (int i = 0; i < 10; i++) {
+    queue_->RecordPeerExchange(kPeerUuid, 100, MonoDelta::FromMilliseconds(50));
+  }
+  ASSERT_EQ(peer.goodput_bytes_per_sec,
+            queue_->GetTrackedPeerForTests(kPeerUuid).goodput_bytes_per_sec);
+
+  // A local peer is bounded below, a distant one above.
+  ASSERT_EQ(FLAGS_consensus_adaptive_min_batch_size_bytes,
+            simulate(MonoDelta::FromMicroseconds(100), kBandwidth));
+  queue_->UntrackPeer(kPeerUuid);
+  queue_->TrackPeer(MakePeer(kPeerUuid, RaftPeerPB::VOTER));
+  ASSERT_EQ(FLAGS_consensus_adaptive_max_batch_size_bytes,
+            simulate(MonoDelta::FromSeconds(1), kBandwidth));
+
+  // The batch size at most doubles from one exchange to the next, even if the
+  // exchange suggests a much larger one.
+  FLAGS_consensus_adaptive_max_batch_size_bytes = 64 * 1024 * 1024;
+  queue_->UntrackPeer(kPeerUuid);
+  queue_->TrackPeer(MakePeer(kPeerUuid, RaftPeerPB::VOTER));
+  queue_->RecordPeerExchange(kPeerUuid, 16 * 1024 * 1024, MonoDelta::FromMilliseconds(1));
+  ASSERT_EQ(2 * 1024 * 1024, queue_->GetTrackedPeerForTests(kPeerUuid).batch_size_bytes);
+}
+
+// An observer which records the commit indexes it's notified of, and blocks in
+// the first notification until Release() is called.
+class BlockingCommitObserver : public PeerMessageQueueObserver {
+ public:
+  BlockingCommitObserver() : release_(1), first_notified_(1) {}
+
+  void NotifyCommitIndex(int64_t committed_index) override {
+    {
+      std::lock_guard<simple_spinlock> l(lock_);
+      notified_.push_back(committed_index);
+    }
+    if (first_notified_.count() > 0) {
+      first_notified_.CountDown();
+      release_.Wait();
+    }
+  }
+  void NotifyTermChange(int64_t /*term*/) override {}
+  void NotifyFailedFollower(const string& /*peer_uuid*/,
+                            int64_t /*term*/,
+                            const string& /*reason*/) override {}
+  void NotifyPeerToPromote(const string& /*peer_uuid*/) override {}
+  void NotifyPeerToStartElection(
+      const string& /*peer_uuid*/,
+      boost::optional<PeerMessageQueue::TransferContext> /*transfer_context*/) override {}
+  void NotifyPeerHealthChange() override {}
+
+  void WaitForFirstNotification() { first_notified_.Wait(); }
+  void Release() { release_.CountDown(); }
+
+  vector<int64_t> notified() const {
+    std::lock_guard<simple_spinlock> l(lock_);
+    return notified_;
+  }
+
+ private:
+  CountDownLatch release_;
+  CountDownLatch first_notified_;
+  mutable simple_spinlock lock_;
+  vector<int64_t> notified_;
+};
+
+// Test that advances of the commit index made while a notification is pending
+// are merged into a single notification of the latest index.
+TEST_F(ConsensusQueueTest, TestCommitIndexNotificationsAreCoalesced) {
+  BlockingCommitObserver observer;
+  queue_->RegisterObserver(&observer);
+
+  // The first notification runs, and holds the observers' pool token.
+  queue_->NotifyObserversOfCommitIndexChange(1);
+  observer.WaitForFirstNotification();
+
+  // These are merged into the notification submitted behind it, including
+  // the one which is lower than the latest.
+  queue_->NotifyObserversOfCommitIndexChange(2);
+  queue_->NotifyObserversOfCommitIndexChange(5);
+  queue_->NotifyObserversOfCommitIndexChange(3);
+  queue_->NotifyObserversOfCommitIndexChange(4);
+  observer.Release();
+
+  ASSERT_EVENTUALLY([&]() {
+    ASSERT_EQ(vector<int64_t>({ 1, 5 }), observer.notified());
+  });
+  // Nothing else is notified.
+  SleepFor(MonoDelta::FromMilliseconds(100));
+  ASSERT_EQ(vector<int64_t>({ 1, 5 }), observer.notified());
+  ASSERT_OK(queue_->UnRegisterObserver(&observer));
+}
+
 }  // namespace consensus
 }  // namespace kudu
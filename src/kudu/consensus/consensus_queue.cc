@@ -27,8 +27,11 @@
 #include <cstdint>
 #include <functional>
 #include <iostream>
+#include <iterator>
+#include <limits>
 #include <memory>
 #include <mutex>
+#include <set>
 #include <string>
 #include <unordered_set>
 #include <utility>
@@ -54,8 +57,10 @@
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/stl_util.h"
 #include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/compression/compression_codec.h"
 #include "kudu/util/fault_injection.h"
 #include "kudu/util/flag_tags.h"
+#include "kudu/util/flag_validators.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/pb_util.h"
@@ -67,6 +72,46 @@ DEFINE_int32(consensus_max_batch_size_bytes, 1024 * 1024,
              "The maximum per-tablet RPC batch size when updating peers.");
 TAG_FLAG(consensus_max_batch_size_bytes, advanced);
 
+DEFINE_bool(consensus_adaptive_batch_size, false,
+            "Whether to size the batches of ops sent to each peer according to "
+            "the round trip time and goodput observed for that peer, instead of "
+            "always using --consensus_max_batch_size_bytes. Batches are bounded "
+            "by --consensus_adaptive_min_batch_size_bytes and "
+            "--consensus_adaptive_max_batch_size_bytes.");
+TAG_FLAG(consensus_adaptive_batch_size, advanced);
+TAG_FLAG(consensus_adaptive_batch_size, experimental);
+TAG_FLAG(consensus_adaptive_batch_size, runtime);
+
+DEFINE_int32(consensus_adaptive_min_batch_size_bytes, 64 * 1024,
+             "The smallest batch of ops sent to a peer when "
+             "--consensus_adaptive_batch_size is enabled.");
+TAG_FLAG(consensus_adaptive_min_batch_size_bytes, advanced);
+TAG_FLAG(consensus_adaptive_min_batch_size_bytes, experimental);
+TAG_FLAG(consensus_adaptive_min_batch_size_bytes, runtime);
+
+DEFINE_int32(consensus_adaptive_max_batch_size_bytes, 16 * 1024 * 1024,
+             "The largest batch of ops sent to a peer when "
+             "--consensus_adaptive_batch_size is enabled. Should be kept well "
+             "below --rpc_max_message_size.");
+TAG_FLAG(consensus_adaptive_max_batch_size_bytes, advanced);
+TAG_FLAG(consensus_adaptive_max_batch_size_bytes, experimental);
+TAG_FLAG(consensus_adaptive_max_batch_size_bytes, runtime);
+
+static bool ValidateAdaptiveBatchSizeFlags() {
+  if (FLAGS_consensus_adaptive_min_batch_size_bytes <= 0 ||
+      FLAGS_consensus_adaptive_min_batch_size_bytes >
+      FLAGS_consensus_adaptive_max_batch_size_bytes) {
+    LOG(ERROR) << strings::Substitute(
+        "--consensus_adaptive_min_batch_size_bytes ($0) must be positive and no "
+        "larger than --consensus_adaptive_max_batch_size_bytes ($1)",
+        FLAGS_consensus_adaptive_min_batch_size_bytes,
+        FLAGS_consensus_adaptive_max_batch_size_bytes);
+    return false;
+  }
+  return true;
+}
+GROUP_FLAG_VALIDATOR(consensus_adaptive_batch_size_flags, ValidateAdaptiveBatchSizeFlags);
+
 DEFINE_int32(follower_unavailable_considered_failed_sec, 300,
              "Seconds that a leader is unable to successfully heartbeat to a "
              "follower after which the follower is considered to be failed and "
@@ -123,6 +168,24 @@ METRIC_DEFINE_gauge_int64(server, in_progress_ops, "Operations in Progress",
 METRIC_DEFINE_gauge_int64(server, ops_behind_leader, "Operations Behind Leader",
                           MetricUnit::kOperations,
                           "Number of operations this server believes it is behind the leader.");
+METRIC_DEFINE_histogram(server, peer_update_rtt, "Peer Update Round Trip Time",
+                        kudu::MetricUnit::kMicroseconds,
+                        "Microseconds between sending an UpdateConsensus request to a peer "
+                        "and receiving its response, across all peers. Only recorded on the "
+                        "leader. See the consensus queue dump for each peer's.",
+                        60000000LU, 2);
+METRIC_DEFINE_histogram(server, peer_update_goodput, "Peer Update Goodput",
+                        kudu::MetricUnit::kBytes,
+                        "Bytes per second of UpdateConsensus requests acknowledged by a peer, "
+                        "measured over the round trip of each request, across all peers. Only "
+                        "recorded on the leader. See the consensus queue dump for each peer's.",
+                        10LU * 1024 * 1024 * 1024, 2);
+METRIC_DEFINE_histogram(server, peer_update_batch_size, "Peer Update Batch Size",
+                        kudu::MetricUnit::kBytes,
+                        "Size of the batches of operations chosen for peers when "
+                        "--consensus_adaptive_batch_size is enabled, across all peers. Only "
+                        "recorded on the leader. See the consensus queue dump for each peer's.",
+                        1024LU * 1024 * 1024, 2);
 
 const char* PeerStatusToString(PeerStatus p) {
   switch (p) {
@@ -150,6 +213,11 @@ PeerMessageQueue::TrackedPeer::TrackedPeer(RaftPeerPB peer_pb)
       wal_catchup_possible(true),
       last_overall_health_status(HealthReportPB::UNKNOWN),
       status_log_throttler(std::make_shared<logging::LogThrottler>()),
+      goodput_bytes_per_sec(0),
+      batch_size_bytes(std::max<int64_t>(FLAGS_consensus_adaptive_min_batch_size_bytes,
+                                         std::min<int64_t>(
+                                             FLAGS_consensus_max_batch_size_bytes,
+                                             FLAGS_consensus_adaptive_max_batch_size_bytes))),
       last_seen_term_(0) {
 }
 
@@ -168,7 +236,10 @@ std::string PeerMessageQueue::TrackedPeer::ToString() const {
 PeerMessageQueue::Metrics::Metrics(const scoped_refptr<MetricEntity>& metric_entity)
   : num_majority_done_ops(INSTANTIATE_METRIC(METRIC_majority_done_ops)),
     num_in_progress_ops(INSTANTIATE_METRIC(METRIC_in_progress_ops)),
-    num_ops_behind_leader(INSTANTIATE_METRIC(METRIC_ops_behind_leader)) {
+    num_ops_behind_leader(INSTANTIATE_METRIC(METRIC_ops_behind_leader)),
+    peer_rtt(METRIC_peer_update_rtt.Instantiate(metric_entity)),
+    peer_goodput(METRIC_peer_update_goodput.Instantiate(metric_entity)),
+    peer_batch_size(METRIC_peer_update_batch_size.Instantiate(metric_entity)) {
 }
 #undef INSTANTIATE_METRIC
 
@@ -186,6 +257,7 @@ PeerMessageQueue::PeerMessageQueue(const scoped_refptr<MetricEntity>& metric_ent
       routing_table_container_(std::move(routing_table_container)),
       tablet_id_(std::move(tablet_id)),
       adjust_voter_distribution_(true),
+      lease_not_before_(MonoTime::Min()),
       successor_watch_in_progress_(false),
       log_cache_(metric_entity, std::move(log), local_peer_pb_.permanent_uuid(), tablet_id_),
       metrics_(metric_entity),
@@ -252,6 +324,10 @@ void PeerMessageQueue::SetLeaderMode(int64_t committed_index,
                                      int64_t current_term,
                                      const RaftConfigPB& active_config) {
   std::lock_guard<simple_spinlock> lock(queue_lock_);
+  if (queue_state_.mode != LEADER || current_term != queue_state_.current_term) {
+    // Acknowledgements from before this leadership began don't confirm it.
+    ResetLeadershipConfirmationsUnlocked();
+  }
   if (current_term != queue_state_.current_term) {
     CHECK_GT(current_term, queue_state_.current_term) << "Terms should only increase";
     queue_state_.first_index_in_current_term = boost::none;
@@ -280,20 +356,142 @@ void PeerMessageQueue::SetLeaderMode(int64_t committed_index,
 }
 
 void PeerMessageQueue::SetNonLeaderMode(const RaftConfigPB& active_config) {
+  {
+    std::lock_guard<simple_spinlock> lock(queue_lock_);
+    queue_state_.active_config.reset(new RaftConfigPB(active_config));
+    queue_state_.mode = NON_LEADER;
+    queue_state_.majority_size_ = -1;
+
+    // Update this when stepping down, since it doesn't get tracked as LEADER.
+    queue_state_.last_idx_appended_to_leader = queue_state_.last_appended.index();
+
+    TrackLocalPeerUnlocked();
+
+    LOG_WITH_PREFIX_UNLOCKED(INFO) << "Queue going to NON_LEADER mode. State: "
+                                   << queue_state_.ToString();
+
+    time_manager_->SetNonLeaderMode();
+  }
+  AbortPendingReads(Status::IllegalState("leadership lost before the read was confirmed"));
+}
+
+bool PeerMessageQueue::ReadIndex(const ReadIndexCallback& callback,
+                                 const boost::optional<MonoDelta>& lease_duration,
+                                 const MonoTime& deadline) {
+  Status s;
+  int64_t read_index = kMinimumOpIdIndex;
+  {
+    std::lock_guard<simple_spinlock> lock(queue_lock_);
+    if (queue_state_.mode != LEADER) {
+      s = Status::IllegalState("not the leader");
+    } else if (queue_state_.first_index_in_current_term == boost::none ||
+               queue_state_.committed_index < *queue_state_.first_index_in_current_term) {
+      // Until then, the leader may not know about ops committed by its
+      // predecessors (see section 6.4 of the Raft dissertation).
+      s = Status::ServiceUnavailable("leader has not committed an operation in its term yet");
+    } else {
+      read_index = queue_state_.committed_index;
+      const MonoTime now = MonoTime::Now();
+      const MonoTime confirmed = LeadershipConfirmedTimeUnlocked();
+      // Leadership is confirmed up to now, e.g. with a single voter.
+      const bool lease_valid = confirmed >= now ||
+          (lease_duration && confirmed >= lease_not_before_ &&
+           confirmed + *lease_duration > now);
+      if (!lease_valid) {
+        pending_reads_.push_back({ now, read_index, callback, deadline });
+        return true;
+      }
+    }
+  }
+  callback(s, read_index);
+  return false;
+}
+
+void PeerMessageQueue::RevokeLeaderLease() {
   std::lock_guard<simple_spinlock> lock(queue_lock_);
-  queue_state_.active_config.reset(new RaftConfigPB(active_config));
-  queue_state_.mode = NON_LEADER;
-  queue_state_.majority_size_ = -1;
+  lease_not_before_ = MonoTime::Now();
+}
 
-  // Update this when stepping down, since it doesn't get tracked as LEADER.
-  queue_state_.last_idx_appended_to_leader = queue_state_.last_appended.index();
+void PeerMessageQueue::ResetLeadershipConfirmationsUnlocked() {
+  DCHECK(queue_lock_.is_locked());
+  ack_time_watermarks_.Clear();
+  const TrackedPeer* local_peer = FindPtrOrNull(peers_map_, local_peer_pb_.permanent_uuid());
+  if (local_peer) {
+    ack_time_watermarks_.Set(*local_peer, std::numeric_limits<int64_t>::max());
+  }
+  lease_not_before_ = MonoTime::Now();
+}
 
-  TrackLocalPeerUnlocked();
+MonoTime PeerMessageQueue::LeadershipConfirmedTimeUnlocked() {
+  DCHECK(queue_lock_.is_locked());
+  int64_t confirmed = -1;
+  ComputeQuorumWatermarkUnlocked(ack_time_watermarks_, &confirmed);
+  if (confirmed < 0) {
+    return MonoTime::Min();
+  }
+  if (confirmed == std::numeric_limits<int64_t>::max()) {
+    return MonoTime::Max();
+  }
+  return MonoTime::Min() + MonoDelta::FromNanoseconds(confirmed);
+}
 
-  LOG_WITH_PREFIX_UNLOCKED(INFO) << "Queue going to NON_LEADER mode. State: "
-                                 << queue_state_.ToString();
+void PeerMessageQueue::CompleteConfirmedReads() {
+  vector<PendingRead> confirmed_reads;
+  {
+    std::lock_guard<simple_spinlock> lock(queue_lock_);
+    if (queue_state_.mode != LEADER || pending_reads_.empty()) {
+      return;
+    }
+    const MonoTime confirmed = LeadershipConfirmedTimeUnlocked();
+    while (!pending_reads_.empty() && pending_reads_.front().start_time <= confirmed) {
+      confirmed_reads.emplace_back(std::move(pending_reads_.front()));
+      pending_reads_.pop_front();
+    }
+  }
+  for (const PendingRead& read : confirmed_reads) {
+    read.callback(Status::OK(), read.read_index);
+  }
+}
+
+void PeerMessageQueue::ExpirePendingReads() {
+  vector<PendingRead> expired_reads;
+  {
+    std::lock_guard<simple_spinlock> lock(queue_lock_);
+    if (pending_reads_.empty()) {
+      return;
+    }
+    const MonoTime now = MonoTime::Now();
+    auto expired = [&now](const PendingRead& read) {
+      return read.deadline.Initialized() && read.deadline <= now;
+    };
+    // Keep the remaining reads ordered by start time.
+    auto it = std::stable_partition(pending_reads_.begin(), pending_reads_.end(),
+                                    [&expired](const PendingRead& read) {
+                                      return !expired(read);
+                                    });
+    std::move(it, pending_reads_.end(), std::back_inserter(expired_reads));
+    pending_reads_.erase(it, pending_reads_.end());
+  }
+  for (const PendingRead& read : expired_reads) {
+    read.callback(Status::TimedOut("read index was not confirmed before the deadline"),
+                  read.read_index);
+  }
+}
 
-  time_manager_->SetNonLeaderMode();
+int PeerMessageQueue::GetNumPendingReadsForTests() const {
+  std::lock_guard<simple_spinlock> lock(queue_lock_);
+  return pending_reads_.size();
+}
+
+void PeerMessageQueue::AbortPendingReads(const Status& status) {
+  std::deque<PendingRead> aborted_reads;
+  {
+    std::lock_guard<simple_spinlock> lock(queue_lock_);
+    aborted_reads.swap(pending_reads_);
+  }
+  for (const PendingRead& read : aborted_reads) {
+    read.callback(status, read.read_index);
+  }
 }
 
 void PeerMessageQueue::TrackPeer(const RaftPeerPB& peer_pb) {
@@ -319,6 +517,11 @@ void PeerMessageQueue::TrackPeerUnlocked(const RaftPeerPB& peer_pb) {
   tracked_peer->next_index = queue_state_.last_appended.index() + 1;
   InsertOrDie(&peers_map_, tracked_peer->uuid(), tracked_peer);
 
+  // The local peer never needs convincing that this node is the leader.
+  if (tracked_peer->uuid() == local_peer_pb_.permanent_uuid()) {
+    ack_time_watermarks_.Set(*tracked_peer, std::numeric_limits<int64_t>::max());
+  }
+
   CheckPeersInActiveConfigIfLeaderUnlocked();
 
   // We don't know how far back this peer is, so set the all replicated watermark to
@@ -334,9 +537,52 @@ void PeerMessageQueue::UntrackPeer(const string& uuid) {
 void PeerMessageQueue::UntrackPeerUnlocked(const string& uuid) {
   DCHECK(queue_lock_.is_locked());
   TrackedPeer* peer = EraseKeyReturnValuePtr(&peers_map_, uuid);
+  if (peer != nullptr) {
+    replicated_watermarks_.Remove(*peer);
+    ack_time_watermarks_.Remove(*peer);
+  }
   delete peer; // Deleting a nullptr is safe.
 }
 
+void PeerMessageQueue::PeerWatermarks::Set(const TrackedPeer& peer, int64_t value) {
+  all.Set(peer.uuid(), value);
+  if (peer.peer_pb.member_type() == RaftPeerPB::VOTER) {
+    voters.Set(peer.uuid(), value);
+    voters_by_region[peer.peer_pb.attrs().region()].Set(peer.uuid(), value);
+  }
+}
+
+void PeerMessageQueue::PeerWatermarks::Remove(const TrackedPeer& peer) {
+  all.Remove(peer.uuid());
+  if (peer.peer_pb.member_type() == RaftPeerPB::VOTER) {
+    voters.Remove(peer.uuid());
+    auto it = voters_by_region.find(peer.peer_pb.attrs().region());
+    if (it != voters_by_region.end()) {
+      it->second.Remove(peer.uuid());
+      if (it->second.empty()) {
+        voters_by_region.erase(it);
+      }
+    }
+  }
+}
+
+void PeerMessageQueue::PeerWatermarks::Clear() {
+  all.Clear();
+  voters.Clear();
+  voters_by_region.clear();
+}
+
+void PeerMessageQueue::UpdatePeerWatermarksUnlocked(const TrackedPeer& peer) {
+  DCHECK(queue_lock_.is_locked());
+  // Refer to the comment in AdvanceQueueWatermark method for why only
+  // successful last exchanges are considered.
+  if (peer.last_exchange_status != PeerStatus::OK) {
+    replicated_watermarks_.Remove(peer);
+    return;
+  }
+  replicated_watermarks_.Set(peer, peer.last_received.index());
+}
+
 void PeerMessageQueue::TrackLocalPeerUnlocked() {
   DCHECK(queue_lock_.is_locked());
   RaftPeerPB* local_peer_in_config;
@@ -436,6 +682,11 @@ Status PeerMessageQueue::AppendOperation(const ReplicateRefPtr& msg) {
                                         "Enqueued replicate operation failed to write to WAL"));
 }
 
+Status PeerMessageQueue::AppendOperations(const vector<ReplicateRefPtr>& msgs) {
+  return AppendOperations(msgs, Bind(CrashIfNotOkStatusCB,
+                                     "Enqueued replicate operations failed to write to WAL"));
+}
+
 Status PeerMessageQueue::AppendOperations(const vector<ReplicateRefPtr>& msgs,
                                           const StatusCallback& log_append_callback) {
 
@@ -698,15 +949,46 @@ Status PeerMessageQueue::RequestForPeer(const string& uuid,
                                         vector<ReplicateRefPtr>* msg_refs,
                                         bool* needs_tablet_copy,
                                         std::string* next_hop_uuid) {
+  return DoRequestForPeer(uuid, boost::none, request, msg_refs, needs_tablet_copy,
+                          next_hop_uuid);
+}
+
+Status PeerMessageQueue::PipelinedRequestForPeer(const string& uuid,
+                                                 int64_t next_index,
+                                                 ConsensusRequestPB* request,
+                                                 vector<ReplicateRefPtr>* msg_refs,
+                                                 std::string* next_hop_uuid) {
+  bool needs_tablet_copy = false;
+  RETURN_NOT_OK(DoRequestForPeer(uuid, next_index, request, msg_refs, &needs_tablet_copy,
+                                 next_hop_uuid));
+  DCHECK(!needs_tablet_copy);
+  return Status::OK();
+}
+
+Status PeerMessageQueue::DoRequestForPeer(const string& uuid,
+                                          boost::optional<int64_t> pipeline_next_index,
+                                          ConsensusRequestPB* request,
+                                          vector<ReplicateRefPtr>* msg_refs,
+                                          bool* needs_tablet_copy,
+                                          std::string* next_hop_uuid) {
   // Maintain a thread-safe copy of necessary members.
   OpId preceding_id;
   int64_t current_term;
   TrackedPeer peer_copy;
   MonoDelta unreachable_time;
+  // Requests, heartbeats in particular, are sent even if the peers don't
+  // respond, so queued reads are expired from here.
+  bool check_pending_reads = false;
+  SCOPED_CLEANUP({
+      if (check_pending_reads) {
+        ExpirePendingReads();
+      }
+    });
   {
     std::lock_guard<simple_spinlock> lock(queue_lock_);
     DCHECK_EQ(queue_state_.state, kQueueOpen);
     DCHECK_NE(uuid, local_peer_pb_.permanent_uuid());
+    check_pending_reads = !pending_reads_.empty();
 
     TrackedPeer* peer = FindPtrOrNull(peers_map_, uuid);
     if (PREDICT_FALSE(peer == nullptr || queue_state_.mode == NON_LEADER)) {
@@ -715,8 +997,18 @@ Status PeerMessageQueue::RequestForPeer(const string& uuid,
     }
     peer_copy = *peer;
 
+    // Only pipeline requests while the peer's log is known to match ours up to
+    // the ops in flight. Otherwise the ops in flight may be rejected and we
+    // don't know where the next request should start yet.
+    if (pipeline_next_index &&
+        (peer_copy.last_exchange_status != PeerStatus::OK ||
+         *pipeline_next_index < peer_copy.next_index)) {
+      return Status::IllegalState(Substitute("cannot pipeline requests to peer $0", uuid));
+    }
+
     // Clear the requests without deleting the entries, as they may be in use by other peers.
     request->mutable_ops()->ExtractSubrange(0, request->ops_size(), nullptr);
+    request->clear_compression_dictionaries();
 
     // This is initialized to the queue's last appended op but gets set to the id of the
     // log entry preceding the first one in 'messages' if messages are found for the peer.
@@ -789,7 +1081,9 @@ Status PeerMessageQueue::RequestForPeer(const string& uuid,
 
     // The batch of messages to send to the peer.
     vector<ReplicateRefPtr> messages;
-    int max_batch_size = FLAGS_consensus_max_batch_size_bytes - request->ByteSize();
+    int64_t batch_size = FLAGS_consensus_adaptive_batch_size ?
+        peer_copy.batch_size_bytes : FLAGS_consensus_max_batch_size_bytes;
+    int max_batch_size = batch_size - request->ByteSize();
 
     ReadContext read_context;
     read_context.for_peer_uuid = &uuid;
@@ -798,7 +1092,8 @@ Status PeerMessageQueue::RequestForPeer(const string& uuid,
     read_context.route_via_proxy = route_via_proxy;
 
     // We try to get the follower's next_index from our log.
-    Status s = log_cache_.ReadOps(peer_copy.next_index - 1,
+    int64_t next_index = pipeline_next_index ? *pipeline_next_index : peer_copy.next_index;
+    Status s = log_cache_.ReadOps(next_index - 1,
                                   max_batch_size,
                                   read_context,
                                   &messages,
@@ -838,6 +1133,23 @@ Status PeerMessageQueue::RequestForPeer(const string& uuid,
     // "all replicated" point. At some point we may want to allow partially loading
     // (and not pinning) earlier messages. At that point we'll need to do something
     // smarter here, like copy or ref-count.
+    // Send the dictionaries the ops were compressed with along with them,
+    // until the peer confirms having them. A proxy forwards them to the peer
+    // along with the ops it reconstitutes from its own log.
+    std::set<uint32_t> dict_ids;
+    for (const ReplicateRefPtr& msg : messages) {
+      uint32_t dict_id = msg->get()->write_payload().compression_dictionary_id();
+      if (dict_id != 0 && !ContainsKey(peer_copy.compression_dictionary_ids, dict_id)) {
+        dict_ids.insert(dict_id);
+      }
+    }
+    for (uint32_t dict_id : dict_ids) {
+      Slice dictionary;
+      RETURN_NOT_OK_PREPEND(GetZstdDictionary(dict_id, &dictionary),
+                            Substitute("Unable to send ops to peer $0", uuid));
+      request->add_compression_dictionaries(dictionary.data(), dictionary.size());
+    }
+
     if (!route_via_proxy) {
       for (const ReplicateRefPtr& msg : messages) {
         request->mutable_ops()->AddAllocated(msg->get());
@@ -974,43 +1286,32 @@ void PeerMessageQueue::AdvanceQueueWatermark(const char* type,
   }
 
 
-  // Go through the peer's watermarks, we want the highest watermark that
-  // 'num_peers_required' of peers has replicated. To find this we do the
-  // following:
-  // - Store all the peer's 'last_received' in a vector
-  // - Sort the vector
-  // - Find the vector.size() - 'num_peers_required' position, this
-  //   will be the new 'watermark'.
-  std::vector<int64_t> watermarks;
-  for (const PeersMap::value_type& peer : peers_map_) {
-    if (replica_types == VOTER_REPLICAS &&
-        peer.second->peer_pb.member_type() != RaftPeerPB::VOTER) {
-      continue;
-    }
-    // TODO(todd): The fact that we only consider peers whose last exchange was
-    // successful can cause the "all_replicated" watermark to lag behind
-    // farther than necessary. For example:
-    // - local peer has replicated opid 100
-    // - remote peer A has replicated opid 100
-    // - remote peer B has replication opid 10 and is catching up
-    // - remote peer A goes down
-    // Here we'd start getting a non-OK last_exchange_status for peer A.
-    // In that case, the 'all_replicated_watermark', which requires 3 peers, would not
-    // be updateable, even once we've replicated peer 'B' up to opid 100. It would
-    // get "stuck" at 10. In fact, in this case, the 'majority_replicated_watermark' would
-    // also move *backwards* when peer A started getting errors.
-    //
-    // The issue with simply removing this condition is that 'last_received' does not
-    // perfectly correspond to the 'match_index' in Raft Figure 2. It is simply the
-    // highest operation in a peer's log, regardless of whether that peer currently
-    // holds a prefix of the leader's log. So, in the case that the last exchange
-    // was an error (LMP mismatch, for example), the 'last_received' is _not_ usable
-    // for watermark calculation. This could be fixed by separately storing the
-    // 'match_index' on a per-peer basis and using that for watermark calculation.
-    if (peer.second->last_exchange_status == PeerStatus::OK) {
-      watermarks.push_back(peer.second->last_received.index());
-    }
-  }
+  // We want the highest watermark that 'num_peers_required' of peers has
+  // replicated, i.e. the 'num_peers_required'-th highest 'last_received'.
+  //
+  // TODO(todd): The fact that we only consider peers whose last exchange was
+  // successful can cause the "all_replicated" watermark to lag behind
+  // farther than necessary. For example:
+  // - local peer has replicated opid 100
+  // - remote peer A has replicated opid 100
+  // - remote peer B has replication opid 10 and is catching up
+  // - remote peer A goes down
+  // Here we'd start getting a non-OK last_exchange_status for peer A.
+  // In that case, the 'all_replicated_watermark', which requires 3 peers, would not
+  // be updateable, even once we've replicated peer 'B' up to opid 100. It would
+  // get "stuck" at 10. In fact, in this case, the 'majority_replicated_watermark' would
+  // also move *backwards* when peer A started getting errors.
+  //
+  // The issue with simply removing this condition is that 'last_received' does not
+  // perfectly correspond to the 'match_index' in Raft Figure 2. It is simply the
+  // highest operation in a peer's log, regardless of whether that peer currently
+  // holds a prefix of the leader's log. So, in the case that the last exchange
+  // was an error (LMP mismatch, for example), the 'last_received' is _not_ usable
+  // for watermark calculation. This could be fixed by separately storing the
+  // 'match_index' on a per-peer basis and using that for watermark calculation.
+  const WatermarkTracker& watermarks =
+      replica_types == VOTER_REPLICAS ?
+      replicated_watermarks_.voters : replicated_watermarks_.all;
 
   // If we haven't enough peers to calculate the watermark return.
   if (watermarks.size() < num_peers_required) {
@@ -1019,9 +1320,7 @@ void PeerMessageQueue::AdvanceQueueWatermark(const char* type,
     return;
   }
 
-  std::sort(watermarks.begin(), watermarks.end());
-
-  int64_t new_watermark = watermarks[watermarks.size() - num_peers_required];
+  int64_t new_watermark = watermarks.NthHighest(num_peers_required);
   int64_t old_watermark = *watermark;
   *watermark = new_watermark;
 
@@ -1032,16 +1331,13 @@ void PeerMessageQueue::AdvanceQueueWatermark(const char* type,
     for (const PeersMap::value_type& peer : peers_map_) {
       VLOG_WITH_PREFIX_UNLOCKED(3) << "Peer: " << peer.second->ToString();
     }
-    VLOG_WITH_PREFIX_UNLOCKED(3) << "Sorted watermarks:";
-    for (int64_t watermark : watermarks) {
-      VLOG_WITH_PREFIX_UNLOCKED(3) << "Watermark: " << watermark;
-    }
+    VLOG_WITH_PREFIX_UNLOCKED(3) << "Sorted watermarks: " << watermarks.ToString();
   }
 }
 
 int64_t PeerMessageQueue::DoComputeNewWatermarkStaticMode(
     const std::map<std::string, int>& voter_distribution,
-    const std::map<std::string, std::vector<int64_t> >& watermarks_by_region,
+    const std::map<std::string, WatermarkTracker>& watermarks_by_region,
     int64_t* watermark) {
   CHECK(watermark);
   CHECK(queue_state_.active_config->has_commit_rule());
@@ -1087,7 +1383,7 @@ int64_t PeerMessageQueue::DoComputeNewWatermarkStaticMode(
     for (const std::string& region : rule_predicate.regions()) {
       int total_voters = FindOrDie(voter_distribution, region);
       int commit_req = MajoritySize(total_voters);
-      std::map<std::string, std::vector<int64_t> >::const_iterator it =
+      std::map<std::string, WatermarkTracker>::const_iterator it =
           watermarks_by_region.find(region);
 
       // If we haven't got responses from enough number of servers in region,
@@ -1103,19 +1399,15 @@ int64_t PeerMessageQueue::DoComputeNewWatermarkStaticMode(
         continue;
       }
 
-      const std::vector<int64_t>& watermarks_in_region = it->second;
+      const WatermarkTracker& watermarks_in_region = it->second;
 
       // Computing the commit index in each region.
-      int64_t regional_commit_index = watermarks_in_region[
-          watermarks_in_region.size() - commit_req];
+      int64_t regional_commit_index = watermarks_in_region.NthHighest(commit_req);
 
       if (VLOG_IS_ON(3)) {
         VLOG_WITH_PREFIX_UNLOCKED(3)
-            << "Watermarks in region: " << region;
-        for (int64_t watermark_it : watermarks_in_region) {
-          VLOG_WITH_PREFIX_UNLOCKED(3)
-              << "Watermark: " << watermark_it;
-        }
+            << "Watermarks in region: " << region << ": "
+            << watermarks_in_region.ToString();
         VLOG_WITH_PREFIX_UNLOCKED(3)
             << "Regional commit index: " << regional_commit_index;
       }
@@ -1196,7 +1488,8 @@ int64_t PeerMessageQueue::DoComputeNewWatermarkStaticMode(
   return old_watermark;
 }
 
-int64_t PeerMessageQueue::ComputeNewWatermarkDynamicMode(int64_t* watermark) {
+int64_t PeerMessageQueue::ComputeNewWatermarkDynamicMode(const PeerWatermarks& watermarks,
+                                                         int64_t* watermark) {
   CHECK(watermark);
   CHECK(queue_state_.active_config->has_commit_rule());
   CHECK(queue_state_.active_config->commit_rule().mode() ==
@@ -1207,27 +1500,14 @@ int64_t PeerMessageQueue::ComputeNewWatermarkDynamicMode(int64_t* watermark) {
 
   const std::string& leader_region = local_peer_pb_.attrs().region();
 
-  // Compute the watermarks in leader region. As an example, at the end of this
-  // loop, watermarks_in_leader_region might have entries (3, 7, 5) which
-  // indicates that the leader region has 3 peers that have responded to OpId
-  // indexes 3, 7 and 5 respectively
-  std::vector<int64_t> watermarks_in_leader_region;
-  for (const PeersMap::value_type& peer : peers_map_) {
-    // Only voter members are considered for advancing watermark
-    if (peer.second->peer_pb.member_type() != RaftPeerPB::VOTER) {
-      continue;
-    }
-
-    // Refer to the comment in AdvanceQueueWatermark method for why only
-    // successful last exchanges are considered.
-    if (peer.second->last_exchange_status == PeerStatus::OK) {
-      const string& peer_region = peer.second->peer_pb.attrs().region();
-      if (peer_region == leader_region) {
-        watermarks_in_leader_region.push_back(
-            peer.second->last_received.index());
-      }
-    }
-  }
+  // The watermarks of the voters in the leader region. As an example,
+  // watermarks_in_leader_region might hold (3, 5, 7) which indicates that the
+  // leader region has 3 voters that have responded to OpId indexes 3, 5 and 7
+  // respectively. It is null if no voter in the region has responded.
+  const WatermarkTracker* watermarks_in_leader_region =
+      FindOrNull(watermarks.voters_by_region, leader_region);
+  int num_watermarks_in_leader_region =
+      watermarks_in_leader_region ? watermarks_in_leader_region->size() : 0;
 
   int total_voters_from_voter_distribution =
     FindOrDie(queue_state_.active_config->voter_distribution(), leader_region);
@@ -1273,28 +1553,24 @@ int64_t PeerMessageQueue::ComputeNewWatermarkDynamicMode(int64_t* watermark) {
   // Return without advancing the commit watermark, if majority in leader
   // region is not satisfied, ie. not enough number of replicas have responded
   // from that region.
-  if (watermarks_in_leader_region.size() < commit_req) {
+  if (num_watermarks_in_leader_region < commit_req) {
     if (VLOG_IS_ON(3)) {
       VLOG_WITH_PREFIX_UNLOCKED(3)
           << "Watermarks size: "
-          << watermarks_in_leader_region.size()
+          << num_watermarks_in_leader_region
           << ", Num peers required: " << commit_req
           << ", Region: " << leader_region;
     }
     return *watermark;
   }
 
-  // Sort the watermarks
-  std::sort(
-      watermarks_in_leader_region.begin(), watermarks_in_leader_region.end());
-
   int64_t old_watermark = *watermark;
-  *watermark = watermarks_in_leader_region[
-      watermarks_in_leader_region.size() - commit_req];
+  *watermark = watermarks_in_leader_region->NthHighest(commit_req);
   return old_watermark;
 }
 
-int64_t PeerMessageQueue::ComputeNewWatermarkStaticMode(int64_t* watermark) {
+int64_t PeerMessageQueue::ComputeNewWatermarkStaticMode(const PeerWatermarks& watermarks,
+                                                        int64_t* watermark) {
   CHECK(watermark);
   CHECK(queue_state_.active_config->has_commit_rule());
 
@@ -1302,8 +1578,8 @@ int64_t PeerMessageQueue::ComputeNewWatermarkStaticMode(int64_t* watermark) {
     return *watermark;
   }
 
-  // For each region, we compute a vector of indexes that were replicated.
-  // It might look like the following example:
+  // For each region, 'watermarks' tracks e.g. the indexes that were
+  // replicated. It might look like the following example:
   // prn: <4,4,5,7>
   // frc: <2,3,4>
   // lla: <5,5>
@@ -1311,26 +1587,6 @@ int64_t PeerMessageQueue::ComputeNewWatermarkStaticMode(int64_t* watermark) {
   // replicas in prn, 3 in frc and 2 in lla. Two replicas in prn have received
   // entries until index 4, one has received until 5 and one until 7. Similarly,
   // 2 replicas in lla have received entries until index 5.
-  std::map<std::string, std::vector<int64_t> > watermarks_by_region;
-  for (const PeersMap::value_type& peer : peers_map_) {
-    if (peer.second->peer_pb.member_type() != RaftPeerPB::VOTER) {
-      continue;
-    }
-    // Refer to the comment in AdvanceQueueWatermark method for why only
-    // successful last exchanges are considered.
-    if (peer.second->last_exchange_status == PeerStatus::OK) {
-      const string& peer_region = peer.second->peer_pb.attrs().region();
-      std::vector<int64_t>& regional_watermarks = LookupOrInsert(
-          &watermarks_by_region, peer_region, std::vector<int64_t>());
-      regional_watermarks.push_back(peer.second->last_received.index());
-    }
-  }
-
-  // Sort all the watermarks.
-  for (std::map<std::string, std::vector<int64_t> >::iterator it =
-      watermarks_by_region.begin(); it != watermarks_by_region.end(); it++) {
-    std::sort(it->second.begin(), it->second.end());
-  }
 
   // Map to store the number of voters in each region from the active config.
   std::map<std::string, int> voter_distribution;
@@ -1352,7 +1608,24 @@ int64_t PeerMessageQueue::ComputeNewWatermarkStaticMode(int64_t* watermark) {
   }
 
   return DoComputeNewWatermarkStaticMode(
-      voter_distribution, watermarks_by_region, watermark);
+      voter_distribution, watermarks.voters_by_region, watermark);
+}
+
+void PeerMessageQueue::ComputeQuorumWatermarkUnlocked(const PeerWatermarks& watermarks,
+                                                      int64_t* watermark) {
+  DCHECK(queue_lock_.is_locked());
+  if (!FLAGS_enable_flexi_raft) {
+    const int majority_size = queue_state_.majority_size_;
+    if (majority_size > 0 && watermarks.voters.size() >= majority_size) {
+      *watermark = watermarks.voters.NthHighest(majority_size);
+    }
+    return;
+  }
+  if (queue_state_.active_config->commit_rule().mode() == QuorumMode::SINGLE_REGION_DYNAMIC) {
+    ComputeNewWatermarkDynamicMode(watermarks, watermark);
+  } else {
+    ComputeNewWatermarkStaticMode(watermarks, watermark);
+  }
 }
 
 void PeerMessageQueue::AdvanceMajorityReplicatedWatermarkFlexiRaft(
@@ -1378,10 +1651,10 @@ void PeerMessageQueue::AdvanceMajorityReplicatedWatermarkFlexiRaft(
     // In SINGLE_REGION_DYNAMIC mode, only an ack from the leader region can
     // advance the watermark. Skip this expensive operation otherwise
     if (leader_region == peer_region) {
-      old_watermark = ComputeNewWatermarkDynamicMode(watermark);
+      old_watermark = ComputeNewWatermarkDynamicMode(replicated_watermarks_, watermark);
     }
   } else {
-    old_watermark = ComputeNewWatermarkStaticMode(watermark);
+    old_watermark = ComputeNewWatermarkStaticMode(replicated_watermarks_, watermark);
   }
 
   VLOG_WITH_PREFIX_UNLOCKED(1) << "Updated majority_replicated watermark "
@@ -1451,6 +1724,7 @@ void PeerMessageQueue::UpdatePeerStatus(const string& peer_uuid,
     return;
   }
   peer->last_exchange_status = ps;
+  UpdatePeerWatermarksUnlocked(*peer);
 
   if (ps != PeerStatus::RPC_LAYER_ERROR) {
     // So long as we got _any_ response from the follower, we consider it a 'communication'.
@@ -1666,8 +1940,73 @@ void PeerMessageQueue::TransferLeadershipIfNeeded(const TrackedPeer& peer,
   NotifyObserversOfSuccessor(peer.uuid());
 }
 
+void PeerMessageQueue::RecordPeerExchange(const std::string& peer_uuid,
+                                          int64_t request_bytes,
+                                          const MonoDelta& rtt) {
+  // How long the minimum round trip time is remembered for. Expiring it lets
+  // the estimate follow the peer if its network path changes.
+  static const MonoDelta kMinRttWindow = MonoDelta::FromSeconds(10);
+
+  const MonoTime now = MonoTime::Now();
+  const double rtt_sec = std::max(rtt.ToSeconds(), 1e-6);
+  const double sample_goodput = request_bytes / rtt_sec;
+  int64_t batch_size;
+  {
+    std::lock_guard<simple_spinlock> lock(queue_lock_);
+    TrackedPeer* peer = FindPtrOrNull(peers_map_, peer_uuid);
+    if (PREDICT_FALSE(peer == nullptr || queue_state_.mode == NON_LEADER)) {
+      return;
+    }
+
+    // Smooth the round trip time the same way TCP does (RFC 6298).
+    if (!peer->smoothed_rtt.Initialized()) {
+      peer->smoothed_rtt = rtt;
+    } else {
+      peer->smoothed_rtt = MonoDelta::FromNanoseconds(
+          (peer->smoothed_rtt.ToNanoseconds() * 7 + rtt.ToNanoseconds()) / 8);
+    }
+    if (!peer->min_rtt.Initialized() || rtt < peer->min_rtt ||
+        now - peer->min_rtt_time > kMinRttWindow) {
+      peer->min_rtt = rtt;
+      peer->min_rtt_time = now;
+    }
+
+    // Requests which are much smaller than the batch size were limited by how
+    // many ops were waiting to be sent, not by the link, so they say nothing
+    // about the goodput unless they raise the estimate.
+    if (request_bytes * 2 >= peer->batch_size_bytes ||
+        sample_goodput > peer->goodput_bytes_per_sec) {
+      peer->goodput_bytes_per_sec = peer->goodput_bytes_per_sec == 0 ?
+          sample_goodput : (peer->goodput_bytes_per_sec * 3 + sample_goodput) / 4;
+    }
+
+    // Aim for twice the bandwidth-delay product. Since the goodput of a batch
+    // is measured over the propagation delay plus its transfer time, this
+    // converges on the batch size whose transfer time matches the propagation
+    // delay: large enough to keep the link busy, and no larger. The batch size
+    // at most doubles from one exchange to the next, so that a single fast
+    // exchange doesn't make the next batch overshoot what the link can take.
+    if (FLAGS_consensus_adaptive_batch_size) {
+      int64_t target = static_cast<int64_t>(
+          2 * peer->goodput_bytes_per_sec * peer->min_rtt.ToSeconds());
+      target = std::min<int64_t>(target, 2 * peer->batch_size_bytes);
+      peer->batch_size_bytes = std::max<int64_t>(
+          FLAGS_consensus_adaptive_min_batch_size_bytes,
+          std::min<int64_t>(target, FLAGS_consensus_adaptive_max_batch_size_bytes));
+    }
+    batch_size = peer->batch_size_bytes;
+  }
+
+  metrics_.peer_rtt->Increment(rtt.ToMicroseconds());
+  metrics_.peer_goodput->Increment(static_cast<int64_t>(sample_goodput));
+  if (FLAGS_consensus_adaptive_batch_size) {
+    metrics_.peer_batch_size->Increment(batch_size);
+  }
+}
+
 bool PeerMessageQueue::ResponseFromPeer(const std::string& peer_uuid,
-                                        const ConsensusResponsePB& response) {
+                                        const ConsensusResponsePB& response,
+                                        const MonoTime& request_send_time) {
   DCHECK(response.IsInitialized()) << "Error: Uninitialized: "
       << response.InitializationErrorString() << ". Response: " << SecureShortDebugString(response);
 #ifdef FB_DO_NOT_REMOVE
@@ -1677,6 +2016,12 @@ bool PeerMessageQueue::ResponseFromPeer(const std::string& peer_uuid,
   bool send_more_immediately = false;
   boost::optional<int64_t> updated_commit_index;
   Mode mode_copy;
+  bool check_pending_reads = false;
+  SCOPED_CLEANUP({
+      if (check_pending_reads) {
+        CompleteConfirmedReads();
+      }
+    });
   {
     std::lock_guard<simple_spinlock> scoped_lock(queue_lock_);
 
@@ -1720,6 +2065,20 @@ bool PeerMessageQueue::ResponseFromPeer(const std::string& peer_uuid,
     // offset between the local leader and the remote peer.
     UpdateExchangeStatus(peer, prev_peer_state, response, &send_more_immediately);
 
+    for (uint32_t dict_id : response.compression_dictionary_ids()) {
+      peer->compression_dictionary_ids.insert(dict_id);
+    }
+
+    // A successful response shows that the peer still recognized this leader
+    // when it handled the request, and that it won't vote for another
+    // candidate for an election timeout (which the leader lease relies on).
+    // Responses with an error, even a log matching one, show neither.
+    if (queue_state_.mode == LEADER && request_send_time.Initialized() &&
+        !status.has_error()) {
+      ack_time_watermarks_.Set(*peer, (request_send_time - MonoTime::Min()).ToNanoseconds());
+      check_pending_reads = !pending_reads_.empty();
+    }
+
     // If the reported last-received op for the replica is in our local log,
     // then resume sending entries from that point onward. Otherwise, resume
     // after the last op they received from us. If we've never successfully
@@ -1758,6 +2117,7 @@ bool PeerMessageQueue::ResponseFromPeer(const std::string& peer_uuid,
           << "this leader's log and it has not received anything from this leader yet. "
           << "Falling back to committed index " << peer->last_known_committed_index;
     }
+    UpdatePeerWatermarksUnlocked(*peer);
 
     if (peer->last_exchange_status != PeerStatus::OK) {
       // In this case, 'send_more_immediately' has already been set by
@@ -1942,6 +2302,18 @@ void PeerMessageQueue::DumpToStringsUnlocked(vector<string>* lines) const {
     lines->push_back(
         Substitute("Peer: $0 Watermark: $1", entry.first, entry.second->ToString()));
   }
+  lines->push_back("Batch sizing:");
+  for (const PeersMap::value_type& entry : peers_map_) {
+    const TrackedPeer* peer = entry.second;
+    lines->push_back(Substitute(
+        "Peer: $0 Smoothed RTT: $1 Min RTT: $2 Goodput: $3 bytes/sec Batch size: $4 bytes",
+        entry.first,
+        peer->smoothed_rtt.Initialized() ? peer->smoothed_rtt.ToString() : "unknown",
+        peer->min_rtt.Initialized() ? peer->min_rtt.ToString() : "unknown",
+        static_cast<int64_t>(peer->goodput_bytes_per_sec),
+        FLAGS_consensus_adaptive_batch_size ?
+            peer->batch_size_bytes : FLAGS_consensus_max_batch_size_bytes));
+  }
 
   log_cache_.DumpToStrings(lines);
 }
@@ -1959,6 +2331,22 @@ void PeerMessageQueue::DumpToHtml(std::ostream& out) const {
                       EscapeForHtmlToString(entry.second->ToString())) << endl;
   }
   out << "</table>" << endl;
+  out << "<h3>Batch sizing</h3>" << endl;
+  out << "<table>" << endl;
+  out << "  <tr><th>Peer</th><th>Smoothed RTT</th><th>Min RTT</th>"
+      << "<th>Goodput (bytes/sec)</th><th>Batch size (bytes)</th></tr>" << endl;
+  for (const PeersMap::value_type& entry : peers_map_) {
+    const TrackedPeer* peer = entry.second;
+    out << Substitute("  <tr><td>$0</td><td>$1</td><td>$2</td><td>$3</td><td>$4</td></tr>",
+                      EscapeForHtmlToString(entry.first),
+                      peer->smoothed_rtt.Initialized() ? peer->smoothed_rtt.ToString() : "",
+                      peer->min_rtt.Initialized() ? peer->min_rtt.ToString() : "",
+                      static_cast<int64_t>(peer->goodput_bytes_per_sec),
+                      FLAGS_consensus_adaptive_batch_size ?
+                          peer->batch_size_bytes : FLAGS_consensus_max_batch_size_bytes)
+        << endl;
+  }
+  out << "</table>" << endl;
   out << "<p>" << queue_state_.ToString() << "</p>" << endl;
 
   log_cache_.DumpToHtml(out);
@@ -1967,14 +2355,19 @@ void PeerMessageQueue::DumpToHtml(std::ostream& out) const {
 void PeerMessageQueue::ClearUnlocked() {
   DCHECK(queue_lock_.is_locked());
   STLDeleteValues(&peers_map_);
+  replicated_watermarks_.Clear();
+  ack_time_watermarks_.Clear();
   queue_state_.state = kQueueClosed;
 }
 
 void PeerMessageQueue::Close() {
   raft_pool_observers_token_->Shutdown();
 
-  std::lock_guard<simple_spinlock> lock(queue_lock_);
-  ClearUnlocked();
+  {
+    std::lock_guard<simple_spinlock> lock(queue_lock_);
+    ClearUnlocked();
+  }
+  AbortPendingReads(Status::Aborted("consensus queue closed"));
 }
 
 int64_t PeerMessageQueue::GetQueuedOperationsSizeBytesForTests() const {
@@ -2028,12 +2421,38 @@ bool PeerMessageQueue::IsOpInLog(const OpId& desired_op) const {
 }
 
 void PeerMessageQueue::NotifyObserversOfCommitIndexChange(int64_t new_commit_index) {
-  WARN_NOT_OK(raft_pool_observers_token_->SubmitClosure(
-      Bind(&PeerMessageQueue::NotifyObserversTask, Unretained(this),
-           [=](PeerMessageQueueObserver* observer) {
-             observer->NotifyCommitIndex(new_commit_index);
-           })),
-      LogPrefixUnlocked() + "Unable to notify RaftConsensus of commit index change.");
+  {
+    std::lock_guard<simple_spinlock> lock(queue_lock_);
+    // If a notification is already pending, it notifies the new commit index
+    // instead.
+    bool pending = commit_index_to_notify_ != boost::none;
+    if (!pending || *commit_index_to_notify_ < new_commit_index) {
+      commit_index_to_notify_ = new_commit_index;
+    }
+    if (pending) {
+      return;
+    }
+  }
+  Status s = raft_pool_observers_token_->SubmitClosure(
+      Bind(&PeerMessageQueue::NotifyObserversOfCommitIndexTask, Unretained(this)));
+  if (PREDICT_FALSE(!s.ok())) {
+    WARN_NOT_OK(s, LogPrefixUnlocked() + "Unable to notify RaftConsensus of commit index change.");
+    std::lock_guard<simple_spinlock> lock(queue_lock_);
+    commit_index_to_notify_ = boost::none;
+  }
+}
+
+void PeerMessageQueue::NotifyObserversOfCommitIndexTask() {
+  int64_t commit_index;
+  {
+    std::lock_guard<simple_spinlock> lock(queue_lock_);
+    DCHECK(commit_index_to_notify_ != boost::none);
+    commit_index = *commit_index_to_notify_;
+    commit_index_to_notify_ = boost::none;
+  }
+  NotifyObserversTask([=](PeerMessageQueueObserver* observer) {
+    observer->NotifyCommitIndex(commit_index);
+  });
 }
 
 void PeerMessageQueue::NotifyObserversOfTermChange(int64_t term) {
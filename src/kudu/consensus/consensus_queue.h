@@ -25,9 +25,12 @@
 #define KUDU_CONSENSUS_CONSENSUS_QUEUE_H_
 
 #include <cstdint>
+#include <deque>
 #include <functional>
 #include <iosfwd>
+#include <map>
 #include <memory>
+#include <set>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -42,6 +45,7 @@
 #include "kudu/consensus/ref_counted_replicate.h"
 #include "kudu/consensus/time_manager.h"
 #include "kudu/consensus/routing.h"
+#include "kudu/consensus/watermark_tracker.h"
 #include "kudu/gutil/gscoped_ptr.h"
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/gutil/threading/thread_collision_warner.h"
@@ -119,9 +123,9 @@ const char* PeerStatusToString(PeerStatus p);
 // This also takes care of pushing requests to peers as new operations are
 // added, and notifying RaftConsensus when the commit index advances.
 //
-// TODO(todd): Right now this class is able to track one outstanding operation
-// per peer. If we want to have more than one outstanding RPC we need to
-// modify it.
+// A peer may have several requests outstanding (see PipelinedRequestForPeer()).
+// Responses must be handed to ResponseFromPeer() in the order in which the
+// requests were assembled.
 class PeerMessageQueue {
  public:
   struct TrackedPeer {
@@ -184,6 +188,26 @@ class PeerMessageQueue {
     // peer (eg when it is lagging, etc).
     std::shared_ptr<logging::LogThrottler> status_log_throttler;
 
+    // Estimates of the round trip time and goodput of UpdateConsensus
+    // exchanges with the peer. See RecordPeerExchange().
+    //
+    // 'min_rtt' is the lowest round trip time seen since 'min_rtt_time'. Since
+    // it includes heartbeats and other small requests, it approximates the
+    // propagation delay to the peer. 'goodput_bytes_per_sec' is zero until a
+    // sample has been taken.
+    MonoDelta smoothed_rtt;
+    MonoDelta min_rtt;
+    MonoTime min_rtt_time;
+    double goodput_bytes_per_sec;
+
+    // The size, in bytes, of the next batch of ops to send to the peer when
+    // --consensus_adaptive_batch_size is enabled.
+    int64_t batch_size_bytes;
+
+    // The ids of the compression dictionaries the peer confirmed having. Ops
+    // compressed with any other dictionary are sent along with it.
+    std::set<uint32_t> compression_dictionary_ids;
+
    private:
     // The last term we saw from a given peer.
     // This is only used for sanity checking that a peer doesn't
@@ -246,6 +270,10 @@ class PeerMessageQueue {
   // with concurrent Append calls.
   Status AppendOperation(const ReplicateRefPtr& msg);
 
+  // Like AppendOperation(), for several messages appended to the log cache
+  // and the log at once.
+  Status AppendOperations(const std::vector<ReplicateRefPtr>& msgs);
+
   // Appends a vector of messages to be replicated to the peers.
   // Returns OK unless the message could not be added to the queue for some
   // reason (e.g. the queue reached max size), calls 'log_append_callback' when
@@ -298,6 +326,20 @@ class PeerMessageQueue {
                         bool* needs_tablet_copy,
                         std::string* next_hop_uuid);
 
+  // Like RequestForPeer(), but assembles a request to be pipelined behind
+  // requests which are still in flight to the peer: entries are read starting
+  // at 'next_index', one past the last op in flight, rather than at the peer's
+  // acknowledged next_index.
+  //
+  // Returns Status::IllegalState() if the peer isn't known to be in sync with
+  // this leader's log, in which case the caller should wait for the responses
+  // to the requests in flight and then use RequestForPeer().
+  Status PipelinedRequestForPeer(const std::string& uuid,
+                                 int64_t next_index,
+                                 ConsensusRequestPB* request,
+                                 std::vector<ReplicateRefPtr>* msg_refs,
+                                 std::string* next_hop_uuid);
+
 #ifdef FB_DO_NOT_REMOVE
   // Fill in a StartTabletCopyRequest for the specified peer.
   // If that peer should not initiate Tablet Copy, returns a non-OK status.
@@ -319,8 +361,24 @@ class PeerMessageQueue {
   // Returns true iff there are more requests pending in the queue for this
   // peer and another request should be sent immediately, with no intervening
   // delay.
+  //
+  // 'request_send_time' is the time at which the request that 'response'
+  // answers was sent, if known. It is used to confirm leadership for reads
+  // (see ReadIndex()).
   bool ResponseFromPeer(const std::string& peer_uuid,
-                        const ConsensusResponsePB& response);
+                        const ConsensusResponsePB& response,
+                        const MonoTime& request_send_time = MonoTime());
+
+  // Records that a request of 'request_bytes' sent to peer 'peer_uuid' was
+  // answered after 'rtt', updating the peer's round trip time and goodput
+  // estimates. If --consensus_adaptive_batch_size is set, the size of the
+  // peer's next batch is then set to the bandwidth-delay product of the link.
+  //
+  // Should be called for successful exchanges only, before the response is
+  // handed to ResponseFromPeer().
+  void RecordPeerExchange(const std::string& peer_uuid,
+                          int64_t request_bytes,
+                          const MonoDelta& rtt);
 
   // Called by the consensus implementation to update the queue's watermarks
   // based on information provided by the leader. This is used for metrics and
@@ -354,6 +412,47 @@ class PeerMessageQueue {
   // Return true if the committed index falls within the current term.
   bool IsCommittedIndexInCurrentTerm() const;
 
+  typedef std::function<void(const Status& status, int64_t read_index)> ReadIndexCallback;
+
+  // Obtains the index up to which a linearizable read must reflect the
+  // replicated state (the "read index", see section 6.4 of the Raft
+  // dissertation): the committed index at the time of the call.
+  //
+  // This is only safe to serve once it's confirmed that this node was still
+  // the leader when the read was requested, i.e. once the commit quorum of
+  // voters has acknowledged requests sent after this call. Until then,
+  // 'callback' is queued, and all the reads queued are confirmed by the same
+  // round of requests. Returns true in that case: the caller should make sure
+  // that a round of requests is sent to the peers.
+  //
+  // If 'lease_duration' is set and the commit quorum acknowledged requests
+  // sent less than 'lease_duration' ago, the leader holds a lease and
+  // 'callback' is invoked right away instead.
+  //
+  // 'callback' gets an error if the queue isn't in leader mode, if the leader
+  // hasn't committed an op in its current term yet, or if the queue leaves
+  // leader mode or is closed before the read is confirmed. If 'deadline' is
+  // initialized and the read isn't confirmed by then, 'callback' gets
+  // Status::TimedOut once ExpirePendingReads() notices it, which happens on
+  // every request sent to a peer, heartbeats included. 'callback' may run on
+  // the calling thread or on the thread handling a peer response, and must
+  // not block.
+  bool ReadIndex(const ReadIndexCallback& callback,
+                 const boost::optional<MonoDelta>& lease_duration,
+                 const MonoTime& deadline = MonoTime());
+
+  // Fails the queued reads whose deadline has passed with Status::TimedOut.
+  // Must be called without 'queue_lock_' held.
+  void ExpirePendingReads();
+
+  // Returns the number of reads waiting for their read index to be confirmed.
+  int GetNumPendingReadsForTests() const;
+
+  // Makes the acknowledgements received so far insufficient to hold a lease
+  // in ReadIndex(), e.g. because other nodes may have been allowed to start
+  // an election while the leader was still active.
+  void RevokeLeaderLease();
+
   // Whether the queue run in the leader mode.
   bool IsInLeaderMode() const;
 
@@ -384,6 +483,12 @@ class PeerMessageQueue {
     // Keeps track of the number of ops. behind the leader the peer is, measured as the difference
     // between the latest appended op index on this peer versus on the leader (0 if leader).
     scoped_refptr<AtomicGauge<int64_t> > num_ops_behind_leader;
+    // Round trip time of UpdateConsensus exchanges with peers.
+    scoped_refptr<Histogram> peer_rtt;
+    // Goodput of UpdateConsensus exchanges with peers, in bytes per second.
+    scoped_refptr<Histogram> peer_goodput;
+    // Size of the batches of ops chosen for peers.
+    scoped_refptr<Histogram> peer_batch_size;
 
     explicit Metrics(const scoped_refptr<MetricEntity>& metric_entity);
   };
@@ -435,9 +540,19 @@ class PeerMessageQueue {
   }
 
  private:
+  // Implements RequestForPeer() and PipelinedRequestForPeer(). If set,
+  // 'pipeline_next_index' is the index to start reading entries from.
+  Status DoRequestForPeer(const std::string& uuid,
+                          boost::optional<int64_t> pipeline_next_index,
+                          ConsensusRequestPB* request,
+                          std::vector<ReplicateRefPtr>* msg_refs,
+                          bool* needs_tablet_copy,
+                          std::string* next_hop_uuid);
+
   FRIEND_TEST(ConsensusQueueTest, TestQueueAdvancesCommittedIndex);
   FRIEND_TEST(ConsensusQueueTest, TestQueueMovesWatermarksBackward);
   FRIEND_TEST(ConsensusQueueTest, TestFollowerCommittedIndexAndMetrics);
+  FRIEND_TEST(ConsensusQueueTest, TestCommitIndexNotificationsAreCoalesced);
   FRIEND_TEST(ConsensusQueueUnitTest, PeerHealthStatus);
   FRIEND_TEST(RaftConsensusQuorumTest, TestReplicasEnforceTheLogMatchingProperty);
 
@@ -577,8 +692,38 @@ class PeerMessageQueue {
   // Notify all PeerMessageQueueObservers using the given callback function.
   void NotifyObserversTask(const std::function<void(PeerMessageQueueObserver*)>& func);
 
+  // Notifies the observers of the commit index in 'commit_index_to_notify_'.
+  void NotifyObserversOfCommitIndexTask();
+
   typedef std::unordered_map<std::string, TrackedPeer*> PeersMap;
 
+  // A value per peer, such as its last_received index, indexed so that the
+  // highest value reached by a given number of peers, of voters, or of voters
+  // in a region can be found quickly.
+  struct PeerWatermarks {
+    // Sets 'peer's value to 'value'.
+    void Set(const TrackedPeer& peer, int64_t value);
+
+    // Removes 'peer's value, if any.
+    void Remove(const TrackedPeer& peer);
+
+    void Clear();
+
+    WatermarkTracker all;
+    WatermarkTracker voters;
+    std::map<std::string, WatermarkTracker> voters_by_region;
+  };
+
+  // A read waiting for its read index to be confirmed. See ReadIndex().
+  struct PendingRead {
+    // When the read was requested, and the committed index at the time.
+    MonoTime start_time;
+    int64_t read_index;
+    ReadIndexCallback callback;
+    // When the read expires, if initialized.
+    MonoTime deadline;
+  };
+
   std::string ToStringUnlocked() const;
 
   std::string LogPrefixUnlocked() const;
@@ -602,6 +747,28 @@ class PeerMessageQueue {
 
   void UntrackPeerUnlocked(const std::string& uuid);
 
+  // Brings the watermark trackers up to date with 'peer's last_received and
+  // last_exchange_status. Must be called whenever either of them changes.
+  void UpdatePeerWatermarksUnlocked(const TrackedPeer& peer);
+
+  // Returns the latest time at or after which the commit quorum of voters has
+  // sent acknowledgements, i.e. the latest time at which this node is known
+  // to have been the leader. Returns MonoTime::Min() if unknown.
+  MonoTime LeadershipConfirmedTimeUnlocked();
+
+  // Forgets the acknowledgements received so far, which neither confirm
+  // leadership nor grant a lease anymore.
+  void ResetLeadershipConfirmationsUnlocked();
+
+  // Invokes the callbacks of the queued reads which are confirmed by the
+  // commit quorum's acknowledgements so far. Must be called without
+  // 'queue_lock_' held.
+  void CompleteConfirmedReads();
+
+  // Fails all queued reads with 'status'. Must be called without 'queue_lock_'
+  // held.
+  void AbortPendingReads(const Status& status);
+
   // We need the local peer in the config because it contains the current
   // 'member_type' of the local node while 'local_peer_pb_' does not.
   void TrackLocalPeerUnlocked();
@@ -643,15 +810,24 @@ class PeerMessageQueue {
   // This function returns the old watermark.
   int64_t DoComputeNewWatermarkStaticMode(
     const std::map<std::string, int>& voter_distribution,
-    const std::map<std::string, std::vector<int64_t> >& watermarks_by_region,
+    const std::map<std::string, WatermarkTracker>& watermarks_by_region,
     int64_t* watermark);
-  int64_t ComputeNewWatermarkStaticMode(int64_t* watermark);
+  int64_t ComputeNewWatermarkStaticMode(const PeerWatermarks& watermarks,
+                                        int64_t* watermark);
 
   // Function to compute the new `watermark` in the single region dynamic
   // mode given a pointer to it, the voter distribution and the watermarks
   // classified by region.
   // This function returns the old watermark.
-  int64_t ComputeNewWatermarkDynamicMode(int64_t* watermark);
+  int64_t ComputeNewWatermarkDynamicMode(const PeerWatermarks& watermarks,
+                                         int64_t* watermark);
+
+  // Advances 'watermark' to the highest value in 'watermarks' reached by the
+  // commit quorum of voters: a majority of them, or as prescribed by the
+  // commit rule with FlexiRaft. Leaves it unchanged if the quorum can't be
+  // satisfied.
+  void ComputeQuorumWatermarkUnlocked(const PeerWatermarks& watermarks,
+                                      int64_t* watermark);
 
   // Function to compute the commit index in FlexiRaft. Same as
   // `AdvanceQueueWatermark` except that its only used for commit index
@@ -671,6 +847,11 @@ class PeerMessageQueue {
   // The pool token which executes observer notifications.
   std::unique_ptr<ThreadPoolToken> raft_pool_observers_token_;
 
+  // The commit index to notify the observers of, if a commit index
+  // notification was submitted and hasn't run yet. Later advances of the
+  // commit index are merged into that notification. Protected by queue_lock_.
+  boost::optional<int64_t> commit_index_to_notify_;
+
   // PB containing identifying information about the local peer.
   const RaftPeerPB local_peer_pb_;
 
@@ -686,6 +867,24 @@ class PeerMessageQueue {
 
   // The currently tracked peers.
   PeersMap peers_map_;
+
+  // The last_received indexes of the tracked peers whose last exchange was
+  // successful, kept up to date as responses arrive so that the watermarks
+  // can be advanced without sorting every peer's index on each response.
+  // See UpdatePeerWatermarksUnlocked().
+  PeerWatermarks replicated_watermarks_;
+
+  // For each tracked peer, the time (in nanoseconds since MonoTime::Min())
+  // at which the latest request it acknowledged was sent. The local peer
+  // acknowledges everything. Used to confirm leadership for reads.
+  PeerWatermarks ack_time_watermarks_;
+
+  // Reads waiting for confirmation, in the order they were requested.
+  std::deque<PendingRead> pending_reads_;
+
+  // Only acknowledgements of requests sent at or after this time may grant a
+  // lease. See RevokeLeaderLease().
+  MonoTime lease_not_before_;
   mutable simple_spinlock queue_lock_; // TODO(todd): rename
 
   bool successor_watch_in_progress_;
@@ -23,13 +23,18 @@
 
 #include "kudu/consensus/log.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <algorithm>
+#include <atomic>
 #include <cerrno>
 #include <cstdint>
 #include <limits>
 #include <memory>
 #include <ostream>
 #include <string>
+#include <thread>
 #include <type_traits>
 #include <vector>
 
@@ -50,16 +55,23 @@
 #include "kudu/consensus/log_util.h"
 #include "kudu/consensus/opid.pb.h"
 #include "kudu/consensus/opid_util.h"
+#include "kudu/consensus/ref_counted_replicate.h"
 #include "kudu/fs/fs_manager.h"
 #include "kudu/gutil/gscoped_ptr.h"
+#include "kudu/gutil/macros.h"
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/gutil/stl_util.h"
 #include "kudu/gutil/strings/substitute.h"
+#include "kudu/gutil/strings/util.h"
 #include "kudu/util/async_util.h"
 #include "kudu/util/compression/compression.pb.h"
 #include "kudu/util/env.h"
+#include "kudu/util/errno.h"
 #include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/path_util.h"
 #include "kudu/util/random.h"
+#include "kudu/util/random_util.h"
 #include "kudu/util/status.h"
 #include "kudu/util/stopwatch.h"
 #include "kudu/util/test_macros.h"
@@ -67,9 +79,21 @@
 
 DEFINE_int32(num_batches, 10000,
              "Number of batches to write to/read from the Log in TestWriteManyBatches");
+DEFINE_int32(open_benchmark_wal_mb, 2048,
+             "Amount of WAL written before reopening it in BenchmarkOpenLargeLog, "
+             "when slow tests are enabled");
 
 DECLARE_int32(log_min_segments_to_retain);
 DECLARE_int32(log_max_segments_to_retain);
+DECLARE_int32(log_max_recycled_segments);
+DECLARE_int32(log_group_commit_max_wait_us);
+DECLARE_int32(log_group_commit_target_latency_us);
+DECLARE_bool(log_mmap_sealed_segments);
+DECLARE_bool(log_verify_segments_on_open);
+DECLARE_int32(log_reader_open_threads);
+DECLARE_int32(log_zero_copy_min_payload_bytes);
+DECLARE_int64(log_segment_delete_bytes_per_sec);
+DECLARE_int64(log_segment_delete_chunk_bytes);
 DECLARE_double(log_inject_io_error_on_preallocate_fraction);
 DECLARE_int64(fs_wal_dir_reserved_bytes);
 DECLARE_int64(disk_reserved_bytes_free_for_testing);
@@ -87,7 +111,9 @@ using consensus::MakeOpId;
 using consensus::NO_OP;
 using consensus::OpId;
 using consensus::ReplicateMsg;
+using consensus::ReplicateRefPtr;
 using consensus::WRITE_OP;
+using consensus::WritePayloadPB;
 using strings::Substitute;
 
 struct TestLogSequenceElem {
@@ -239,6 +265,99 @@ TEST_P(LogTestOptionalCompression, TestMultipleEntriesInABatch) {
   ASSERT_OK(log_->Close());
 }
 
+// Large write payloads are written out without being copied into the
+// serialized batch. Make sure that they, as well as the small ones which are
+// copied, read back exactly as they were appended.
+TEST_P(LogTestOptionalCompression, TestWritePayloadsAroundZeroCopyThreshold) {
+  FLAGS_log_zero_copy_min_payload_bytes = 1024;
+  ASSERT_OK(BuildLog());
+
+  Random rng(SeedRandom());
+  vector<ReplicateRefPtr> replicates;
+  OpId op_id = MakeOpId(1, 1);
+  for (int size : { 0, 1, 1023, 1024, 1025, 100, 64 * 1024, 5000 }) {
+    ReplicateRefPtr replicate = make_scoped_refptr_replicate(new ReplicateMsg());
+    ReplicateMsg* msg = replicate->get();
+    msg->mutable_id()->CopyFrom(op_id);
+    msg->set_op_type(WRITE_OP);
+    msg->set_timestamp(clock_->Now().ToUint64());
+    string payload;
+    payload.resize(size);
+    RandomString(&payload[0], payload.size(), &rng);
+    msg->mutable_write_payload()->set_payload(payload);
+    // Exercise the optional fields on either side of the payload.
+    if (op_id.index() % 2 == 0) {
+      msg->mutable_write_payload()->set_crc32(rng.Next());
+      msg->mutable_write_payload()->set_uncompressed_size(size);
+      msg->mutable_request_id()->set_client_id("client");
+      msg->mutable_request_id()->set_seq_no(op_id.index());
+      msg->mutable_request_id()->set_first_incomplete_seq_no(1);
+      msg->mutable_request_id()->set_attempt_no(0);
+      msg->mutable_noop_request()->set_timestamp_in_opid_order(true);
+    }
+    op_id.set_index(op_id.index() + 1);
+    replicates.emplace_back(std::move(replicate));
+  }
+  Synchronizer sync;
+  ASSERT_OK(log_->AsyncAppendReplicates(replicates, sync.AsStatusCallback()));
+  ASSERT_OK(sync.Wait());
+
+  vector<ReplicateMsg*> repls;
+  ElementDeleter d(&repls);
+  ASSERT_OK(log_->reader()->ReadReplicatesInRange(
+      1, replicates.size(), LogReader::kNoSizeLimit, ReadContext(), &repls));
+  ASSERT_EQ(replicates.size(), repls.size());
+  for (int i = 0; i < repls.size(); i++) {
+    ASSERT_EQ(replicates[i]->get()->SerializeAsString(), repls[i]->SerializeAsString());
+  }
+  ASSERT_OK(log_->Close());
+}
+
+// Ops received from the leader are written out from the bytes they were
+// received as, rather than serialized again. Make sure they read back exactly
+// as they were appended, alongside ops which are serialized.
+TEST_P(LogTestOptionalCompression, TestAppendReceivedReplicates) {
+  FLAGS_log_zero_copy_min_payload_bytes = 1024;
+  ASSERT_OK(BuildLog());
+
+  Random rng(SeedRandom());
+  vector<ReplicateRefPtr> replicates;
+  vector<string> received;
+  received.reserve(8);
+  OpId op_id = MakeOpId(1, 1);
+  for (int size : { 0, 10, 2000, 64 * 1024, 100, 5000, 1, 300 * 1024 }) {
+    ReplicateRefPtr replicate = make_scoped_refptr_replicate(new ReplicateMsg());
+    ReplicateMsg* msg = replicate->get();
+    msg->mutable_id()->CopyFrom(op_id);
+    msg->set_op_type(WRITE_OP);
+    msg->set_timestamp(clock_->Now().ToUint64());
+    string payload;
+    payload.resize(size);
+    RandomString(&payload[0], payload.size(), &rng);
+    msg->mutable_write_payload()->set_payload(payload);
+    msg->mutable_write_payload()->set_crc32(rng.Next());
+    if (op_id.index() % 3 != 0) {
+      received.emplace_back(msg->SerializeAsString());
+      replicate->set_received_bytes(Slice(received.back()));
+    }
+    op_id.set_index(op_id.index() + 1);
+    replicates.emplace_back(std::move(replicate));
+  }
+  Synchronizer sync;
+  ASSERT_OK(log_->AsyncAppendReplicates(replicates, sync.AsStatusCallback()));
+  ASSERT_OK(sync.Wait());
+
+  vector<ReplicateMsg*> repls;
+  ElementDeleter d(&repls);
+  ASSERT_OK(log_->reader()->ReadReplicatesInRange(
+      1, replicates.size(), LogReader::kNoSizeLimit, ReadContext(), &repls));
+  ASSERT_EQ(replicates.size(), repls.size());
+  for (int i = 0; i < repls.size(); i++) {
+    ASSERT_EQ(replicates[i]->get()->SerializeAsString(), repls[i]->SerializeAsString());
+  }
+  ASSERT_OK(log_->Close());
+}
+
 // Tests that everything works properly with fsync enabled:
 // This also tests SyncDir() (see KUDU-261), which is called whenever
 // a new log segment is initialized.
@@ -509,6 +628,51 @@ TEST_F(LogTest, TestWriteAndReadToAndFromInProgressSegment) {
   ASSERT_EQ(written_entries_size, log_->active_segment_->written_offset());
 }
 
+// With io_uring, appended entries are only buffered until they are synced.
+// Readers must not find them in the index before they can read them.
+TEST_F(LogTest, TestReadWhileAppendingWithIoUring) {
+  options_.use_io_uring = true;
+  Status s = BuildLog();
+  // Skip if the kernel lacks io_uring (ENOSYS) or a sandbox forbids it (EPERM).
+  if (s.IsNotSupported() ||
+      (s.IsIOError() && (s.posix_code() == ENOSYS || s.posix_code() == EPERM))) {
+    LOG(INFO) << "io_uring log segments not available, skipping: " << s.ToString();
+    return;
+  }
+  ASSERT_OK(s);
+
+  std::atomic<bool> done(false);
+  Status read_status;
+  std::thread reader_thread([&]() {
+    shared_ptr<LogReader> reader = log_->reader();
+    int64_t last_indexed = 0;
+    while (!done && read_status.ok()) {
+      LogIndexEntry entry;
+      while (log_->log_index_->GetEntry(last_indexed + 1, &entry).ok()) {
+        last_indexed++;
+      }
+      if (last_indexed == 0) {
+        continue;
+      }
+      vector<ReplicateMsg*> repls;
+      ElementDeleter d(&repls);
+      read_status = reader->ReadReplicatesInRange(
+          1, last_indexed, LogReader::kNoSizeLimit, ReadContext(), &repls);
+      if (read_status.ok() && static_cast<int64_t>(repls.size()) != last_indexed) {
+        read_status = Status::Corruption(Substitute("read $0 of $1 indexed replicates",
+                                                    repls.size(), last_indexed));
+      }
+    }
+  });
+
+  OpId op_id = MakeOpId(1, 1);
+  Status append_status = AppendNoOps(&op_id, 1000);
+  done = true;
+  reader_thread.join();
+  ASSERT_OK(append_status);
+  ASSERT_OK(read_status);
+}
+
 // Tests that segments can be GC'd while the log is running.
 TEST_P(LogTestOptionalCompression, TestGCWithLogRunning) {
   FLAGS_log_min_segments_to_retain = 2;
@@ -599,6 +763,69 @@ TEST_P(LogTestOptionalCompression, TestGCWithLogRunning) {
   }
 }
 
+// Garbage-collected segments are deleted in the background, a chunk at a
+// time and throttled, with the backlog reported by a metric.
+TEST_F(LogTest, TestAsyncThrottledSegmentDeletion) {
+  FLAGS_log_segment_delete_chunk_bytes = 1024;
+  ASSERT_OK(BuildLog());
+
+  const int kNumSegments = 4;
+  const int kNumOpsPerSegment = 50;
+  OpId op_id = MakeOpId(1, 1);
+  ASSERT_OK(AppendMultiSegmentSequence(kNumSegments, kNumOpsPerSegment, &op_id, nullptr));
+
+  vector<string> gc_paths;
+  int64_t gc_bytes = 0;
+  {
+    SegmentSequence segments;
+    ASSERT_OK(log_->reader()->GetSegmentsSnapshot(&segments));
+    for (int i = 0; i < 2; i++) {
+      gc_paths.push_back(segments[i]->path());
+      gc_bytes += segments[i]->file_size();
+    }
+  }
+
+  // Throttle deletion so that it takes about a second.
+  FLAGS_log_segment_delete_bytes_per_sec = gc_bytes;
+  const int64_t retention = 2 * kNumOpsPerSegment + 1;
+  int num_gced_segments;
+  ASSERT_OK(log_->GC(RetentionIndexes(retention, retention), &num_gced_segments));
+  ASSERT_EQ(2, num_gced_segments);
+  ASSERT_GT(log_->metrics_->gc_pending_delete_bytes->value(), 0);
+
+  ASSERT_EVENTUALLY([&]() {
+    ASSERT_EQ(0, log_->metrics_->gc_pending_delete_bytes->value());
+  });
+  for (const string& path : gc_paths) {
+    ASSERT_FALSE(env_->FileExists(path)) << path;
+  }
+  ASSERT_OK(log_->Close());
+  NO_FATALS(CheckRightNumberOfSegmentFiles(kNumSegments - 2));
+}
+
+// Closing the log finishes off throttled deletions without waiting out the
+// throttle.
+TEST_F(LogTest, TestCloseDrainsThrottledSegmentDeletion) {
+  ASSERT_OK(BuildLog());
+
+  const int kNumSegments = 4;
+  const int kNumOpsPerSegment = 50;
+  OpId op_id = MakeOpId(1, 1);
+  ASSERT_OK(AppendMultiSegmentSequence(kNumSegments, kNumOpsPerSegment, &op_id, nullptr));
+
+  // Throttle deletion so that it would take far longer than the test.
+  FLAGS_log_segment_delete_bytes_per_sec = 1;
+  const int64_t retention = 2 * kNumOpsPerSegment + 1;
+  int num_gced_segments;
+  ASSERT_OK(log_->GC(RetentionIndexes(retention, retention), &num_gced_segments));
+  ASSERT_EQ(2, num_gced_segments);
+
+  MonoTime start = MonoTime::Now();
+  ASSERT_OK(log_->Close());
+  ASSERT_LT(MonoTime::Now() - start, MonoDelta::FromSeconds(30));
+  NO_FATALS(CheckRightNumberOfSegmentFiles(kNumSegments - 2));
+}
+
 // Test that, when we are set to retain a given number of log segments,
 // we also retain any relevant log index chunks, even if those operations
 // are not necessary for recovery.
@@ -737,6 +964,128 @@ TEST_P(LogTestOptionalCompression, TestLogReopenAndGC) {
   ASSERT_OK(log_anchor_registry_->Unregister(anchors[3]));
 }
 
+// Test that GC'd segment files are reused by new segments, and that the stale
+// contents left over from their previous segments are not read back.
+TEST_P(LogTestOptionalCompression, TestGCRecyclesSegments) {
+  FLAGS_log_min_segments_to_retain = 1;
+  FLAGS_log_max_recycled_segments = 2;
+  ASSERT_OK(BuildLog());
+
+  vector<LogAnchor*> anchors;
+  ElementDeleter deleter(&anchors);
+
+  const int kNumOpsPerSegment = 5;
+  int num_gced_segments;
+  OpId op_id = MakeOpId(1, 1);
+  ASSERT_OK(AppendMultiSegmentSequence(4, kNumOpsPerSegment, &op_id, &anchors));
+
+  // GC the first three segments. Only two of them are kept for reuse.
+  for (int i = 0; i < 3; i++) {
+    ASSERT_OK(log_anchor_registry_->Unregister(anchors[i]));
+  }
+  RetentionIndexes retention;
+  ASSERT_OK(log_anchor_registry_->GetEarliestRegisteredLogIndex(&retention.for_durability));
+  ASSERT_OK(log_->GC(retention, &num_gced_segments));
+  ASSERT_EQ(3, num_gced_segments);
+  log_->WaitForPendingDeletesForTests();
+  NO_FATALS(CheckRightNumberOfSegmentFiles(1));
+
+  // Roll onto the two recycled files, writing fewer entries than they held
+  // before so that stale entries follow the new ones.
+  const int64_t first_new_index = op_id.index();
+  ASSERT_OK(RollLog());
+  ASSERT_OK(AppendMultiSegmentSequence(2, 2, &op_id, &anchors));
+  NO_FATALS(CheckRightNumberOfSegmentFiles(3));
+
+  SegmentSequence segments;
+  ASSERT_OK(log_->reader()->GetSegmentsSnapshot(&segments));
+  ASSERT_EQ(3, segments.size()) << DumpSegmentsToString(segments);
+  ASSERT_FALSE(IsRecycledSegment(segments[0]->header()));
+  ASSERT_TRUE(IsRecycledSegment(segments[1]->header()));
+  ASSERT_TRUE(IsRecycledSegment(segments[2]->header()));
+
+  // Open the active segment as if we had crashed: the stale footer at the end
+  // of the file must be ignored, and only the new entries read back.
+  scoped_refptr<ReadableLogSegment> active;
+  ASSERT_OK(ReadableLogSegment::Open(env_, segments[2]->path(), &active));
+  ASSERT_FALSE(active->HasFooter());
+  ASSERT_OK(active->RebuildFooterByScanning());
+  ASSERT_EQ(2, active->footer().num_entries());
+
+  // After reopening, all of the new entries should be readable.
+  ASSERT_OK(log_->Close());
+  ASSERT_OK(BuildLog());
+  {
+    vector<ReplicateMsg*> repls;
+    ElementDeleter d(&repls);
+    ASSERT_OK(log_->reader()->ReadReplicatesInRange(
+        first_new_index, op_id.index() - 1, LogReader::kNoSizeLimit, ReadContext(), &repls));
+    ASSERT_EQ(4, repls.size());
+  }
+  ASSERT_OK(log_->Close());
+
+  for (int i = 3; i < anchors.size(); i++) {
+    ASSERT_OK(log_anchor_registry_->Unregister(anchors[i]));
+  }
+}
+
+// Test that GC deletes the files of the compression dictionaries which no
+// retained segment has entries compressed with, except the latest one.
+TEST_F(LogTest, TestGCDeletesUnusedCompressionDictionaries) {
+  FLAGS_log_min_segments_to_retain = 1;
+  ASSERT_OK(BuildLog());
+
+  const string wal_dir = fs_manager_->GetTabletWalDir(kTestTablet);
+  auto dictionary_path = [&](uint32_t dict_id) {
+    return JoinPathSegments(wal_dir, Substitute("$0$1", kCompressionDictionaryFilePrefix,
+                                                dict_id));
+  };
+  auto append_op = [&](int64_t index, uint32_t dict_id) {
+    ReplicateRefPtr replicate = make_scoped_refptr_replicate(new ReplicateMsg());
+    replicate->get()->set_op_type(WRITE_OP);
+    *replicate->get()->mutable_id() = MakeOpId(1, index);
+    replicate->get()->set_timestamp(clock_->Now().ToUint64());
+    WritePayloadPB* payload = replicate->get()->mutable_write_payload();
+    payload->set_payload("payload");
+    if (dict_id != 0) {
+      payload->set_compression_dictionary_id(dict_id);
+    }
+    return AppendReplicateBatch(replicate);
+  };
+
+  // One segment per dictionary, followed by one without any.
+  const uint32_t kFirstDictId = 1001;
+  const uint32_t kSecondDictId = 1002;
+  const uint32_t kUnusedDictId = 1003;
+  ASSERT_OK(log_->PersistCompressionDictionary(kFirstDictId, "first"));
+  ASSERT_OK(append_op(1, kFirstDictId));
+  ASSERT_OK(RollLog());
+  ASSERT_OK(log_->PersistCompressionDictionary(kSecondDictId, "second"));
+  ASSERT_OK(append_op(2, kSecondDictId));
+  ASSERT_OK(RollLog());
+  ASSERT_OK(append_op(3, 0));
+  ASSERT_OK(RollLog());
+  ASSERT_OK(log_->PersistCompressionDictionary(kUnusedDictId, "unused"));
+
+  // GC the first segment. Only its dictionary is deleted: the second is used
+  // by a retained segment, and the latest may be used by new entries.
+  int num_gced_segments;
+  ASSERT_OK(log_->GC(RetentionIndexes(2, 2), &num_gced_segments));
+  ASSERT_EQ(1, num_gced_segments);
+  log_->WaitForPendingDeletesForTests();
+  ASSERT_FALSE(env_->FileExists(dictionary_path(kFirstDictId)));
+  ASSERT_TRUE(env_->FileExists(dictionary_path(kSecondDictId)));
+  ASSERT_TRUE(env_->FileExists(dictionary_path(kUnusedDictId)));
+
+  // Once the second segment is GCed, so is its dictionary.
+  ASSERT_OK(log_->GC(RetentionIndexes(3, 3), &num_gced_segments));
+  ASSERT_EQ(1, num_gced_segments);
+  log_->WaitForPendingDeletesForTests();
+  ASSERT_FALSE(env_->FileExists(dictionary_path(kSecondDictId)));
+  ASSERT_TRUE(env_->FileExists(dictionary_path(kUnusedDictId)));
+  ASSERT_OK(log_->Close());
+}
+
 // Helper to measure the performance of the log.
 TEST_P(LogTestOptionalCompression, TestWriteManyBatches) {
   uint64_t num_batches = 10;
@@ -1063,6 +1412,163 @@ TEST_P(LogTestOptionalCompression, TestReadReplicatesHighIndex) {
   ASSERT_GT(op_id.index(), std::numeric_limits<int32_t>::max());
 }
 
+// Test that entries in closed segments can be read from their mappings, and
+// that reads spanning into the active segment fall back to pread().
+TEST_P(LogTestOptionalCompression, TestReadReplicatesFromMappedSegments) {
+  FLAGS_log_mmap_sealed_segments = true;
+  ASSERT_OK(BuildLog());
+
+  const int kNumSegments = 3;
+  const int kNumOpsPerSegment = 5;
+  OpId op_id = MakeOpId(1, 1);
+  ASSERT_OK(AppendMultiSegmentSequence(kNumSegments, kNumOpsPerSegment, &op_id, nullptr));
+  const int64_t last_index = op_id.index() - 1;
+
+  shared_ptr<LogReader> reader = log_->reader();
+  SegmentSequence segments;
+  ASSERT_OK(reader->GetSegmentsSnapshot(&segments));
+  ASSERT_EQ(kNumSegments, segments.size());
+  ASSERT_FALSE(segments.back()->HasFooter());
+
+  // Read everything twice: once to map the closed segments, and once more
+  // to read from the existing mappings.
+  for (int i = 0; i < 2; i++) {
+    int64_t bytes_read = reader->bytes_read_->value();
+    vector<ReplicateMsg*> repls;
+    ElementDeleter d(&repls);
+    ASSERT_OK(reader->ReadReplicatesInRange(
+        1, last_index, LogReader::kNoSizeLimit, ReadContext(), &repls));
+    ASSERT_EQ(last_index, repls.size());
+    for (int j = 0; j < repls.size(); j++) {
+      ASSERT_EQ(j + 1, repls[j]->id().index());
+    }
+    ASSERT_GT(reader->bytes_read_->value(), bytes_read);
+  }
+}
+
+// Test that reopening a log with --log_verify_segments_on_open verifies the
+// closed segments in parallel, repopulates the index, and detects corruption.
+TEST_P(LogTestOptionalCompression, TestVerifySegmentsOnOpen) {
+  FLAGS_log_verify_segments_on_open = true;
+  FLAGS_log_reader_open_threads = 4;
+  ASSERT_OK(BuildLog());
+
+  const int kNumSegments = 5;
+  const int kNumOpsPerSegment = 10;
+  OpId op_id = MakeOpId(1, 1);
+  ASSERT_OK(AppendMultiSegmentSequence(kNumSegments, kNumOpsPerSegment, &op_id, nullptr));
+  const int64_t last_index = op_id.index() - 1;
+  SegmentSequence segments;
+  ASSERT_OK(log_->reader()->GetSegmentsSnapshot(&segments));
+  const string sealed_path = segments[1]->path();
+  const int64_t sealed_entry_offset = segments[1]->first_entry_offset();
+  segments.clear();
+  ASSERT_OK(log_->Close());
+
+  // Throw away the index, so that reads only work if it was rebuilt.
+  string wal_dir = fs_manager_->GetTabletWalDir(kTestTablet);
+  vector<string> children;
+  ASSERT_OK(env_->GetChildren(wal_dir, &children));
+  for (const string& child : children) {
+    if (HasPrefixString(child, "index.")) {
+      ASSERT_OK(env_->DeleteFile(JoinPathSegments(wal_dir, child)));
+    }
+  }
+
+  ASSERT_OK(BuildLog());
+  {
+    vector<ReplicateMsg*> repls;
+    ElementDeleter d(&repls);
+    ASSERT_OK(log_->reader()->ReadReplicatesInRange(
+        1, last_index, LogReader::kNoSizeLimit, ReadContext(), &repls));
+    ASSERT_EQ(last_index, repls.size());
+  }
+  ASSERT_OK(log_->Close());
+
+  // Corrupt the first batch of one of the closed segments. Its header and
+  // footer are intact, so only verification notices.
+  ASSERT_OK(CorruptLogFile(env_, sealed_path, FLIP_BYTE, sealed_entry_offset + 20));
+  Status s = BuildLog();
+  ASSERT_TRUE(s.IsCorruption()) << s.ToString();
+}
+
+// Writes back and evicts the files in 'dir' from the page cache, so that the
+// next open of the log reads them from disk.
+static Status EvictFromPageCache(Env* env, const string& dir) {
+  vector<string> children;
+  RETURN_NOT_OK(env->GetChildren(dir, &children));
+  for (const string& child : children) {
+    if (child == "." || child == "..") {
+      continue;
+    }
+    const string path = JoinPathSegments(dir, child);
+    int fd;
+    RETRY_ON_EINTR(fd, open(path.c_str(), O_RDONLY));
+    if (fd < 0) {
+      return Status::IOError(path, ErrnoToString(errno), errno);
+    }
+    int err = fdatasync(fd) == 0 ? 0 : errno;
+#if !defined(__APPLE__)
+    if (err == 0) {
+      err = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+#endif
+    close(fd);
+    if (err != 0) {
+      return Status::IOError(path, ErrnoToString(err), err);
+    }
+  }
+  return Status::OK();
+}
+
+// Measures how long it takes to open a large log, verifying all of its
+// entries, with and without parallelism. Each open starts with the log evicted
+// from the page cache, and the runs alternate between thread counts, so that
+// no configuration benefits from the reads of the one before it.
+TEST_F(LogTest, BenchmarkOpenLargeLog) {
+  const int64_t wal_bytes = static_cast<int64_t>(AllowSlowTests() ?
+      FLAGS_open_benchmark_wal_mb : 16) * 1024 * 1024;
+  const int kPayloadSize = 64 * 1024;
+  const int kOpsPerBatch = 16;
+  FLAGS_log_verify_segments_on_open = true;
+  ASSERT_OK(BuildLog());
+
+  Random rng(SeedRandom());
+  string payload;
+  payload.resize(kPayloadSize);
+  RandomString(&payload[0], payload.size(), &rng);
+
+  OpId op_id = MakeOpId(1, 1);
+  LOG_TIMING(INFO, Substitute("writing $0 MB of WAL", wal_bytes / (1024 * 1024))) {
+    for (int64_t written = 0; written < wal_bytes; written += kPayloadSize * kOpsPerBatch) {
+      vector<ReplicateRefPtr> replicates;
+      for (int i = 0; i < kOpsPerBatch; i++) {
+        ReplicateRefPtr replicate = make_scoped_refptr_replicate(new ReplicateMsg());
+        replicate->get()->mutable_id()->CopyFrom(op_id);
+        replicate->get()->set_op_type(WRITE_OP);
+        replicate->get()->set_timestamp(clock_->Now().ToUint64());
+        replicate->get()->mutable_write_payload()->set_payload(payload);
+        op_id.set_index(op_id.index() + 1);
+        replicates.emplace_back(std::move(replicate));
+      }
+      Synchronizer sync;
+      ASSERT_OK(log_->AsyncAppendReplicates(replicates, sync.AsStatusCallback()));
+      ASSERT_OK(sync.Wait());
+    }
+  }
+  ASSERT_OK(log_->Close());
+
+  const string wal_dir = fs_manager_->GetTabletWalDir(kTestTablet);
+  for (int threads : { 1, 8, 8, 1 }) {
+    FLAGS_log_reader_open_threads = threads;
+    ASSERT_OK(EvictFromPageCache(env_, wal_dir));
+    LOG_TIMING(INFO, Substitute("opening the log with $0 thread(s)", threads)) {
+      ASSERT_OK(BuildLog());
+    }
+    ASSERT_OK(log_->Close());
+  }
+}
+
 // Test various situations where we expect different segments depending on what the
 // min log index is.
 TEST_F(LogTest, TestGetGCableDataSize) {
@@ -1206,5 +1712,78 @@ TEST_P(LogTestOptionalCompression, TestTotalSize) {
   }
 }
 
+class GroupCommitControllerTest : public KuduTest {
+ public:
+  void SetUp() override {
+    KuduTest::SetUp();
+    FLAGS_log_group_commit_target_latency_us = 2000;
+    FLAGS_log_group_commit_max_wait_us = 500;
+  }
+};
+
+// Without any measured arrivals, waiting can't pick up more batches.
+TEST_F(GroupCommitControllerTest, TestNoWaitWithoutArrivals) {
+  GroupCommitController controller;
+  ASSERT_EQ(0, controller.WaitTime().ToMicroseconds());
+  controller.RecordGroup(1, MonoTime::Now());
+  ASSERT_EQ(0, controller.WaitTime().ToMicroseconds());
+}
+
+// With a high arrival rate and fast commits, the wait is capped at
+// --log_group_commit_max_wait_us.
+TEST_F(GroupCommitControllerTest, TestWaitCappedAtMaxWait) {
+  GroupCommitController controller;
+  MonoTime now = MonoTime::Now();
+  controller.RecordGroup(1, now);
+  // 10 batches in 100us, i.e. an average rate of 0.2 * 0.1 = 0.02 batches/us
+  // after the first sample, so 10 batches are expected within 500us.
+  controller.RecordGroup(10, now + MonoDelta::FromMicroseconds(100));
+  ASSERT_EQ(500, controller.WaitTime().ToMicroseconds());
+
+  FLAGS_log_group_commit_max_wait_us = 200;
+  ASSERT_EQ(200, controller.WaitTime().ToMicroseconds());
+  FLAGS_log_group_commit_max_wait_us = 0;
+  ASSERT_EQ(0, controller.WaitTime().ToMicroseconds());
+}
+
+// The wait shrinks as the measured commit latency approaches the target, and
+// disappears once it reaches it.
+TEST_F(GroupCommitControllerTest, TestWaitBoundedByTargetLatency) {
+  GroupCommitController controller;
+  MonoTime now = MonoTime::Now();
+  controller.RecordGroup(1, now);
+  controller.RecordGroup(10, now + MonoDelta::FromMicroseconds(100));
+
+  // Converge the average commit latency to 1900us, leaving a 100us budget.
+  for (int i = 0; i < 100; i++) {
+    controller.RecordGroupCommitLatency(MonoDelta::FromMicroseconds(1900));
+  }
+  ASSERT_EQ(100, controller.WaitTime().ToMicroseconds());
+
+  for (int i = 0; i < 100; i++) {
+    controller.RecordGroupCommitLatency(MonoDelta::FromMicroseconds(2500));
+  }
+  ASSERT_EQ(0, controller.WaitTime().ToMicroseconds());
+}
+
+// A low arrival rate makes another batch unlikely within the budget, so the
+// controller doesn't wait.
+TEST_F(GroupCommitControllerTest, TestNoWaitAtLowArrivalRate) {
+  GroupCommitController controller;
+  MonoTime now = MonoTime::Now();
+  controller.RecordGroup(1, now);
+  // One batch per second.
+  controller.RecordGroup(1, now + MonoDelta::FromSeconds(1));
+  ASSERT_EQ(0, controller.WaitTime().ToMicroseconds());
+
+  // Once batches arrive quickly, the moving average catches up.
+  MonoTime t = now + MonoDelta::FromSeconds(1);
+  for (int i = 0; i < 20; i++) {
+    t += MonoDelta::FromMicroseconds(10);
+    controller.RecordGroup(1, t);
+  }
+  ASSERT_EQ(500, controller.WaitTime().ToMicroseconds());
+}
+
 } // namespace log
 } // namespace kudu
@@ -25,6 +25,9 @@
 
 #include <cerrno>
 #include <cstdint>
+#include <cstring>
+#include <deque>
+#include <limits>
 #include <memory>
 #include <mutex>
 #include <ostream>
@@ -33,6 +36,9 @@
 #include <boost/optional/optional.hpp>
 #include <boost/range/adaptor/reversed.hpp>
 #include <gflags/gflags.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
+#include <google/protobuf/wire_format_lite_inl.h>
 
 #include "kudu/common/wire_protocol.h"
 #include "kudu/consensus/opid.pb.h"
@@ -45,13 +51,17 @@
 #include "kudu/gutil/bind.h"
 #include "kudu/gutil/bind_helpers.h"
 #include "kudu/gutil/dynamic_annotations.h"
+#include "kudu/gutil/map-util.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/ref_counted.h"
+#include "kudu/gutil/strings/numbers.h"
 #include "kudu/gutil/strings/substitute.h"
+#include "kudu/gutil/strings/util.h"
 #include "kudu/gutil/walltime.h"
 #include "kudu/util/async_util.h"
 #include "kudu/util/compression/compression.pb.h"
 #include "kudu/util/compression/compression_codec.h"
+#include "kudu/util/condition_variable.h"
 #include "kudu/util/debug/trace_event.h"
 #include "kudu/util/env.h"
 #include "kudu/util/env_util.h"
@@ -61,6 +71,7 @@
 #include "kudu/util/logging.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
+#include "kudu/util/mutex.h"
 #include "kudu/util/path_util.h"
 #include "kudu/util/pb_util.h"
 #include "kudu/util/random.h"
@@ -85,6 +96,37 @@ TAG_FLAG(log_max_segments_to_retain, runtime);
 TAG_FLAG(log_max_segments_to_retain, advanced);
 TAG_FLAG(log_max_segments_to_retain, experimental);
 
+DEFINE_int32(log_max_recycled_segments, 0,
+             "Maximum number of garbage-collected WAL segment files to keep per tablet "
+             "for reuse by new segments, instead of deleting them and allocating new "
+             "files. Overwriting an existing file avoids the metadata and extent "
+             "conversion costs of allocating new segments. Recycled segments cannot be "
+             "read by versions which do not support them. 0 disables recycling.");
+TAG_FLAG(log_max_recycled_segments, experimental);
+
+DEFINE_bool(log_async_segment_deletion, true,
+            "Whether garbage-collected log segments are deleted by a background "
+            "thread, rather than by the thread running log GC.");
+TAG_FLAG(log_async_segment_deletion, advanced);
+TAG_FLAG(log_async_segment_deletion, runtime);
+
+DEFINE_int64(log_segment_delete_bytes_per_sec, 0,
+             "Maximum rate at which garbage-collected log segments are deleted "
+             "in the background, in bytes per second. 0 means unlimited.");
+TAG_FLAG(log_segment_delete_bytes_per_sec, advanced);
+TAG_FLAG(log_segment_delete_bytes_per_sec, runtime);
+DEFINE_validator(log_segment_delete_bytes_per_sec,
+                 [](const char* /*n*/, int64_t v) { return v >= 0; });
+
+DEFINE_int64(log_segment_delete_chunk_bytes, 32 * 1024 * 1024,
+             "Garbage-collected log segments larger than this are truncated down "
+             "this many bytes at a time before being deleted in the background. "
+             "0 disables truncation.");
+TAG_FLAG(log_segment_delete_chunk_bytes, advanced);
+TAG_FLAG(log_segment_delete_chunk_bytes, runtime);
+DEFINE_validator(log_segment_delete_chunk_bytes,
+                 [](const char* /*n*/, int64_t v) { return v >= 0; });
+
 
 // Group commit configuration.
 // -----------------------------
@@ -93,6 +135,44 @@ DEFINE_int32(group_commit_queue_size_bytes, 4 * 1024 * 1024,
 TAG_FLAG(group_commit_queue_size_bytes, advanced);
 
 
+DEFINE_bool(log_pipelined_group_commit, false,
+            "Whether the WAL should pipeline group commit, writing the next group "
+            "of entries to the active segment while the previous group is still "
+            "being fsynced. Callbacks are still invoked in append order.");
+TAG_FLAG(log_pipelined_group_commit, experimental);
+
+DEFINE_int32(log_group_commit_pipeline_depth, 2,
+             "When --log_pipelined_group_commit is enabled, the maximum number of "
+             "groups which may be written to the WAL but not yet synced. Groups "
+             "queued behind an in-progress fsync are coalesced into a single fsync.");
+DEFINE_validator(log_group_commit_pipeline_depth,
+                 [](const char* /*n*/, int32_t v) { return v >= 1; });
+TAG_FLAG(log_group_commit_pipeline_depth, experimental);
+
+DEFINE_bool(log_adaptive_group_commit, false,
+            "Whether the WAL append thread may wait briefly for more entry batches "
+            "before writing a group, in order to fsync fewer, larger groups. The wait "
+            "is sized from the measured group commit latency and batch arrival rate "
+            "so that groups still commit within --log_group_commit_target_latency_us.");
+TAG_FLAG(log_adaptive_group_commit, experimental);
+
+DEFINE_int32(log_group_commit_target_latency_us, 2000,
+             "When --log_adaptive_group_commit is enabled, the latency which a group "
+             "commit, including any time spent waiting for more batches, should stay "
+             "within.");
+DEFINE_validator(log_group_commit_target_latency_us,
+                 [](const char* /*n*/, int32_t v) { return v > 0; });
+TAG_FLAG(log_group_commit_target_latency_us, runtime);
+TAG_FLAG(log_group_commit_target_latency_us, experimental);
+
+DEFINE_int32(log_group_commit_max_wait_us, 500,
+             "When --log_adaptive_group_commit is enabled, the maximum number of "
+             "microseconds to wait for more batches before writing a group.");
+DEFINE_validator(log_group_commit_max_wait_us,
+                 [](const char* /*n*/, int32_t v) { return v >= 0; });
+TAG_FLAG(log_group_commit_max_wait_us, runtime);
+TAG_FLAG(log_group_commit_max_wait_us, experimental);
+
 DEFINE_int32(log_thread_idle_threshold_ms, 1000,
              "Number of milliseconds after which the log append thread decides that a "
              "log is idle, and considers shutting down. Used by tests.");
@@ -105,6 +185,13 @@ DEFINE_string(log_compression_codec, "LZ4",
               "Codec to use for compressing WAL segments.");
 TAG_FLAG(log_compression_codec, experimental);
 
+DEFINE_int32(log_zero_copy_min_payload_bytes, 16 * 1024,
+             "Write payloads of at least this many bytes are written to the WAL "
+             "straight from the replicated message, instead of being copied into "
+             "the serialized entry batch first.");
+TAG_FLAG(log_zero_copy_min_payload_bytes, advanced);
+TAG_FLAG(log_zero_copy_min_payload_bytes, runtime);
+
 // Fault/latency injection flags.
 // -----------------------------
 DEFINE_bool(log_inject_latency, false,
@@ -185,7 +272,11 @@ namespace log {
 
 using consensus::CommitMsg;
 using consensus::OpId;
+using consensus::ReplicateMsg;
 using consensus::ReplicateRefPtr;
+using consensus::WritePayloadPB;
+using google::protobuf::io::CodedOutputStream;
+using google::protobuf::internal::WireFormatLite;
 using env_util::OpenFileForRandom;
 using std::shared_ptr;
 using std::string;
@@ -215,6 +306,19 @@ using strings::Substitute;
 //    ensure that it doesn't miss a concurrent wake-up. This is done in GoIdle().
 //
 // See the implementation comments in Wake() and GoIdle() for details.
+//
+// When --log_pipelined_group_commit is enabled, the append task only writes
+// each group to the active segment and then hands it off to a second
+// single-threaded pool which syncs the segment and runs the callbacks. This
+// lets the append task write group N+1 while group N is being fsynced. At most
+// --log_group_commit_pipeline_depth groups may be written but not yet synced,
+// and the sync task covers every group queued behind it with a single fsync.
+// Since both stages are serial and FIFO, callbacks are still invoked in the
+// order the batches were appended.
+//
+// When --log_adaptive_group_commit is enabled, the append task may hold a
+// freshly drained group open for a few more microseconds to pick up batches
+// arriving behind it. See GroupCommitController for how long it waits.
 class Log::AppendThread {
  public:
   explicit AppendThread(Log* log);
@@ -237,11 +341,47 @@ class Log::AppendThread {
     return base::subtle::NoBarrier_Load(&worker_state_) == WORKER_ACTIVE;
   }
 
+  // Blocks until every group handed off to the sync stage has been synced
+  // and had its callbacks run. No-op unless group commit is pipelined.
+  //
+  // Must be called before the active segment is closed or swapped out.
+  void WaitForPendingSyncs();
+
  private:
+  // A group of batches which has been written to the active segment and is
+  // waiting to be synced by the sync stage of a pipelined group commit.
+  struct PendingSyncGroup {
+    vector<LogEntryBatch*> entry_batches;
+
+    // The result of appending each batch in 'entry_batches'. Failed batches
+    // are kept in the group so their callbacks still run in order.
+    vector<Status> append_statuses;
+
+    // Whether the group only contains COMMIT batches, which need no fsync.
+    bool is_all_commits;
+
+    // When the group was drained from the queue, for 'group_commit_latency'.
+    MonoTime start_time;
+
+    // The file of the segment the group was last appended to, taken on the
+    // append thread so that the sync stage never reads 'active_segment_'.
+    shared_ptr<WritableFile> segment_file;
+  };
+
   // The task submitted to the threadpool which collects batches from the queue
   // and appends them, until it determines that the queue is idle.
   void DoWork();
 
+  // Waits for more batches to join 'entry_batches' for as long as the
+  // controller decides, or until the group is large enough.
+  void MaybeWaitForMoreBatches(vector<LogEntryBatch*>* entry_batches);
+
+  // Records a group commit latency sample to the metrics and the controller.
+  void RecordGroupCommitLatency(MonoDelta latency);
+
+  // Returns the total size of the batches in a group.
+  static size_t TotalSizeBytes(const vector<LogEntryBatch*>& entry_batches);
+
   // Tries to transition back to WORKER_STOPPED state. If successful, returns true.
   //
   // Otherwise, returns false to indicate that the task should keep running because
@@ -252,10 +392,52 @@ class Log::AppendThread {
   // LogEntryBatch* pointers.
   void HandleGroup(vector<LogEntryBatch*> entry_batches);
 
+  // Like HandleGroup(), but only writes the group and then queues it for the
+  // sync stage, blocking if the pipeline is already full.
+  void HandleGroupPipelined(vector<LogEntryBatch*> entry_batches);
+
+  // The task submitted to sync_pool_ which syncs the log on behalf of every
+  // queued group, then runs their callbacks, until the sync queue is empty.
+  void DoSyncWork();
+
+  // Runs the callback of each batch in 'group' and deletes the batches.
+  // Batches whose append failed get their append status, the rest get
+  // 'sync_status'.
+  void FinishGroup(PendingSyncGroup* group, const Status& sync_status);
+
   string LogPrefix() const;
 
   Log* const log_;
 
+  // Whether group commit is pipelined. Fixed at construction, so that a
+  // runtime flag change cannot affect a running log.
+  const bool pipelined_;
+
+  // The maximum number of groups which may be queued for, or in, the sync stage.
+  const int max_groups_in_flight_;
+
+  // Whether group commit is adaptive. Fixed at construction like 'pipelined_'.
+  const bool adaptive_;
+
+  GroupCommitController controller_;
+
+  // Protects the sync stage state below.
+  Mutex sync_lock_;
+  ConditionVariable sync_cond_;
+
+  // Groups written by the append task and waiting for the sync task.
+  std::deque<PendingSyncGroup> sync_queue_;
+
+  // Number of groups handed to the sync stage which have not yet been finished.
+  int groups_in_flight_ = 0;
+
+  // Whether a DoSyncWork() task is queued or running on sync_pool_.
+  bool sync_task_active_ = false;
+
+  // Pool with a single thread which runs the sync stage of pipelined group
+  // commit. Null unless 'pipelined_' is true.
+  gscoped_ptr<ThreadPool> sync_pool_;
+
   // Atomic state machine for whether there is any worker task currently
   // queued or running on append_pool_. See Wake() and GoIdle() for more details.
   enum WorkerState {
@@ -273,7 +455,13 @@ class Log::AppendThread {
 
 
 Log::AppendThread::AppendThread(Log *log)
-  : log_(log) {
+  : log_(log),
+    // The io_uring writable file is not thread-safe, so it can't be synced
+    // concurrently with the next group's append.
+    pipelined_(FLAGS_log_pipelined_group_commit && !log->options_.use_io_uring),
+    max_groups_in_flight_(FLAGS_log_group_commit_pipeline_depth),
+    adaptive_(FLAGS_log_adaptive_group_commit),
+    sync_cond_(&sync_lock_) {
 }
 
 Status Log::AppendThread::Init() {
@@ -288,6 +476,22 @@ Status Log::AppendThread::Init() {
                 // handles waiting for work while idle.
                 .set_idle_timeout(MonoDelta::FromSeconds(0))
                 .Build(&append_pool_));
+  if (FLAGS_log_pipelined_group_commit && !pipelined_) {
+    LOG_WITH_PREFIX(WARNING) << "Pipelined group commit is not supported together with "
+                             << "io_uring WAL segments, and has been disabled";
+  }
+  if (pipelined_) {
+    VLOG_WITH_PREFIX(1) << "Starting log sync thread for pipelined group commit";
+    RETURN_NOT_OK(ThreadPoolBuilder("wal-sync")
+                  .set_min_threads(0)
+                  .set_max_threads(1)
+                  // Unlike the append pool, the sync task exits as soon as its
+                  // queue is empty, so keep the thread around while the log is
+                  // busy to avoid re-spawning it for every group.
+                  .set_idle_timeout(MonoDelta::FromMilliseconds(
+                      FLAGS_log_thread_idle_threshold_ms))
+                  .Build(&sync_pool_));
+  }
   return Status::OK();
 }
 
@@ -355,7 +559,14 @@ void Log::AppendThread::DoWork() {
       if (GoIdle()) break;
       continue;
     }
-    HandleGroup(std::move(entry_batches));
+    if (adaptive_) {
+      MaybeWaitForMoreBatches(&entry_batches);
+    }
+    if (pipelined_) {
+      HandleGroupPipelined(std::move(entry_batches));
+    } else {
+      HandleGroup(std::move(entry_batches));
+    }
   }
   VLOG_WITH_PREFIX(2) << "WAL Appender going idle";
 }
@@ -364,10 +575,14 @@ void Log::AppendThread::HandleGroup(vector<LogEntryBatch*> entry_batches) {
   CHECK(!FLAGS_raft_derived_log_mode);
   if (log_->metrics_) {
     log_->metrics_->entry_batches_per_group->Increment(entry_batches.size());
+    log_->metrics_->bytes_per_group->Increment(TotalSizeBytes(entry_batches));
   }
   TRACE_EVENT1("log", "batch", "batch_size", entry_batches.size());
 
-  SCOPED_LATENCY_METRIC(log_->metrics_, group_commit_latency);
+  MonoTime start_time = MonoTime::Now();
+  auto record_latency = MakeScopedCleanup([&]() {
+    RecordGroupCommitLatency(MonoTime::Now() - start_time);
+  });
 
   bool is_all_commits = true;
   for (LogEntryBatch* entry_batch : entry_batches) {
@@ -392,6 +607,8 @@ void Log::AppendThread::HandleGroup(vector<LogEntryBatch*> entry_batches) {
   Status s;
   if (!is_all_commits) {
     s = log_->Sync();
+  } else {
+    s = log_->MakeAppendsVisible();
   }
   if (PREDICT_FALSE(!s.ok())) {
     LOG_WITH_PREFIX(ERROR) << "Error syncing log: " << s.ToString();
@@ -417,12 +634,210 @@ void Log::AppendThread::HandleGroup(vector<LogEntryBatch*> entry_batches) {
   }
 }
 
+void Log::AppendThread::HandleGroupPipelined(vector<LogEntryBatch*> entry_batches) {
+  CHECK(!FLAGS_raft_derived_log_mode);
+  if (log_->metrics_) {
+    log_->metrics_->entry_batches_per_group->Increment(entry_batches.size());
+    log_->metrics_->bytes_per_group->Increment(TotalSizeBytes(entry_batches));
+  }
+  TRACE_EVENT1("log", "batch", "batch_size", entry_batches.size());
+
+  PendingSyncGroup group;
+  group.start_time = MonoTime::Now();
+  group.is_all_commits = true;
+  group.append_statuses.reserve(entry_batches.size());
+  for (LogEntryBatch* entry_batch : entry_batches) {
+    TRACE_EVENT_FLOW_END0("log", "Batch", entry_batch);
+    Status s = log_->DoAppend(entry_batch);
+    if (PREDICT_FALSE(!s.ok())) {
+      LOG_WITH_PREFIX(ERROR) << "Error appending to the log: " << s.ToString();
+    }
+    group.append_statuses.emplace_back(std::move(s));
+    if (group.is_all_commits && entry_batch->type_ != COMMIT) {
+      group.is_all_commits = false;
+    }
+  }
+  group.entry_batches = std::move(entry_batches);
+  group.segment_file = log_->active_segment_->writable_file();
+
+  MutexLock l(sync_lock_);
+  while (groups_in_flight_ >= max_groups_in_flight_) {
+    sync_cond_.Wait();
+  }
+  groups_in_flight_++;
+  sync_queue_.emplace_back(std::move(group));
+  if (!sync_task_active_) {
+    sync_task_active_ = true;
+    CHECK_OK(sync_pool_->SubmitClosure(Bind(&Log::AppendThread::DoSyncWork,
+                                            Unretained(this))));
+  }
+}
+
+void Log::AppendThread::DoSyncWork() {
+  while (true) {
+    std::deque<PendingSyncGroup> groups;
+    {
+      MutexLock l(sync_lock_);
+      if (sync_queue_.empty()) {
+        sync_task_active_ = false;
+        sync_cond_.Broadcast();
+        return;
+      }
+      groups.swap(sync_queue_);
+    }
+
+    bool is_all_commits = true;
+    for (const PendingSyncGroup& group : groups) {
+      is_all_commits &= group.is_all_commits;
+    }
+    // A single fsync covers every group written before it was issued. The
+    // groups are all in the last group's segment: rolling over waits for the
+    // sync stage, and syncs the segment it closes itself.
+    Status s;
+    if (!is_all_commits) {
+      s = log_->SyncFile(groups.back().segment_file.get());
+    }
+    if (PREDICT_FALSE(!s.ok())) {
+      LOG_WITH_PREFIX(ERROR) << "Error syncing log: " << s.ToString();
+    }
+
+    {
+      TRACE_EVENT0("log", "Callbacks");
+      SCOPED_WATCH_STACK(0);
+      for (PendingSyncGroup& group : groups) {
+        VLOG_WITH_PREFIX(2) << "Synchronized " << group.entry_batches.size()
+                            << " entry batches";
+        FinishGroup(&group, s);
+        RecordGroupCommitLatency(MonoTime::Now() - group.start_time);
+      }
+    }
+
+    MutexLock l(sync_lock_);
+    groups_in_flight_ -= groups.size();
+    sync_cond_.Broadcast();
+  }
+}
+
+void Log::AppendThread::FinishGroup(PendingSyncGroup* group, const Status& sync_status) {
+  DCHECK_EQ(group->entry_batches.size(), group->append_statuses.size());
+  for (size_t i = 0; i < group->entry_batches.size(); i++) {
+    LogEntryBatch* entry_batch = group->entry_batches[i];
+    const Status& append_status = group->append_statuses[i];
+    if (PREDICT_TRUE(!entry_batch->callback().is_null())) {
+      entry_batch->callback().Run(append_status.ok() ? sync_status : append_status);
+    }
+    // As in HandleGroup(), delete each batch as we see it so that memory is
+    // released before the callbacks of later batches run.
+    delete entry_batch;
+  }
+  group->entry_batches.clear();
+}
+
+void Log::AppendThread::WaitForPendingSyncs() {
+  if (!pipelined_) {
+    return;
+  }
+  MutexLock l(sync_lock_);
+  while (groups_in_flight_ > 0) {
+    sync_cond_.Wait();
+  }
+}
+
 void Log::AppendThread::Shutdown() {
   log_->entry_queue()->Shutdown();
   if (append_pool_) {
     append_pool_->Wait();
     append_pool_->Shutdown();
   }
+  if (sync_pool_) {
+    WaitForPendingSyncs();
+    sync_pool_->Wait();
+    sync_pool_->Shutdown();
+  }
+}
+
+GroupCommitController::GroupCommitController()
+    : avg_commit_latency_us_(0),
+      avg_arrival_rate_(0) {
+}
+
+MonoDelta GroupCommitController::WaitTime() const {
+  std::lock_guard<simple_spinlock> l(lock_);
+  double budget_us = std::min<double>(
+      FLAGS_log_group_commit_max_wait_us,
+      FLAGS_log_group_commit_target_latency_us - avg_commit_latency_us_);
+  if (budget_us < 1 || avg_arrival_rate_ * budget_us < 1) {
+    return MonoDelta::FromMicroseconds(0);
+  }
+  return MonoDelta::FromMicroseconds(static_cast<int64_t>(budget_us));
+}
+
+void GroupCommitController::RecordGroup(int num_batches, MonoTime now) {
+  std::lock_guard<simple_spinlock> l(lock_);
+  if (last_group_time_.Initialized()) {
+    int64_t elapsed_us = std::max<int64_t>(1, (now - last_group_time_).ToMicroseconds());
+    double rate = static_cast<double>(num_batches) / elapsed_us;
+    avg_arrival_rate_ = kAlpha * rate + (1 - kAlpha) * avg_arrival_rate_;
+  }
+  last_group_time_ = now;
+}
+
+void GroupCommitController::RecordGroupCommitLatency(MonoDelta latency) {
+  std::lock_guard<simple_spinlock> l(lock_);
+  avg_commit_latency_us_ = kAlpha * latency.ToMicroseconds() +
+      (1 - kAlpha) * avg_commit_latency_us_;
+}
+
+void Log::AppendThread::MaybeWaitForMoreBatches(vector<LogEntryBatch*>* entry_batches) {
+  MonoTime start = MonoTime::Now();
+  MonoDelta wait_time = controller_.WaitTime();
+  if (log_->metrics_) {
+    log_->metrics_->group_commit_window->Increment(wait_time.ToMicroseconds());
+  }
+
+  if (wait_time.ToMicroseconds() > 0) {
+    TRACE_EVENT1("log", "WaitForMoreBatches", "wait_us", wait_time.ToMicroseconds());
+    // Don't hold back a group which already takes up a large part of the
+    // queue, since appenders may be about to block on it.
+    const size_t max_group_bytes = log_->entry_queue()->max_size() / 2;
+    size_t group_bytes = TotalSizeBytes(*entry_batches);
+    MonoTime deadline = start + wait_time;
+    while (group_bytes < max_group_bytes) {
+      vector<LogEntryBatch*> more_batches;
+      // Stop on TimedOut, or on Aborted at shutdown: the group collected so
+      // far is still written, and DoWork() notices the shutdown next time.
+      if (!log_->entry_queue()->BlockingDrainTo(&more_batches, deadline).ok()) {
+        break;
+      }
+      for (LogEntryBatch* entry_batch : more_batches) {
+        group_bytes += entry_batch->total_size_bytes();
+        entry_batches->push_back(entry_batch);
+      }
+    }
+  }
+
+  MonoTime now = MonoTime::Now();
+  controller_.RecordGroup(entry_batches->size(), now);
+  if (log_->metrics_) {
+    log_->metrics_->group_commit_wait_time->Increment((now - start).ToMicroseconds());
+  }
+}
+
+size_t Log::AppendThread::TotalSizeBytes(const vector<LogEntryBatch*>& entry_batches) {
+  size_t total = 0;
+  for (const LogEntryBatch* entry_batch : entry_batches) {
+    total += entry_batch->total_size_bytes();
+  }
+  return total;
+}
+
+void Log::AppendThread::RecordGroupCommitLatency(MonoDelta latency) {
+  if (log_->metrics_) {
+    log_->metrics_->group_commit_latency->Increment(latency.ToMicroseconds());
+  }
+  if (adaptive_) {
+    controller_.RecordGroupCommitLatency(latency);
+  }
 }
 
 string Log::AppendThread::LogPrefix() const {
@@ -497,6 +912,7 @@ Log::Log(LogOptions options, FsManager* fs_manager, string log_path,
 #endif
       active_segment_sequence_number_(0),
       log_state_(kLogInitialized),
+      next_segment_recycled_(false),
       max_segment_size_(options_.segment_size_mb * 1024 * 1024),
       entry_batch_queue_(FLAGS_group_commit_queue_size_bytes),
       append_thread_(new AppendThread(this)),
@@ -504,9 +920,14 @@ Log::Log(LogOptions options, FsManager* fs_manager, string log_path,
       sync_disabled_(false),
       allocation_state_(kAllocationNotStarted),
       codec_(nullptr),
+      last_persisted_dictionary_id_(0),
       metric_entity_(std::move(metric_entity)),
+      pending_deletes_(0),
+      delete_throttle_cond_(&delete_throttle_lock_),
+      drain_pending_deletes_(false),
       on_disk_size_(0) {
   CHECK_OK(ThreadPoolBuilder("log-alloc").set_max_threads(1).Build(&allocation_pool_));
+  CHECK_OK(ThreadPoolBuilder("log-delete").set_max_threads(1).Build(&delete_pool_));
   if (metric_entity_) {
     metrics_.reset(new LogMetrics(metric_entity_));
   }
@@ -557,6 +978,7 @@ Status Log::Init() {
     RETURN_NOT_OK(reader_->GetSegmentsSnapshot(&segments));
     active_segment_sequence_number_ = segments.back()->header().sequence_number();
   }
+  RETURN_NOT_OK(InitCompressionDictionaryUsage());
 
   if (force_sync_all_) {
     KLOG_FIRST_N(INFO, 1) << LogPrefix() << "Log is configured to fsync() on all Append() calls";
@@ -610,6 +1032,9 @@ Status Log::RollOver() {
 
   DCHECK_EQ(allocation_state(), kAllocationFinished);
 
+  // With pipelined group commit, the sync stage may still be syncing the
+  // segment we are about to close.
+  append_thread_->WaitForPendingSyncs();
   RETURN_NOT_OK(Sync());
   RETURN_NOT_OK(CloseCurrentSegment());
 
@@ -651,11 +1076,10 @@ Status Log::AsyncAppend(unique_ptr<LogEntryBatch> entry_batch, const StatusCallb
 Status Log::AsyncAppendReplicates(const vector<ReplicateRefPtr>& replicates,
                                   const StatusCallback& callback) {
   CHECK(!FLAGS_raft_derived_log_mode);
-  unique_ptr<LogEntryBatchPB> batch_pb = CreateBatchFromAllocatedOperations(replicates);
-
-  unique_ptr<LogEntryBatch> batch;
-  RETURN_NOT_OK(CreateBatchFromPB(REPLICATE, std::move(batch_pb), &batch));
-  batch->SetReplicates(replicates);
+  unique_ptr<LogEntryBatch> batch(new LogEntryBatch(
+      REPLICATE, CreateBatchFromAllocatedOperations(replicates), replicates.size(), replicates));
+  batch->Serialize();
+  TRACE("Serialized $0 byte log entry", batch->total_size_bytes());
   return AsyncAppend(std::move(batch), callback);
 }
 
@@ -683,7 +1107,7 @@ Status Log::DoAppend(LogEntryBatch* entry_batch) {
   MAYBE_RETURN_FAILURE(FLAGS_log_inject_io_error_on_append_fraction,
                        Status::IOError("Injected IOError in Log::DoAppend()"));
 
-  Slice entry_batch_data = entry_batch->data();
+  const vector<Slice>& entry_batch_data = entry_batch->data();
   uint32_t entry_batch_bytes = entry_batch->total_size_bytes();
   // If there is no data to write return OK.
   if (PREDICT_FALSE(entry_batch_bytes == 0)) {
@@ -717,8 +1141,12 @@ Status Log::DoAppend(LogEntryBatch* entry_batch) {
 
     RETURN_NOT_OK(active_segment_->WriteEntryBatch(entry_batch_data, codec_));
 
-    // Update the reader on how far it can read the active segment.
-    reader_->UpdateLastSegmentOffset(active_segment_->written_offset());
+    // Update the reader on how far it can read the active segment. With
+    // io_uring the entry is only buffered at this point, so the reader is
+    // updated in MakeAppendsVisible() instead.
+    if (!options_.use_io_uring) {
+      reader_->UpdateLastSegmentOffset(active_segment_->written_offset());
+    }
 
     if (log_hooks_) {
       RETURN_NOT_OK_PREPEND(log_hooks_->PostAppend(), "PostAppend hook failed");
@@ -747,6 +1175,12 @@ Status Log::UpdateIndexForBatch(const LogEntryBatch& batch,
     index_entry.op_id = entry_pb.replicate().id();
     index_entry.segment_sequence_number = active_segment_sequence_number_;
     index_entry.offset_in_segment = start_offset;
+    // With io_uring the entry is only buffered, so it's indexed once readers
+    // can see it.
+    if (options_.use_io_uring) {
+      pending_index_entries_.push_back(std::move(index_entry));
+      continue;
+    }
     RETURN_NOT_OK(log_index_->AddEntry(index_entry));
   }
   return Status::OK();
@@ -763,9 +1197,19 @@ void Log::UpdateFooterForBatch(LogEntryBatch* batch) {
   // immediately.
   if (batch->type_ == REPLICATE) {
     // Update the index bounds for the current segment.
+    const int num_dictionaries = footer_builder_.compression_dictionary_ids_size();
     for (const LogEntryPB& entry_pb : batch->entry_batch_pb_->entry()) {
       UpdateFooterForReplicateEntry(entry_pb, &footer_builder_);
     }
+    // Only the first entry compressed with a dictionary in each segment needs
+    // to be recorded for dictionary GC.
+    if (footer_builder_.compression_dictionary_ids_size() > num_dictionaries) {
+      std::lock_guard<simple_spinlock> l(dictionaries_lock_);
+      for (int i = num_dictionaries; i < footer_builder_.compression_dictionary_ids_size(); i++) {
+        dictionary_last_segment_[footer_builder_.compression_dictionary_ids(i)] =
+            active_segment_sequence_number_;
+      }
+    }
   }
 }
 
@@ -781,6 +1225,27 @@ FsManager* Log::GetFsManager() {
 
 Status Log::Sync() {
   CHECK(!FLAGS_raft_derived_log_mode);
+  RETURN_NOT_OK(SyncFile(active_segment_->writable_file().get()));
+  return MakeAppendsVisible();
+}
+
+Status Log::MakeAppendsVisible() {
+  if (options_.use_io_uring) {
+    // Unless they were just fsynced, the buffered appends still need to be
+    // written out before readers may see them.
+    if (!force_sync_all_ || sync_disabled_) {
+      RETURN_NOT_OK(active_segment_->Flush());
+    }
+    reader_->UpdateLastSegmentOffset(active_segment_->written_offset());
+    for (const LogIndexEntry& index_entry : pending_index_entries_) {
+      RETURN_NOT_OK(log_index_->AddEntry(index_entry));
+    }
+    pending_index_entries_.clear();
+  }
+  return Status::OK();
+}
+
+Status Log::SyncFile(WritableFile* file) {
   TRACE_EVENT0("log", "Sync");
   SCOPED_LATENCY_METRIC(metrics_, sync_latency);
 
@@ -796,7 +1261,7 @@ Status Log::Sync() {
 
   if (force_sync_all_ && !sync_disabled_) {
     LOG_SLOW_EXECUTION(WARNING, 50, Substitute("$0Fsync log took a long time", LogPrefix())) {
-      RETURN_NOT_OK(active_segment_->Sync());
+      RETURN_NOT_OK(file->Sync());
 
       if (log_hooks_) {
         RETURN_NOT_OK_PREPEND(log_hooks_->PostSyncIfFsyncEnabled(),
@@ -920,8 +1385,30 @@ Status Log::GC(RetentionIndexes retention_indexes, int32_t* num_gced) {
                              segment->footer().min_replicate_index(),
                              segment->footer().max_replicate_index());
       }
-      LOG_WITH_PREFIX(INFO) << "Deleting log segment in path: " << segment->path() << ops_str;
-      RETURN_NOT_OK(fs_manager_->env()->DeleteFile(segment->path()));
+      // A segment still referenced by an in-flight reader (which may have it
+      // mapped) is deleted rather than recycled or truncated, so that the
+      // reader never sees the file being overwritten underneath it.
+      bool recycled = false;
+      // Failing to recycle a segment only costs an allocation later, so the
+      // segment is deleted instead.
+      if (segment->HasOneRef()) {
+        WARN_NOT_OK(RecycleSegmentFile(segment->path(), segment->header().sequence_number(),
+                                       &recycled),
+                    Substitute("$0Deleting log segment instead", LogPrefix()));
+      }
+      if (recycled) {
+        LOG_WITH_PREFIX(INFO) << "Recycling log segment in path: " << segment->path() << ops_str;
+      } else if (FLAGS_log_async_segment_deletion) {
+        LOG_WITH_PREFIX(INFO) << "Scheduling deletion of log segment in path: "
+                              << segment->path() << ops_str;
+        AsyncDeleteSegmentFile(segment->path(), segment->file_size(), segment->HasOneRef());
+      } else {
+        LOG_WITH_PREFIX(INFO) << "Deleting log segment in path: " << segment->path() << ops_str;
+        // The segment is already trimmed from the reader, so carry on with the
+        // rest of GC, as the asynchronous deletion does.
+        WARN_NOT_OK(fs_manager_->env()->DeleteFile(segment->path()),
+                    Substitute("$0Unable to delete log segment $1", LogPrefix(), segment->path()));
+      }
       (*num_gced)++;
     }
 
@@ -931,6 +1418,18 @@ Status Log::GC(RetentionIndexes retention_indexes, int32_t* num_gced) {
     if (min_remaining_op_idx > 0) {
       log_index_->GC(min_remaining_op_idx);
     }
+
+    // Delete the dictionaries only the GCed segments were compressed with,
+    // after the segments themselves, so that a segment left behind by a
+    // crash can still be read.
+    const uint64_t min_segment_sequence_number =
+        segments_to_delete.back()->header().sequence_number() + 1;
+    if (!FLAGS_log_async_segment_deletion ||
+        !delete_pool_->SubmitFunc([this, min_segment_sequence_number]() {
+            DeleteUnusedCompressionDictionaries(min_segment_sequence_number);
+          }).ok()) {
+      DeleteUnusedCompressionDictionaries(min_segment_sequence_number);
+    }
   }
   return Status::OK();
 }
@@ -1022,6 +1521,16 @@ Status Log::Close() {
   CHECK(!FLAGS_raft_derived_log_mode);
   allocation_pool_->Shutdown();
   append_thread_->Shutdown();
+  {
+    MutexLock l(delete_throttle_lock_);
+    drain_pending_deletes_ = true;
+    delete_throttle_cond_.Broadcast();
+  }
+  delete_pool_->Wait();
+  {
+    MutexLock l(delete_throttle_lock_);
+    drain_pending_deletes_ = false;
+  }
 
   std::lock_guard<percpu_rwlock> l(state_lock_);
   switch (log_state_) {
@@ -1039,6 +1548,7 @@ Status Log::Close() {
       // Release FDs held by these objects.
       log_index_.reset();
       reader_.reset();
+      DeleteRecycledSegments();
 
       if (log_hooks_) {
         RETURN_NOT_OK_PREPEND(log_hooks_->PostClose(),
@@ -1118,25 +1628,205 @@ Status Log::PreAllocateNewSegment() {
 
   WritableFileOptions opts;
   opts.sync_on_close = force_sync_all_;
-  RETURN_NOT_OK(CreatePlaceholderSegment(opts, &next_segment_path_, &next_segment_file_));
+  opts.use_io_uring = options_.use_io_uring;
+  opts.direct_io = options_.io_uring_direct_io;
+  uint64_t recycled_size = 0;
+  RETURN_NOT_OK(OpenRecycledSegment(opts, &recycled_size));
+  if (!next_segment_recycled_) {
+    RETURN_NOT_OK(CreatePlaceholderSegment(opts, &next_segment_path_, &next_segment_file_));
+  }
 
   MAYBE_RETURN_FAILURE(FLAGS_log_inject_io_error_on_preallocate_fraction,
                        Status::IOError("Injected IOError in Log::PreAllocateNewSegment()"));
 
-  if (options_.preallocate_segments) {
-    TRACE("Preallocating $0 byte segment in $1", max_segment_size_, next_segment_path_);
+  // A recycled file already has blocks allocated for its previous contents,
+  // so only the remainder needs to be preallocated.
+  if (options_.preallocate_segments && recycled_size < max_segment_size_) {
+    uint64_t bytes_to_allocate = max_segment_size_ - recycled_size;
+    TRACE("Preallocating $0 bytes for segment in $1", bytes_to_allocate, next_segment_path_);
     RETURN_NOT_OK(env_util::VerifySufficientDiskSpace(fs_manager_->env(),
                                                       next_segment_path_,
-                                                      max_segment_size_,
+                                                      bytes_to_allocate,
                                                       FLAGS_fs_wal_dir_reserved_bytes));
     // TODO (perf) zero the new segments -- this could result in
     // additional performance improvements.
-    RETURN_NOT_OK(next_segment_file_->PreAllocate(max_segment_size_));
+    RETURN_NOT_OK(next_segment_file_->PreAllocate(bytes_to_allocate));
   }
 
   return Status::OK();
 }
 
+Status Log::OpenRecycledSegment(const WritableFileOptions& opts, uint64_t* recycled_size) {
+  CHECK(!FLAGS_raft_derived_log_mode);
+  next_segment_recycled_ = false;
+  *recycled_size = 0;
+  string path;
+  {
+    std::lock_guard<simple_spinlock> l(recycle_lock_);
+    if (recycled_segment_paths_.empty()) {
+      return Status::OK();
+    }
+    path = std::move(recycled_segment_paths_.front());
+    recycled_segment_paths_.pop_front();
+  }
+
+  Env* env = fs_manager_->env();
+  WritableFileOptions recycle_opts = opts;
+  recycle_opts.mode = Env::OPEN_EXISTING;
+  recycle_opts.overwrite_existing = true;
+  unique_ptr<WritableFile> file;
+  Status s = env->GetFileSize(path, recycled_size);
+  if (s.ok()) {
+    s = env->NewWritableFile(recycle_opts, path, &file);
+  }
+  if (!s.ok()) {
+    // Fall back to allocating a new file.
+    LOG_WITH_PREFIX(WARNING) << "Could not reuse recycled log segment " << path << ": "
+                             << s.ToString();
+    WARN_NOT_OK(env->DeleteFile(path), "Could not delete recycled log segment");
+    *recycled_size = 0;
+    return Status::OK();
+  }
+  VLOG_WITH_PREFIX(1) << "Reusing recycled log segment " << path << " for next WAL segment";
+  next_segment_path_ = std::move(path);
+  next_segment_file_.reset(file.release());
+  next_segment_recycled_ = true;
+  if (metrics_) {
+    metrics_->segments_recycled->Increment();
+  }
+  return Status::OK();
+}
+
+Status Log::RecycleSegmentFile(const string& path, uint64_t sequence_number, bool* recycled) {
+  CHECK(!FLAGS_raft_derived_log_mode);
+  *recycled = false;
+  {
+    std::lock_guard<simple_spinlock> l(recycle_lock_);
+    if (static_cast<int>(recycled_segment_paths_.size()) >= FLAGS_log_max_recycled_segments) {
+      return Status::OK();
+    }
+  }
+
+  Env* env = fs_manager_->env();
+  string recycled_path = JoinPathSegments(
+      log_dir_, Substitute("$0.recycled.$1", kTmpInfix, sequence_number));
+  RETURN_NOT_OK(env->RenameFile(path, recycled_path));
+
+  // Wipe the segment header magic, so that if we crash after a new segment
+  // takes over the file but before its header is written, the file is
+  // treated as an uninitialized segment rather than as a stale one.
+  Status s;
+  {
+    RWFileOptions opts;
+    opts.mode = Env::OPEN_EXISTING;
+    unique_ptr<RWFile> file;
+    s = env->NewRWFile(opts, recycled_path, &file);
+    if (s.ok()) {
+      uint8_t zeros[kLogSegmentHeaderMagicAndHeaderLength] = {};
+      s = file->Write(0, Slice(zeros, sizeof(zeros)));
+    }
+    if (s.ok() && force_sync_all_) {
+      s = file->Sync();
+    }
+    if (s.ok()) {
+      s = file->Close();
+    }
+  }
+  if (!s.ok()) {
+    // Put the file back, so that the caller can delete it as usual.
+    Status restore = env->RenameFile(recycled_path, path);
+    if (!restore.ok()) {
+      WARN_NOT_OK(restore, "Could not restore log segment after failing to recycle it");
+      WARN_NOT_OK(env->DeleteFile(recycled_path), "Could not delete recycled log segment");
+    }
+    return s.CloneAndPrepend(Substitute("Could not recycle log segment $0", path));
+  }
+
+  std::lock_guard<simple_spinlock> l(recycle_lock_);
+  recycled_segment_paths_.emplace_back(std::move(recycled_path));
+  *recycled = true;
+  return Status::OK();
+}
+
+void Log::AsyncDeleteSegmentFile(const string& path, uint64_t size, bool truncate) {
+  if (metrics_) {
+    metrics_->gc_pending_delete_bytes->IncrementBy(size);
+  }
+  pending_deletes_++;
+  Status s = delete_pool_->SubmitFunc([this, path, size, truncate]() {
+      WARN_NOT_OK(DeleteSegmentFile(path, size, truncate),
+                  Substitute("$0Unable to delete log segment $1", LogPrefix(), path));
+      pending_deletes_--;
+      if (metrics_) {
+        metrics_->gc_pending_delete_bytes->IncrementBy(-static_cast<int64_t>(size));
+      }
+    });
+  if (!s.ok()) {
+    WARN_NOT_OK(s, Substitute("$0Unable to schedule deletion of log segment $1, deleting it now",
+                              LogPrefix(), path));
+    WARN_NOT_OK(fs_manager_->env()->DeleteFile(path),
+                Substitute("$0Unable to delete log segment $1", LogPrefix(), path));
+    pending_deletes_--;
+    if (metrics_) {
+      metrics_->gc_pending_delete_bytes->IncrementBy(-static_cast<int64_t>(size));
+    }
+  }
+}
+
+Status Log::DeleteSegmentFile(const string& path, uint64_t size, bool truncate) {
+  TRACE_EVENT1("log", "Log::DeleteSegmentFile", "path", path);
+  Env* env = fs_manager_->env();
+  MonoTime start = MonoTime::Now();
+  uint64_t deleted = 0;
+  const uint64_t chunk_size = FLAGS_log_segment_delete_chunk_bytes;
+  if (truncate && chunk_size > 0 && size > chunk_size) {
+    RWFileOptions opts;
+    opts.mode = Env::OPEN_EXISTING;
+    unique_ptr<RWFile> file;
+    RETURN_NOT_OK(env->NewRWFile(opts, path, &file));
+    uint64_t remaining;
+    RETURN_NOT_OK(file->Size(&remaining));
+    while (remaining > chunk_size) {
+      remaining -= chunk_size;
+      RETURN_NOT_OK(file->Truncate(remaining));
+      deleted += chunk_size;
+      ThrottleSegmentDeletion(deleted, start);
+    }
+    RETURN_NOT_OK(file->Close());
+  }
+  RETURN_NOT_OK(env->DeleteFile(path));
+  // Only pace the deletions which are still queued behind this one.
+  if (pending_deletes_ > 1) {
+    ThrottleSegmentDeletion(size, start);
+  }
+  return Status::OK();
+}
+
+void Log::ThrottleSegmentDeletion(uint64_t bytes, const MonoTime& start) {
+  const int64_t bytes_per_sec = FLAGS_log_segment_delete_bytes_per_sec;
+  if (bytes_per_sec == 0) {
+    return;
+  }
+  MonoTime deadline = start + MonoDelta::FromSeconds(static_cast<double>(bytes) / bytes_per_sec);
+  MutexLock l(delete_throttle_lock_);
+  while (!drain_pending_deletes_ && MonoTime::Now() < deadline) {
+    delete_throttle_cond_.WaitUntil(deadline);
+  }
+}
+
+void Log::DeleteRecycledSegments() {
+  CHECK(!FLAGS_raft_derived_log_mode);
+  std::deque<string> paths;
+  {
+    std::lock_guard<simple_spinlock> l(recycle_lock_);
+    paths.swap(recycled_segment_paths_);
+  }
+  for (const string& path : paths) {
+    WARN_NOT_OK(fs_manager_->env()->DeleteFile(path),
+                Substitute("Could not delete recycled log segment $0", path));
+  }
+}
+
 Status Log::SwitchToAllocatedSegment() {
   CHECK(!FLAGS_raft_derived_log_mode);
   CHECK_EQ(allocation_state(), kAllocationFinished);
@@ -1164,6 +1854,9 @@ Status Log::SwitchToAllocatedSegment() {
   if (codec_) {
     header.set_compression_codec(codec_->type());
   }
+  if (next_segment_recycled_) {
+    header.add_incompatible_features(LogSegmentHeaderPB::RECYCLED_SEGMENT);
+  }
 
   // Set up the new footer. This will be maintained as the segment is written.
   footer_builder_.Clear();
@@ -1180,6 +1873,10 @@ Status Log::SwitchToAllocatedSegment() {
 #endif
 
   RETURN_NOT_OK(new_segment->WriteHeaderAndOpen(header));
+  if (options_.use_io_uring) {
+    // The header must be on disk before a reader is opened on the segment.
+    RETURN_NOT_OK(new_segment->Flush());
+  }
 
   // Transform the currently-active segment into a readable one, since we
   // need to be able to replay the segments for other peers.
@@ -1229,6 +1926,92 @@ Status Log::ReplaceSegmentInReaderUnlocked() {
   return reader_->ReplaceLastSegment(readable_segment);
 }
 
+Status Log::PersistCompressionDictionary(uint32_t dict_id, const Slice& dictionary) {
+  Env* env = fs_manager_->env();
+  const string path = JoinPathSegments(
+      log_dir_, Substitute("$0$1", kCompressionDictionaryFilePrefix, dict_id));
+  // Keep the file from being garbage collected until the entries compressed
+  // with it are appended.
+  {
+    std::lock_guard<simple_spinlock> l(dictionaries_lock_);
+    dictionary_last_segment_[dict_id] = std::numeric_limits<uint64_t>::max();
+    last_persisted_dictionary_id_ = dict_id;
+  }
+  if (env->FileExists(path)) {
+    return Status::OK();
+  }
+
+  // Write it to a temporary file first, so that a crash never leaves a
+  // truncated dictionary behind.
+  WritableFileOptions opts;
+  opts.sync_on_close = true;
+  string tmp_path;
+  unique_ptr<WritableFile> file;
+  RETURN_NOT_OK_PREPEND(env->NewTempWritableFile(
+      opts, JoinPathSegments(log_dir_, Substitute("$0.zstd_dictionaryXXXXXX", kTmpInfix)),
+      &tmp_path, &file), "Unable to create compression dictionary file");
+  auto cleanup = MakeScopedCleanup([&]() {
+    WARN_NOT_OK(env->DeleteFile(tmp_path),
+                Substitute("Unable to delete temporary file $0", tmp_path));
+  });
+  RETURN_NOT_OK(file->Append(dictionary));
+  RETURN_NOT_OK(file->Close());
+  RETURN_NOT_OK(env->RenameFile(tmp_path, path));
+  cleanup.cancel();
+  RETURN_NOT_OK(env->SyncDir(log_dir_));
+  LOG_WITH_PREFIX(INFO) << "Persisted compression dictionary " << dict_id << " to " << path;
+  return Status::OK();
+}
+
+Status Log::InitCompressionDictionaryUsage() {
+  SegmentSequence segments;
+  RETURN_NOT_OK(reader_->GetSegmentsSnapshot(&segments));
+  std::lock_guard<simple_spinlock> l(dictionaries_lock_);
+  for (const scoped_refptr<ReadableLogSegment>& segment : segments) {
+    if (!segment->HasFooter()) {
+      continue;
+    }
+    for (uint32_t dict_id : segment->footer().compression_dictionary_ids()) {
+      dictionary_last_segment_[dict_id] = segment->header().sequence_number();
+    }
+  }
+  return Status::OK();
+}
+
+void Log::DeleteUnusedCompressionDictionaries(uint64_t min_segment_sequence_number) {
+  Env* env = fs_manager_->env();
+  vector<string> children;
+  Status s = env->GetChildren(log_dir_, &children);
+  if (!s.ok()) {
+    WARN_NOT_OK(s, Substitute("$0Unable to list compression dictionaries", LogPrefix()));
+    return;
+  }
+  for (const string& child : children) {
+    if (!HasPrefixString(child, kCompressionDictionaryFilePrefix)) {
+      continue;
+    }
+    uint32_t dict_id;
+    if (!safe_strtou32(child.substr(strlen(kCompressionDictionaryFilePrefix)), &dict_id)) {
+      continue;
+    }
+    {
+      std::lock_guard<simple_spinlock> l(dictionaries_lock_);
+      if (dict_id == last_persisted_dictionary_id_) {
+        continue;
+      }
+      const uint64_t* last_segment = FindOrNull(dictionary_last_segment_, dict_id);
+      if (last_segment && *last_segment >= min_segment_sequence_number) {
+        continue;
+      }
+      dictionary_last_segment_.erase(dict_id);
+    }
+    const string path = JoinPathSegments(log_dir_, child);
+    LOG_WITH_PREFIX(INFO) << "Deleting unused compression dictionary in path: " << path;
+    WARN_NOT_OK(env->DeleteFile(path),
+                Substitute("$0Unable to delete compression dictionary $1", LogPrefix(), path));
+  }
+}
+
 Status Log::CreatePlaceholderSegment(const WritableFileOptions& opts,
                                      string* result_path,
                                      shared_ptr<WritableFile>* out) {
@@ -1256,13 +2039,16 @@ Log::~Log() {
 
 LogEntryBatch::LogEntryBatch(LogEntryTypePB type,
                              unique_ptr<LogEntryBatchPB> entry_batch_pb,
-                             size_t count)
+                             size_t count,
+                             vector<ReplicateRefPtr> replicates)
     : type_(type),
       entry_batch_pb_(std::move(entry_batch_pb)),
+      replicates_(std::move(replicates)),
       total_size_bytes_(
           PREDICT_FALSE(count == 1 && entry_batch_pb_->entry(0).type() == FLUSH_MARKER) ?
-          0 : entry_batch_pb_->ByteSize()),
+          0 : ComputeTotalSize()),
       count_(count) {
+  DCHECK(replicates_.empty() || replicates_.size() == count);
 }
 
 LogEntryBatch::~LogEntryBatch() {
@@ -1275,14 +2061,220 @@ LogEntryBatch::~LogEntryBatch() {
   }
 }
 
+namespace {
+
+uint8_t* WriteLengthDelimitedHeader(int field_number, uint32_t length, uint8_t* target) {
+  target = WireFormatLite::WriteTagToArray(
+      field_number, WireFormatLite::WIRETYPE_LENGTH_DELIMITED, target);
+  return CodedOutputStream::WriteVarint32ToArray(length, target);
+}
+
+// Returns the size of a REPLICATE entry whose message serializes to
+// 'msg_size' bytes.
+uint32_t ReplicateEntrySize(uint32_t msg_size) {
+  return WireFormatLite::TagSize(LogEntryPB::kTypeFieldNumber, WireFormatLite::TYPE_ENUM) +
+      WireFormatLite::EnumSize(REPLICATE) +
+      WireFormatLite::TagSize(LogEntryPB::kReplicateFieldNumber, WireFormatLite::TYPE_MESSAGE) +
+      CodedOutputStream::VarintSize32(msg_size) + msg_size;
+}
+
+// If 'entry' is a REPLICATE carrying a write payload of at least 'min_size'
+// bytes, appends the serialized 'entry' to 'dst', except for the bytes of the
+// payload itself, and sets 'payload_offset' to the position in 'dst' where
+// they belong. The result is byte for byte what LogEntryBatchPB would have
+// serialized once the payload is spliced back in.
+//
+// Returns false, leaving 'dst' untouched, if the entry should be serialized
+// normally instead.
+//
+// Requires the cached sizes of 'entry' to be up to date.
+bool AppendEntryWithoutPayload(const LogEntryPB& entry, size_t min_size,
+                               faststring* dst, size_t* payload_offset) {
+  if (entry.type() != REPLICATE || !entry.has_replicate() || entry.has_commit()) {
+    return false;
+  }
+  const ReplicateMsg& msg = entry.replicate();
+  if (!msg.has_write_payload() || msg.write_payload().payload().size() < min_size) {
+    return false;
+  }
+  const WritePayloadPB& payload_pb = msg.write_payload();
+
+  // The fields which are serialized before and after the payload. These are
+  // all small, so copying them is cheap.
+  ReplicateMsg msg_head;
+  *msg_head.mutable_id() = msg.id();
+  msg_head.set_timestamp(msg.timestamp());
+  msg_head.set_op_type(msg.op_type());
+  if (msg.has_change_config_record()) {
+    *msg_head.mutable_change_config_record() = msg.change_config_record();
+  }
+  if (msg.has_request_id()) {
+    *msg_head.mutable_request_id() = msg.request_id();
+  }
+  WritePayloadPB payload_tail;
+  if (payload_pb.has_compression_codec()) {
+    payload_tail.set_compression_codec(payload_pb.compression_codec());
+  }
+  if (payload_pb.has_uncompressed_size()) {
+    payload_tail.set_uncompressed_size(payload_pb.uncompressed_size());
+  }
+  if (payload_pb.has_crc32()) {
+    payload_tail.set_crc32(payload_pb.crc32());
+  }
+  if (payload_pb.has_compression_dictionary_id()) {
+    payload_tail.set_compression_dictionary_id(payload_pb.compression_dictionary_id());
+  }
+  ReplicateMsg msg_tail;
+  if (msg.has_proxy_record()) {
+    *msg_tail.mutable_proxy_record() = msg.proxy_record();
+  }
+  if (msg.has_noop_request()) {
+    *msg_tail.mutable_noop_request() = msg.noop_request();
+  }
+
+  const uint32_t payload_size = payload_pb.payload().size();
+  const uint32_t payload_header_size =
+      WireFormatLite::TagSize(WritePayloadPB::kPayloadFieldNumber, WireFormatLite::TYPE_BYTES) +
+      CodedOutputStream::VarintSize32(payload_size);
+  const uint32_t payload_pb_size =
+      payload_header_size + payload_size + payload_tail.ByteSize();
+  const uint32_t payload_pb_header_size =
+      WireFormatLite::TagSize(ReplicateMsg::kWritePayloadFieldNumber,
+                              WireFormatLite::TYPE_MESSAGE) +
+      CodedOutputStream::VarintSize32(payload_pb_size);
+  const uint32_t msg_size = msg_head.ByteSize() + payload_pb_header_size + payload_pb_size +
+      msg_tail.ByteSize();
+  if (PREDICT_FALSE(msg_size != msg.GetCachedSize())) {
+    // A field was added to ReplicateMsg or WritePayloadPB without being
+    // accounted for above.
+    LOG(DFATAL) << "Unexpected size of serialized ReplicateMsg: expected "
+                << msg.GetCachedSize() << " bytes, got " << msg_size;
+    return false;
+  }
+  const uint32_t entry_size = ReplicateEntrySize(msg_size);
+  DCHECK_EQ(entry_size, entry.GetCachedSize());
+
+  // Everything up to the payload.
+  const size_t start = dst->size();
+  dst->resize(start +
+              WireFormatLite::TagSize(LogEntryBatchPB::kEntryFieldNumber,
+                                      WireFormatLite::TYPE_MESSAGE) +
+              CodedOutputStream::VarintSize32(entry_size) +
+              entry_size - msg_size + msg_head.GetCachedSize() +
+              payload_pb_header_size + payload_header_size);
+  uint8_t* target = dst->data() + start;
+  target = WriteLengthDelimitedHeader(LogEntryBatchPB::kEntryFieldNumber, entry_size, target);
+  target = WireFormatLite::WriteEnumToArray(LogEntryPB::kTypeFieldNumber, entry.type(), target);
+  target = WriteLengthDelimitedHeader(LogEntryPB::kReplicateFieldNumber, msg_size, target);
+  target = msg_head.SerializeWithCachedSizesToArray(target);
+  target = WriteLengthDelimitedHeader(ReplicateMsg::kWritePayloadFieldNumber,
+                                      payload_pb_size, target);
+  target = WriteLengthDelimitedHeader(WritePayloadPB::kPayloadFieldNumber,
+                                      payload_size, target);
+  DCHECK_EQ(target, dst->data() + dst->size());
+  *payload_offset = dst->size();
+
+  // Everything after it.
+  const size_t tail_start = dst->size();
+  dst->resize(tail_start + payload_tail.GetCachedSize() + msg_tail.GetCachedSize());
+  target = payload_tail.SerializeWithCachedSizesToArray(dst->data() + tail_start);
+  target = msg_tail.SerializeWithCachedSizesToArray(target);
+  DCHECK_EQ(target, dst->data() + dst->size());
+  return true;
+}
+
+// Appends to 'dst' the serialized REPLICATE 'entry' up to its message, whose
+// bytes are 'msg_bytes', as received from the leader.
+void AppendReceivedEntryHeader(const LogEntryPB& entry, const Slice& msg_bytes,
+                               faststring* dst) {
+  DCHECK(entry.type() == REPLICATE && !entry.has_commit());
+  DCHECK(msg_bytes == Slice(entry.replicate().SerializeAsString()))
+      << "the received bytes don't match op " << entry.replicate().id().ShortDebugString();
+  const uint32_t msg_size = msg_bytes.size();
+  const size_t start = dst->size();
+  dst->resize(start +
+              WireFormatLite::TagSize(LogEntryBatchPB::kEntryFieldNumber,
+                                      WireFormatLite::TYPE_MESSAGE) +
+              CodedOutputStream::VarintSize32(ReplicateEntrySize(msg_size)) +
+              ReplicateEntrySize(msg_size) - msg_size);
+  uint8_t* target = dst->data() + start;
+  target = WriteLengthDelimitedHeader(LogEntryBatchPB::kEntryFieldNumber,
+                                      ReplicateEntrySize(msg_size), target);
+  target = WireFormatLite::WriteEnumToArray(LogEntryPB::kTypeFieldNumber, REPLICATE, target);
+  target = WriteLengthDelimitedHeader(LogEntryPB::kReplicateFieldNumber, msg_size, target);
+  DCHECK_EQ(target, dst->data() + dst->size());
+}
+
+} // anonymous namespace
+
+size_t LogEntryBatch::ComputeTotalSize() {
+  if (replicates_.empty()) {
+    return entry_batch_pb_->ByteSize();
+  }
+  size_t total = 0;
+  for (int i = 0; i < entry_batch_pb_->entry_size(); i++) {
+    const Slice& received = replicates_[i]->received_bytes();
+    const uint32_t entry_size = received.empty() ?
+        entry_batch_pb_->entry(i).ByteSize() : ReplicateEntrySize(received.size());
+    total += WireFormatLite::TagSize(LogEntryBatchPB::kEntryFieldNumber,
+                                     WireFormatLite::TYPE_MESSAGE) +
+        CodedOutputStream::VarintSize32(entry_size) + entry_size;
+  }
+  return total;
+}
+
 void LogEntryBatch::Serialize() {
   DCHECK_EQ(buffer_.size(), 0);
+  DCHECK(slices_.empty());
   // FLUSH_MARKER LogEntries are markers and are not serialized.
   if (PREDICT_FALSE(count() == 1 && entry_batch_pb_->entry(0).type() == FLUSH_MARKER)) {
     return;
   }
-  buffer_.reserve(total_size_bytes_);
-  pb_util::AppendToString(*entry_batch_pb_, &buffer_);
+
+  // Large write payloads, and the messages received from the leader, are not
+  // copied into 'buffer_'. Instead, the batch is written out as the ranges of
+  // 'buffer_' in between them, interleaved with the payloads and messages
+  // themselves. Since 'buffer_' may be reallocated while it is being filled
+  // in, the ranges are only turned into slices at the end.
+  const size_t min_payload_size = FLAGS_log_zero_copy_min_payload_bytes;
+  vector<std::pair<size_t, Slice>> payloads;
+  for (int i = 0; i < entry_batch_pb_->entry_size(); i++) {
+    const LogEntryPB& entry = entry_batch_pb_->entry(i);
+    if (!replicates_.empty() && !replicates_[i]->received_bytes().empty()) {
+      const Slice& msg_bytes = replicates_[i]->received_bytes();
+      AppendReceivedEntryHeader(entry, msg_bytes, &buffer_);
+      payloads.emplace_back(buffer_.size(), msg_bytes);
+      continue;
+    }
+    size_t payload_offset;
+    if (AppendEntryWithoutPayload(entry, min_payload_size, &buffer_, &payload_offset)) {
+      payloads.emplace_back(payload_offset, entry.replicate().write_payload().payload());
+      continue;
+    }
+    const size_t start = buffer_.size();
+    buffer_.resize(start +
+                   WireFormatLite::TagSize(LogEntryBatchPB::kEntryFieldNumber,
+                                           WireFormatLite::TYPE_MESSAGE) +
+                   CodedOutputStream::VarintSize32(entry.GetCachedSize()) +
+                   entry.GetCachedSize());
+    uint8_t* target = WriteLengthDelimitedHeader(LogEntryBatchPB::kEntryFieldNumber,
+                                                 entry.GetCachedSize(),
+                                                 buffer_.data() + start);
+    target = entry.SerializeWithCachedSizesToArray(target);
+    DCHECK_EQ(target, buffer_.data() + buffer_.size());
+  }
+
+  slices_.reserve(payloads.size() * 2 + 1);
+  size_t buffer_offset = 0;
+  size_t payload_bytes = 0;
+  for (const auto& payload : payloads) {
+    slices_.emplace_back(buffer_.data() + buffer_offset, payload.first - buffer_offset);
+    slices_.emplace_back(payload.second);
+    buffer_offset = payload.first;
+    payload_bytes += payload.second.size();
+  }
+  slices_.emplace_back(buffer_.data() + buffer_offset, buffer_.size() - buffer_offset);
+  DCHECK_EQ(total_size_bytes_, buffer_.size() + payload_bytes);
 }
 
 
@@ -27,6 +27,7 @@
 #include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <deque>
 #include <limits>
 #include <map>
 #include <memory>
@@ -42,6 +43,7 @@
 #endif
 #include "kudu/consensus/consensus.pb.h"
 #include "kudu/consensus/log.pb.h"
+#include "kudu/consensus/log_index.h"
 #include "kudu/consensus/log_util.h"
 #include "kudu/consensus/opid.pb.h"
 #include "kudu/consensus/ref_counted_replicate.h"
@@ -50,8 +52,11 @@
 #include "kudu/gutil/macros.h"
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/util/blocking_queue.h"
+#include "kudu/util/condition_variable.h"
 #include "kudu/util/faststring.h"
 #include "kudu/util/locks.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/mutex.h"
 #include "kudu/util/promise.h"
 #include "kudu/util/rw_mutex.h"
 #include "kudu/util/slice.h"
@@ -117,6 +122,49 @@ class LogReader;
 
 typedef BlockingQueue<LogEntryBatch*, LogEntryBatchLogicalSize> LogEntryBatchQueue;
 
+// Decides how long the append task should keep collecting batches for a
+// group before writing it, when --log_adaptive_group_commit is enabled.
+//
+// The wait is bounded so that the expected group commit latency, i.e. the
+// average of the samples which also feed the 'group_commit_latency' metric,
+// plus the wait stays within --log_group_commit_target_latency_us. Within
+// that budget, we only wait if the measured arrival rate of batches makes it
+// likely that at least one more batch arrives, since otherwise the wait
+// would only add latency without saving an fsync.
+//
+// Used by the WAL append thread. Thread-safe, since group commit latencies
+// are recorded by the sync task when group commit is pipelined.
+class GroupCommitController {
+ public:
+  GroupCommitController();
+
+  // Returns how long to wait for more batches to join the group being
+  // collected. Returns a zero delta if the group should be written now.
+  MonoDelta WaitTime() const;
+
+  // Records that a group of 'num_batches' batches finished collecting at
+  // 'now', to estimate the rate at which batches arrive.
+  void RecordGroup(int num_batches, MonoTime now);
+
+  // Records the time taken to write, sync and run the callbacks of a group.
+  void RecordGroupCommitLatency(MonoDelta latency);
+
+ private:
+  // Weight of a new sample in the moving averages below.
+  static constexpr double kAlpha = 0.2;
+
+  mutable simple_spinlock lock_;
+
+  // Exponentially weighted moving average of the group commit latency.
+  double avg_commit_latency_us_;
+
+  // Exponentially weighted moving average of batch arrivals per microsecond.
+  double avg_arrival_rate_;
+
+  // When the last group finished collecting.
+  MonoTime last_group_time_;
+};
+
 // Log interface, inspired by Raft's (logcabin) Log. Provides durability to
 // Kudu as a normal Write Ahead Log and also plays the role of persistent
 // storage for the consensus state machine.
@@ -225,6 +273,11 @@ class Log : public RefCountedThreadSafe<Log> {
     options_.async_preallocate_segments = false;
   }
 
+  // Waits for the background deletion of garbage-collected segments to finish.
+  void WaitForPendingDeletesForTests() {
+    delete_pool_->Wait();
+  }
+
   void DisableSync() {
     sync_disabled_ = true;
   }
@@ -291,6 +344,14 @@ class Log : public RefCountedThreadSafe<Log> {
   // Return true if the append thread is currently active.
   bool append_thread_active_for_tests() const;
 
+  // Durably writes 'dictionary', the zstd dictionary with id 'dict_id', to
+  // the WAL directory unless it is already there. Entries compressed with the
+  // dictionary must not be appended before this returns OK, so that the
+  // dictionary is registered again by LogReader when the log is reopened.
+  // The file is deleted by GC once no retained segment has entries compressed
+  // with the dictionary, unless it is the most recently persisted one.
+  Status PersistCompressionDictionary(uint32_t dict_id, const Slice& dictionary);
+
   // Forces the Log to allocate a new segment and roll over.
   // This can be used to make sure all entries appended up to this point are
   // available in closed, readable segments.
@@ -327,6 +388,7 @@ class Log : public RefCountedThreadSafe<Log> {
   FRIEND_TEST(LogTestOptionalCompression, TestMultipleEntriesInABatch);
   FRIEND_TEST(LogTestOptionalCompression, TestReadLogWithReplacedReplicates);
   FRIEND_TEST(LogTest, TestWriteAndReadToAndFromInProgressSegment);
+  FRIEND_TEST(LogTest, TestReadWhileAppendingWithIoUring);
 
   class AppendThread;
 
@@ -378,9 +440,49 @@ class Log : public RefCountedThreadSafe<Log> {
   // disk as the header, and sets active_segment_ to point to this new segment.
   Status SwitchToAllocatedSegment();
 
-  // Preallocates the space for a new segment.
+  // Preallocates the space for a new segment, reusing a recycled segment
+  // file if one is available.
   Status PreAllocateNewSegment();
 
+  // Opens the oldest recycled segment file, if any, as the next segment.
+  // Sets 'next_segment_recycled_' and 'recycled_size' accordingly.
+  Status OpenRecycledSegment(const WritableFileOptions& opts, uint64_t* recycled_size);
+
+  // Moves the file of the garbage-collected segment at 'path' into the pool
+  // of recycled segment files, unless the pool is full. Sets 'recycled'
+  // to whether it did. On failure, the file is normally left at 'path'.
+  Status RecycleSegmentFile(const std::string& path, uint64_t sequence_number,
+                            bool* recycled);
+
+  // Deletes any segment files left in the recycling pool.
+  void DeleteRecycledSegments();
+
+  // Records the compression dictionaries used by the entries of the
+  // segments in the reader, when the log is opened.
+  Status InitCompressionDictionaryUsage();
+
+  // Deletes the files of the compression dictionaries which no segment from
+  // 'min_segment_sequence_number' on has entries compressed with, other than
+  // the most recently persisted dictionary.
+  void DeleteUnusedCompressionDictionaries(uint64_t min_segment_sequence_number);
+
+  // Deletes the file of the garbage-collected segment at 'path', which is
+  // 'size' bytes long, in the background. See DeleteSegmentFile().
+  void AsyncDeleteSegmentFile(const std::string& path, uint64_t size, bool truncate);
+
+  // Deletes the file at 'path'. If 'truncate' is true, the file is first
+  // truncated down a chunk at a time, so that the filesystem frees its extents
+  // in small steps rather than all at once on unlink. Throttled according to
+  // --log_segment_delete_bytes_per_sec.
+  //
+  // Must not truncate a file which may still be mapped by a reader.
+  Status DeleteSegmentFile(const std::string& path, uint64_t size, bool truncate);
+
+  // Waits as needed to keep deleting at most --log_segment_delete_bytes_per_sec,
+  // having just deleted 'bytes' since 'start'. Returns early once Close()
+  // starts draining the pending deletions.
+  void ThrottleSegmentDeletion(uint64_t bytes, const MonoTime& start);
+
   // Writes serialized contents of 'entry' to the log. Called inside
   // AppenderThread.
   Status DoAppend(LogEntryBatch* entry_batch);
@@ -400,6 +502,19 @@ class Log : public RefCountedThreadSafe<Log> {
 
   Status Sync();
 
+  // With io_uring, writes out the entries buffered in the active segment and
+  // lets readers see them, first extending the readable part of the segment
+  // and then indexing them. Does nothing otherwise, since DoAppend() already
+  // made them visible. Called by Sync(), and by the append thread for groups
+  // of COMMIT entries only, which are not synced.
+  Status MakeAppendsVisible();
+
+  // Syncs 'file', the file of the active segment or of the segment a group
+  // was just appended to, according to 'force_sync_all_'. Unlike Sync(),
+  // does not touch 'active_segment_', so it may run on the pipelined group
+  // commit sync thread while the append thread keeps appending.
+  Status SyncFile(WritableFile* file);
+
   // Helper method to get the segment sequence to GC based on the provided 'retention' struct.
   Status GetSegmentsToGCUnlocked(RetentionIndexes retention_indexes,
                                  SegmentSequence* segments_to_gc) const;
@@ -444,6 +559,16 @@ class Log : public RefCountedThreadSafe<Log> {
   // The path for the next allocated segment.
   std::string next_segment_path_;
 
+  // Whether the next allocated segment reuses a recycled segment file.
+  bool next_segment_recycled_;
+
+  // Protects 'recycled_segment_paths_'.
+  simple_spinlock recycle_lock_;
+
+  // Files of garbage-collected segments which may be overwritten by new
+  // segments, oldest first. Bounded by --log_max_recycled_segments.
+  std::deque<std::string> recycled_segment_paths_;
+
   // Lock to protect mutations to log_state_ and other shared state variables.
   mutable percpu_rwlock state_lock_;
 
@@ -462,6 +587,11 @@ class Log : public RefCountedThreadSafe<Log> {
   // When the segment is closed, it will be written.
   LogSegmentFooterPB footer_builder_;
 
+  // With io_uring, the index entries of the appended replicates which readers
+  // can't see yet. Added to 'log_index_' by MakeAppendsVisible(). Like
+  // 'footer_builder_', only used by the thread appending to the log.
+  std::vector<LogIndexEntry> pending_index_entries_;
+
   // The maximum segment size, in bytes.
   uint64_t max_segment_size_;
 
@@ -491,9 +621,38 @@ class Log : public RefCountedThreadSafe<Log> {
   // The codec used to compress entries, or nullptr if not configured.
   const CompressionCodec* codec_;
 
+  // Protects 'dictionary_last_segment_' and 'last_persisted_dictionary_id_'.
+  mutable simple_spinlock dictionaries_lock_;
+
+  // The sequence number of the last segment with entries compressed with each
+  // of the zstd dictionaries persisted in the WAL directory. Dictionaries
+  // persisted since the last entry compressed with them was appended map to
+  // the maximum sequence number.
+  std::map<uint32_t, uint64_t> dictionary_last_segment_;
+
+  // The id of the dictionary last passed to PersistCompressionDictionary(),
+  // or 0 if none. It may be used for new entries at any time, so its file is
+  // kept.
+  uint32_t last_persisted_dictionary_id_;
+
   scoped_refptr<MetricEntity> metric_entity_;
   gscoped_ptr<LogMetrics> metrics_;
 
+  // Deletes garbage-collected segment files in the background. Declared
+  // after the members its tasks use, so that it is shut down first.
+  gscoped_ptr<ThreadPool> delete_pool_;
+
+  // The number of segment deletions submitted to 'delete_pool_' which have
+  // not finished yet.
+  std::atomic<int> pending_deletes_;
+
+  // Set while closing, to finish off pending deletions without throttling.
+  // Protected by 'delete_throttle_lock_'; 'delete_throttle_cond_' is
+  // signaled when it is set, to wake up a throttled deletion.
+  Mutex delete_throttle_lock_;
+  ConditionVariable delete_throttle_cond_;
+  bool drain_pending_deletes_;
+
   std::shared_ptr<LogFaultHooks> log_hooks_;
 
   // The cached on-disk size of the log, used to track its size even if it has been closed.
@@ -568,11 +727,17 @@ class LogEntryBatch {
   friend struct LogEntryBatchLogicalSize;
   friend class MultiThreadedLogTest;
 
+  // For a REPLICATE batch, 'replicates' holds the messages of the entries of
+  // 'entry_batch_pb', in the same order.
   LogEntryBatch(LogEntryTypePB type,
                 std::unique_ptr<LogEntryBatchPB> entry_batch_pb,
-                size_t count);
+                size_t count,
+                std::vector<consensus::ReplicateRefPtr> replicates = {});
 
-  // Serializes contents of the entry to an internal buffer.
+  // Serializes contents of the entry. Large write payloads, and messages
+  // whose bytes were received from the leader, are referenced rather than
+  // copied, so the entry must not be modified or destroyed until it has been
+  // appended.
   void Serialize();
 
   // Sets the callback that will be invoked after the entry is
@@ -588,10 +753,10 @@ class LogEntryBatch {
   }
 
 
-  // Returns a Slice representing the serialized contents of the
-  // entry.
-  Slice data() const {
-    return Slice(buffer_);
+  // Returns the serialized contents of the entry, as a sequence of
+  // fragments which are to be written out back to back.
+  const std::vector<Slice>& data() const {
+    return slices_;
   }
 
   size_t count() const { return count_; }
@@ -610,9 +775,9 @@ class LogEntryBatch {
     return entry_batch_pb_->entry(idx).replicate().id();
   }
 
-  void SetReplicates(const std::vector<consensus::ReplicateRefPtr>& replicates) {
-    replicates_ = replicates;
-  }
+  // Returns the size of the serialized entries, without computing the size
+  // of those which are written out from the bytes received from the leader.
+  size_t ComputeTotalSize();
 
   // The type of entries in this batch.
   const LogEntryTypePB type_;
@@ -620,26 +785,30 @@ class LogEntryBatch {
   // Contents of the log entries that will be written to disk.
   std::unique_ptr<LogEntryBatchPB> entry_batch_pb_;
 
+  // The vector of refcounted replicates.
+  // Used only when type is REPLICATE, this makes sure there's at
+  // least a reference to each replicate message until we're finished
+  // appending.
+  const std::vector<consensus::ReplicateRefPtr> replicates_;
+
    // Total size in bytes of all entries
   const uint32_t total_size_bytes_;
 
   // Number of entries in 'entry_batch_pb_'
   const size_t count_;
 
-  // The vector of refcounted replicates.
-  // Used only when type is REPLICATE, this makes sure there's at
-  // least a reference to each replicate message until we're finished
-  // appending.
-  std::vector<consensus::ReplicateRefPtr> replicates_;
-
   // Callback to be invoked upon the entries being written and
   // synced to disk.
   StatusCallback callback_;
 
   // Buffer to which 'phys_entries_' are serialized by call to
-  // 'Serialize()'
+  // 'Serialize()', except for large write payloads and received messages.
   faststring buffer_;
 
+  // The serialized entries: ranges of 'buffer_' interleaved with the write
+  // payloads and received messages which were left out of it.
+  std::vector<Slice> slices_;
+
   DISALLOW_COPY_AND_ASSIGN(LogEntryBatch);
 };
 
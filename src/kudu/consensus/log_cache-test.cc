@@ -46,9 +46,13 @@
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/compression/compression_codec.h"
+#include "kudu/util/env.h"
+#include "kudu/util/faststring.h"
 #include "kudu/util/mem_tracker.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
+#include "kudu/util/path_util.h"
 #include "kudu/util/scoped_cleanup.h"
 #include "kudu/util/status.h"
 #include "kudu/util/test_macros.h"
@@ -56,6 +60,7 @@
 
 using std::atomic;
 using std::shared_ptr;
+using std::string;
 using std::thread;
 using std::vector;
 using strings::Substitute;
@@ -63,6 +68,12 @@ using strings::Substitute;
 DECLARE_int32(log_cache_size_limit_mb);
 DECLARE_int32(global_log_cache_size_limit_mb);
 
+DEFINE_int32(log_cache_bench_readers, 8,
+             "Number of reader threads in BenchmarkConcurrentReadersAndAppender");
+DEFINE_int32(log_cache_bench_seconds, 10,
+             "Duration of BenchmarkConcurrentReadersAndAppender, in seconds, "
+             "when slow tests are enabled");
+
 //METRIC_DECLARE_entity(tablet);
 
 namespace kudu {
@@ -363,6 +374,63 @@ TEST_F(LogCacheTest, TestReplaceMessages) {
             cache_->ToString());
 }
 
+// Test that the encodings built for sending cached ops to peers are charged
+// to the cache's MemTracker until the ops are evicted.
+TEST_F(LogCacheTest, TestOpEncodingIsTracked) {
+  const int kPayloadSize = 64 * 1024;
+  shared_ptr<MemTracker> tracker = cache_->tracker_;
+  ASSERT_OK(AppendReplicateMessagesToCache(1, 2, kPayloadSize));
+  log_->WaitUntilAllFlushed();
+  const int64_t size_without_encodings = tracker->consumption();
+
+  int64_t encodings_size = 0;
+  {
+    vector<ReplicateRefPtr> messages;
+    OpId preceding;
+    ASSERT_OK(cache_->ReadOps(0, 8 * 1024 * 1024, ReadContext(), &messages, &preceding));
+    ASSERT_EQ(2, messages.size());
+    for (const ReplicateRefPtr& msg : messages) {
+      const string& encoding = *msg->ConsensusRequestOpEncoding();
+      ASSERT_GT(encoding.size(), kPayloadSize);
+      encodings_size += encoding.capacity();
+    }
+  }
+  ASSERT_EQ(size_without_encodings + encodings_size, tracker->consumption());
+
+  // Both the ops and their encodings are released on eviction.
+  cache_->EvictThroughOp(2);
+  ASSERT_EQ(0, tracker->consumption());
+}
+
+// Test that a compression dictionary is persisted alongside the log segments,
+// so that the entries compressed with it remain readable after a restart.
+TEST_F(LogCacheTest, TestCompressionDictionaryIsPersisted) {
+  vector<string> records;
+  for (int i = 0; i < 2000; i++) {
+    records.emplace_back(Substitute(
+        "{\"table\":\"$0\",\"op\":\"UPDATE\",\"key\":$1,\"value\":\"value-$2\"}",
+        kTestTablet, i, i % 97));
+  }
+  vector<Slice> samples(records.begin(), records.end());
+  string dictionary;
+  ASSERT_OK(TrainZstdDictionary(samples, 4096, &dictionary));
+  uint32_t dict_id;
+  ASSERT_OK(RegisterZstdDictionary(dictionary, &dict_id));
+
+  ASSERT_OK(cache_->SetCompressionDictionary(dictionary));
+  const string path = JoinPathSegments(
+      fs_manager_->GetTabletWalDir(kTestTablet),
+      Substitute("$0$1", log::kCompressionDictionaryFilePrefix, dict_id));
+  faststring persisted;
+  ASSERT_OK(ReadFileToString(env_, path, &persisted));
+  ASSERT_EQ(dictionary, persisted.ToString());
+
+  // Setting it again leaves the file alone.
+  ASSERT_OK(cache_->SetCompressionDictionary(dictionary));
+  ASSERT_OK(ReadFileToString(env_, path, &persisted));
+  ASSERT_EQ(dictionary, persisted.ToString());
+}
+
 // Test that the cache truncates any future messages when either explicitly
 // truncated or replacing any earlier message.
 TEST_F(LogCacheTest, TestTruncation) {
@@ -403,6 +471,117 @@ TEST_F(LogCacheTest, TestTruncation) {
   }
 }
 
+// Messages still in use by a peer can't be evicted. Make sure that the cache
+// keeps working with the holes this leaves, including as it grows.
+TEST_F(LogCacheTest, TestEvictionAroundMessagesInUse) {
+  const int kNumOps = 3000;
+  ASSERT_OK(AppendReplicateMessagesToCache(1, kNumOps));
+  log_->WaitUntilAllFlushed();
+
+  // Hold on to a few of the messages, as if they were being sent to a peer.
+  vector<ReplicateRefPtr> in_use;
+  OpId preceding;
+  for (int64_t index : { 5, 1500, 1501 }) {
+    vector<ReplicateRefPtr> messages;
+    ASSERT_OK(cache_->ReadOps(index - 1, 1, ReadContext(), &messages, &preceding));
+    ASSERT_EQ(1, messages.size());
+    in_use.push_back(messages[0]);
+  }
+
+  cache_->EvictThroughOp(2000);
+  ASSERT_EQ(kNumOps - 2000 + static_cast<int>(in_use.size()), cache_->num_cached_ops());
+
+  // Append enough to wrap around the ring several times while the messages
+  // in use pin its start.
+  ASSERT_OK(AppendReplicateMessagesToCache(kNumOps + 1, kNumOps));
+  in_use.clear();
+  cache_->EvictThroughOp(kNumOps);
+  ASSERT_EQ(kNumOps, cache_->num_cached_ops());
+
+  // Everything is still readable, from the cache or from the log.
+  for (int64_t after_index : { 0, 4, 5, 1499, 1502, 2 * kNumOps - 1 }) {
+    SCOPED_TRACE(after_index);
+    vector<ReplicateRefPtr> messages;
+    ASSERT_OK(cache_->ReadOps(after_index, 8 * 1024 * 1024, ReadContext(),
+                              &messages, &preceding));
+    ASSERT_EQ(after_index, preceding.index());
+    ASSERT_EQ(2 * kNumOps - after_index, static_cast<int64_t>(messages.size()));
+    for (int i = 0; i < messages.size(); i++) {
+      ASSERT_EQ(after_index + i + 1, messages[i]->get()->id().index());
+    }
+  }
+}
+
+// Measures how appends and reads of the cache hold up with many peers
+// reading from it concurrently.
+TEST_F(LogCacheTest, BenchmarkConcurrentReadersAndAppender) {
+  const int kNumReaders = FLAGS_log_cache_bench_readers;
+  const MonoDelta kDuration =
+      MonoDelta::FromSeconds(AllowSlowTests() ? FLAGS_log_cache_bench_seconds : 1);
+  const int kBatch = 10;
+  const int kPayloadSize = 1024;
+
+  atomic<bool> stop { false };
+  atomic<int64_t> ops_appended { 0 };
+  atomic<int64_t> ops_read { 0 };
+  atomic<int64_t> lookups { 0 };
+  vector<thread> threads;
+  SCOPED_CLEANUP({
+      stop = true;
+      for (auto& t : threads) {
+        t.join();
+      }
+    });
+
+  threads.emplace_back([&] {
+      int64_t index = 1;
+      while (!stop) {
+        vector<ReplicateRefPtr> msgs;
+        for (int i = 0; i < kBatch; i++) {
+          msgs.push_back(make_scoped_refptr_replicate(
+              CreateDummyReplicate(index / 7, index, clock_->Now(), kPayloadSize).release()));
+          index++;
+        }
+        CHECK_OK(cache_->AppendOperations(msgs, Bind(&FatalOnError)));
+        ops_appended += kBatch;
+      }
+    });
+  for (int i = 0; i < kNumReaders; i++) {
+    threads.emplace_back([&] {
+        int64_t index = 0;
+        while (!stop) {
+          // Like a peer, check where the leader is at before asking for ops.
+          OpId op_id;
+          if (cache_->HasOpBeenWritten(index + 1)) {
+            CHECK_OK(cache_->LookupOpId(index, &op_id));
+          }
+          lookups++;
+
+          vector<ReplicateRefPtr> messages;
+          OpId preceding;
+          Status s = cache_->ReadOps(index, 64 * 1024, ReadContext(), &messages, &preceding);
+          if (s.IsIncomplete()) {
+            continue;
+          }
+          CHECK_OK(s);
+          index += messages.size();
+          ops_read += messages.size();
+        }
+      });
+  }
+
+  SleepFor(kDuration);
+  stop = true;
+  for (auto& t : threads) {
+    t.join();
+  }
+  threads.clear();
+
+  const double secs = kDuration.ToSeconds();
+  LOG(INFO) << Substitute("$0 reader(s): $1 ops/s appended, $2 ops/s read, $3 lookups/s",
+                          kNumReaders, ops_appended / secs, ops_read / secs, lookups / secs);
+}
+
 TEST_F(LogCacheTest, TestMTReadAndWrite) {
   atomic<bool> stop { false };
   vector<thread> threads;
@@ -17,7 +17,7 @@
 
 #include "kudu/consensus/log_cache.h"
 
-#include <map>
+#include <algorithm>
 #include <mutex>
 #include <ostream>
 #include <string>
@@ -38,7 +38,7 @@
 #include "kudu/consensus/ref_counted_replicate.h"
 #include "kudu/gutil/bind.h"
 #include "kudu/gutil/bind_helpers.h"
-#include "kudu/gutil/map-util.h"
+#include "kudu/gutil/bits.h"
 #include "kudu/gutil/mathlimits.h"
 #include "kudu/gutil/strings/human_readable.h"
 #include "kudu/gutil/strings/substitute.h"
@@ -47,6 +47,7 @@
 #include "kudu/util/crc.h"
 #include "kudu/util/faststring.h"
 #include "kudu/util/flag_tags.h"
+#include "kudu/util/locks.h"
 #include "kudu/util/mutex.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/mem_tracker.h"
@@ -95,8 +96,27 @@ METRIC_DEFINE_counter(server, log_cache_payload_size,
 
 static const char kParentMemTrackerId[] = "log_cache";
 
+// The initial number of slots of the ring buffer of cached messages.
+static const size_t kInitialRingSize = 1024;
+
 typedef vector<const ReplicateMsg*>::const_iterator MsgIter;
 
+namespace {
+// Calculate the total byte size that will be used on the wire to replicate
+// this message as part of a consensus update request. This accounts for the
+// length delimiting and tagging of the message.
+int64_t TotalByteSizeForSerializedMessage(size_t serialized_size) {
+  int msg_size = google::protobuf::internal::WireFormatLite::LengthDelimitedSize(
+    serialized_size);
+  msg_size += 1; // for the type tag
+  return msg_size;
+}
+
+int64_t TotalByteSizeForMessage(const ReplicateMsg& msg) {
+  return TotalByteSizeForSerializedMessage(msg.ByteSize());
+}
+} // anonymous namespace
+
 LogCache::LogCache(const scoped_refptr<MetricEntity>& metric_entity,
                    scoped_refptr<log::Log> log,
                    string local_uuid,
@@ -105,6 +125,8 @@ LogCache::LogCache(const scoped_refptr<MetricEntity>& metric_entity,
     local_uuid_(std::move(local_uuid)),
     tablet_id_(std::move(tablet_id)),
     next_index_cond_(&lock_),
+    ring_(kInitialRingSize),
+    ring_begin_(0),
     next_sequential_op_index_(0),
     min_pinned_op_index_(0),
     metrics_(metric_entity),
@@ -130,22 +152,64 @@ LogCache::LogCache(const scoped_refptr<MetricEntity>& metric_entity,
   // code paths elsewhere.
   auto zero_op = new ReplicateMsg();
   *zero_op->mutable_id() = MinimumOpId();
-  InsertOrDie(&cache_, 0, { make_scoped_refptr_replicate(zero_op), zero_op->SpaceUsed() });
+  zero_op_entry_.msg = make_scoped_refptr_replicate(zero_op);
+  zero_op_entry_.mem_usage = zero_op->SpaceUsed();
+  zero_op_entry_.msg_size = zero_op_entry_.mem_usage;
+  zero_op_entry_.wire_size = TotalByteSizeForMessage(*zero_op);
 }
 
 LogCache::~LogCache() {
+  // The ops may outlive the cache, so stop charging their encodings to it
+  // before releasing everything.
+  for (const CacheEntry& entry : ring_) {
+    if (entry.msg) {
+      entry.msg->UntrackEncoding();
+    }
+  }
   tracker_->Release(tracker_->consumption());
-  cache_.clear();
+  ring_.clear();
 }
 
 void LogCache::Init(const OpId& preceding_op) {
   std::lock_guard<Mutex> l(lock_);
-  CHECK_EQ(cache_.size(), 1)
+  std::lock_guard<rw_spinlock> cl(cache_lock_);
+  CHECK_EQ(ring_begin_, next_sequential_op_index_)
     << "Cache should have only our special '0' op";
   next_sequential_op_index_ = preceding_op.index() + 1;
+  ring_begin_ = next_sequential_op_index_;
   min_pinned_op_index_ = next_sequential_op_index_;
 }
 
+const LogCache::CacheEntry* LogCache::FindEntryUnlocked(int64_t index) const {
+  if (index == 0) {
+    return &zero_op_entry_;
+  }
+  if (index < ring_begin_ || index >= next_sequential_op_index_) {
+    return nullptr;
+  }
+  const CacheEntry& entry = ring_[index & (ring_.size() - 1)];
+  return entry.msg ? &entry : nullptr;
+}
+
+void LogCache::InsertEntryUnlocked(int64_t index, CacheEntry entry) {
+  DCHECK(cache_lock_.is_write_locked());
+  CHECK_EQ(index, next_sequential_op_index_);
+  if (index - ring_begin_ >= static_cast<int64_t>(ring_.size())) {
+    // Grow the ring, rehashing the slots in use.
+    size_t new_size = 1ULL << Bits::Log2Ceiling64(index - ring_begin_ + 1);
+    new_size = std::max(new_size, ring_.size() * 2);
+    vector<CacheEntry> new_ring(new_size);
+    for (int64_t i = ring_begin_; i < index; i++) {
+      new_ring[i & (new_size - 1)] = std::move(RingSlotUnlocked(i));
+    }
+    ring_.swap(new_ring);
+  }
+  CacheEntry& slot = RingSlotUnlocked(index);
+  slot = std::move(entry);
+  slot.msg->TrackEncoding(tracker_);
+  next_sequential_op_index_ = index + 1;
+}
+
 Status LogCache::SetCompressionCodec(const std::string& codec) {
   if (codec.empty()) {
     LOG(INFO) << "Disabling compression";
@@ -181,6 +245,70 @@ Status LogCache::EnableCompressionOnCacheMiss(bool enable) {
   return Status::OK();
 }
 
+Status LogCache::TrainCompressionDictionary(size_t max_size, std::string* dictionary) {
+  // Sample the most recent write payloads, up to a total size which gives the
+  // trainer enough to work with without taking too long.
+  static const int kMaxSamples = 10000;
+  const size_t max_sample_bytes = max_size * 100;
+  vector<ReplicateRefPtr> msgs;
+  {
+    // Writers only change the cached ops with 'lock_' held, so holding it is
+    // enough to read them, without making appends spin on 'cache_lock_' for
+    // the length of the scan.
+    std::lock_guard<Mutex> l(lock_);
+    size_t sample_bytes = 0;
+    for (int64_t index = next_sequential_op_index_ - 1;
+         index >= ring_begin_ && msgs.size() < kMaxSamples && sample_bytes < max_sample_bytes;
+         index--) {
+      const CacheEntry* entry = FindEntryUnlocked(index);
+      if (!entry) continue;
+      const ReplicateRefPtr& msg = entry->msg;
+      if (msg->get()->op_type() != WRITE_OP_EXT) continue;
+      const WritePayloadPB& payload = msg->get()->write_payload();
+      sample_bytes += payload.has_uncompressed_size() ?
+          payload.uncompressed_size() : payload.payload().size();
+      msgs.push_back(msg);
+    }
+  }
+
+  vector<string> payloads;
+  payloads.reserve(msgs.size());
+  faststring buffer;
+  for (const ReplicateRefPtr& msg : msgs) {
+    if (msg->get()->write_payload().compression_codec() == NO_COMPRESSION) {
+      payloads.push_back(msg->get()->write_payload().payload());
+      continue;
+    }
+    std::unique_ptr<ReplicateMsg> uncompressed_msg;
+    RETURN_NOT_OK(UncompressMsg(msg, buffer, &uncompressed_msg));
+    payloads.emplace_back(std::move(*uncompressed_msg->mutable_write_payload()->mutable_payload()));
+  }
+
+  vector<Slice> samples(payloads.begin(), payloads.end());
+  RETURN_NOT_OK_PREPEND(TrainZstdDictionary(samples, max_size, dictionary),
+                        Substitute("Unable to train a dictionary on $0 payloads",
+                                   samples.size()));
+  LOG(INFO) << "Trained a " << dictionary->size() << " byte compression dictionary on "
+            << samples.size() << " payloads";
+  return Status::OK();
+}
+
+Status LogCache::RegisterCompressionDictionary(const Slice& dictionary, uint32_t* dict_id) {
+  RETURN_NOT_OK(RegisterZstdDictionary(dictionary, dict_id));
+  return log_->PersistCompressionDictionary(*dict_id, dictionary);
+}
+
+Status LogCache::SetCompressionDictionary(const std::string& dictionary) {
+  uint32_t dict_id;
+  RETURN_NOT_OK(RegisterCompressionDictionary(dictionary, &dict_id));
+  const CompressionCodec* comp_codec = nullptr;
+  RETURN_NOT_OK(GetZstdDictionaryCodec(dict_id, &comp_codec));
+
+  LOG(INFO) << "Updating compression codec to zstd with dictionary " << dict_id;
+  codec_.store(comp_codec);
+  return Status::OK();
+}
+
 void LogCache::TruncateOpsAfter(int64_t index) {
   {
     std::unique_lock<Mutex> l(lock_);
@@ -209,14 +337,21 @@ void LogCache::TruncateOpsAfterUnlocked(int64_t index) {
   CHECK_LE(first_to_truncate, next_sequential_op_index_);
 
   // Now remove the overwritten operations.
-  for (int64_t i = first_to_truncate; i < next_sequential_op_index_; ++i) {
-    auto it = cache_.find(i);
-    if (it != cache_.end()) {
-      AccountForMessageRemovalUnlocked(it->second);
-      cache_.erase(it);
+  vector<ReplicateRefPtr> removed;
+  {
+    std::lock_guard<rw_spinlock> l(cache_lock_);
+    for (int64_t i = std::max(first_to_truncate, ring_begin_);
+         i < next_sequential_op_index_;
+         ++i) {
+      CacheEntry& entry = RingSlotUnlocked(i);
+      if (entry.msg) {
+        AccountForMessageRemovalUnlocked(entry);
+        removed.emplace_back(std::move(entry.msg));
+      }
     }
+    next_sequential_op_index_ = index + 1;
+    ring_begin_ = std::min<int64_t>(ring_begin_, next_sequential_op_index_);
   }
-  next_sequential_op_index_ = index + 1;
 }
 
 Status LogCache::UncompressMsg(const ReplicateRefPtr& msg,
@@ -334,6 +469,9 @@ Status LogCache::CompressMsg(const ReplicateMsg* msg,
   write_payload->set_payload(std::move(buffer.ToString()));
   write_payload->set_compression_codec(codec->type());
   write_payload->set_uncompressed_size(payload_str.size());
+  if (codec->dictionary_id() != 0) {
+    write_payload->set_compression_dictionary_id(codec->dictionary_id());
+  }
 
   compressed_msg->reset(rep_msg.release());
   return Status::OK();
@@ -424,7 +562,18 @@ Status LogCache::AppendOperations(const vector<ReplicateRefPtr>& msgs,
     uint32_t payload_crc32 = crc::Crc32c(
         e.msg->get()->write_payload().payload().c_str(),
         e.msg->get()->write_payload().payload().size());
+    const WritePayloadPB& payload_pb = e.msg->get()->write_payload();
+    if (!e.msg->received_bytes().empty() &&
+        (!e.msg->get()->has_write_payload() || !payload_pb.has_crc32() ||
+         payload_pb.crc32() != payload_crc32)) {
+      // Setting the checksum changes the message, so the bytes it was
+      // received as no longer match it.
+      e.msg->clear_received_bytes();
+    }
     e.msg->get()->mutable_write_payload()->set_crc32(payload_crc32);
+    e.wire_size = e.msg->received_bytes().empty() ?
+        TotalByteSizeForMessage(*e.msg->get()) :
+        TotalByteSizeForSerializedMessage(e.msg->received_bytes().size());
 
     total_msg_size += e.msg_size;
     mem_required += e.mem_usage;
@@ -465,10 +614,12 @@ Status LogCache::AppendOperations(const vector<ReplicateRefPtr>& msgs,
     borrowed_memory = parent_tracker_->LimitExceeded();
   }
 
-  for (auto& e : entries_to_insert) {
-    auto index = e.msg->get()->id().index();
-    EmplaceOrDie(&cache_, index, std::move(e));
-    next_sequential_op_index_ = index + 1;
+  {
+    std::lock_guard<rw_spinlock> cl(cache_lock_);
+    for (auto& e : entries_to_insert) {
+      auto index = e.msg->get()->id().index();
+      InsertEntryUnlocked(index, std::move(e));
+    }
   }
 
   // We drop the lock during the AsyncAppendReplicates call, since it may block
@@ -567,27 +718,27 @@ void LogCache::LogCallback(int64_t last_idx_in_batch,
 }
 
 bool LogCache::HasOpBeenWritten(int64_t index) const {
-  std::lock_guard<Mutex> l(lock_);
   return index < next_sequential_op_index_;
 }
 
 Status LogCache::LookupOpId(int64_t op_index, OpId* op_id) const {
   // First check the log cache itself.
   {
-    std::lock_guard<Mutex> l(lock_);
+    shared_lock<rw_spinlock> l(cache_lock_);
 
     // We sometimes try to look up OpIds that have never been written
     // on the local node. In that case, don't try to read the op from
     // the log reader, since it might actually race against the writing
     // of the op.
-    if (op_index >= next_sequential_op_index_) {
+    const int64_t next_sequential_op_index = next_sequential_op_index_;
+    if (op_index >= next_sequential_op_index) {
       return Status::Incomplete(Substitute("Op with index $0 is ahead of the local log "
                                            "(next sequential op: $1)",
-                                           op_index, next_sequential_op_index_));
+                                           op_index, next_sequential_op_index));
     }
-    auto iter = cache_.find(op_index);
-    if (iter != cache_.end()) {
-      *op_id = iter->second.msg->get()->id();
+    const CacheEntry* entry = FindEntryUnlocked(op_index);
+    if (entry) {
+      *op_id = entry->msg->get()->id();
       return Status::OK();
     }
   }
@@ -596,18 +747,6 @@ Status LogCache::LookupOpId(int64_t op_index, OpId* op_id) const {
   return log_->LookupOpId(op_index, op_id);
 }
 
-namespace {
-// Calculate the total byte size that will be used on the wire to replicate
-// this message as part of a consensus update request. This accounts for the
-// length delimiting and tagging of the message.
-int64_t TotalByteSizeForMessage(const ReplicateMsg& msg) {
-  int msg_size = google::protobuf::internal::WireFormatLite::LengthDelimitedSize(
-    msg.ByteSize());
-  msg_size += 1; // for the type tag
-  return msg_size;
-}
-} // anonymous namespace
-
 Status LogCache::BlockingReadOps(int64_t after_op_index,
                                  int max_size_bytes,
                                  const ReadContext& context,
@@ -617,7 +756,7 @@ Status LogCache::BlockingReadOps(int64_t after_op_index,
   MonoTime deadline =
     MonoTime::Now() + MonoDelta::FromMilliseconds(max_duration_ms);
 
-  {
+  if (after_op_index >= next_sequential_op_index_) {
     std::lock_guard<Mutex> l(lock_);
     while (after_op_index >= next_sequential_op_index_) {
       (void) next_index_cond_.WaitUntil(deadline);
@@ -631,7 +770,8 @@ Status LogCache::BlockingReadOps(int64_t after_op_index,
       // in the local log
       return Status::Incomplete(Substitute("Op with index $0 is ahead of the local log "
                                            "(next sequential op: $1)",
-                                           after_op_index, next_sequential_op_index_));
+                                           after_op_index,
+                                           next_sequential_op_index_.load()));
     }
   }
 
@@ -670,99 +810,92 @@ Status LogCache::ReadOps(int64_t after_op_index,
     return lookUpStatus;
   }
 
-  std::unique_lock<Mutex> l(lock_);
   int64_t next_index = after_op_index + 1;
 
   // Return as many operations as we can, up to the limit
   int64_t remaining_space = max_size_bytes;
-  while (remaining_space > 0 && next_index < next_sequential_op_index_) {
-
-    // If the messages the peer needs haven't been loaded into the queue yet,
-    // load them.
-    MessageCache::const_iterator iter = cache_.lower_bound(next_index);
-    if (iter == cache_.end() || iter->first != next_index) {
-      int64_t up_to;
-      if (iter == cache_.end()) {
-        // Read all the way to the current op
-        up_to = next_sequential_op_index_ - 1;
-      } else {
-        // Read up to the next entry that's in the cache
-        up_to = iter->first - 1;
-      }
-
-      l.unlock();
+  while (remaining_space > 0) {
+    int64_t up_to;
+    {
+      shared_lock<rw_spinlock> l(cache_lock_);
+      const int64_t next_sequential_op_index = next_sequential_op_index_;
 
-      vector<ReplicateMsg*> raw_replicate_ptrs;
-      RETURN_NOT_OK_PREPEND(
-        log_->ReadReplicatesInRange(
-          next_index, up_to, remaining_space, context, &raw_replicate_ptrs),
-        Substitute("Failed to read ops $0..$1", next_index, up_to));
-
-      VLOG_WITH_PREFIX_UNLOCKED(2)
-          << "Successfully read " << raw_replicate_ptrs.size() << " ops "
-          << "from disk (" << next_index << ".."
-          << (next_index + raw_replicate_ptrs.size() - 1) << ")";
-
-      if (enable_compression_on_cache_miss_ && !context.route_via_proxy) {
-        // Compress messages read from the log if:
-        // (1) the feature is enabled through
-        // enable_compression_on_cache_miss_ flag
-        // (2) the request is not for a proxy host (the payload is discarded for
-        // a proxy request and it is wasteful to compress it here)
-        vector<ReplicateMsg*> compressed_replicate_ptrs;
-        (void) CompressMsgs(raw_replicate_ptrs, &compressed_replicate_ptrs);
-
-        // TODO (vinay): Refactor this to not have to copy pointers again into
-        // original vector
-        raw_replicate_ptrs.clear();
-        raw_replicate_ptrs.reserve(compressed_replicate_ptrs.size());
-        raw_replicate_ptrs.insert(
-            raw_replicate_ptrs.end(),
-            compressed_replicate_ptrs.begin(),
-            compressed_replicate_ptrs.end());
+      // Pull contiguous messages from the cache until the size limit is achieved.
+      for (; next_index < next_sequential_op_index; next_index++) {
+        const CacheEntry* entry = FindEntryUnlocked(next_index);
+        if (!entry) {
+          break;
+        }
+        remaining_space -= entry->wire_size;
+        if (remaining_space < 0 && !messages->empty()) {
+          break;
+        }
+        messages->push_back(entry->msg);
+      }
+      if (remaining_space <= 0 || next_index >= next_sequential_op_index) {
+        break;
       }
 
-      if (!context.route_via_proxy) {
-        // Compute crc checksums for the payload that was read from the log
-        // Note that this is done _only_ for non-proxy requests because payload
-        // is discarded for proxy requests
-        for (ReplicateMsg* msg : raw_replicate_ptrs) {
-          const std::string& payload = msg->write_payload().payload();
-          uint32_t payload_crc32 = crc::Crc32c(payload.c_str(), payload.size());
-          msg->mutable_write_payload()->set_crc32(payload_crc32);
-        }
+      // The messages the peer needs haven't been loaded into the queue yet.
+      // Read up to the next entry that's in the cache, or all the way to the
+      // current op.
+      up_to = next_index + 1;
+      while (up_to < next_sequential_op_index && !FindEntryUnlocked(up_to)) {
+        up_to++;
       }
+      up_to--;
+    }
 
-      l.lock();
+    vector<ReplicateMsg*> raw_replicate_ptrs;
+    RETURN_NOT_OK_PREPEND(
+      log_->ReadReplicatesInRange(
+        next_index, up_to, remaining_space, context, &raw_replicate_ptrs),
+      Substitute("Failed to read ops $0..$1", next_index, up_to));
+
+    VLOG_WITH_PREFIX_UNLOCKED(2)
+        << "Successfully read " << raw_replicate_ptrs.size() << " ops "
+        << "from disk (" << next_index << ".."
+        << (next_index + raw_replicate_ptrs.size() - 1) << ")";
+
+    if (enable_compression_on_cache_miss_ && !context.route_via_proxy) {
+      // Compress messages read from the log if:
+      // (1) the feature is enabled through
+      // enable_compression_on_cache_miss_ flag
+      // (2) the request is not for a proxy host (the payload is discarded for
+      // a proxy request and it is wasteful to compress it here)
+      vector<ReplicateMsg*> compressed_replicate_ptrs;
+      (void) CompressMsgs(raw_replicate_ptrs, &compressed_replicate_ptrs);
+
+      // TODO (vinay): Refactor this to not have to copy pointers again into
+      // original vector
+      raw_replicate_ptrs.clear();
+      raw_replicate_ptrs.reserve(compressed_replicate_ptrs.size());
+      raw_replicate_ptrs.insert(
+          raw_replicate_ptrs.end(),
+          compressed_replicate_ptrs.begin(),
+          compressed_replicate_ptrs.end());
+    }
 
+    if (!context.route_via_proxy) {
+      // Compute crc checksums for the payload that was read from the log
+      // Note that this is done _only_ for non-proxy requests because payload
+      // is discarded for proxy requests
       for (ReplicateMsg* msg : raw_replicate_ptrs) {
-        CHECK_EQ(next_index, msg->id().index());
-
-        remaining_space -= TotalByteSizeForMessage(*msg);
-        if (remaining_space > 0 || messages->empty()) {
-          messages->push_back(make_scoped_refptr_replicate(msg));
-          next_index++;
-        } else {
-          delete msg;
-        }
+        const std::string& payload = msg->write_payload().payload();
+        uint32_t payload_crc32 = crc::Crc32c(payload.c_str(), payload.size());
+        msg->mutable_write_payload()->set_crc32(payload_crc32);
       }
+    }
 
-    } else {
-      // Pull contiguous messages from the cache until the size limit is achieved.
-      for (; iter != cache_.end(); ++iter) {
-        const ReplicateRefPtr& msg = iter->second.msg;
-        int64_t index = msg->get()->id().index();
-        if (index != next_index) {
-          continue;
-        }
-
-        remaining_space -= TotalByteSizeForMessage(*msg->get());
-        if (remaining_space < 0 && !messages->empty()) {
-          break;
-        }
+    for (ReplicateMsg* msg : raw_replicate_ptrs) {
+      CHECK_EQ(next_index, msg->id().index());
 
-        messages->push_back(msg);
+      remaining_space -= TotalByteSizeForMessage(*msg);
+      if (remaining_space > 0 || messages->empty()) {
+        messages->push_back(make_scoped_refptr_replicate(msg));
         next_index++;
+      } else {
+        delete msg;
       }
     }
   }
@@ -783,45 +916,51 @@ void LogCache::EvictSomeUnlocked(int64_t stop_after_index, int64_t bytes_to_evic
                       << ": before state: " << ToStringUnlocked();
 
   int64_t bytes_evicted = 0;
-  for (auto iter = cache_.begin(); iter != cache_.end();) {
-    const CacheEntry& entry = (*iter).second;
-    const ReplicateRefPtr& msg = entry.msg;
-    VLOG_WITH_PREFIX_UNLOCKED(2) << "considering for eviction: " << msg->get()->id();
-    int64_t msg_index = msg->get()->id().index();
-    if (msg_index == 0) {
-      // Always keep our special '0' op.
-      ++iter;
-      continue;
-    }
+  vector<ReplicateRefPtr> evicted;
+  {
+    std::lock_guard<rw_spinlock> l(cache_lock_);
+    const int64_t end = std::min<int64_t>(
+        { stop_after_index + 1, min_pinned_op_index_, next_sequential_op_index_ });
+    for (int64_t index = ring_begin_; index < end; index++) {
+      CacheEntry& entry = RingSlotUnlocked(index);
+      if (!entry.msg) {
+        continue;
+      }
+      const ReplicateRefPtr& msg = entry.msg;
+      VLOG_WITH_PREFIX_UNLOCKED(2) << "considering for eviction: " << msg->get()->id();
+
+      // Readers only take references to cached messages while holding
+      // 'cache_lock_', so this cannot race with one doing so.
+      if (!msg->HasOneRef()) {
+        VLOG_WITH_PREFIX_UNLOCKED(2) << "Evicting cache: cannot remove " << msg->get()->id()
+                                     << " because it is in-use by a peer.";
+        continue;
+      }
 
-    if (msg_index > stop_after_index || msg_index >= min_pinned_op_index_) {
-      break;
-    }
+      VLOG_WITH_PREFIX_UNLOCKED(2) << "Evicting cache. Removing: " << msg->get()->id();
+      bytes_evicted += AccountForMessageRemovalUnlocked(entry);
+      evicted.emplace_back(std::move(entry.msg));
 
-    if (!msg->HasOneRef()) {
-      VLOG_WITH_PREFIX_UNLOCKED(2) << "Evicting cache: cannot remove " << msg->get()->id()
-                                   << " because it is in-use by a peer.";
-      ++iter;
-      continue;
+      if (bytes_evicted >= bytes_to_evict) {
+        break;
+      }
     }
 
-    VLOG_WITH_PREFIX_UNLOCKED(2) << "Evicting cache. Removing: " << msg->get()->id();
-    AccountForMessageRemovalUnlocked(entry);
-    bytes_evicted += entry.mem_usage;
-    cache_.erase(iter++);
-
-    if (bytes_evicted >= bytes_to_evict) {
-      break;
+    // Skip over the slots which are no longer in use.
+    while (ring_begin_ < next_sequential_op_index_ && !RingSlotUnlocked(ring_begin_).msg) {
+      ring_begin_++;
     }
   }
   VLOG_WITH_PREFIX_UNLOCKED(1) << "Evicting log cache: after state: " << ToStringUnlocked();
 }
 
-void LogCache::AccountForMessageRemovalUnlocked(const LogCache::CacheEntry& entry) {
+int64_t LogCache::AccountForMessageRemovalUnlocked(const LogCache::CacheEntry& entry) {
+  const int64_t encoding_bytes = entry.msg->UntrackEncoding();
   tracker_->Release(entry.mem_usage);
   metrics_.log_cache_size->DecrementBy(entry.mem_usage);
   metrics_.log_cache_msg_size->DecrementBy(entry.msg_size);
   metrics_.log_cache_num_ops->Decrement();
+  return entry.mem_usage + encoding_bytes;
 }
 
 int64_t LogCache::BytesUsed() const {
@@ -866,11 +1005,16 @@ void LogCache::DumpToLog() const {
 
 void LogCache::DumpToStrings(vector<string>* lines) const {
   std::lock_guard<Mutex> lock(lock_);
+  shared_lock<rw_spinlock> l(cache_lock_);
   int counter = 0;
   lines->push_back(ToStringUnlocked());
   lines->push_back("Messages:");
-  for (const auto& entry : cache_) {
-    const ReplicateMsg* msg = entry.second.msg->get();
+  for (int64_t index = 0;
+       index < next_sequential_op_index_;
+       index = std::max(index + 1, ring_begin_)) {
+    const CacheEntry* entry = FindEntryUnlocked(index);
+    if (!entry) continue;
+    const ReplicateMsg* msg = entry->msg->get();
     lines->push_back(
       Substitute("Message[$0] $1.$2 : REPLICATE. Type: $3, Size: $4",
                  counter++, msg->id().term(), msg->id().index(),
@@ -882,14 +1026,18 @@ void LogCache::DumpToStrings(vector<string>* lines) const {
 void LogCache::DumpToHtml(std::ostream& out) const {
   using std::endl;
 
-  std::lock_guard<Mutex> lock(lock_);
+  shared_lock<rw_spinlock> l(cache_lock_);
   out << "<h3>Messages:</h3>" << endl;
   out << "<table>" << endl;
   out << "<tr><th>Entry</th><th>OpId</th><th>Type</th><th>Size</th><th>Status</th></tr>" << endl;
 
   int counter = 0;
-  for (const auto& entry : cache_) {
-    const ReplicateMsg* msg = entry.second.msg->get();
+  for (int64_t index = 0;
+       index < next_sequential_op_index_;
+       index = std::max(index + 1, ring_begin_)) {
+    const CacheEntry* entry = FindEntryUnlocked(index);
+    if (!entry) continue;
+    const ReplicateMsg* msg = entry->msg->get();
     out << Substitute("<tr><th>$0</th><th>$1.$2</th><td>REPLICATE $3</td>"
                       "<td>$4</td><td>$5</td></tr>",
                       counter++, msg->id().term(), msg->id().index(),
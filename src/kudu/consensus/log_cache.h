@@ -17,9 +17,9 @@
 #ifndef KUDU_CONSENSUS_LOG_CACHE_H
 #define KUDU_CONSENSUS_LOG_CACHE_H
 
+#include <atomic>
 #include <cstdint>
 #include <iosfwd>
-#include <map>
 #include <memory>
 #include <string>
 #include <vector>
@@ -32,6 +32,7 @@
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/util/condition_variable.h"
 #include "kudu/util/faststring.h"
+#include "kudu/util/locks.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/mutex.h"
 #include "kudu/util/status.h"
@@ -41,6 +42,7 @@ namespace kudu {
 
 class CompressionCodec;
 class MemTracker;
+class Slice;
 
 namespace log {
 class Log;
@@ -172,6 +174,21 @@ class LogCache {
   // Enable (or disable) compression of messages read from log
   Status EnableCompressionOnCacheMiss(bool enable);
 
+  // Trains a zstd dictionary of at most 'max_size' bytes on the payloads of
+  // the most recent write ops in the cache.
+  Status TrainCompressionDictionary(size_t max_size, std::string* dictionary);
+
+  // Registers 'dictionary' for uncompressing payloads, setting 'dict_id' to
+  // its id, and persists it alongside the log segments, so that it is
+  // registered again when the log is reopened.
+  Status RegisterCompressionDictionary(const Slice& dictionary, uint32_t* dict_id);
+
+  // Registers 'dictionary' as above and switches to compressing payloads with
+  // zstd using that dictionary. The leader sends the dictionary to each peer
+  // along with the first ops compressed with it, until the peer confirms it
+  // has registered it (see PeerMessageQueue::RequestForPeer()).
+  Status SetCompressionDictionary(const std::string& dictionary);
+
  private:
   FRIEND_TEST(LogCacheTest, TestAppendAndGetMessages);
   FRIEND_TEST(LogCacheTest, TestGlobalMemoryLimit);
@@ -210,16 +227,34 @@ class LogCache {
     // The uncompressed size of the msg. If msg is not compressed, then it is
     // same as mem_usage
     int64_t msg_size;
+    // The size of msg on the wire, as part of a consensus update request.
+    int64_t wire_size;
   };
 
+  // Returns the entry for the op with index 'index', or nullptr if it is not
+  // cached. Requires 'cache_lock_' to be held, in either mode.
+  const CacheEntry* FindEntryUnlocked(int64_t index) const;
+
+  // Returns the slot of 'ring_' for the op with index 'index'.
+  CacheEntry& RingSlotUnlocked(int64_t index) {
+    return ring_[index & (ring_.size() - 1)];
+  }
+
+  // Caches 'entry' as the op with index 'index', which must be the next
+  // sequential op, growing 'ring_' if needed. The op's encoding is charged to
+  // 'tracker_' from then on. Requires 'cache_lock_' to be held exclusively.
+  void InsertEntryUnlocked(int64_t index, CacheEntry entry);
+
   // Try to evict the oldest operations from the queue, stopping either when
   // 'bytes_to_evict' bytes have been evicted, or the op with index
   // 'stop_after_index' has been evicted, whichever comes first.
   void EvictSomeUnlocked(int64_t stop_after_index, int64_t bytes_to_evict);
 
   // Update metrics and MemTracker to account for the removal of the
-  // given message.
-  void AccountForMessageRemovalUnlocked(const CacheEntry& entry);
+  // given message, including the encoding the peers may have built for it
+  // (see RefCountedReplicate::TrackEncoding()). Returns the number of bytes
+  // released.
+  int64_t AccountForMessageRemovalUnlocked(const CacheEntry& entry);
 
   void TruncateOpsAfterUnlocked(int64_t index);
 
@@ -243,17 +278,35 @@ class LogCache {
   // The id of the tablet.
   const std::string tablet_id_;
 
+  // Serializes the writers of the cache: appends, truncations and evictions.
+  // Readers of cached ops do not take it.
   mutable Mutex  lock_;
   ConditionVariable next_index_cond_;
 
-  // An ordered map that serves as the buffer for the cached messages.
-  // Maps from log index -> ReplicateMsg
-  typedef std::map<uint64_t, CacheEntry> MessageCache;
-  MessageCache cache_;
+  // Protects 'ring_' and 'ring_begin_'. Readers take it in shared mode, so
+  // that they do not block each other. Writers take it exclusively, with
+  // 'lock_' held, only while updating the slots they change. Messages removed
+  // from the cache are released after dropping it.
+  mutable rw_spinlock cache_lock_;
+
+  // The fake message at index 0, which is always cached, since this
+  // simplifies a lot of our code paths elsewhere.
+  CacheEntry zero_op_entry_;
+
+  // The cached messages, in a ring buffer indexed by op index modulo its size,
+  // which is a power of two. Only the slots of the ops in
+  // [ring_begin_, next_sequential_op_index_) may be in use. The slots of the
+  // ops in that range which are not cached, e.g. because they were evicted
+  // while an earlier op was still in use by a peer, have a null 'msg'.
+  std::vector<CacheEntry> ring_;
+  int64_t ring_begin_;
 
   // The next log index to append. Each append operation must either
   // start with this log index, or go backward (but never skip forward).
-  int64_t next_sequential_op_index_;
+  //
+  // Only modified with both 'lock_' and 'cache_lock_' held, so that it may be
+  // read while holding either of them, or neither when a stale value is fine.
+  std::atomic<int64_t> next_sequential_op_index_;
 
   // Any operation with an index >= min_pinned_op_ may not be
   // evicted from the cache. This is used to prevent ops from being evicted
@@ -25,10 +25,14 @@
 #include "kudu/consensus/opid_util.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/ref_counted.h"
+#include "kudu/util/metrics.h"
 #include "kudu/util/status.h"
 #include "kudu/util/test_macros.h"
 #include "kudu/util/test_util.h"
 
+METRIC_DECLARE_counter(log_index_chunk_mmap_for_read);
+METRIC_DECLARE_counter(log_index_chunk_readahead);
+
 namespace kudu {
 namespace log {
 
@@ -117,5 +121,57 @@ TEST_F(LogIndexTest, TestMultiSegmentWithGC) {
   VerifyNotFound(2500000);
 }
 
+class LogIndexChunkCacheTest : public LogIndexTest {
+ public:
+  virtual void SetUp() override {
+    LogIndexTest::SetUp();
+    metric_entity_ = METRIC_ENTITY_server.Instantiate(&metric_registry_, "log-index-test");
+    ASSERT_OK(index_->OpenAllChunksOnStartup(env_, metric_entity_));
+    index_->SetNumEntriesPerChunkForTest(kEntriesPerChunk);
+    index_->SetNumMmapChunks(3);
+
+    // Fill up chunks 0 through 5.
+    for (int i = 1; i < kEntriesPerChunk * 6; i++) {
+      ASSERT_OK(AddEntry(MakeOpId(1, i), 1, i * 100));
+    }
+  }
+
+ protected:
+  int64_t CounterValue(CounterPrototype* prototype) {
+    return metric_entity_->FindOrCreateCounter(prototype)->value();
+  }
+
+  static const int kEntriesPerChunk = 10;
+  MetricRegistry metric_registry_;
+  scoped_refptr<MetricEntity> metric_entity_;
+};
+
+// Test that two readers lagging at different chunks don't keep evicting each
+// other's chunk, as long as there is room for both of them.
+TEST_F(LogIndexChunkCacheTest, TestLaggingReadersDoNotThrash) {
+  for (int i = 0; i < 10; i++) {
+    VerifyEntry(MakeOpId(1, 5), 1, 500);
+    VerifyEntry(MakeOpId(1, 25), 1, 2500);
+  }
+  ASSERT_EQ(2, CounterValue(&METRIC_log_index_chunk_mmap_for_read));
+
+  // The latest chunk stays mapped for writes.
+  ASSERT_OK(AddEntry(MakeOpId(1, kEntriesPerChunk * 6 - 1), 1, 12345));
+  VerifyEntry(MakeOpId(1, kEntriesPerChunk * 6 - 1), 1, 12345);
+  ASSERT_EQ(2, CounterValue(&METRIC_log_index_chunk_mmap_for_read));
+}
+
+// Test that a sequential reader gets the next chunk mapped before it reaches it.
+TEST_F(LogIndexChunkCacheTest, TestSequentialReadAhead) {
+  for (int i = 1; i < kEntriesPerChunk * 2 + kEntriesPerChunk / 2; i++) {
+    VerifyEntry(MakeOpId(1, i), 1, i * 100);
+  }
+  // Chunks 0 and 1 are mapped on demand. By the end of chunk 1, the reader
+  // is known to be sequential, so chunk 2 is mapped ahead of time and reading
+  // the first half of it doesn't need to map anything.
+  ASSERT_EQ(2, CounterValue(&METRIC_log_index_chunk_mmap_for_read));
+  ASSERT_EQ(1, CounterValue(&METRIC_log_index_chunk_readahead));
+}
+
 } // namespace log
 } // namespace kudu
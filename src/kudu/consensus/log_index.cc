@@ -25,6 +25,12 @@
 //
 // When the log is GCed, we remove any index chunks which are no longer needed, and
 // unmap them.
+//
+// Only a bounded number of chunks is mmapped at a time. Mapped chunks are kept in an
+// LRU list, and reads of an unmapped chunk evict the least recently used one (but
+// never the latest chunk, which receives all writes). Runs of sequential reads are
+// detected without the readers having to identify themselves, and the following
+// chunk is mapped, and the kernel asked to read it in, shortly before they get there.
 
 #include "kudu/consensus/log_index.h"
 
@@ -42,6 +48,7 @@
 #include <utility>
 #include <vector>
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 
 #include "kudu/consensus/opid_util.h"
@@ -52,7 +59,15 @@
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/util/env.h"
 #include "kudu/util/errno.h"
-#include "kudu/util/env.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/logging.h"
+#include "kudu/util/mem_tracker.h"
+
+DEFINE_bool(log_index_chunk_readahead, true,
+            "Whether to mmap the next log index chunk ahead of time when a chunk is "
+            "being read sequentially, e.g. by a peer catching up.");
+TAG_FLAG(log_index_chunk_readahead, advanced);
+TAG_FLAG(log_index_chunk_readahead, runtime);
 
 using std::string;
 using std::vector;
@@ -64,6 +79,14 @@ METRIC_DEFINE_counter(server, log_index_chunk_mmap_for_read,
                       "Number of times an index chunk had to be mmapeed "
                       "before a read operation.");
 
+METRIC_DEFINE_counter(server, log_index_chunk_readahead,
+                      "Number of index chunks mmapped ahead of sequential reads",
+                      kudu::MetricUnit::kUnits,
+                      "Number of times an index chunk was mmapped ahead of time "
+                      "for a sequential reader.");
+
+static const char kParentMemTrackerId[] = "log_index";
+
 namespace kudu {
 namespace log {
 
@@ -86,23 +109,32 @@ struct PhysicalEntry {
 class LogIndex::IndexChunk : public RefCountedThreadSafe<LogIndex::IndexChunk> {
  public:
   // Construct an index chunk.
+  // 'chunk_idx' is the index of this chunk
   // 'path' is the full path for the underlying file
   // 'size' is the configured size for this index chunk/file
-  explicit IndexChunk(string path, int64_t size);
+  IndexChunk(int64_t chunk_idx, string path, int64_t size);
   ~IndexChunk();
 
   // Open the chunk file
   Status Open();
 
-  // Memory map the chunk file
+  // Memory map the chunk file, returning the new mapping in 'mapping'
+  // without installing it. Safe to call concurrently with anything but
+  // Open().
+  Status Mmap(uint8_t** mapping) const;
+
+  // Unmap a mapping returned by Mmap() or ReleaseMapping()
+  void Munmap(uint8_t* mapping) const;
+
+  // Install 'mapping' as the chunk's mapping
   // This is not thread safe with GetEntry() and SetEntry(). The caller should
   // synchronize correctly
-  Status Mmap();
+  void SetMapping(uint8_t* mapping);
 
-  // Unmap the chunk file from memory
+  // Detach and return the chunk's mapping, which the caller should unmap
   // This is not thread safe with GetEntry() and SetEntry(). The caller should
   // synchronize correctly
-  void Munmap();
+  uint8_t* ReleaseMapping();
 
   // Get an entry from the memory mapped cunk file for a given index
   void GetEntry(int entry_index, PhysicalEntry* ret);
@@ -113,11 +145,23 @@ class LogIndex::IndexChunk : public RefCountedThreadSafe<LogIndex::IndexChunk> {
   // Is this chunk file memory mapped?
   bool IsMmapped() const;
 
+  // Ask the kernel to read in 'mapping' of the chunk file asynchronously
+  void WillNeed(uint8_t* mapping) const;
+
+  int64_t chunk_idx() const { return chunk_idx_; }
+  int64_t size() const { return size_; }
+
+  // Position in LogIndex::mapped_chunks_lru_, if mapped
+  std::list<int64_t>::iterator lru_pos() const { return lru_pos_; }
+  void set_lru_pos(std::list<int64_t>::iterator pos) { lru_pos_ = pos; }
+
  private:
+  const int64_t chunk_idx_; // index of this chunk
   const string path_; // path of the underlying chunk file
   int fd_; // file descriptor
   uint8_t* mapping_; // mmapped memory location of the chunk
   int64_t size_; // configured size for the chunk file
+  std::list<int64_t>::iterator lru_pos_;
 };
 
 namespace  {
@@ -130,8 +174,8 @@ Status CheckError(int rc, const char* operation) {
 }
 } // anonymous namespace
 
-LogIndex::IndexChunk::IndexChunk(std::string path, int64_t size)
-    : path_(std::move(path)), fd_(-1), mapping_(nullptr), size_(size) {}
+LogIndex::IndexChunk::IndexChunk(int64_t chunk_idx, std::string path, int64_t size)
+    : chunk_idx_(chunk_idx), path_(std::move(path)), fd_(-1), mapping_(nullptr), size_(size) {}
 
 LogIndex::IndexChunk::~IndexChunk() {
   if (mapping_ != nullptr) {
@@ -158,33 +202,38 @@ Status LogIndex::IndexChunk::Open() {
   return Status::OK();
 }
 
-Status LogIndex::IndexChunk::Mmap() {
+Status LogIndex::IndexChunk::Mmap(uint8_t** mapping) const {
   if (fd_ == -1) {
     return Status::IOError("Chunk should be opened before mmapping");
   }
 
-  if (mapping_) {
-    // Already mmaped, return
-    return Status::OK();
-  }
-
-  mapping_ = static_cast<uint8_t*>(mmap(nullptr, size_, PROT_READ | PROT_WRITE,
-                                        MAP_SHARED, fd_, 0));
-  if (mapping_ == nullptr) {
+  void* addr = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  if (addr == MAP_FAILED) {
     int err = errno;
     return Status::IOError("Unable to mmap()", ErrnoToString(err), err);
   }
+  *mapping = static_cast<uint8_t*>(addr);
 
   return Status::OK();
 }
 
-void LogIndex::IndexChunk::Munmap() {
-  if (mapping_ != nullptr) {
-    munmap(mapping_, size_);
-    mapping_ = nullptr;
+void LogIndex::IndexChunk::Munmap(uint8_t* mapping) const {
+  if (mapping != nullptr) {
+    munmap(mapping, size_);
   }
 }
 
+void LogIndex::IndexChunk::SetMapping(uint8_t* mapping) {
+  DCHECK(mapping_ == nullptr);
+  mapping_ = mapping;
+}
+
+uint8_t* LogIndex::IndexChunk::ReleaseMapping() {
+  uint8_t* mapping = mapping_;
+  mapping_ = nullptr;
+  return mapping;
+}
+
 void LogIndex::IndexChunk::GetEntry(int entry_index, PhysicalEntry* ret) {
   DCHECK_GE(fd_, 0) << "Must Open() first";
   memcpy(ret, mapping_ + sizeof(PhysicalEntry) * entry_index, sizeof(PhysicalEntry));
@@ -199,15 +248,34 @@ bool LogIndex::IndexChunk::IsMmapped() const {
   return (mapping_ != nullptr);
 }
 
+void LogIndex::IndexChunk::WillNeed(uint8_t* mapping) const {
+  DCHECK(mapping);
+  if (madvise(mapping, size_, MADV_WILLNEED) != 0) {
+    PLOG(WARNING) << "madvise() failed on index chunk " << path_;
+  }
+}
+
 ////////////////////////////////////////////////////////////
 // LogIndex
 ////////////////////////////////////////////////////////////
 
 LogIndex::LogIndex(std::string base_dir)
   : base_dir_(std::move(base_dir)),
-    mmap_for_reads_(nullptr) {}
+    mmap_for_reads_(nullptr) {
+  mem_tracker_ = MemTracker::CreateTracker(
+      -1, Substitute("$0:$1", kParentMemTrackerId, base_dir_),
+      MemTracker::FindOrCreateGlobalTracker(-1, kParentMemTrackerId));
+}
 
 LogIndex::~LogIndex() {
+  vector<DetachedMapping> to_unmap;
+  {
+    std::lock_guard<simple_spinlock> l(open_chunks_lock_);
+    while (!mapped_chunks_lru_.empty()) {
+      UnmapChunkUnlocked(FindOrDie(open_chunks_, mapped_chunks_lru_.front()).get(), &to_unmap);
+    }
+  }
+  UnmapDetached(to_unmap);
 }
 
 string LogIndex::GetChunkPath(int64_t chunk_idx) {
@@ -221,9 +289,11 @@ Status LogIndex::OpenAllChunksOnStartup(
   std::vector<std::string> children;
   RETURN_NOT_OK(env->GetChildren(base_dir_, &children));
 
-  // Initialize metric counter
+  // Initialize metric counters
   mmap_for_reads_ =
     metric_entity->FindOrCreateCounter(&METRIC_log_index_chunk_mmap_for_read);
+  readahead_chunks_ =
+    metric_entity->FindOrCreateCounter(&METRIC_log_index_chunk_readahead);
 
   for (const auto& fname: children) {
     if (fname.find("index.") != 0) {
@@ -250,14 +320,20 @@ Status LogIndex::OpenAllChunksOnStartup(
 
   // mmap 'kNumChunksToMmap' chunks. Note that the latest chunks are mmapped
   // (chunks having the highest chunk_idx)
-  int64_t mmapped_chunks = 0;
-  for (auto rit = open_chunks_.rbegin(); rit != open_chunks_.rend(); ++rit) {
-    if (mmapped_chunks == kNumChunksToMmap) {
-      break;
+  vector<scoped_refptr<IndexChunk>> to_map;
+  {
+    std::lock_guard<simple_spinlock> l(open_chunks_lock_);
+    for (auto rit = open_chunks_.rbegin(); rit != open_chunks_.rend(); ++rit) {
+      if (mapped_chunks_lru_.size() + to_map.size() >= kNumChunksToMmap) {
+        break;
+      }
+      if (!rit->second->IsMmapped()) {
+        to_map.push_back(rit->second);
+      }
     }
-
-    RETURN_NOT_OK(rit->second->Mmap());
-    mmapped_chunks++;
+  }
+  for (const auto& chunk : to_map) {
+    RETURN_NOT_OK(MapChunk(chunk, /*for_readahead=*/false));
   }
 
   return Status::OK();
@@ -267,31 +343,18 @@ void LogIndex::SetNumMmapChunks(int64_t num_chunks) {
   if (num_chunks <= 0)
     return;
 
-  std::lock_guard<simple_spinlock> l(open_chunks_lock_);
-  kNumChunksToMmap = num_chunks;
-
-  // If necessary, unmap additional chunks
-  if (open_chunks_.size() <= kNumChunksToMmap) {
-    return;
-  }
-
-  // get the number of chunks that are currently mmapped
-  int64_t num_chunks_mmapped = 0;
-  for (auto it = open_chunks_.begin(); it != open_chunks_.end(); ++it) {
-    if (it->second->IsMmapped()) {
-      num_chunks_mmapped++;
-    }
-  }
+  vector<DetachedMapping> to_unmap;
+  {
+    std::lock_guard<simple_spinlock> l(open_chunks_lock_);
+    kNumChunksToMmap = num_chunks;
 
-  // unmap additional chunks (starting with the oldest chunks)
-  for (auto it = open_chunks_.begin();
-      it != open_chunks_.end() && num_chunks_mmapped > kNumChunksToMmap;
-      ++it) {
-    if (it->second->IsMmapped()) {
-      it->second->Munmap();
-      num_chunks_mmapped--;
+    // If necessary, unmap additional chunks (starting with the least recently
+    // used ones)
+    while (mapped_chunks_lru_.size() > kNumChunksToMmap &&
+           EvictChunkUnlocked(/*for_readahead=*/false, &to_unmap)) {
     }
   }
+  UnmapDetached(to_unmap);
 }
 
 void LogIndex::SetNumEntriesPerChunkForTest(int64_t entries) {
@@ -300,41 +363,139 @@ void LogIndex::SetNumEntriesPerChunkForTest(int64_t entries) {
   kEntriesPerIndexChunk = entries;
 }
 
-Status LogIndex::MmapChunk(scoped_refptr<IndexChunk> *chunk) {
-  if (open_chunks_.size() < kNumChunksToMmap) {
-    RETURN_NOT_OK((*chunk)->Mmap());
-    return Status::OK();
+Status LogIndex::MapChunk(const scoped_refptr<IndexChunk>& chunk, bool for_readahead) {
+  // Map the chunk without holding the lock: mmap() and madvise() may block
+  // on mmap_sem or on IO, and readers and writers of other chunks spin on
+  // 'open_chunks_lock_'.
+  uint8_t* mapping;
+  RETURN_NOT_OK(chunk->Mmap(&mapping));
+  if (for_readahead) {
+    chunk->WillNeed(mapping);
   }
 
-  // The victim that needs to be unmapped is the oldest chunk (i.e the chunk
-  // with the oldest chunk_idx). See documentation in log_index.h for more
-  // details.
-  //
-  // Note that we have to reverse iterate through the open_chunks_ while the
-  // caller is holding onto the open_chunks_lock_. With 'open_chunks_' map
-  // having only a few hundred entries, this should be acceptable (to keep
-  // things simple)
-  int64_t num_chunks_mmapped = 0;
-  auto rit = open_chunks_.rbegin();
-  for (; rit != open_chunks_.rend(); ++rit) {
-    if (rit->second->IsMmapped()) {
-      num_chunks_mmapped++;
+  Status s;
+  vector<DetachedMapping> to_unmap;
+  {
+    std::lock_guard<simple_spinlock> l(open_chunks_lock_);
+    if (PREDICT_FALSE(!ContainsKey(open_chunks_, chunk->chunk_idx()))) {
+      s = Status::NotFound("index chunk was GCed");
+    } else if (chunk->IsMmapped()) {
+      // Someone else mapped the chunk in the meantime.
+      TouchChunkUnlocked(chunk.get());
+    } else {
+      // If there are 'kNumChunksToMmap' chunks already mmapped, then unmap
+      // the 'victim' chunk. See documentation in log_index.h for more details.
+      bool has_room = true;
+      while (mapped_chunks_lru_.size() >= kNumChunksToMmap) {
+        if (!EvictChunkUnlocked(for_readahead, &to_unmap)) {
+          has_room = !for_readahead;
+          break;
+        }
+      }
+      if (has_room) {
+        InstallMappingUnlocked(chunk.get(), mapping);
+        mapping = nullptr;
+        if (for_readahead && readahead_chunks_) {
+          readahead_chunks_->Increment();
+        }
+      }
     }
+  }
+  chunk->Munmap(mapping);
+  UnmapDetached(to_unmap);
+  return s;
+}
 
-    if (num_chunks_mmapped == kNumChunksToMmap)
-      break;
+void LogIndex::InstallMappingUnlocked(IndexChunk* chunk, uint8_t* mapping) {
+  DCHECK(!chunk->IsMmapped());
+  chunk->SetMapping(mapping);
+  chunk->set_lru_pos(mapped_chunks_lru_.insert(mapped_chunks_lru_.begin(),
+                                               chunk->chunk_idx()));
+  mem_tracker_->Consume(chunk->size());
+}
+
+void LogIndex::UnmapChunkUnlocked(IndexChunk* chunk, vector<DetachedMapping>* to_unmap) {
+  if (!chunk->IsMmapped()) {
+    return;
   }
+  mapped_chunks_lru_.erase(chunk->lru_pos());
+  to_unmap->push_back({ chunk->ReleaseMapping(), chunk->size() });
+  mem_tracker_->Release(chunk->size());
+}
 
-  // If there are 'kNumChunksToMmap' chunks already mmapped, then unmap the
-  // 'victim' chunk
-  if (num_chunks_mmapped == kNumChunksToMmap && rit != open_chunks_.rend()) {
-    rit->second->Munmap();
+void LogIndex::UnmapDetached(const vector<DetachedMapping>& mappings) {
+  for (const DetachedMapping& m : mappings) {
+    munmap(m.addr, m.size);
   }
+}
 
-  // Now mmap the provided 'chunk'
-  RETURN_NOT_OK((*chunk)->Mmap());
+bool LogIndex::EvictChunkUnlocked(bool for_readahead,
+                                  vector<DetachedMapping>* to_unmap) {
+  if (mapped_chunks_lru_.empty()) {
+    return false;
+  }
+  const int64_t latest_chunk_idx = open_chunks_.rbegin()->first;
+  auto is_being_read = [&](int64_t chunk_idx) {
+    for (const ReadStream& stream : read_streams_) {
+      if (stream.chunk_idx == chunk_idx) return true;
+    }
+    return false;
+  };
+
+  for (auto rit = mapped_chunks_lru_.rbegin(); rit != mapped_chunks_lru_.rend(); ++rit) {
+    int64_t chunk_idx = *rit;
+    if (chunk_idx == latest_chunk_idx) continue;
+    if (for_readahead && is_being_read(chunk_idx)) continue;
+    UnmapChunkUnlocked(FindOrDie(open_chunks_, chunk_idx).get(), to_unmap);
+    return true;
+  }
+  if (for_readahead) {
+    return false;
+  }
 
-  return Status::OK();
+  // Only the latest chunk is left.
+  UnmapChunkUnlocked(FindOrDie(open_chunks_, latest_chunk_idx).get(), to_unmap);
+  return true;
+}
+
+void LogIndex::TouchChunkUnlocked(IndexChunk* chunk) {
+  DCHECK(chunk->IsMmapped());
+  mapped_chunks_lru_.splice(mapped_chunks_lru_.begin(), mapped_chunks_lru_, chunk->lru_pos());
+}
+
+scoped_refptr<LogIndex::IndexChunk> LogIndex::MaybeReadAheadUnlocked(int64_t index) {
+  // The number of sequential reads, and how far into its chunk a stream has
+  // to be, before the next chunk is mapped.
+  static const int64_t kMinSequentialReads = 16;
+  const int64_t readahead_start = kEntriesPerIndexChunk - kEntriesPerIndexChunk / 4;
+
+  ReadStream* stream = nullptr;
+  for (ReadStream& s : read_streams_) {
+    if (s.next_index == index) {
+      stream = &s;
+      break;
+    }
+  }
+  if (!stream) {
+    stream = &read_streams_[next_read_stream_];
+    next_read_stream_ = (next_read_stream_ + 1) % kMaxReadStreams;
+    stream->sequential_reads = 0;
+  }
+  stream->next_index = index + 1;
+  stream->chunk_idx = index / kEntriesPerIndexChunk;
+  stream->sequential_reads++;
+
+  if (!FLAGS_log_index_chunk_readahead ||
+      stream->sequential_reads < kMinSequentialReads ||
+      index % kEntriesPerIndexChunk < readahead_start) {
+    return nullptr;
+  }
+
+  scoped_refptr<IndexChunk> next;
+  if (!FindCopy(open_chunks_, stream->chunk_idx + 1, &next) || next->IsMmapped()) {
+    return nullptr;
+  }
+  return next;
 }
 
 Status LogIndex::OpenChunk(
@@ -343,7 +504,7 @@ Status LogIndex::OpenChunk(
   string path = GetChunkPath(chunk_idx);
   int64_t size = kEntriesPerIndexChunk * sizeof(PhysicalEntry);
 
-  scoped_refptr<IndexChunk> new_chunk(new IndexChunk(path, size));
+  scoped_refptr<IndexChunk> new_chunk(new IndexChunk(chunk_idx, path, size));
   RETURN_NOT_OK(new_chunk->Open());
 
   chunk->swap(new_chunk);
@@ -356,7 +517,7 @@ Status LogIndex::OpenAndInsertChunk(
     bool should_mmap) {
   RETURN_NOT_OK_PREPEND(OpenChunk(chunk_idx, chunk),
                         "Couldn't open index chunk");
-  std::lock_guard<simple_spinlock> l(open_chunks_lock_);
+  std::unique_lock<simple_spinlock> l(open_chunks_lock_);
   if (PREDICT_FALSE(ContainsKey(open_chunks_, chunk_idx))) {
     // Someone else opened the chunk in the meantime.
     // We'll just return that one.
@@ -365,9 +526,10 @@ Status LogIndex::OpenAndInsertChunk(
   }
 
   InsertOrDie(&open_chunks_, chunk_idx, *chunk);
+  l.unlock();
 
   if (should_mmap) {
-    RETURN_NOT_OK(MmapChunk(chunk));
+    RETURN_NOT_OK(MapChunk(*chunk, /*for_readahead=*/false));
   }
 
   return Status::OK();
@@ -408,10 +570,13 @@ Status LogIndex::AddEntry(const LogIndexEntry& entry) {
 
   {
     // Grab the 'open_chunks_lock_' to ensure that the chunk does not get
-    // unmapped
-    std::lock_guard<simple_spinlock> l(open_chunks_lock_);
-    if (PREDICT_FALSE(!chunk->IsMmapped())) {
-      RETURN_NOT_OK(MmapChunk(&chunk));
+    // unmapped. The chunk is mapped with the lock released, so it may have
+    // been evicted again by the time the lock is re-acquired.
+    std::unique_lock<simple_spinlock> l(open_chunks_lock_);
+    while (PREDICT_FALSE(!chunk->IsMmapped())) {
+      l.unlock();
+      RETURN_NOT_OK(MapChunk(chunk, /*for_readahead=*/false));
+      l.lock();
     }
     chunk->SetEntry(index_in_chunk, phys);
     VLOG(3) << "Added log index entry " << entry.ToString();
@@ -428,20 +593,34 @@ Status LogIndex::GetEntry(int64_t index, LogIndexEntry* entry) {
   int index_in_chunk = index % kEntriesPerIndexChunk;
   DCHECK_LT(index_in_chunk, kEntriesPerIndexChunk);
   PhysicalEntry phys;
+  scoped_refptr<IndexChunk> readahead_chunk;
 
   {
     // Grab the 'open_chunks_lock_' to ensure that the chunk does not get
-    // unmapped
-    std::lock_guard<simple_spinlock> l(open_chunks_lock_);
-    if (PREDICT_FALSE(!chunk->IsMmapped())) {
-      RETURN_NOT_OK(MmapChunk(&chunk));
-
+    // unmapped. See AddEntry() for why mapping is retried.
+    std::unique_lock<simple_spinlock> l(open_chunks_lock_);
+    if (PREDICT_TRUE(chunk->IsMmapped())) {
+      TouchChunkUnlocked(chunk.get());
+    }
+    while (PREDICT_FALSE(!chunk->IsMmapped())) {
+      l.unlock();
+      RETURN_NOT_OK(MapChunk(chunk, /*for_readahead=*/false));
       if (mmap_for_reads_) {
         mmap_for_reads_->Increment();
       }
+      l.lock();
     }
 
     chunk->GetEntry(index_in_chunk, &phys);
+    readahead_chunk = MaybeReadAheadUnlocked(index);
+  }
+
+  if (readahead_chunk) {
+    Status s = MapChunk(readahead_chunk, /*for_readahead=*/true);
+    if (!s.ok()) {
+      KLOG_EVERY_N_SECS(WARNING, 60) << "Unable to read ahead log index chunk "
+                                     << readahead_chunk->chunk_idx() << ": " << s.ToString();
+    }
   }
 
   // We never write any real entries to offset 0, because there's a header
@@ -479,10 +658,16 @@ void LogIndex::GC(int64_t min_index_to_retain) {
       continue;
     }
     VLOG(2) << "Deleted log index segment " << path;
+    vector<DetachedMapping> to_unmap;
     {
       std::lock_guard<simple_spinlock> l(open_chunks_lock_);
-      open_chunks_.erase(chunk_idx);
+      scoped_refptr<IndexChunk> chunk;
+      if (FindCopy(open_chunks_, chunk_idx, &chunk)) {
+        UnmapChunkUnlocked(chunk.get(), &to_unmap);
+        open_chunks_.erase(chunk_idx);
+      }
     }
+    UnmapDetached(to_unmap);
   }
 }
 
@@ -18,8 +18,11 @@
 #define KUDU_CONSENSUS_LOG_INDEX_H
 
 #include <cstdint>
-#include <string>
+#include <list>
 #include <map>
+#include <memory>
+#include <string>
+#include <vector>
 
 #include "kudu/consensus/opid.pb.h"
 #include "kudu/gutil/macros.h"
@@ -30,6 +33,7 @@
 
 namespace kudu {
 class Env;
+class MemTracker;
 namespace log {
 
 // An entry in the index.
@@ -75,7 +79,8 @@ class LogIndex : public RefCountedThreadSafe<LogIndex> {
   // earlier entries.
   void GC(int64_t min_index_to_retain);
 
-  // Number of chunks to mmap. The default value is 3.
+  // Number of chunks to keep mmapped. The default value is 3. If more chunks
+  // are currently mmapped, the least recently used ones are unmapped.
   void SetNumMmapChunks(int64_t num_chunks);
 
   // Only to be used in tests. It is dangerous to change number of entries per
@@ -110,22 +115,62 @@ class LogIndex : public RefCountedThreadSafe<LogIndex> {
       int64_t chunk_idx, 
       scoped_refptr<IndexChunk>* chunk);
 
-  // mmaps the file corresponding to chunk. The caller should hold
+  // A mapping which was detached from its chunk while holding
+  // 'open_chunks_lock_', to be unmapped once the lock has been released.
+  struct DetachedMapping {
+    uint8_t* addr;
+    int64_t size;
+  };
+
+  // mmaps the file corresponding to chunk. The caller should not hold
   // 'open_chunks_lock_' and 'chunk' should have already been opened and
-  // inserted into 'open_chunks_' map.
+  // inserted into 'open_chunks_' map. The mmap() call is made without the
+  // lock, and the mapping is installed under it unless another thread mapped
+  // the chunk first. Since the lock is released on return, the chunk may be
+  // unmapped again by the time the caller re-acquires it.
   //
-  // At any given time, the instance can only mmap a max of 'kChunksToMmap'
+  // At any given time, the instance can only mmap a max of 'kNumChunksToMmap'
   // chunks. Hence, this method might have to 'evict' and unmap a chunk before
-  // it can mmap the provided 'chunk'. The victim is chosen to be the oldest
-  // chunk that is mmapped (i.e the chunk that has the lowest chunk_idx). The
-  // rationale is that writes only append an entry to the latest chunk and hence
-  // it should always be mmapped. A side effect of such an eviction policy is
-  // that the most lagging peer is always the victim which will delay that peer
-  // from catching up sooner. One way to void this is to configure
-  // 'kChunksToMMap' to be equal to the number of peers in the ring and each
-  // peer have its own slot for 'mmapping' an index chunk (but this strategy is
-  // not implemented yet). Check 'kChunksToMmap' for more details
-  Status MmapChunk(scoped_refptr<IndexChunk>* chunk);
+  // it can mmap the provided 'chunk'. The victim is the least recently used
+  // chunk other than the latest one, which writes append to and hence
+  // should always stay mmapped. Check 'kNumChunksToMmap' for more details.
+  //
+  // If 'for_readahead' is true, the chunk is also madvise()d for reading, and
+  // it is left unmapped if no chunk can be evicted for it (see
+  // EvictChunkUnlocked()).
+  Status MapChunk(const scoped_refptr<IndexChunk>& chunk, bool for_readahead);
+
+  // Installs 'mapping' for 'chunk' and makes it the most recently used chunk,
+  // without evicting anything. The caller should hold 'open_chunks_lock_'.
+  void InstallMappingUnlocked(IndexChunk* chunk, uint8_t* mapping);
+
+  // Detaches the mapping of 'chunk', appending it to 'to_unmap', and removes
+  // the chunk from 'mapped_chunks_lru_'. The caller should hold
+  // 'open_chunks_lock_', and pass 'to_unmap' to UnmapDetached() after
+  // releasing it.
+  void UnmapChunkUnlocked(IndexChunk* chunk, std::vector<DetachedMapping>* to_unmap);
+
+  // Unmaps mappings detached by UnmapChunkUnlocked(). The caller should not
+  // hold 'open_chunks_lock_'.
+  static void UnmapDetached(const std::vector<DetachedMapping>& mappings);
+
+  // Unmaps the least recently used chunk, avoiding the latest chunk if
+  // possible. If 'for_readahead' is true, the latest chunk and any chunk
+  // being read by a sequential reader are never chosen. Returns false if no
+  // chunk could be unmapped. The detached mapping is appended to 'to_unmap'.
+  // The caller should hold 'open_chunks_lock_'.
+  bool EvictChunkUnlocked(bool for_readahead, std::vector<DetachedMapping>* to_unmap);
+
+  // Marks 'chunk' as the most recently used chunk. The caller should hold
+  // 'open_chunks_lock_'.
+  void TouchChunkUnlocked(IndexChunk* chunk);
+
+  // Records a read of 'index' and, if it continues a sequential run of reads
+  // which is getting close to the end of its chunk, returns the next chunk,
+  // which the caller should map ahead of time with MapChunk() once it has
+  // released the lock. Returns null otherwise. The caller should hold
+  // 'open_chunks_lock_'.
+  scoped_refptr<IndexChunk> MaybeReadAheadUnlocked(int64_t index);
 
   // Return the index chunk which contains the given log index.
   // If 'create' is true, creates it on-demand. If 'create' is false, and
@@ -148,6 +193,23 @@ class LogIndex : public RefCountedThreadSafe<LogIndex> {
   typedef std::map<int64_t, scoped_refptr<IndexChunk> > ChunkMap;
   ChunkMap open_chunks_;
 
+  // The indexes of the mmapped chunks, most recently used first.
+  // Protected by open_chunks_lock_
+  std::list<int64_t> mapped_chunks_lru_;
+
+  // A run of sequential reads, e.g. by a peer catching up. Reads are
+  // attributed to a stream when they are for the index following the last
+  // one it read; otherwise they start a new stream, replacing the oldest.
+  // Protected by open_chunks_lock_
+  struct ReadStream {
+    int64_t next_index = -1;
+    int64_t chunk_idx = -1;
+    int64_t sequential_reads = 0;
+  };
+  static const int kMaxReadStreams = 8;
+  ReadStream read_streams_[kMaxReadStreams];
+  int next_read_stream_ = 0;
+
   // Number of index chunks to mmap for faster access. The default value is 3.
   //
   // The latest index chunks (ones with the highest chunk_idx) is always
@@ -157,18 +219,12 @@ class LogIndex : public RefCountedThreadSafe<LogIndex> {
   // is trimmed from the replication log)
   //
   // A lagging peer that is trying to catch up might trigger a read operation
-  // from an index chunk that is unmapped. One of the existing mmapped chunk
-  // is unmapped to make space for dynamically map an index chunk for read
-  // operation. The victim chunk that gets unmapped is the oldest index chunk
-  // (so that writes are not effected)
-  //
-  // It might so happen that a set of lagging peers will thrash each other. For
-  // example, follower1 is trying to catchup OpId(1, 1), follower2 is trying to
-  // cathcup OpId(1, 1000001) and follower3 is trying to catchup (1, 2000001).
-  // In this case, each follower will thrash and end up mapping/unmapping chunks
-  // rapidly to read from the replication log. This is a very unlikely scenario
-  // (since there should be peers lagging across OpIds that are multiple million
-  // trxs away from each other).
+  // from an index chunk that is unmapped. The least recently used of the
+  // other mmapped chunks is unmapped to make space for it, so that lagging
+  // peers reading from different chunks each keep their own chunk mmapped as
+  // long as this is at least the number of such peers plus one. Sequential
+  // readers also get the next chunk mapped before they reach it, when there
+  // is a chunk that nobody is reading from to make room for it.
   //
   // On followers, learners and any other nodes in the ring that are not
   // expected to serve read requests, this could be configured to value of 1 or
@@ -184,6 +240,13 @@ class LogIndex : public RefCountedThreadSafe<LogIndex> {
   // dynamically for a read operation
   scoped_refptr<Counter> mmap_for_reads_;
 
+  // Counter tracking number of index chunks mmapped ahead of a sequential
+  // reader.
+  scoped_refptr<Counter> readahead_chunks_;
+
+  // Tracks the memory of the mmapped chunks.
+  std::shared_ptr<MemTracker> mem_tracker_;
+
   DISALLOW_COPY_AND_ASSIGN(LogIndex);
 };
 
@@ -43,11 +43,39 @@ METRIC_DEFINE_histogram(server, log_roll_latency, "Log Roll Latency",
                         "Microseconds spent on rolling over to a new log segment file",
                         60000000LU, 2);
 
+METRIC_DEFINE_counter(server, log_segments_recycled, "Log Segments Recycled",
+                      kudu::MetricUnit::kUnits,
+                      "Number of new log segments written over the file of a "
+                      "garbage-collected segment rather than a newly allocated one");
+
+METRIC_DEFINE_gauge_int64(server, log_gc_pending_delete_bytes, "Log GC Pending Delete Bytes",
+                          kudu::MetricUnit::kBytes,
+                          "Size of the garbage-collected log segments which are "
+                          "waiting to be deleted in the background");
+
 METRIC_DEFINE_histogram(server, log_entry_batches_per_group, "Log Group Commit Batch Size",
                         kudu::MetricUnit::kRequests,
                         "Number of log entry batches in a group commit group",
                         1024, 2);
 
+METRIC_DEFINE_histogram(server, log_bytes_per_group, "Log Group Commit Bytes",
+                        kudu::MetricUnit::kBytes,
+                        "Number of bytes of log entry batches in a group commit group",
+                        1024LU * 1024 * 1024, 2);
+
+METRIC_DEFINE_histogram(server, log_group_commit_window, "Log Group Commit Window",
+                        kudu::MetricUnit::kMicroseconds,
+                        "Microseconds the adaptive group commit controller decided to "
+                        "wait for more entry batches before writing a group. Zero if it "
+                        "decided to write the group right away.",
+                        60000000LU, 2);
+
+METRIC_DEFINE_histogram(server, log_group_commit_wait_time, "Log Group Commit Wait Time",
+                        kudu::MetricUnit::kMicroseconds,
+                        "Microseconds actually spent waiting for more entry batches "
+                        "before writing a group, when adaptive group commit is enabled",
+                        60000000LU, 2);
+
 namespace kudu {
 namespace log {
 
@@ -58,7 +86,12 @@ LogMetrics::LogMetrics(const scoped_refptr<MetricEntity>& metric_entity)
       MINIT(append_latency),
       MINIT(group_commit_latency),
       MINIT(roll_latency),
-      MINIT(entry_batches_per_group) {
+      MINIT(entry_batches_per_group),
+      MINIT(bytes_per_group),
+      MINIT(group_commit_window),
+      MINIT(group_commit_wait_time),
+      MINIT(segments_recycled),
+      gc_pending_delete_bytes(METRIC_log_gc_pending_delete_bytes.Instantiate(metric_entity, 0)) {
 }
 #undef MINIT
 
@@ -35,6 +35,16 @@ struct LogMetrics {
   scoped_refptr<Histogram> group_commit_latency;
   scoped_refptr<Histogram> roll_latency;
   scoped_refptr<Histogram> entry_batches_per_group;
+  scoped_refptr<Histogram> bytes_per_group;
+
+  // Adaptive group commit controller decisions
+  scoped_refptr<Histogram> group_commit_window;
+  scoped_refptr<Histogram> group_commit_wait_time;
+
+  scoped_refptr<Counter> segments_recycled;
+
+  // Bytes of garbage-collected segments still waiting to be deleted.
+  scoped_refptr<AtomicGauge<int64_t>> gc_pending_delete_bytes;
 };
 
 } // namespace log
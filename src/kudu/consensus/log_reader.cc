@@ -22,6 +22,7 @@
 #include <mutex>
 #include <ostream>
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 
 #include "kudu/consensus/consensus.pb.h"
@@ -33,11 +34,37 @@
 #include "kudu/gutil/stl_util.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/gutil/strings/util.h"
+#include "kudu/util/compression/compression_codec.h"
 #include "kudu/util/env.h"
 #include "kudu/util/faststring.h"
+#include "kudu/util/flag_tags.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/path_util.h"
 #include "kudu/util/pb_util.h"
+#include "kudu/util/stopwatch.h"
+#include "kudu/util/threadpool.h"
+
+DEFINE_int32(log_reader_open_threads, 8,
+             "Maximum number of threads used to open, and if "
+             "--log_verify_segments_on_open is set, verify the closed segments "
+             "of a WAL when it is opened.");
+TAG_FLAG(log_reader_open_threads, advanced);
+
+DEFINE_bool(log_verify_segments_on_open, false,
+            "Whether to read back and checksum every entry of a WAL when it is "
+            "opened, rewriting the log index entries for every replicate found. "
+            "Closed segments are verified in parallel.");
+TAG_FLAG(log_verify_segments_on_open, advanced);
+
+static bool ValidateLogReaderOpenThreads(const char* flagname, int32_t value) {
+  if (value < 1) {
+    LOG(ERROR) << "Invalid value for " << flagname << ": " << value
+               << ", must be at least 1";
+    return false;
+  }
+  return true;
+}
+DEFINE_validator(log_reader_open_threads, &ValidateLogReaderOpenThreads);
 
 METRIC_DEFINE_counter(server, log_reader_bytes_read, "Bytes Read From Log",
                       kudu::MetricUnit::kBytes,
@@ -135,40 +162,79 @@ Status LogReader::Init(const string& tablet_wal_path) {
   RETURN_NOT_OK_PREPEND(env_->GetChildren(tablet_wal_path, &log_files),
                         "Unable to read children from path");
 
-  SegmentSequence read_segments;
-
-  // build a log segment from each file
+  vector<string> segment_paths;
+  vector<string> dictionary_paths;
   for (const string &log_file : log_files) {
     if (HasPrefixString(log_file, FsManager::kWalFileNamePrefix)) {
-      string fqp = JoinPathSegments(tablet_wal_path, log_file);
-      scoped_refptr<ReadableLogSegment> segment;
-      Status s = ReadableLogSegment::Open(env_, fqp, &segment);
-      if (s.IsUninitialized()) {
-        // This indicates that the segment was created but the writer
-        // crashed before the header was successfully written. In this
-        // case, we should skip it.
-        LOG(WARNING) << "Ignoring log segment " << log_file << " since it was uninitialized "
-                     << "(probably left after a prior tablet server crash)";
-        continue;
-      }
+      segment_paths.emplace_back(JoinPathSegments(tablet_wal_path, log_file));
+    } else if (HasPrefixString(log_file, kCompressionDictionaryFilePrefix)) {
+      dictionary_paths.emplace_back(JoinPathSegments(tablet_wal_path, log_file));
+    }
+  }
 
-      RETURN_NOT_OK_PREPEND(s, "Unable to open readable log segment");
-      DCHECK(segment);
-      CHECK(segment->IsInitialized()) << "Uninitialized segment at: " << segment->path();
+  // Register the dictionaries the entries may have been compressed with
+  // before anything reads them.
+  for (const string& path : dictionary_paths) {
+    faststring dictionary;
+    uint32_t dict_id;
+    RETURN_NOT_OK_PREPEND(ReadFileToString(env_, path, &dictionary),
+                          "Unable to read compression dictionary");
+    RETURN_NOT_OK_PREPEND(RegisterZstdDictionary(Slice(dictionary), &dict_id),
+                          Substitute("Unable to register compression dictionary $0", path));
+    VLOG(1) << "Registered compression dictionary " << dict_id << " from " << path;
+  }
 
-      if (!segment->HasFooter()) {
-        VLOG(1) << "Log segment " << fqp << " was likely left in-progress "
-                << "after a previous crash. Will try to rebuild footer by scanning data.";
-        RETURN_NOT_OK(segment->RebuildFooterByScanning());
-      }
+  // Open the segments in parallel: besides the header and footer reads this
+  // verifies closed segments if requested, which is by far the most
+  // expensive part of opening a large WAL.
+  vector<scoped_refptr<ReadableLogSegment>> opened(segment_paths.size());
+  vector<Status> statuses(segment_paths.size());
+  LOG_SLOW_EXECUTION(INFO, 1000, Substitute("T $0: opening $1 log segments",
+                                            tablet_id_, segment_paths.size())) {
+    gscoped_ptr<ThreadPool> pool;
+    RETURN_NOT_OK(ThreadPoolBuilder("wal-open")
+                  .set_max_threads(std::min<int>(FLAGS_log_reader_open_threads,
+                                                 std::max<size_t>(segment_paths.size(), 1)))
+                  .Build(&pool));
+    for (size_t i = 0; i < segment_paths.size(); i++) {
+      RETURN_NOT_OK(pool->SubmitFunc([&, i]() {
+        statuses[i] = OpenSegment(segment_paths[i], &opened[i]);
+      }));
+    }
+    pool->Wait();
+  }
 
-      read_segments.push_back(segment);
+  SegmentSequence read_segments;
+  for (size_t i = 0; i < segment_paths.size(); i++) {
+    const Status& s = statuses[i];
+    if (s.IsUninitialized()) {
+      // This indicates that the segment was created but the writer
+      // crashed before the header was successfully written. In this
+      // case, we should skip it.
+      LOG(WARNING) << "Ignoring log segment " << segment_paths[i] << " since it was uninitialized "
+                   << "(probably left after a prior tablet server crash)";
+      continue;
     }
+    RETURN_NOT_OK(s);
+    read_segments.push_back(opened[i]);
   }
 
   // Sort the segments by sequence number.
   std::sort(read_segments.begin(), read_segments.end(), LogSegmentSeqnoComparator());
 
+  // A segment without a footer was left in progress by a crash, which
+  // normally only happens to the last one. It is scanned serially once the
+  // closed segments have been dealt with.
+  for (const scoped_refptr<ReadableLogSegment>& segment : read_segments) {
+    if (!segment->HasFooter()) {
+      VLOG(1) << "Log segment " << segment->path() << " was likely left in-progress "
+              << "after a previous crash. Will try to rebuild footer by scanning data.";
+      RETURN_NOT_OK(segment->RebuildFooterByScanning());
+      if (FLAGS_log_verify_segments_on_open) {
+        RETURN_NOT_OK(VerifySegment(segment));
+      }
+    }
+  }
 
   {
     std::lock_guard<simple_spinlock> lock(lock_);
@@ -194,6 +260,56 @@ Status LogReader::Init(const string& tablet_wal_path) {
   return Status::OK();
 }
 
+Status LogReader::OpenSegment(const string& path,
+                              scoped_refptr<ReadableLogSegment>* segment) const {
+  Status s = ReadableLogSegment::Open(env_, path, segment);
+  if (s.IsUninitialized()) {
+    return s;
+  }
+  RETURN_NOT_OK_PREPEND(s, "Unable to open readable log segment");
+  DCHECK(*segment);
+  CHECK((*segment)->IsInitialized()) << "Uninitialized segment at: " << (*segment)->path();
+
+  if ((*segment)->HasFooter() && FLAGS_log_verify_segments_on_open) {
+    RETURN_NOT_OK(VerifySegment(*segment));
+  }
+  return Status::OK();
+}
+
+Status LogReader::VerifySegment(const scoped_refptr<ReadableLogSegment>& segment) const {
+  DCHECK(segment->HasFooter());
+  const int64_t seqno = segment->header().sequence_number();
+  faststring tmp_buf;
+  int64_t offset = segment->first_entry_offset();
+  int64_t num_entries = 0;
+  while (offset < segment->readable_up_to()) {
+    const int64_t batch_offset = offset;
+    unique_ptr<LogEntryBatchPB> batch;
+    EntryHeaderStatus unused_status_detail;
+    RETURN_NOT_OK_PREPEND(segment->ReadEntryHeaderAndBatch(&offset, &tmp_buf, &batch,
+                                                           &unused_status_detail),
+                          Substitute("Failed to verify log segment $0 at offset $1",
+                                     segment->path(), batch_offset));
+    num_entries += batch->entry_size();
+    if (!log_index_) continue;
+    for (const LogEntryPB& entry : batch->entry()) {
+      if (entry.type() != REPLICATE) continue;
+      LogIndexEntry index_entry;
+      index_entry.op_id = entry.replicate().id();
+      index_entry.segment_sequence_number = seqno;
+      index_entry.offset_in_segment = batch_offset;
+      RETURN_NOT_OK(log_index_->AddEntry(index_entry));
+    }
+  }
+
+  if (PREDICT_FALSE(num_entries != segment->footer().num_entries())) {
+    return Status::Corruption(Substitute(
+        "Log segment $0 has $1 entries, but its footer claims $2",
+        segment->path(), num_entries, segment->footer().num_entries()));
+  }
+  return Status::OK();
+}
+
 Status LogReader::InitEmptyReaderForTests() {
   std::lock_guard<simple_spinlock> lock(lock_);
   state_ = kLogReaderReading;
@@ -261,7 +377,9 @@ Status LogReader::ReadBatchUsingIndexEntry(const LogIndexEntry& index_entry,
                                    index_entry.offset_in_segment));
 
   if (bytes_read_) {
-    bytes_read_->IncrementBy(segment->entry_header_size() + tmp_buf->length());
+    // 'tmp_buf' is left empty when the batch is read in place from a mapped
+    // segment, so count the bytes the header and batch occupy on disk.
+    bytes_read_->IncrementBy(offset - index_entry.offset_in_segment);
     entries_read_->IncrementBy((**batch).entry_size());
   }
 
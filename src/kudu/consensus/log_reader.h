@@ -174,6 +174,19 @@ class LogReader : public enable_make_shared<LogReader> {
   // Reads the headers of all segments in 'tablet_wal_path'.
   Status Init(const std::string& tablet_wal_path);
 
+  // Opens the segment at 'path' into 'segment', verifying it with
+  // VerifySegment() if it has a footer and --log_verify_segments_on_open is
+  // set. Returns Uninitialized() if the segment's header was never written.
+  //
+  // Called concurrently for different segments by Init().
+  Status OpenSegment(const std::string& path,
+                     scoped_refptr<ReadableLogSegment>* segment) const;
+
+  // Reads every entry batch of 'segment', checking that they are intact and
+  // that their number matches the footer, and adds the REPLICATE entries to
+  // the log index, if there is one.
+  Status VerifySegment(const scoped_refptr<ReadableLogSegment>& segment) const;
+
   // Initializes an 'empty' reader for tests, i.e. does not scan a path looking for segments.
   Status InitEmptyReaderForTests();
 
@@ -17,6 +17,10 @@
 
 #include "kudu/consensus/log_util.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
 #include <algorithm>
 #include <cstring>
 #include <iostream>
@@ -41,10 +45,12 @@
 #include "kudu/util/crc.h"
 #include "kudu/util/debug/trace_event.h"
 #include "kudu/util/env_util.h"
+#include "kudu/util/errno.h"
 #include "kudu/util/fault_injection.h"
 #include "kudu/util/flag_tags.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/pb_util.h"
+#include "kudu/util/scoped_cleanup.h"
 
 DEFINE_int32(log_segment_size_mb, 8,
              "The default size for log segments, in MB");
@@ -62,6 +68,24 @@ DEFINE_bool(log_async_preallocate_segments, true,
             "Whether the WAL segments preallocation should happen asynchronously");
 TAG_FLAG(log_async_preallocate_segments, advanced);
 
+DEFINE_bool(log_use_io_uring, false,
+            "Whether the WAL should write segments through io_uring, with appends "
+            "staged in an aligned buffer and written out together with the fsync on "
+            "each group commit. Only available on Linux builds with io_uring support.");
+TAG_FLAG(log_use_io_uring, experimental);
+
+DEFINE_bool(log_io_uring_direct_io, true,
+            "Whether WAL segments written through io_uring should be opened with "
+            "O_DIRECT. Only applies if --log_use_io_uring is set.");
+TAG_FLAG(log_io_uring_direct_io, experimental);
+
+DEFINE_bool(log_mmap_sealed_segments, false,
+            "Whether entries read from closed WAL segments, e.g. to catch up lagging "
+            "peers, are read from a read-only memory mapping of the segment rather "
+            "than copied into a buffer with pread().");
+TAG_FLAG(log_mmap_sealed_segments, runtime);
+TAG_FLAG(log_mmap_sealed_segments, experimental);
+
 DEFINE_double(fault_crash_before_write_log_segment_header, 0.0,
               "Fraction of the time we will crash just before writing the log segment header");
 TAG_FLAG(fault_crash_before_write_log_segment_header, unsafe);
@@ -95,14 +119,35 @@ const size_t kEntryHeaderSizeV1 = 12;
 // Later versions, which added support for compression, use a 16-byte header.
 const size_t kEntryHeaderSizeV2 = 16;
 
+const char kCompressionDictionaryFilePrefix[] = "zstd_dictionary.";
+
 // Maximum log segment header/footer size, in bytes (8 MB).
 const uint32_t kLogSegmentMaxHeaderOrFooterSize = 8 * 1024 * 1024;
 
+namespace {
+
+// Returns the value used to seed the CRC of each entry header in a segment
+// with the given header. Segments written over a recycled file seed it with
+// their sequence number, so that the stale entries of the file's previous
+// segment fail to verify. Other segments use an unseeded CRC.
+uint32_t EntryHeaderCrcSeed(const LogSegmentHeaderPB& header) {
+  if (!IsRecycledSegment(header)) {
+    return 0;
+  }
+  uint8_t buf[sizeof(uint64_t)];
+  InlineEncodeFixed64(buf, header.sequence_number());
+  return crc::Crc32c(buf, sizeof(buf));
+}
+
+} // anonymous namespace
+
 LogOptions::LogOptions()
 : segment_size_mb(FLAGS_log_segment_size_mb),
   force_fsync_all(FLAGS_log_force_fsync_all),
   preallocate_segments(FLAGS_log_preallocate_segments),
-  async_preallocate_segments(FLAGS_log_async_preallocate_segments) {
+  async_preallocate_segments(FLAGS_log_async_preallocate_segments),
+  use_io_uring(FLAGS_log_use_io_uring),
+  io_uring_direct_io(FLAGS_log_io_uring_direct_io) {
 }
 
 ////////////////////////////////////////////////////////////
@@ -278,7 +323,60 @@ ReadableLogSegment::ReadableLogSegment(
       readable_file_(std::move(readable_file)),
       codec_(nullptr),
       is_initialized_(false),
-      footer_was_rebuilt_(false) {}
+      footer_was_rebuilt_(false),
+      entry_crc_seed_(0),
+      mapping_(nullptr),
+      mapping_size_(0) {}
+
+ReadableLogSegment::~ReadableLogSegment() {
+  if (mapping_ != nullptr) {
+    munmap(mapping_, mapping_size_);
+  }
+}
+
+Status ReadableLogSegment::MapFile() {
+  int fd;
+  RETRY_ON_EINTR(fd, open(path_.c_str(), O_RDONLY | O_CLOEXEC));
+  if (fd < 0) {
+    int err = errno;
+    return Status::IOError(Substitute("could not open $0 for mapping", path_),
+                           ErrnoToString(err), err);
+  }
+  SCOPED_CLEANUP({ close(fd); });
+
+  const size_t size = file_size();
+  void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED) {
+    int err = errno;
+    return Status::IOError(Substitute("could not map $0", path_), ErrnoToString(err), err);
+  }
+  // Catch-up reads walk the segment front to back.
+  if (madvise(addr, size, MADV_SEQUENTIAL) != 0) {
+    int err = errno;
+    VLOG(1) << "madvise on " << path_ << " failed: " << ErrnoToString(err);
+  }
+  mapping_ = static_cast<uint8_t*>(addr);
+  mapping_size_ = size;
+  return Status::OK();
+}
+
+bool ReadableLogSegment::GetMappedSlice(int64_t offset, size_t length, Slice* data) {
+  // Only segments with a footer are mapped: they are never appended to, so
+  // their size is fixed for as long as the segment is open.
+  if (!FLAGS_log_mmap_sealed_segments || !HasFooter()) {
+    return false;
+  }
+  Status s = mmap_once_.Init(&ReadableLogSegment::MapFile, this);
+  if (PREDICT_FALSE(!s.ok())) {
+    KLOG_FIRST_N(WARNING, 1) << "Falling back to pread() for WAL reads: " << s.ToString();
+    return false;
+  }
+  if (PREDICT_FALSE(offset < 0 || offset + length > mapping_size_)) {
+    return false;
+  }
+  *data = Slice(mapping_ + offset, length);
+  return true;
+}
 
 Status ReadableLogSegment::Init(const LogSegmentHeaderPB& header,
                                 const LogSegmentFooterPB& footer,
@@ -290,6 +388,7 @@ Status ReadableLogSegment::Init(const LogSegmentHeaderPB& header,
   RETURN_NOT_OK(ReadFileSize());
 
   header_.CopyFrom(header);
+  entry_crc_seed_ = EntryHeaderCrcSeed(header_);
   RETURN_NOT_OK(InitCompressionCodec());
 
   footer_.CopyFrom(footer);
@@ -308,6 +407,7 @@ Status ReadableLogSegment::Init(const LogSegmentHeaderPB& header,
   RETURN_NOT_OK(ReadFileSize());
 
   header_.CopyFrom(header);
+  entry_crc_seed_ = EntryHeaderCrcSeed(header_);
   first_entry_offset_ = first_entry_offset;
   RETURN_NOT_OK(InitCompressionCodec());
   is_initialized_ = true;
@@ -331,6 +431,11 @@ Status ReadableLogSegment::Init() {
     if (s.IsNotFound()) {
       VLOG(1) << "Log segment " << path_ << " has no footer. This segment was likely "
               << "being written when the server previously shut down.";
+    } else if (IsRecycledSegment(header_)) {
+      // The end of an unclosed recycled segment holds whatever the file's
+      // previous segment left there, which need not parse as a footer.
+      VLOG(1) << "Ignoring unreadable footer of recycled log segment " << path_
+              << ": " << s.ToString();
     } else {
       LOG(WARNING) << "Could not read footer for segment: " << path_
           << ": " << s.ToString();
@@ -436,12 +541,15 @@ Status ReadableLogSegment::ReadHeader() {
                                                 header_size),
                         "Unable to parse protobuf");
 
-  if (header.incompatible_features_size() > 0) {
-    return Status::NotSupported("log segment uses a feature not supported by this version "
-                                "of Kudu");
+  for (int feature : header.incompatible_features()) {
+    if (feature != LogSegmentHeaderPB::RECYCLED_SEGMENT) {
+      return Status::NotSupported("log segment uses a feature not supported by this version "
+                                  "of Kudu");
+    }
   }
 
   header_.Swap(&header);
+  entry_crc_seed_ = EntryHeaderCrcSeed(header_);
   first_entry_offset_ = header_size + kLogSegmentHeaderMagicAndHeaderLength;
 
   return Status::OK();
@@ -517,6 +625,14 @@ Status ReadableLogSegment::ReadFooter() {
                                                 footer_size),
                         "Unable to parse protobuf");
 
+  // A recycled segment which was not closed may end with the footer of the
+  // file's previous segment.
+  if (IsRecycledSegment(header_) &&
+      (!footer.has_sequence_number() ||
+       footer.sequence_number() != header_.sequence_number())) {
+    return Status::NotFound("Footer not found. Footer belongs to a previous segment");
+  }
+
   footer_.Swap(&footer);
   return Status::OK();
 }
@@ -636,9 +752,12 @@ Status ReadableLogSegment::ReadEntryHeader(int64_t *offset, EntryHeader* header,
                                            EntryHeaderStatus* status_detail) {
   const size_t header_size = entry_header_size();
   uint8_t scratch[header_size];
-  Slice slice(scratch, header_size);
-  RETURN_NOT_OK_PREPEND(readable_file()->Read(*offset, slice),
-                        "Could not read log entry header");
+  Slice slice;
+  if (!GetMappedSlice(*offset, header_size, &slice)) {
+    slice = Slice(scratch, header_size);
+    RETURN_NOT_OK_PREPEND(readable_file()->Read(*offset, slice),
+                          "Could not read log entry header");
+  }
 
   *status_detail = DecodeEntryHeader(slice, header);
   switch (*status_detail) {
@@ -665,7 +784,7 @@ EntryHeaderStatus ReadableLogSegment::DecodeEntryHeader(
     header->msg_length = DecodeFixed32(&data[4]);
     header->msg_crc    = DecodeFixed32(&data[8]);
     header->header_crc = DecodeFixed32(&data[12]);
-    computed_header_crc = crc::Crc32c(&data[0], 12);
+    computed_header_crc = crc::Crc32c(&data[0], 12, entry_crc_seed_);
   } else {
     DCHECK_EQ(kEntryHeaderSizeV1, data.size());
     header->msg_length = DecodeFixed32(&data[0]);
@@ -708,17 +827,29 @@ Status ReadableLogSegment::ReadEntryBatch(int64_t* offset,
   }
 
   tmp_buf->clear();
-  size_t buf_len = header.msg_length_compressed;
-  if (codec_) {
-    // Reserve some space for the decompressed copy as well.
-    buf_len += header.msg_length;
+  Slice entry_batch_slice;
+  uint8_t* uncompress_buf = nullptr;
+  if (GetMappedSlice(*offset, header.msg_length_compressed, &entry_batch_slice)) {
+    // The batch is read in place, so the buffer is only needed to decompress.
+    if (codec_) {
+      tmp_buf->resize(header.msg_length);
+      uncompress_buf = tmp_buf->data();
+    }
+  } else {
+    size_t buf_len = header.msg_length_compressed;
+    if (codec_) {
+      // Reserve some space for the decompressed copy as well.
+      buf_len += header.msg_length;
+    }
+    tmp_buf->resize(buf_len);
+    entry_batch_slice = Slice(tmp_buf->data(), header.msg_length_compressed);
+    Status s = readable_file()->Read(*offset, entry_batch_slice);
+    if (!s.ok()) return Status::IOError(Substitute("Could not read entry. Cause: $0",
+                                                   s.ToString()));
+    if (codec_) {
+      uncompress_buf = &(*tmp_buf)[header.msg_length_compressed];
+    }
   }
-  tmp_buf->resize(buf_len);
-  Slice entry_batch_slice(tmp_buf->data(), header.msg_length_compressed);
-  Status s =  readable_file()->Read(*offset, entry_batch_slice);
-
-  if (!s.ok()) return Status::IOError(Substitute("Could not read entry. Cause: $0",
-                                                 s.ToString()));
 
   // Verify the CRC.
   uint32_t read_crc = crc::Crc32c(entry_batch_slice.data(), entry_batch_slice.size());
@@ -731,17 +862,16 @@ Status ReadableLogSegment::ReadEntryBatch(int64_t* offset,
 
   // If it was compressed, decompress it.
   if (codec_) {
-    // We pre-reserved space for the decompression up above.
-    uint8_t* uncompress_buf = &(*tmp_buf)[header.msg_length_compressed];
+    // We reserved space for the decompression up above.
     RETURN_NOT_OK_PREPEND(codec_->Uncompress(entry_batch_slice, uncompress_buf, header.msg_length),
                           "failed to uncompress entry");
     entry_batch_slice = Slice(uncompress_buf, header.msg_length);
   }
 
   unique_ptr<LogEntryBatchPB> read_entry_batch(new LogEntryBatchPB);
-  s = pb_util::ParseFromArray(read_entry_batch.get(),
-                              entry_batch_slice.data(),
-                              header.msg_length);
+  Status s = pb_util::ParseFromArray(read_entry_batch.get(),
+                                     entry_batch_slice.data(),
+                                     header.msg_length);
 
   if (!s.ok()) {
     return Status::Corruption(Substitute("Could not parse PB. Cause: $0", s.ToString()));
@@ -758,7 +888,8 @@ WritableLogSegment::WritableLogSegment(string path,
       writable_file_(std::move(writable_file)),
       is_header_written_(false),
       is_footer_written_(false),
-      written_offset_(0) {}
+      written_offset_(0),
+      entry_crc_seed_(0) {}
 
 Status WritableLogSegment::WriteHeaderAndOpen(const LogSegmentHeaderPB& new_header) {
   MAYBE_FAULT(FLAGS_fault_crash_before_write_log_segment_header);
@@ -777,6 +908,7 @@ Status WritableLogSegment::WriteHeaderAndOpen(const LogSegmentHeaderPB& new_head
   RETURN_NOT_OK(writable_file()->Append(Slice(buf)));
 
   header_.CopyFrom(new_header);
+  entry_crc_seed_ = EntryHeaderCrcSeed(header_);
   first_entry_offset_ = buf.size();
   written_offset_ = first_entry_offset_;
   is_header_written_ = true;
@@ -791,14 +923,18 @@ Status WritableLogSegment::WriteFooterAndClose(const LogSegmentFooterPB& footer)
   DCHECK(!IsFooterWritten());
   DCHECK(footer.IsInitialized()) << footer.InitializationErrorString();
 
+  footer_.CopyFrom(footer);
+  if (IsRecycledSegment(header_)) {
+    footer_.set_sequence_number(header_.sequence_number());
+  }
+
   faststring buf;
-  pb_util::AppendToString(footer, &buf);
+  pb_util::AppendToString(footer_, &buf);
   buf.append(kLogSegmentFooterMagicString);
-  PutFixed32(&buf, footer.ByteSize());
+  PutFixed32(&buf, footer_.ByteSize());
 
   RETURN_NOT_OK_PREPEND(writable_file()->Append(Slice(buf)), "Could not write the footer");
 
-  footer_.CopyFrom(footer);
   is_footer_written_ = true;
 
   RETURN_NOT_OK(writable_file_->Close());
@@ -808,39 +944,53 @@ Status WritableLogSegment::WriteFooterAndClose(const LogSegmentFooterPB& footer)
   return Status::OK();
 }
 
-Status WritableLogSegment::WriteEntryBatch(const Slice& data,
+Status WritableLogSegment::WriteEntryBatch(const vector<Slice>& data,
                                            const CompressionCodec* codec) {
   DCHECK(is_header_written_);
   DCHECK(!is_footer_written_);
   uint8_t header_buf[kEntryHeaderSizeV2];
 
-  const uint32_t uncompressed_len = data.size();
+  size_t uncompressed_len = 0;
+  for (const Slice& fragment : data) {
+    uncompressed_len += fragment.size();
+  }
+
+  // The header goes first, followed by the batch data itself.
+  vector<Slice> slices;
+  slices.reserve(data.size() + 1);
+  slices.emplace_back(header_buf, arraysize(header_buf));
 
-  // If necessary, compress the data.
-  Slice data_to_write;
+  // If necessary, compress the data. Otherwise, it is written out as is,
+  // with the checksum computed one fragment at a time.
+  uint32_t data_len;
+  uint32_t data_crc = 0;
   if (codec) {
     DCHECK_NE(header_.compression_codec(), NO_COMPRESSION);
     compress_buf_.resize(codec->MaxCompressedLength(uncompressed_len));
     size_t compressed_len;
     RETURN_NOT_OK(codec->Compress(data, &compress_buf_[0], &compressed_len));
     compress_buf_.resize(compressed_len);
-    data_to_write = Slice(compress_buf_.data(), compress_buf_.size());
+    data_len = compress_buf_.size();
+    data_crc = crc::Crc32c(compress_buf_.data(), compress_buf_.size());
+    slices.emplace_back(compress_buf_.data(), compress_buf_.size());
   } else {
-    data_to_write = data;
+    data_len = uncompressed_len;
+    for (const Slice& fragment : data) {
+      if (fragment.empty()) continue;
+      data_crc = crc::Crc32c(fragment.data(), fragment.size(), data_crc);
+      slices.push_back(fragment);
+    }
   }
 
   // Fill in the header.
-  InlineEncodeFixed32(&header_buf[0], data_to_write.size());
+  InlineEncodeFixed32(&header_buf[0], data_len);
   InlineEncodeFixed32(&header_buf[4], uncompressed_len);
-  InlineEncodeFixed32(&header_buf[8], crc::Crc32c(data_to_write.data(), data_to_write.size()));
-  InlineEncodeFixed32(&header_buf[12], crc::Crc32c(&header_buf[0], kEntryHeaderSizeV2 - 4));
+  InlineEncodeFixed32(&header_buf[8], data_crc);
+  InlineEncodeFixed32(&header_buf[12], crc::Crc32c(&header_buf[0], kEntryHeaderSizeV2 - 4,
+                                                   entry_crc_seed_));
 
-  // Write the header to the file, followed by the batch data itself.
-  Slice slices[2] = {
-    Slice(header_buf, arraysize(header_buf)),
-    data_to_write };
   RETURN_NOT_OK(writable_file_->AppendV(slices));
-  written_offset_ += arraysize(header_buf) + data_to_write.size();
+  written_offset_ += arraysize(header_buf) + data_len;
   return Status::OK();
 }
 
@@ -873,6 +1023,15 @@ bool IsLogFileName(const string& fname) {
   return true;
 }
 
+bool IsRecycledSegment(const LogSegmentHeaderPB& header) {
+  for (int feature : header.incompatible_features()) {
+    if (feature == LogSegmentHeaderPB::RECYCLED_SEGMENT) {
+      return true;
+    }
+  }
+  return false;
+}
+
 void UpdateFooterForReplicateEntry(const LogEntryPB& entry_pb,
                                    LogSegmentFooterPB* footer) {
   DCHECK(entry_pb.has_replicate());
@@ -885,6 +1044,13 @@ void UpdateFooterForReplicateEntry(const LogEntryPB& entry_pb,
       index > footer->max_replicate_index()) {
     footer->set_max_replicate_index(index);
   }
+  uint32_t dict_id = entry_pb.replicate().write_payload().compression_dictionary_id();
+  if (dict_id != 0 &&
+      std::find(footer->compression_dictionary_ids().begin(),
+                footer->compression_dictionary_ids().end(),
+                dict_id) == footer->compression_dictionary_ids().end()) {
+    footer->add_compression_dictionary_ids(dict_id);
+  }
 }
 
 }  // namespace log
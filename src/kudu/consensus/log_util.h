@@ -37,6 +37,7 @@
 #include "kudu/util/atomic.h"
 #include "kudu/util/env.h"
 #include "kudu/util/faststring.h"
+#include "kudu/util/once.h"
 #include "kudu/util/slice.h"
 #include "kudu/util/status.h"
 
@@ -55,6 +56,14 @@ class LogFactory;
 // implementation for details.
 extern const size_t kEntryHeaderSizeV2;
 
+// The size of the magic string and header length at the start of a segment.
+extern const size_t kLogSegmentHeaderMagicAndHeaderLength;
+
+// The prefix of the files in a tablet's WAL directory holding the zstd
+// dictionaries its entries may have been compressed with, followed by the
+// dictionary id. See Log::PersistCompressionDictionary().
+extern const char kCompressionDictionaryFilePrefix[];
+
 class ReadableLogSegment;
 
 typedef std::vector<std::unique_ptr<LogEntryPB>> LogEntries;
@@ -75,6 +84,13 @@ struct LogOptions {
   // Whether the allocation should happen asynchronously.
   bool async_preallocate_segments;
 
+  // Whether to write segments through io_uring. Appends are then buffered
+  // until the next Flush() or Sync() of the segment.
+  bool use_io_uring;
+
+  // Whether io_uring segments are opened with O_DIRECT.
+  bool io_uring_direct_io;
+
   std::shared_ptr<LogFactory> log_factory;
 
   LogOptions();
@@ -295,7 +311,7 @@ class ReadableLogSegment : public RefCountedThreadSafe<ReadableLogSegment> {
     uint32_t header_crc;
   };
 
-  ~ReadableLogSegment() {}
+  ~ReadableLogSegment();
 
   // Helper functions called by Init().
 
@@ -367,6 +383,18 @@ class ReadableLogSegment : public RefCountedThreadSafe<ReadableLogSegment> {
                         faststring* tmp_buf,
                         std::unique_ptr<LogEntryBatchPB>* entry_batch);
 
+  // If --log_mmap_sealed_segments is enabled and this segment has a footer,
+  // sets 'data' to the 'length' bytes at 'offset' within a read-only mapping
+  // of the file, mapping it first if necessary. 'data' remains valid for the
+  // lifetime of the segment.
+  //
+  // Returns false if the bytes should be read from 'readable_file_' instead,
+  // e.g. because the segment may still be written to or mapping failed.
+  bool GetMappedSlice(int64_t offset, size_t length, Slice* data);
+
+  // Maps the whole file into memory. Called once via 'mmap_once_'.
+  Status MapFile();
+
   void UpdateReadableToOffset(int64_t readable_to_offset);
 
   const std::string path_;
@@ -400,9 +428,18 @@ class ReadableLogSegment : public RefCountedThreadSafe<ReadableLogSegment> {
   // True if the footer was rebuilt, rather than actually found on disk.
   bool footer_was_rebuilt_;
 
+  // The seed for entry header CRCs. See EntryHeaderCrcSeed().
+  uint32_t entry_crc_seed_;
+
   // the offset of the first entry in the log
   int64_t first_entry_offset_;
 
+  // Read-only mapping of the file, set up lazily by MapFile(). Only sealed
+  // segments are mapped, since their size never changes.
+  KuduOnceDynamic mmap_once_;
+  uint8_t* mapping_;
+  size_t mapping_size_;
+
   DISALLOW_COPY_AND_ASSIGN(ReadableLogSegment);
 };
 
@@ -431,13 +468,19 @@ class WritableLogSegment {
   // and checksum. If 'codec' is not NULL, compresses the batch.
   // Makes sure that the log segment has not been closed.
   // Write a compressed entry to the log.
-  Status WriteEntryBatch(const Slice& data, const CompressionCodec* codec);
+  Status WriteEntryBatch(const std::vector<Slice>& data, const CompressionCodec* codec);
 
   // Makes sure the I/O buffers in the underlying writable file are flushed.
   Status Sync() {
     return writable_file_->Sync();
   }
 
+  // Writes out any appends buffered by the underlying writable file, without
+  // waiting for them to become durable.
+  Status Flush() {
+    return writable_file_->Flush(WritableFile::FLUSH_ASYNC);
+  }
+
   // Returns true if the segment header has already been written to disk.
   bool IsHeaderWritten() const {
     return is_header_written_;
@@ -496,6 +539,9 @@ class WritableLogSegment {
   // The offset where the last written entry ends.
   int64_t written_offset_;
 
+  // The seed for entry header CRCs. See EntryHeaderCrcSeed().
+  uint32_t entry_crc_seed_;
+
   // Buffer used for output when compressing.
   faststring compress_buf_;
 
@@ -510,8 +556,13 @@ std::unique_ptr<LogEntryBatchPB> CreateBatchFromAllocatedOperations(
 // Checks if 'fname' is a correctly formatted name of log segment file.
 bool IsLogFileName(const std::string& fname);
 
+// Returns true if the segment with the given header was written over the file
+// of a previously garbage-collected segment.
+bool IsRecycledSegment(const LogSegmentHeaderPB& header);
+
 // Update 'footer' to reflect the given REPLICATE message 'entry_pb'.
-// In particular, updates the min/max seen replicate OpID.
+// In particular, updates the min/max seen replicate OpID and the set of
+// compression dictionaries used.
 void UpdateFooterForReplicateEntry(
     const LogEntryPB& entry_pb, LogSegmentFooterPB* footer);
 
@@ -56,8 +56,10 @@
 //#include "kudu/tserver/tserver.pb.h"
 #include "kudu/util/countdown_latch.h"
 #include "kudu/util/fault_injection.h"
+#include "kudu/util/hdr_histogram.h"
 #include "kudu/util/locks.h"
 #include "kudu/util/metrics.h"
+#include "kudu/util/monotime.h"
 #include "kudu/util/random.h"
 #include "kudu/util/status.h"
 #include "kudu/util/status_callback.h"
@@ -72,6 +74,14 @@ DEFINE_int32(num_batches_per_thread, 2000, "Number of batches per thread");
 DEFINE_int32(num_ops_per_batch_avg, 5, "Target average number of ops per batch");
 DEFINE_bool(verify_log, true, "Whether to verify the log by reading it after the writes complete");
 
+METRIC_DECLARE_histogram(log_entry_batches_per_group);
+METRIC_DECLARE_histogram(log_group_commit_wait_time);
+METRIC_DECLARE_histogram(log_group_commit_window);
+
+DECLARE_bool(log_adaptive_group_commit);
+DECLARE_int32(log_group_commit_max_wait_us);
+DECLARE_int32(log_group_commit_target_latency_us);
+DECLARE_bool(log_pipelined_group_commit);
 DECLARE_int32(log_thread_idle_threshold_ms);
 DECLARE_int32(log_inject_thread_lifecycle_latency_ms);
 
@@ -90,15 +100,23 @@ namespace {
 
 class CustomLatchCallback : public RefCountedThreadSafe<CustomLatchCallback> {
  public:
-  CustomLatchCallback(CountDownLatch* latch, vector<Status>* errors)
+  // If 'latency_hist' is not null, the time from construction until the
+  // callback runs is recorded into it, in microseconds.
+  CustomLatchCallback(CountDownLatch* latch, vector<Status>* errors,
+                      HdrHistogram* latency_hist = nullptr)
       : latch_(latch),
-        errors_(errors) {
+        errors_(errors),
+        latency_hist_(latency_hist),
+        start_(MonoTime::Now()) {
   }
 
   void StatusCB(const Status& s) {
     if (!s.ok()) {
       errors_->push_back(s);
     }
+    if (latency_hist_) {
+      latency_hist_->Increment((MonoTime::Now() - start_).ToMicroseconds());
+    }
     latch_->CountDown();
   }
 
@@ -109,6 +127,8 @@ class CustomLatchCallback : public RefCountedThreadSafe<CustomLatchCallback> {
  private:
   CountDownLatch* latch_;
   vector<Status>* errors_;
+  HdrHistogram* latency_hist_;
+  const MonoTime start_;
 };
 
 } // anonymous namespace
@@ -157,7 +177,7 @@ class MultiThreadedLogTest : public LogTestBase {
     for (int i = 0; i < FLAGS_num_batches_per_thread; i++) {
       // Do the expensive allocation outside the lock.
       vector<consensus::ReplicateRefPtr> batch_replicates = CreateRandomBatch();
-      auto cb = new CustomLatchCallback(&latch, &errors);
+      auto cb = new CustomLatchCallback(&latch, &errors, append_latency_hist_);
       // Assign indexes and append inside the lock, so that the index order and
       // log order match up.
       {
@@ -224,6 +244,47 @@ class MultiThreadedLogTest : public LogTestBase {
     ASSERT_TRUE(std::is_sorted(ids.begin(), ids.end()));
   }
 
+  // Runs the writer threads against a freshly built log with the given group
+  // commit mode, and reports the throughput and append latency.
+  void RunGroupCommitBenchmark(bool pipelined) {
+    FLAGS_log_pipelined_group_commit = pipelined;
+    current_index_ = kStartIndex;
+    threads_.clear();
+    HdrHistogram hist(MonoDelta::FromSeconds(60).ToMicroseconds(), 2);
+    append_latency_hist_ = &hist;
+
+    ASSERT_OK(BuildLog());
+    Stopwatch sw;
+    sw.start();
+    ASSERT_NO_FATAL_FAILURE(Run());
+    sw.stop();
+    ASSERT_OK(log_->Close());
+    append_latency_hist_ = nullptr;
+
+    int64_t num_ops = current_index_ - kStartIndex;
+    LOG(INFO) << strings::Substitute(
+        "$0 group commit: $1 ops in $2 batches, $3 ops/s, "
+        "append latency mean=$4us p50=$5us p99=$6us max=$7us",
+        pipelined ? "pipelined" : "serial",
+        num_ops, hist.TotalCount(),
+        static_cast<int64_t>(num_ops / sw.elapsed().wall_seconds()),
+        static_cast<int64_t>(hist.MeanValue()),
+        hist.ValueAtPercentile(50),
+        hist.ValueAtPercentile(99),
+        hist.MaxValue());
+
+    if (FLAGS_verify_log) {
+      ASSERT_NO_FATAL_FAILURE(VerifyLog());
+      entries_.clear();
+    }
+    ASSERT_OK(Log::DeleteOnDiskData(fs_manager_.get(), kTestTablet));
+    log_.reset();
+  }
+
+ protected:
+  // If set, the latency of every append is recorded here.
+  HdrHistogram* append_latency_hist_ = nullptr;
+
  private:
   ThreadSafeRandom random_;
   simple_spinlock lock_;
@@ -250,6 +311,62 @@ TEST_F(MultiThreadedLogTest, TestAppends) {
   }
 }
 
+// Compares serial and pipelined group commit with fsync enabled. The
+// interesting numbers are in the log output; run with a larger
+// --num_batches_per_thread and --num_writer_threads on real disks.
+TEST_F(MultiThreadedLogTest, BenchmarkGroupCommitModes) {
+  options_.force_fsync_all = true;
+  for (bool pipelined : { false, true }) {
+    ASSERT_NO_FATAL_FAILURE(RunGroupCommitBenchmark(pipelined));
+  }
+}
+
+// Same as TestAppends, but with pipelined group commit.
+TEST_F(MultiThreadedLogTest, TestAppendsPipelined) {
+  FLAGS_log_pipelined_group_commit = true;
+  if (gflags::GetCommandLineFlagInfoOrDie("log_segment_size_mb").is_default) {
+    options_.segment_size_mb = 1;
+  }
+  options_.force_fsync_all = true;
+
+  ASSERT_OK(BuildLog());
+  ASSERT_NO_FATAL_FAILURE(Run());
+  ASSERT_OK(log_->Close());
+  ASSERT_NO_FATAL_FAILURE(VerifyLog());
+}
+
+// Same as TestAppends, but with adaptive group commit, which may hold groups
+// open for more batches.
+TEST_F(MultiThreadedLogTest, TestAppendsAdaptiveGroupCommit) {
+  FLAGS_log_adaptive_group_commit = true;
+  FLAGS_log_group_commit_max_wait_us = 500;
+  // Keep the measured commit latency well within the target, and the batches
+  // arriving quickly, however slow fsync is on the test host: otherwise the
+  // controller rightly never waits.
+  FLAGS_log_group_commit_target_latency_us = 1000 * 1000;
+  options_.force_fsync_all = false;
+
+  ASSERT_OK(BuildLog());
+  ASSERT_NO_FATAL_FAILURE(Run());
+  ASSERT_OK(log_->Close());
+  ASSERT_NO_FATAL_FAILURE(VerifyLog());
+
+  // The controller decides on a window for every group, never beyond the
+  // maximum wait, and with this many writers it waits for some of them.
+  scoped_refptr<Histogram> groups =
+      METRIC_log_entry_batches_per_group.Instantiate(metric_entity_);
+  scoped_refptr<Histogram> windows =
+      METRIC_log_group_commit_window.Instantiate(metric_entity_);
+  scoped_refptr<Histogram> wait_times =
+      METRIC_log_group_commit_wait_time.Instantiate(metric_entity_);
+  ASSERT_GT(groups->TotalCount(), 0U);
+  ASSERT_EQ(groups->TotalCount(), windows->TotalCount());
+  ASSERT_EQ(groups->TotalCount(), wait_times->TotalCount());
+  ASSERT_GT(windows->MaxValueForTests(), 0U);
+  ASSERT_LE(windows->MaxValueForTests(),
+            static_cast<uint64_t>(FLAGS_log_group_commit_max_wait_us));
+}
+
 // The lifecycle of the appender task starting and stopping is a bit complicated
 // (see Log::AppendThread::GoIdle for details). This injects some latency in key
 // points of that lifecycle to ensure that the different potential interleavings
@@ -94,9 +94,21 @@ Status PeerManager::UpdateRaftConfig(const RaftConfigPB& config) {
 }
 
 void PeerManager::SignalRequest(bool force_if_queue_empty) {
+  SignalPeers([force_if_queue_empty](Peer* peer) {
+    return peer->SignalRequest(force_if_queue_empty);
+  });
+}
+
+void PeerManager::SignalHeartbeat() {
+  SignalPeers([](Peer* peer) {
+    return peer->SignalHeartbeat();
+  });
+}
+
+void PeerManager::SignalPeers(const std::function<Status(Peer*)>& signal) {
   std::lock_guard<simple_spinlock> lock(lock_);
   for (auto iter = peers_.begin(); iter != peers_.end();) {
-    Status s = (*iter).second->SignalRequest(force_if_queue_empty);
+    Status s = signal((*iter).second.get());
     if (PREDICT_FALSE(!s.ok())) {
       LOG(WARNING) << GetLogPrefix()
                    << "Peer was closed, removing from peers. Peer: "
@@ -17,6 +17,7 @@
 #ifndef KUDU_CONSENSUS_PEER_MANAGER_H
 #define KUDU_CONSENSUS_PEER_MANAGER_H
 
+#include <functional>
 #include <memory>
 #include <string>
 #include <unordered_map>
@@ -61,6 +62,10 @@ class PeerManager {
   // Signals all peers of the current configuration that there is a new request pending.
   void SignalRequest(bool force_if_queue_empty = false);
 
+  // Asks all peers of the current configuration for a round of requests,
+  // even if there is nothing to replicate. See Peer::SignalHeartbeat().
+  void SignalHeartbeat();
+
   // Start an election on the peer with UUID 'uuid'.
   Status StartElection(const std::string& uuid,
                        RunLeaderElectionRequestPB req = {});
@@ -71,6 +76,10 @@ class PeerManager {
  private:
   std::string GetLogPrefix() const;
 
+  // Calls 'signal' on each peer, dropping the peers it returns a non-OK
+  // status for.
+  void SignalPeers(const std::function<Status(Peer*)>& signal);
+
   const std::string tablet_id_;
   const std::string local_uuid_;
   PeerProxyFactory* peer_proxy_factory_;
@@ -17,8 +17,10 @@
 
 #include "kudu/consensus/pending_rounds.h"
 
+#include <memory>
 #include <ostream>
 #include <utility>
+#include <vector>
 
 #include <glog/logging.h>
 
@@ -34,9 +36,11 @@
 #include "kudu/util/pb_util.h"
 #include "kudu/util/status.h"
 #include "kudu/util/thread_restrictions.h"
+#include "kudu/util/threadpool.h"
 
 using kudu::pb_util::SecureShortDebugString;
 using std::string;
+using std::vector;
 using strings::Substitute;
 
 namespace kudu {
@@ -46,10 +50,15 @@ namespace consensus {
 // PendingRounds
 //------------------------------------------------------------
 
-PendingRounds::PendingRounds(string log_prefix, scoped_refptr<TimeManager> time_manager)
+PendingRounds::PendingRounds(string log_prefix,
+                             scoped_refptr<TimeManager> time_manager,
+                             CommittedRoundsCallback committed_rounds_cb,
+                             ThreadPool* callback_pool)
     : log_prefix_(std::move(log_prefix)),
       last_committed_op_id_(MinimumOpId()),
-      time_manager_(std::move(time_manager)) {}
+      time_manager_(std::move(time_manager)),
+      committed_rounds_cb_(std::move(committed_rounds_cb)),
+      callback_pool_(callback_pool) {}
 
 PendingRounds::~PendingRounds() {
 }
@@ -170,6 +179,7 @@ Status PendingRounds::AdvanceCommittedIndex(int64_t committed_index) {
       <<  last_committed_op_id_
       << " Starting to apply from log index: " << (*iter).first;
 
+  vector<scoped_refptr<ConsensusRound>> committed;
   while (iter != end_iter) {
     scoped_refptr<ConsensusRound> round = (*iter).second; // Make a copy.
     DCHECK(round);
@@ -182,9 +192,13 @@ Status PendingRounds::AdvanceCommittedIndex(int64_t committed_index) {
     pending_txns_.erase(iter++);
     last_committed_op_id_ = round->id();
     time_manager_->AdvanceSafeTimeWithMessage(*round->replicate_msg());
-    round->NotifyReplicationFinished(Status::OK());
+    committed.emplace_back(std::move(round));
+  }
+  if (!committed.empty()) {
+    committed_rounds_cb_(committed);
   }
 
+  NotifyCommitWaiters();
   return Status::OK();
 }
 
@@ -208,6 +222,7 @@ Status PendingRounds::SetInitialCommittedOpId(const OpId& committed_op) {
 
   } else {
     last_committed_op_id_ = committed_op;
+    NotifyCommitWaiters();
   }
   return Status::OK();
 }
@@ -232,6 +247,75 @@ int64_t PendingRounds::GetTermWithLastCommittedOp() const {
   return last_committed_op_id_.term();
 }
 
+void PendingRounds::WaitForCommittedIndexAsync(int64_t index,
+                                               const StdStatusCallback& callback,
+                                               const MonoTime& deadline) {
+  if (index <= last_committed_op_id_.index()) {
+    callback(Status::OK());
+    return;
+  }
+  commit_waiters_.emplace(index, CommitWaiter{ callback, deadline });
+}
+
+void PendingRounds::ExpireCommitWaiters() {
+  if (commit_waiters_.empty()) {
+    return;
+  }
+  const MonoTime now = MonoTime::Now();
+  vector<StdStatusCallback> callbacks;
+  for (auto it = commit_waiters_.begin(); it != commit_waiters_.end();) {
+    const MonoTime& deadline = it->second.deadline;
+    if (deadline.Initialized() && deadline <= now) {
+      callbacks.emplace_back(std::move(it->second.callback));
+      commit_waiters_.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+  RunCommitWaiters(std::move(callbacks),
+                   Status::TimedOut("the read index was not committed before the deadline"));
+}
+
+vector<std::function<void()>> PendingRounds::AbortCommitWaiters(const Status& status) {
+  vector<std::function<void()>> to_run;
+  to_run.swap(unsubmitted_commit_waiters_);
+  for (auto& waiter : commit_waiters_) {
+    StdStatusCallback callback = std::move(waiter.second.callback);
+    to_run.emplace_back([callback, status]() { callback(status); });
+  }
+  commit_waiters_.clear();
+  return to_run;
+}
+
+void PendingRounds::NotifyCommitWaiters() {
+  vector<StdStatusCallback> callbacks;
+  auto end = commit_waiters_.upper_bound(last_committed_op_id_.index());
+  for (auto it = commit_waiters_.begin(); it != end;) {
+    callbacks.emplace_back(std::move(it->second.callback));
+    commit_waiters_.erase(it++);
+  }
+  RunCommitWaiters(std::move(callbacks), Status::OK());
+}
+
+void PendingRounds::RunCommitWaiters(vector<StdStatusCallback> callbacks,
+                                     const Status& status) {
+  if (callbacks.empty()) {
+    return;
+  }
+  auto shared_callbacks = std::make_shared<vector<StdStatusCallback>>(std::move(callbacks));
+  auto run = [shared_callbacks, status]() {
+    for (const auto& callback : *shared_callbacks) {
+      callback(status);
+    }
+  };
+  Status s = callback_pool_->SubmitFunc(run);
+  if (PREDICT_FALSE(!s.ok())) {
+    LOG_WITH_PREFIX(WARNING) << "Unable to submit commit waiters, deferring them until "
+                             << "shutdown: " << s.ToString();
+    unsubmitted_commit_waiters_.emplace_back(std::move(run));
+  }
+}
+
 int PendingRounds::GetNumPendingTxns() const {
   return pending_txns_.size();
 }
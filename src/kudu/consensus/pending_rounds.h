@@ -18,12 +18,20 @@
 #pragma once
 
 #include <cstdint>
+#include <functional>
 #include <map>
 #include <string>
+#include <vector>
 
 #include "kudu/consensus/opid.pb.h"
 #include "kudu/gutil/macros.h"
 #include "kudu/gutil/ref_counted.h"
+#include "kudu/util/monotime.h"
+#include "kudu/util/status_callback.h"
+
+namespace kudu {
+class ThreadPool;
+}  // namespace kudu
 
 namespace kudu {
 class Status;
@@ -32,6 +40,11 @@ namespace consensus {
 class ConsensusRound;
 class TimeManager;
 
+// Invoked with a run of consecutive rounds which were committed, in index
+// order.
+typedef std::function<void(const std::vector<scoped_refptr<ConsensusRound>>&)>
+    CommittedRoundsCallback;
+
 // Tracks the pending consensus rounds being managed by a Raft replica (either leader
 // or follower).
 //
@@ -41,7 +54,16 @@ class TimeManager;
 // We should consolidate to "round".
 class PendingRounds {
  public:
-  PendingRounds(std::string log_prefix, scoped_refptr<TimeManager> time_manager);
+  // 'committed_rounds_cb' is responsible for notifying the rounds that they
+  // were replicated. It is invoked once per advance of the committed index.
+  //
+  // The callbacks passed to WaitForCommittedIndexAsync() are run on
+  // 'callback_pool', since the methods which complete them are called with
+  // the replica's lock held.
+  PendingRounds(std::string log_prefix,
+                scoped_refptr<TimeManager> time_manager,
+                CommittedRoundsCallback committed_rounds_cb,
+                ThreadPool* callback_pool);
   ~PendingRounds();
 
   // Set the committed op during startup. This should be done after
@@ -56,7 +78,8 @@ class PendingRounds {
   // Add 'round' to the set of rounds waiting to be committed.
   Status AddPendingOperation(const scoped_refptr<ConsensusRound>& round);
 
-  // Advances the committed index.
+  // Advances the committed index, handing the newly committed rounds to the
+  // committed rounds callback as a single batch.
   // This is a no-op if the committed index has not changed.
   Status AdvanceCommittedIndex(int64_t committed_index);
 
@@ -91,6 +114,25 @@ class PendingRounds {
   int64_t GetCommittedIndex() const;
   int64_t GetTermWithLastCommittedOp() const;
 
+  // Invokes 'callback' with an OK status once the committed index reaches
+  // 'index', i.e. once all the ops up to 'index' have been notified that they
+  // were committed. It is invoked right away, on the calling thread, if that's
+  // already the case. If 'deadline' is initialized and the committed index
+  // doesn't reach 'index' by then, 'callback' gets Status::TimedOut once
+  // ExpireCommitWaiters() notices it.
+  void WaitForCommittedIndexAsync(int64_t index, const StdStatusCallback& callback,
+                                  const MonoTime& deadline = MonoTime());
+
+  // Invokes the callbacks waiting in WaitForCommittedIndexAsync() whose
+  // deadline has passed with Status::TimedOut, on the callback pool.
+  void ExpireCommitWaiters();
+
+  // Fails the callbacks still waiting in WaitForCommittedIndexAsync() with
+  // 'status'. Returns them, along with any waiters the callback pool couldn't
+  // take earlier, for the caller to run once it has released the replica's
+  // lock.
+  std::vector<std::function<void()>> AbortCommitWaiters(const Status& status);
+
   // Checks that 'current' correctly follows 'previous'. Specifically it checks
   // that the term is the same or higher and that the index is sequential.
   static Status CheckOpInSequence(const OpId& previous, const OpId& current);
@@ -98,6 +140,15 @@ class PendingRounds {
  private:
   const std::string& LogPrefix() const { return log_prefix_; }
 
+  // Invokes the callbacks waiting for the committed index to reach its
+  // current value or a lower one, on the callback pool.
+  void NotifyCommitWaiters();
+
+  // Invokes 'callbacks' with 'status' on the callback pool, so that they don't
+  // run under the replica's lock. If the pool is shut down, they're kept until
+  // AbortCommitWaiters() instead.
+  void RunCommitWaiters(std::vector<StdStatusCallback> callbacks, const Status& status);
+
   const std::string log_prefix_;
 
   // Index=>Round map that manages pending ops, i.e. operations for which we've
@@ -109,8 +160,23 @@ class PendingRounds {
   // The OpId of the round that was last committed. Initialized to MinimumOpId().
   OpId last_committed_op_id_;
 
+  // A callback waiting for the committed index to reach its key in
+  // 'commit_waiters_', until 'deadline' if it is initialized.
+  struct CommitWaiter {
+    StdStatusCallback callback;
+    MonoTime deadline;
+  };
+  std::multimap<int64_t, CommitWaiter> commit_waiters_;
+
+  // Completed waiters which couldn't be submitted to the callback pool.
+  std::vector<std::function<void()>> unsubmitted_commit_waiters_;
+
   scoped_refptr<TimeManager> time_manager_;
 
+  const CommittedRoundsCallback committed_rounds_cb_;
+
+  ThreadPool* const callback_pool_;
+
   DISALLOW_COPY_AND_ASSIGN(PendingRounds);
 };
 
@@ -39,7 +39,9 @@
 #include <boost/optional/optional.hpp>
 #include <gflags/gflags.h>
 #include <gflags/gflags_declare.h>
+#include <google/protobuf/io/coded_stream.h>
 #include <google/protobuf/util/message_differencer.h>
+#include <google/protobuf/wire_format_lite.h>
 
 #include "kudu/common/timestamp.h"
 #include "kudu/common/wire_protocol.h"
@@ -188,6 +190,47 @@ DEFINE_bool(enable_flexi_raft, false,
 DEFINE_bool(track_removed_peers, true,
             "Should peers removed from the config be tracked for using it in RequestVote()");
 
+DEFINE_bool(raft_leader_lease_reads, false,
+            "Whether the leader may confirm reads without a round of requests to its peers "
+            "while it holds a lease, i.e. for a fraction of the minimum election timeout "
+            "after the peers last acknowledged it. This relies on the clocks of the replicas "
+            "advancing at about the same rate, and on elections not ignoring live leaders.");
+TAG_FLAG(raft_leader_lease_reads, experimental);
+TAG_FLAG(raft_leader_lease_reads, runtime);
+
+DEFINE_double(raft_leader_lease_fraction, 0.9,
+              "The fraction of the minimum election timeout for which the leader holds a "
+              "lease after the peers acknowledged it, when --raft_leader_lease_reads is set. "
+              "Lower values tolerate larger differences between the clock rates of the "
+              "replicas.");
+TAG_FLAG(raft_leader_lease_fraction, experimental);
+TAG_FLAG(raft_leader_lease_fraction, runtime);
+
+static bool ValidateLeaderLeaseFraction(const char* flagname, double value) {
+  if (value > 0 && value <= 1) {
+    return true;
+  }
+  LOG(ERROR) << "Invalid value for " << flagname << ": " << value
+             << ", must be in (0, 1]";
+  return false;
+}
+DEFINE_validator(raft_leader_lease_fraction, &ValidateLeaderLeaseFraction);
+
+DEFINE_bool(raft_follower_log_received_bytes, true,
+            "Whether followers write the ops they receive to the log as the "
+            "leader serialized them, rather than serialize them again.");
+TAG_FLAG(raft_follower_log_received_bytes, advanced);
+TAG_FLAG(raft_follower_log_received_bytes, runtime);
+
+DEFINE_int32(raft_follower_reordered_update_wait_ms, 5,
+             "How long a follower waits for the preceding ops of an update "
+             "request pipelined by the leader to arrive in an earlier request, "
+             "when the requests are handled out of order, before rejecting it. "
+             "Rejecting it makes the leader resend all the requests it has in "
+             "flight. 0 disables waiting.");
+TAG_FLAG(raft_follower_reordered_update_wait_ms, advanced);
+TAG_FLAG(raft_follower_reordered_update_wait_ms, runtime);
+
 // Metrics
 // ---------
 METRIC_DEFINE_counter(server, raft_log_truncation_counter,
@@ -283,6 +326,7 @@ RaftConsensus::RaftConsensus(
       cmeta_manager_(std::move(cmeta_manager)),
       persistent_vars_manager_(std::move(persistent_vars_manager)),
       raft_pool_(raft_pool),
+      update_order_cond_(&update_order_lock_),
       state_(kNew),
       proxy_policy_(options_.proxy_policy),
       rng_(GetRandomSeed32()),
@@ -427,7 +471,11 @@ Status RaftConsensus::Start(const ConsensusBootstrapInfo& info,
                                                        raft_pool_token_.get(),
                                                        log_));
 
-  unique_ptr<PendingRounds> pending(new PendingRounds(LogPrefixThreadSafe(), time_manager_));
+  unique_ptr<PendingRounds> pending(new PendingRounds(
+      LogPrefixThreadSafe(), time_manager_,
+      [this](const vector<scoped_refptr<ConsensusRound>>& rounds) {
+        round_handler_->FinishCommittedRounds(rounds);
+      }, raft_pool_));
 
   // Capture a weak_ptr reference into the functor so it can safely handle
   // outliving the consensus instance.
@@ -839,6 +887,9 @@ Status RaftConsensus::BeginLeaderTransferPeriodUnlocked(
 void RaftConsensus::EndLeaderTransferPeriod() {
   transfer_period_timer_->Stop();
   queue_->EndWatchForSuccessor();
+  // Peers may have voted for the successor ignoring the lease they granted
+  // before, so the lease must be re-established with new acknowledgements.
+  queue_->RevokeLeaderLease();
   leader_transfer_in_progress_.Store(false, kMemOrderRelease);
 }
 
@@ -957,6 +1008,189 @@ Status RaftConsensus::Replicate(const scoped_refptr<ConsensusRound>& round) {
   return Status::OK();
 }
 
+Status RaftConsensus::ReplicateBatch(const vector<scoped_refptr<ConsensusRound>>& rounds) {
+  if (rounds.empty()) {
+    return Status::OK();
+  }
+
+  std::lock_guard<simple_spinlock> lock(update_lock_);
+  {
+    ThreadRestrictions::AssertWaitAllowed();
+    LockGuard l(lock_);
+    RETURN_NOT_OK(AppendNewRoundsToQueueUnlocked(rounds));
+  }
+
+  peer_manager_->SignalRequest();
+  return Status::OK();
+}
+
+void RaftConsensus::ReadIndexAsync(const ReadIndexCallback& callback,
+                                   const MonoTime& deadline) {
+  Status s;
+  bool is_leader = false;
+  {
+    ThreadRestrictions::AssertWaitAllowed();
+    LockGuard l(lock_);
+    s = CheckRunningUnlocked();
+    if (s.ok()) {
+      is_leader = cmeta_->active_role() == RaftPeerPB::LEADER;
+    }
+  }
+  if (PREDICT_FALSE(!s.ok())) {
+    callback(s, kMinimumOpIdIndex);
+    return;
+  }
+
+  // Even on the leader, the queue may have committed ops which haven't been
+  // notified yet.
+  weak_ptr<RaftConsensus> w = shared_from_this();
+  auto wait_for_commit = [w, callback, deadline](const Status& s, int64_t read_index) {
+    auto consensus = w.lock();
+    if (PREDICT_FALSE(!s.ok() || !consensus)) {
+      callback(s.ok() ? Status::Aborted("RaftConsensus was destroyed") : s, read_index);
+      return;
+    }
+    consensus->WaitForCommittedIndexAsync(read_index, callback, deadline);
+  };
+  if (is_leader) {
+    LeaderReadIndexAsync(wait_for_commit, deadline);
+  } else {
+    ForwardReadIndexToLeader(wait_for_commit, deadline);
+  }
+}
+
+void RaftConsensus::ForwardReadIndexToLeader(const ReadIndexCallback& callback,
+                                             const MonoTime& deadline) {
+  string leader_uuid;
+  RaftPeerPB leader_pb;
+  shared_ptr<PeerProxy> proxy;
+  Status s;
+  {
+    ThreadRestrictions::AssertWaitAllowed();
+    LockGuard l(lock_);
+    leader_uuid = GetLeaderUuidUnlocked();
+    if (leader_uuid.empty()) {
+      s = Status::ServiceUnavailable("no leader is known");
+    } else if (leader_uuid == leader_read_proxy_uuid_) {
+      proxy = leader_read_proxy_;
+    } else {
+      s = cmeta_->GetConfigMemberCopy(leader_uuid, &leader_pb);
+    }
+  }
+  if (s.ok() && !proxy) {
+    // Creating a proxy may resolve the leader's address, so it's done without
+    // holding the lock.
+    s = peer_proxy_factory_->NewProxy(leader_pb, &proxy);
+    if (s.ok()) {
+      LockGuard l(lock_);
+      leader_read_proxy_ = proxy;
+      leader_read_proxy_uuid_ = leader_uuid;
+    }
+  }
+  if (PREDICT_FALSE(!s.ok())) {
+    callback(s.CloneAndPrepend("unable to forward read to the leader"), kMinimumOpIdIndex);
+    return;
+  }
+
+  struct ReadIndexCall {
+    ReadIndexRequestPB request;
+    ReadIndexResponsePB response;
+    rpc::RpcController controller;
+  };
+  // Deleted by the response callback, which the RPC layer always invokes.
+  ReadIndexCall* call = new ReadIndexCall;
+  call->request.set_dest_uuid(leader_uuid);
+  call->request.set_tablet_id(options_.tablet_id);
+  call->request.set_caller_uuid(peer_uuid());
+  if (deadline.Initialized()) {
+    call->controller.set_deadline(deadline);
+  }
+  proxy->ReadIndexAsync(&call->request, &call->response, &call->controller,
+                        [call, proxy, callback]() {
+    unique_ptr<ReadIndexCall> owned_call(call);
+    Status s = call->controller.status();
+    if (s.ok() && call->response.has_error()) {
+      s = StatusFromPB(call->response.error().status());
+    }
+    if (PREDICT_FALSE(!s.ok())) {
+      callback(s.CloneAndPrepend("leader could not confirm the read"), kMinimumOpIdIndex);
+      return;
+    }
+    callback(Status::OK(), call->response.read_index());
+  });
+}
+
+void RaftConsensus::WaitForCommittedIndexAsync(int64_t read_index,
+                                               const ReadIndexCallback& callback,
+                                               const MonoTime& deadline) {
+  Status s;
+  {
+    ThreadRestrictions::AssertWaitAllowed();
+    LockGuard l(lock_);
+    s = CheckRunningUnlocked();
+    if (s.ok() && pending_->GetCommittedIndex() < read_index) {
+      pending_->WaitForCommittedIndexAsync(read_index, [callback, read_index](const Status& s) {
+        callback(s, read_index);
+      }, deadline);
+      return;
+    }
+  }
+  callback(s, read_index);
+}
+
+void RaftConsensus::LeaderReadIndexAsync(const ReadIndexCallback& callback,
+                                         const MonoTime& deadline) {
+  boost::optional<MonoDelta> lease_duration;
+  Status s;
+  {
+    ThreadRestrictions::AssertWaitAllowed();
+    LockGuard l(lock_);
+    s = CheckRunningUnlocked();
+    if (s.ok() && cmeta_->active_role() != RaftPeerPB::LEADER) {
+      s = Status::IllegalState(Substitute("Replica $0 is not leader of this config",
+                                          peer_uuid()));
+    }
+    // While a leadership transfer is in progress, the successor may be
+    // elected without waiting for the lease to expire.
+    if (s.ok() && FLAGS_raft_leader_lease_reads && !leader_transfer_in_progress_.Load()) {
+      lease_duration = MonoDelta::FromNanoseconds(static_cast<int64_t>(
+          MinimumElectionTimeout().ToNanoseconds() * FLAGS_raft_leader_lease_fraction));
+    }
+  }
+  if (PREDICT_FALSE(!s.ok())) {
+    callback(s, kMinimumOpIdIndex);
+    return;
+  }
+  if (queue_->ReadIndex(callback, lease_duration, deadline)) {
+    peer_manager_->SignalHeartbeat();
+  }
+}
+
+Status RaftConsensus::ReadIndex(const MonoDelta& timeout, int64_t* read_index) {
+  // The callback may outlive this call if it times out.
+  auto index = std::make_shared<int64_t>(kMinimumOpIdIndex);
+  Synchronizer sync;
+  auto sync_cb = sync.AsStdStatusCallback();
+  ReadIndexAsync([index, sync_cb](const Status& s, int64_t idx) {
+    *index = idx;
+    sync_cb(s);
+  }, MonoTime::Now() + timeout);
+  Status s = sync.WaitFor(timeout);
+  if (PREDICT_FALSE(s.IsTimedOut())) {
+    // Don't leave the read queued until the next request to a peer, or, on a
+    // follower, until the next request from the leader.
+    queue_->ExpirePendingReads();
+    ThreadRestrictions::AssertWaitAllowed();
+    LockGuard l(lock_);
+    if (pending_) {
+      pending_->ExpireCommitWaiters();
+    }
+  }
+  RETURN_NOT_OK(s);
+  *read_index = *index;
+  return Status::OK();
+}
+
 Status RaftConsensus::TruncateCallbackWithRaftLock(int64_t *index_if_truncated) {
   DCHECK(FLAGS_raft_derived_log_mode);
   ThreadRestrictions::AssertWaitAllowed();
@@ -1011,6 +1245,49 @@ Status RaftConsensus::AppendNewRoundToQueueUnlocked(const scoped_refptr<Consensu
   return Status::OK();
 }
 
+Status RaftConsensus::AppendNewRoundsToQueueUnlocked(
+    const vector<scoped_refptr<ConsensusRound>>& rounds) {
+  DCHECK(lock_.is_locked());
+  RETURN_NOT_OK(CheckSafeToReplicateUnlocked(*rounds.front()->replicate_msg()));
+  const int64_t current_term = CurrentTermUnlocked();
+  OpId next_id = queue_->GetNextOpId();
+
+  // Check every round before admitting any of them, so that a batch is
+  // admitted as a whole or not at all.
+  int64_t index = next_id.index();
+  for (const auto& round : rounds) {
+    RETURN_NOT_OK(round->CheckBoundTerm(current_term));
+    // Adding a config change to the pending rounds may fail, midway through
+    // the batch.
+    if (PREDICT_FALSE(round->replicate_msg()->op_type() == CHANGE_CONFIG_OP)) {
+      return Status::InvalidArgument("config changes can't be replicated in a batch");
+    }
+    // See AppendNewRoundToQueueUnlocked().
+    const int64_t round_index = round->replicate_msg()->id().index();
+    if (PREDICT_FALSE(round_index != 0 && round_index != index)) {
+      return Status::Aborted(Substitute(
+          "Transaction submitted with index $0 mismatches with queue index $1",
+          round_index, index));
+    }
+    index++;
+  }
+
+  vector<ReplicateRefPtr> msgs;
+  msgs.reserve(rounds.size());
+  for (const auto& round : rounds) {
+    *round->replicate_msg()->mutable_id() = next_id;
+    next_id.set_index(next_id.index() + 1);
+    CHECK_OK(AddPendingOperationUnlocked(round));
+    msgs.push_back(round->replicate_scoped_refptr());
+  }
+
+  // The only reasons for a bad status would be if the log itself were shut down,
+  // or if we had an actual IO error, which we currently don't handle.
+  CHECK_OK_PREPEND(queue_->AppendOperations(msgs),
+                   Substitute("$0: could not append to queue", LogPrefixUnlocked()));
+  return Status::OK();
+}
+
 Status RaftConsensus::AddPendingOperationUnlocked(const scoped_refptr<ConsensusRound>& round) {
   DCHECK(lock_.is_locked());
   DCHECK(pending_);
@@ -1263,8 +1540,62 @@ void RaftConsensus::TryStartElectionOnPeerTask(const string& peer_uuid,
               Substitute("unable to start election on peer $0", peer_uuid));
 }
 
+namespace {
+// Sets 'ops' to the serialized ops of 'serialized_request', a serialized
+// ConsensusRequestPB with 'num_ops' ops. Returns false if they couldn't all be
+// found.
+bool FindSerializedOps(const Slice& serialized_request, int num_ops, vector<Slice>* ops) {
+  using google::protobuf::io::CodedInputStream;
+  using google::protobuf::internal::WireFormatLite;
+  CodedInputStream in(serialized_request.data(), serialized_request.size());
+  in.SetTotalBytesLimit(serialized_request.size(), -1);
+  ops->reserve(num_ops);
+  while (uint32_t tag = in.ReadTag()) {
+    if (WireFormatLite::GetTagFieldNumber(tag) != ConsensusRequestPB::kOpsFieldNumber ||
+        WireFormatLite::GetTagWireType(tag) != WireFormatLite::WIRETYPE_LENGTH_DELIMITED) {
+      if (!WireFormatLite::SkipField(&in, tag)) {
+        return false;
+      }
+      continue;
+    }
+    uint32_t length;
+    if (!in.ReadVarint32(&length)) {
+      return false;
+    }
+    const int offset = in.CurrentPosition();
+    if (!in.Skip(length)) {
+      return false;
+    }
+    ops->emplace_back(serialized_request.data() + offset, length);
+  }
+  return ops->size() == num_ops;
+}
+} // anonymous namespace
+
+bool RaftConsensus::IsHeartbeatRequest(const Slice& serialized_request) {
+  using google::protobuf::io::CodedInputStream;
+  using google::protobuf::internal::WireFormatLite;
+  CodedInputStream in(serialized_request.data(), serialized_request.size());
+  while (true) {
+    const uint32_t tag = in.ReadTag();
+    if (tag == 0) {
+      // A malformed request isn't given priority.
+      return in.ConsumedEntireMessage();
+    }
+    const int field = WireFormatLite::GetTagFieldNumber(tag);
+    if (field == ConsensusRequestPB::kOpsFieldNumber ||
+        field == ConsensusRequestPB::kCompressionDictionariesFieldNumber) {
+      return false;
+    }
+    if (!WireFormatLite::SkipField(&in, tag)) {
+      return false;
+    }
+  }
+}
+
 Status RaftConsensus::Update(const ConsensusRequestPB* request,
-                             ConsensusResponsePB* response) {
+                             ConsensusResponsePB* response,
+                             const Slice& serialized_request) {
   update_calls_for_tests_.Increment();
 
   if (PREDICT_FALSE(
@@ -1278,9 +1609,42 @@ Status RaftConsensus::Update(const ConsensusRequestPB* request,
 
   VLOG_WITH_PREFIX(2) << "Replica received request: " << SecureShortDebugString(*request);
 
-  // see var declaration
-  std::lock_guard<simple_spinlock> lock(update_lock_);
-  Status s = UpdateReplica(request, response);
+  // The leader sends each op as it serialized it, so the follower can log
+  // the op's bytes rather than serialize it again.
+  vector<Slice> serialized_ops;
+  if (FLAGS_raft_follower_log_received_bytes && !serialized_request.empty() &&
+      request->ops_size() > 0 &&
+      !FindSerializedOps(serialized_request, request->ops_size(), &serialized_ops)) {
+    LOG_WITH_PREFIX(DFATAL) << "Unable to find the serialized ops of the request";
+    serialized_ops.clear();
+  }
+
+  // Register the dictionaries some of the ops were compressed with before
+  // they are logged or applied.
+  for (const string& dictionary : request->compression_dictionaries()) {
+    uint32_t dict_id;
+    RETURN_NOT_OK_PREPEND(queue_->log_cache()->RegisterCompressionDictionary(dictionary,
+                                                                             &dict_id),
+                          "Unable to register compression dictionary");
+    response->add_compression_dictionary_ids(dict_id);
+  }
+
+  WaitForPrecedingUpdate(*request);
+
+  Status s;
+  {
+    // see var declaration
+    std::unique_lock<simple_spinlock> lock(update_lock_, std::defer_lock);
+    if (request->ops_size() == 0 && request->compression_dictionaries_size() == 0 &&
+        !lock.try_lock() && TryAcknowledgeHeartbeat(request, response)) {
+      return Status::OK();
+    }
+    if (!lock.owns_lock()) {
+      lock.lock();
+    }
+    s = UpdateReplica(request, serialized_ops, response);
+  }
+  UpdateHandled(*request, *response);
   if (PREDICT_FALSE(VLOG_IS_ON(1))) {
     if (request->ops().empty()) {
       VLOG_WITH_PREFIX(1) << "Replica replied to status only request. Replica: "
@@ -1291,6 +1655,71 @@ Status RaftConsensus::Update(const ConsensusRequestPB* request,
   return s;
 }
 
+void RaftConsensus::WaitForPrecedingUpdate(const ConsensusRequestPB& request) {
+  const int32_t wait_ms = FLAGS_raft_follower_reordered_update_wait_ms;
+  if (wait_ms <= 0 || !request.pipelined() || request.ops_size() == 0 ||
+      !request.has_preceding_id()) {
+    return;
+  }
+  const MonoTime deadline = MonoTime::Now() + MonoDelta::FromMilliseconds(wait_ms);
+  MutexLock l(update_order_lock_);
+  while (last_update_received_index_ >= 0 &&
+         last_update_caller_uuid_ == request.caller_uuid() &&
+         last_update_received_index_ < request.preceding_id().index()) {
+    if (!update_order_cond_.WaitUntil(deadline)) {
+      break;
+    }
+  }
+}
+
+void RaftConsensus::UpdateHandled(const ConsensusRequestPB& request,
+                                  const ConsensusResponsePB& response) {
+  if (!response.has_status() || !response.status().has_last_received()) {
+    return;
+  }
+  MutexLock l(update_order_lock_);
+  if (last_update_caller_uuid_ != request.caller_uuid()) {
+    last_update_status_.Clear();
+  }
+  last_update_caller_uuid_ = request.caller_uuid();
+  last_update_received_index_ = response.status().last_received().index();
+  if (!response.status().has_error()) {
+    last_update_term_ = response.responder_term();
+    last_update_status_ = response.status();
+  }
+  update_order_cond_.Broadcast();
+}
+
+bool RaftConsensus::TryAcknowledgeHeartbeat(const ConsensusRequestPB* request,
+                                            ConsensusResponsePB* response) {
+  ConsensusStatusPB status;
+  {
+    MutexLock l(update_order_lock_);
+    if (last_update_caller_uuid_ != request->caller_uuid() ||
+        last_update_term_ != request->caller_term() ||
+        !last_update_status_.IsInitialized()) {
+      return false;
+    }
+    status = last_update_status_;
+  }
+
+  ThreadRestrictions::AssertWaitAllowed();
+  LockGuard l(lock_);
+  if (!CheckRunningUnlocked().ok() ||
+      request->caller_term() != CurrentTermUnlocked() ||
+      request->caller_uuid() != GetLeaderUuidUnlocked()) {
+    return false;
+  }
+  SnoozeFailureDetector(boost::none, MinimumElectionTimeoutWithBan());
+  // The leader counts a successful response towards its lease, so withhold
+  // votes for as long as UpdateReplica() would have.
+  withhold_votes_until_ = MonoTime::Now() + MinimumElectionTimeout();
+  response->set_responder_term(CurrentTermUnlocked());
+  *response->mutable_status() = status;
+  TRACE("Acknowledged heartbeat while another update is in progress");
+  return true;
+}
+
 // Helper function to check if the op is a non-Transaction op.
 static bool IsConsensusOnlyOperation(OperationType op_type) {
   return op_type == NO_OP || op_type == CHANGE_CONFIG_OP;
@@ -1578,6 +2007,7 @@ Status RaftConsensus::CheckLeaderRequestUnlocked(const ConsensusRequestPB* reque
 }
 
 Status RaftConsensus::UpdateReplica(const ConsensusRequestPB* request,
+                                    const vector<Slice>& serialized_ops,
                                     ConsensusResponsePB* response) {
   TRACE_EVENT2("consensus", "RaftConsensus::UpdateReplica",
                "peer", peer_uuid(),
@@ -1677,6 +2107,14 @@ Status RaftConsensus::UpdateReplica(const ConsensusRequestPB* request,
   // The deduplicated request.
   LeaderRequest deduped_req;
   auto& messages = deduped_req.messages;
+  // The messages which are logged from the bytes received from the leader.
+  // The bytes are only valid for the duration of this call.
+  vector<ReplicateRefPtr> received_messages;
+  SCOPED_CLEANUP({
+    for (const ReplicateRefPtr& msg : received_messages) {
+      msg->clear_received_bytes();
+    }
+  });
   {
     ThreadRestrictions::AssertWaitAllowed();
     LockGuard l(lock_);
@@ -1694,6 +2132,14 @@ Status RaftConsensus::UpdateReplica(const ConsensusRequestPB* request,
       return Status::OK();
     }
 
+    if (!serialized_ops.empty()) {
+      DCHECK_EQ(request->ops_size() + messages.size(), serialized_ops.size());
+      for (int i = 0; i < messages.size(); i++) {
+        messages[i]->set_received_bytes(serialized_ops[deduped_req.first_message_idx + i]);
+      }
+      received_messages = messages;
+    }
+
     // Snooze the failure detector as soon as we decide to accept the message.
     // We are guaranteed to be acting as a FOLLOWER at this point by the above
     // sanity check.
@@ -1726,6 +2172,9 @@ Status RaftConsensus::UpdateReplica(const ConsensusRequestPB* request,
     // from 1x -> 2X of election timeout.
     withhold_votes_until_ = MonoTime::Now() + MinimumElectionTimeout();
 
+    // Fail the reads which gave up waiting for the committed index.
+    pending_->ExpireCommitWaiters();
+
     // 1 - Early commit pending (and committed) transactions
 
     // What should we commit?
@@ -2605,10 +3054,15 @@ void RaftConsensus::Stop() {
   // We must close the queue after we close the peers.
   if (queue_) queue_->Close();
 
+  vector<std::function<void()>> aborted_commit_waiters;
   {
     ThreadRestrictions::AssertWaitAllowed();
     LockGuard l(lock_);
-    if (pending_) CHECK_OK(pending_->CancelPendingTransactions());
+    if (pending_) {
+      CHECK_OK(pending_->CancelPendingTransactions());
+      aborted_commit_waiters =
+          pending_->AbortCommitWaiters(Status::Aborted("Raft consensus is shutting down"));
+    }
     SetStateUnlocked(kStopped);
 
     // Clear leader status on Stop(), in case this replica was the leader. If
@@ -2625,6 +3079,9 @@ void RaftConsensus::Stop() {
 
     LOG_WITH_PREFIX_UNLOCKED(INFO) << "Raft consensus is shut down!";
   }
+  for (const auto& waiter : aborted_commit_waiters) {
+    waiter();
+  }
 
   // Shut down things that might acquire locks during destruction.
   if (raft_pool_token_) raft_pool_token_->Shutdown();
@@ -4079,6 +4536,14 @@ void RaftConsensus::HandleProxyRequest(const ConsensusRequestPB* request,
   if(request->has_region_durable_index()) {
     downstream_request.set_region_durable_index(request->region_durable_index());
   }
+  if (request->pipelined()) {
+    downstream_request.set_pipelined(true);
+  }
+  // The peer needs the dictionaries the ops were compressed with, whether
+  // they are forwarded or reconstituted from the local log.
+  for (const string& dictionary : request->compression_dictionaries()) {
+    downstream_request.add_compression_dictionaries(dictionary);
+  }
 
   downstream_request.set_proxy_caller_uuid(peer_uuid());
 
@@ -4252,6 +4717,9 @@ void RaftConsensus::HandleProxyRequest(const ConsensusRequestPB* request,
   if (downstream_response.has_status()) {
     *response->mutable_status() = downstream_response.status();
   }
+  for (uint32_t dict_id : downstream_response.compression_dictionary_ids()) {
+    response->add_compression_dictionary_ids(dict_id);
+  }
   if (downstream_response.has_error()) {
     *response->mutable_error() = downstream_response.error();
   }
@@ -4273,6 +4741,16 @@ Status RaftConsensus::EnableCompressionOnCacheMiss(bool enable) {
   return queue_->log_cache()->EnableCompressionOnCacheMiss(enable);
 }
 
+Status RaftConsensus::TrainCompressionDictionary(size_t max_size, std::string* dictionary) {
+  return queue_->log_cache()->TrainCompressionDictionary(max_size, dictionary);
+}
+
+Status RaftConsensus::SetCompressionDictionary(const std::string& dictionary) {
+  // Not under 'lock_': this syncs the dictionary to disk, and the codec is
+  // switched atomically.
+  return queue_->log_cache()->SetCompressionDictionary(dictionary);
+}
+
 Status RaftConsensus::SetProxyPolicy(const ProxyPolicy& proxy_policy) {
   LockGuard l(lock_);
   proxy_policy_ = proxy_policy;
@@ -4341,6 +4819,13 @@ ConsensusRound::ConsensusRound(RaftConsensus* consensus,
   DCHECK(replicate_msg_);
 }
 
+void ConsensusRoundHandler::FinishCommittedRounds(
+    const vector<scoped_refptr<ConsensusRound>>& rounds) {
+  for (const auto& round : rounds) {
+    round->NotifyReplicationFinished(Status::OK());
+  }
+}
+
 void ConsensusRound::NotifyReplicationFinished(const Status& status) {
   if (PREDICT_FALSE(!replicated_cb_)) return;
   replicated_cb_(status);
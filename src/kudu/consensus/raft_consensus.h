@@ -59,11 +59,14 @@
 #endif
 
 #include "kudu/util/atomic.h"
+#include "kudu/util/condition_variable.h"
 #include "kudu/util/locks.h"
 #include "kudu/util/make_shared.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
+#include "kudu/util/mutex.h"
 #include "kudu/util/random.h"
+#include "kudu/util/slice.h"
 #include "kudu/util/status_callback.h"
 
 namespace kudu {
@@ -92,6 +95,7 @@ class ConsensusMetadataManager;
 class ConsensusRound;
 class ConsensusRoundHandler;
 class PeerManager;
+class PeerProxy;
 class PeerProxyFactory;
 class PersistentVarsManager;
 class PendingRounds;
@@ -380,6 +384,15 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // This method can only be called on the leader, i.e. role() == LEADER
   Status Replicate(const scoped_refptr<ConsensusRound>& round);
 
+  // Replicates 'rounds' as if by calling Replicate() on each of them in
+  // order, but checks leadership, assigns the OpIds and appends the rounds to
+  // the queue, the log cache and the log once for the whole batch, under a
+  // single acquisition of the consensus lock.
+  //
+  // Either all the rounds are admitted or, if any of them can't be, none is
+  // and an error is returned. Config changes can't be batched.
+  Status ReplicateBatch(const std::vector<scoped_refptr<ConsensusRound>>& rounds);
+
   // Ensures that the consensus implementation is currently acting as LEADER,
   // and thus is allowed to submit operations to be prepared before they are
   // replicated. To avoid a time-of-check-to-time-of-use (TOCTOU) race, the
@@ -388,6 +401,46 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // that the term has not changed in the meantime.
   Status CheckLeadershipAndBindTerm(const scoped_refptr<ConsensusRound>& round);
 
+  typedef PeerMessageQueue::ReadIndexCallback ReadIndexCallback;
+
+  // Obtains the read index for a linearizable read: once 'callback' is
+  // invoked with an OK status, a read served from the state resulting from
+  // applying all the ops up to 'read_index' is linearizable.
+  //
+  // The leader obtains it with LeaderReadIndexAsync(). Followers and learners
+  // ask the leader for it with a ReadIndex RPC, so that reads can be served
+  // by any replica. In both cases, 'callback' is invoked once this replica
+  // has notified all the ops up to 'read_index' that they were committed;
+  // the caller must still wait for them to be applied.
+  //
+  // 'callback' gets an error if no leader is known, if the leader couldn't
+  // confirm the read, or if this replica is shut down first. It gets
+  // Status::TimedOut if 'deadline' is initialized and the read isn't confirmed
+  // and committed locally by then. It is never invoked while this instance's
+  // lock is held, but may run on the raft thread pool, and must not block.
+  void ReadIndexAsync(const ReadIndexCallback& callback,
+                      const MonoTime& deadline = MonoTime());
+
+  // Synchronous version of ReadIndexAsync(), which waits up to 'timeout' for
+  // the read index to be obtained and committed locally. If it times out, the
+  // read stops waiting, whether for its confirmation on the leader or for the
+  // committed index to reach it.
+  Status ReadIndex(const MonoDelta& timeout, int64_t* read_index);
+
+  // Obtains the read index on the leader: its committed index, once it has
+  // confirmed that it was still the leader when this was called.
+  //
+  // The leader confirms it with a round of requests to its peers, which is
+  // shared by concurrent reads. With --raft_leader_lease_reads, it skips the
+  // round while it holds a lease.
+  //
+  // 'callback' gets an error if this replica isn't the leader, hasn't
+  // committed an op in its term yet, or loses leadership before the read is
+  // confirmed, and Status::TimedOut if 'deadline' is initialized and the read
+  // isn't confirmed by then. It must not block.
+  void LeaderReadIndexAsync(const ReadIndexCallback& callback,
+                            const MonoTime& deadline = MonoTime());
+
   // Messages sent from LEADER to FOLLOWERS and LEARNERS to update their
   // state machines. This is equivalent to "AppendEntries()" in Raft
   // terminology.
@@ -412,8 +465,17 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // error response could not be formed, which will result in the service
   // returning an UNKNOWN_ERROR RPC error code to the caller and including the
   // stringified Status message.
+  //
+  // If 'serialized_request' is the request as it was received, the ops are
+  // logged from their bytes in it rather than serialized again.
   Status Update(const ConsensusRequestPB* request,
-                ConsensusResponsePB* response);
+                ConsensusResponsePB* response,
+                const Slice& serialized_request = Slice());
+
+  // Returns true if 'serialized_request', a serialized ConsensusRequestPB, is a
+  // heartbeat, i.e. carries neither ops nor compression dictionaries. Such
+  // requests are cheap to handle and are given priority by the service.
+  static bool IsHeartbeatRequest(const Slice& serialized_request);
 
   // Messages sent from CANDIDATEs to voting peers to request their vote
   // in leader election.
@@ -626,6 +688,14 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // Enables (or disables) compression of messages read from log
   Status EnableCompressionOnCacheMiss(bool enable);
 
+  // Trains a zstd dictionary on recently replicated payloads. See
+  // LogCache::TrainCompressionDictionary().
+  Status TrainCompressionDictionary(size_t max_size, std::string* dictionary);
+
+  // Compress ReplicateMsg payloads with zstd using 'dictionary'. See
+  // LogCache::SetCompressionDictionary().
+  Status SetCompressionDictionary(const std::string& dictionary);
+
   // Clear the 'removed_peers_' list managed by consensus_meta
   void ClearRemovedPeersList();
 
@@ -646,9 +716,12 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   friend class tserver::TSTabletManager;
   FRIEND_TEST(RaftConsensusQuorumTest, TestConsensusContinuesIfAMinorityFallsBehind);
   FRIEND_TEST(RaftConsensusQuorumTest, TestConsensusStopsIfAMajorityFallsBehind);
+  FRIEND_TEST(RaftConsensusQuorumTest, TestCommittedRoundsAreNotifiedInBatches);
+  FRIEND_TEST(RaftConsensusQuorumTest, TestReadIndex);
   FRIEND_TEST(RaftConsensusQuorumTest, TestLeaderElectionWithQuiescedQuorum);
   FRIEND_TEST(RaftConsensusQuorumTest, TestReplicasEnforceTheLogMatchingProperty);
   FRIEND_TEST(RaftConsensusQuorumTest, TestRequestVote);
+  FRIEND_TEST(RaftConsensusQuorumTest, TestAcknowledgedHeartbeatWithholdsVotes);
 
   // RaftConsensus lifecycle states.
   //
@@ -768,9 +841,37 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // and triggering the required transactions. This method won't return until all
   // operations have been stored in the log and all Prepares() have been completed,
   // and a replica cannot accept any more Update() requests until this is done.
+  //
+  // 'serialized_ops' are the serialized ops of the request, if available, or
+  // empty.
   Status UpdateReplica(const ConsensusRequestPB* request,
+                       const std::vector<Slice>& serialized_ops,
                        ConsensusResponsePB* response);
 
+  // A leader may pipeline several UpdateConsensus requests to a follower, and
+  // the service threads may pick them up out of order. A request handled
+  // before the one carrying its preceding ops would be rejected with an LMP
+  // mismatch, which stalls the leader's pipeline until everything it has in
+  // flight has been answered. So if 'request' was pipelined and starts past
+  // the last op received from the same leader, this waits for up to
+  // --raft_follower_reordered_update_wait_ms for the requests ahead of it to
+  // be handled.
+  void WaitForPrecedingUpdate(const ConsensusRequestPB& request);
+
+  // Records the last op received as of handling 'request', waking up the
+  // requests waiting for it in WaitForPrecedingUpdate().
+  void UpdateHandled(const ConsensusRequestPB& request, const ConsensusResponsePB& response);
+
+  // Called for a heartbeat, i.e. an UpdateConsensus request without ops, which
+  // arrives while another request holds 'update_lock_', e.g. a large batch
+  // waiting for its ops to be logged. Rather than leave a high priority service
+  // thread blocked behind it, a heartbeat from the current leader snoozes the
+  // failure detector and is answered with the status of the last request
+  // handled, which the leader has already seen. Returns false if 'request'
+  // must be handled by UpdateReplica() instead.
+  bool TryAcknowledgeHeartbeat(const ConsensusRequestPB* request,
+                               ConsensusResponsePB* response);
+
   // Deduplicates an RPC request making sure that we get only messages that we
   // haven't appended to our log yet.
   // On return 'deduplicated_req' is instantiated with only the new messages
@@ -985,6 +1086,10 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // As a leader, append a new ConsensusRound to the queue.
   Status AppendNewRoundToQueueUnlocked(const scoped_refptr<ConsensusRound>& round);
 
+  // As a leader, append several new ConsensusRounds to the queue at once.
+  // See ReplicateBatch().
+  Status AppendNewRoundsToQueueUnlocked(const std::vector<scoped_refptr<ConsensusRound>>& rounds);
+
   // As a follower, start a consensus round not associated with a Transaction.
   Status StartConsensusOnlyRoundUnlocked(const ReplicateRefPtr& msg);
 
@@ -1039,6 +1144,16 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // Returns the term set in the last config change round.
   const int64_t CurrentTermUnlocked() const;
 
+  // Asks the leader for a read index on behalf of this replica, with an RPC
+  // which times out at 'deadline' if it is initialized. See ReadIndexAsync().
+  void ForwardReadIndexToLeader(const ReadIndexCallback& callback, const MonoTime& deadline);
+
+  // Invokes 'callback' once the ops up to 'read_index' have been notified
+  // that they were committed, or with Status::TimedOut if 'deadline' is
+  // initialized and passes first.
+  void WaitForCommittedIndexAsync(int64_t read_index, const ReadIndexCallback& callback,
+                                  const MonoTime& deadline);
+
   // Accessors for the leader of the current term.
   std::string GetLeaderUuidUnlocked() const;
   bool HasLeaderUnlocked() const;
@@ -1098,6 +1213,25 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // 'update_lock_' lock must be taken first.
   mutable simple_spinlock update_lock_;
 
+  // Orders the handling of the UpdateConsensus requests pipelined by a
+  // leader, which the service threads may pick up out of order. See
+  // WaitForPrecedingUpdate().
+  Mutex update_order_lock_;
+  ConditionVariable update_order_cond_;
+
+  // The leader of the last UpdateConsensus request handled, and the index of
+  // the last op received as of handling it, or -1 before any request was
+  // handled. Protected by 'update_order_lock_'.
+  std::string last_update_caller_uuid_;
+  int64_t last_update_received_index_ = -1;
+
+  // The term and status of the last response to an UpdateConsensus request
+  // from 'last_update_caller_uuid_' which was handled without error, or an
+  // uninitialized status if there is none. See TryAcknowledgeHeartbeat().
+  // Protected by 'update_order_lock_'.
+  int64_t last_update_term_ = -1;
+  ConsensusStatusPB last_update_status_;
+
   // Coarse-grained lock that protects all mutable data members.
   mutable simple_spinlock lock_;
 
@@ -1167,6 +1301,11 @@ class RaftConsensus : public std::enable_shared_from_this<RaftConsensus>,
   // nodes from disturbing the healthy leader.
   MonoTime withhold_votes_until_;
 
+  // A proxy to the leader, to forward reads to, and the leader's uuid. See
+  // ForwardReadIndexToLeader(). Protected by 'lock_'.
+  std::shared_ptr<PeerProxy> leader_read_proxy_;
+  std::string leader_read_proxy_uuid_;
+
   // This is used in tests to reject AppendEntries RPC requests.
   bool reject_append_entries_;
 
@@ -1274,6 +1413,14 @@ class ConsensusRoundHandler {
   // replication. This can be used to trigger callbacks, akin to an Apply() for
   // transaction ops.
   virtual void FinishConsensusOnlyRound(ConsensusRound* round) = 0;
+
+  // Called with each run of consecutive rounds, in index order, that the
+  // commit index advanced over. Handlers which can apply several rounds in one
+  // step may override this, and must then call NotifyReplicationFinished() on
+  // each of the rounds. By default every round is notified in turn.
+  //
+  // This is called with the consensus lock held.
+  virtual void FinishCommittedRounds(const std::vector<scoped_refptr<ConsensusRound>>& rounds);
 };
 
 // Context for a consensus round on the LEADER side, typically created as an
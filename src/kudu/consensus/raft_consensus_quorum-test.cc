@@ -22,10 +22,12 @@
 // ********************************************************************
 
 #include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <memory>
 #include <ostream>
 #include <string>
+#include <thread>
 #include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
@@ -74,6 +76,7 @@
 #include "kudu/gutil/strings/substitute.h"
 //#include "kudu/tablet/metadata.pb.h"
 #include "kudu/util/async_util.h"
+#include "kudu/util/countdown_latch.h"
 #include "kudu/util/mem_tracker.h"
 #include "kudu/util/metrics.h"
 //METRIC_DEFINE_entity(tablet);
@@ -81,12 +84,14 @@
 #include "kudu/util/pb_util.h"
 #include "kudu/util/status.h"
 #include "kudu/util/status_callback.h"
+#include "kudu/util/stopwatch.h"
 #include "kudu/util/test_macros.h"
 #include "kudu/util/test_util.h"
 #include "kudu/util/threadpool.h"
 
 DECLARE_int32(raft_heartbeat_interval_ms);
 DECLARE_bool(enable_leader_failure_detection);
+DECLARE_bool(raft_leader_lease_reads);
 
 //METRIC_DECLARE_entity(tablet);
 
@@ -765,6 +770,220 @@ TEST_F(RaftConsensusQuorumTest, TestConsensusStopsIfAMajorityFallsBehind) {
   VerifyLogs(2, 0, 1);
 }
 
+// Tests that the rounds the commit index advances over are handed to the
+// round handler in contiguous batches, in index order, and that advances made
+// while the followers are blocked are merged into one batch.
+TEST_F(RaftConsensusQuorumTest, TestCommittedRoundsAreNotifiedInBatches) {
+  const int kFollower0Idx = 0;
+  const int kFollower1Idx = 1;
+  const int kLeaderIdx = 2;
+  const int kNumOps = 10;
+
+  ASSERT_OK(BuildAndStartConfig(3));
+  shared_ptr<RaftConsensus> follower0;
+  CHECK_OK(peers_->GetPeerByIdx(kFollower0Idx, &follower0));
+  shared_ptr<RaftConsensus> follower1;
+  CHECK_OK(peers_->GetPeerByIdx(kFollower1Idx, &follower1));
+
+  OpId last_op_id;
+  vector<scoped_refptr<ConsensusRound>> rounds;
+  NO_FATALS(ReplicateSequenceOfMessages(
+      1, kLeaderIdx, WAIT_FOR_ALL_REPLICAS, DONT_COMMIT, &last_op_id, &rounds));
+  WaitForCommitIfNotAlreadyPresent(last_op_id.index(), kLeaderIdx, kLeaderIdx);
+  const int64_t first_index = last_op_id.index() + 1;
+
+  // Without the followers, the leader can't commit anything: the ops pile up
+  // and are committed together once the followers are back.
+  {
+    RaftConsensus::LockGuard l_0(follower0->lock_);
+    RaftConsensus::LockGuard l_1(follower1->lock_);
+    for (int i = 0; i < kNumOps; i++) {
+      scoped_refptr<ConsensusRound> round;
+      ASSERT_OK(AppendDummyMessage(kLeaderIdx, &round));
+      rounds.push_back(round);
+    }
+  }
+  for (const auto& round : rounds) {
+    ASSERT_OK(WaitForReplicate(round.get()));
+  }
+  const int64_t last_index = rounds.back()->id().index();
+  ASSERT_EQ(first_index + kNumOps - 1, last_index);
+
+  int64_t next_index = -1;
+  size_t max_batch_size = 0;
+  for (const auto& batch : txn_factories_[kLeaderIdx]->committed_batches()) {
+    ASSERT_FALSE(batch.empty());
+    if (batch.back() < first_index) {
+      continue;
+    }
+    if (next_index == -1) {
+      next_index = batch.front();
+      ASSERT_LE(next_index, first_index);
+    }
+    for (int64_t index : batch) {
+      ASSERT_EQ(next_index, index);
+      next_index++;
+    }
+    max_batch_size = std::max(max_batch_size, batch.size());
+  }
+  ASSERT_EQ(last_index + 1, next_index);
+  ASSERT_GT(max_batch_size, 1U);
+}
+
+// Tests that the leader confirms reads with its peers before serving them,
+// unless it holds a lease.
+TEST_F(RaftConsensusQuorumTest, TestReadIndex) {
+  const int kFollower0Idx = 0;
+  const int kFollower1Idx = 1;
+  const int kLeaderIdx = 2;
+  const MonoDelta kTimeout = MonoDelta::FromSeconds(10);
+
+  ASSERT_OK(BuildAndStartConfig(3));
+  shared_ptr<RaftConsensus> leader;
+  CHECK_OK(peers_->GetPeerByIdx(kLeaderIdx, &leader));
+  shared_ptr<RaftConsensus> follower0;
+  CHECK_OK(peers_->GetPeerByIdx(kFollower0Idx, &follower0));
+  shared_ptr<RaftConsensus> follower1;
+  CHECK_OK(peers_->GetPeerByIdx(kFollower1Idx, &follower1));
+
+  // Wait for the leader to commit an op in its term, then it can serve reads.
+  OpId last_op_id;
+  vector<scoped_refptr<ConsensusRound>> rounds;
+  NO_FATALS(ReplicateSequenceOfMessages(
+      1, kLeaderIdx, WAIT_FOR_ALL_REPLICAS, COMMIT_ONE_BY_ONE,
+      &last_op_id, &rounds));
+  WaitForCommitIfNotAlreadyPresent(last_op_id.index(), kLeaderIdx, kLeaderIdx);
+  int64_t read_index;
+  ASSERT_OK(leader->ReadIndex(kTimeout, &read_index));
+  ASSERT_EQ(last_op_id.index(), read_index);
+
+  // Followers get the read index from the leader, and wait until they have
+  // committed the ops up to it.
+  ASSERT_OK(follower0->ReadIndex(kTimeout, &read_index));
+  ASSERT_EQ(last_op_id.index(), read_index);
+  ASSERT_GE(follower0->GetLastOpId(COMMITTED_OPID)->index(), read_index);
+
+  // Without a majority of the peers, reads can't be confirmed. They are once
+  // the peers are back.
+  Synchronizer sync;
+  auto sync_cb = sync.AsStdStatusCallback();
+  {
+    RaftConsensus::LockGuard l_0(follower0->lock_);
+    RaftConsensus::LockGuard l_1(follower1->lock_);
+    Status s = leader->ReadIndex(MonoDelta::FromMilliseconds(500), &read_index);
+    ASSERT_TRUE(s.IsTimedOut()) << s.ToString();
+    // The timed out read doesn't stay queued.
+    ASSERT_EQ(0, leader->queue_->GetNumPendingReadsForTests());
+    leader->ReadIndexAsync([&](const Status& s, int64_t index) {
+      read_index = index;
+      sync_cb(s);
+    });
+  }
+  ASSERT_OK(sync.WaitFor(kTimeout));
+  ASSERT_EQ(last_op_id.index(), read_index);
+
+  // With a lease, the leader serves reads for a while after the peers last
+  // acknowledged it, without contacting them again.
+  FLAGS_raft_leader_lease_reads = true;
+  ASSERT_OK(leader->ReadIndex(kTimeout, &read_index));
+  {
+    RaftConsensus::LockGuard l_0(follower0->lock_);
+    RaftConsensus::LockGuard l_1(follower1->lock_);
+    ASSERT_OK(leader->ReadIndex(MonoDelta::FromMilliseconds(100), &read_index));
+    ASSERT_EQ(last_op_id.index(), read_index);
+  }
+
+  // A follower which doesn't commit up to the read index by the deadline
+  // fails the read, at the latest with the next request from the leader.
+  Synchronizer expired;
+  auto expired_cb = expired.AsStdStatusCallback();
+  follower0->WaitForCommittedIndexAsync(
+      last_op_id.index() + 1000,
+      [expired_cb](const Status& s, int64_t /*index*/) {
+        expired_cb(s.IsTimedOut() ? Status::OK() :
+                   Status::IllegalState(Substitute("expected TimedOut: $0", s.ToString())));
+      },
+      MonoTime::Now() + MonoDelta::FromMilliseconds(100));
+  ASSERT_OK(expired.WaitFor(kTimeout));
+  VerifyLogs(2, 0, 1);
+}
+
+// Admits the same number of rounds from many client threads, first one round
+// at a time with Replicate(), then in batches with ReplicateBatch(), and logs
+// the time each takes to get all the rounds replicated.
+TEST_F(RaftConsensusQuorumTest, TestReplicateBatchAdmission) {
+  const int kLeaderIdx = 2;
+  const int kNumThreads = 64;
+  const size_t kBatchSize = 16;
+  const int kRoundsPerThread = AllowSlowTests() ? 1024 : 64;
+
+  ASSERT_OK(BuildAndStartConfig(3));
+  shared_ptr<RaftConsensus> leader;
+  ASSERT_OK(peers_->GetPeerByIdx(kLeaderIdx, &leader));
+  const int64_t term = leader->CurrentTerm();
+
+  for (bool batched : { false, true }) {
+    CountDownLatch replicated(kNumThreads * kRoundsPerThread);
+    std::atomic<int> num_failed(0);
+    auto replicated_cb = [&](const Status& s) {
+      if (!s.ok()) {
+        num_failed++;
+      }
+      replicated.CountDown();
+    };
+    auto client = [&]() {
+      vector<scoped_refptr<ConsensusRound>> batch;
+      for (int i = 0; i < kRoundsPerThread; i++) {
+        gscoped_ptr<ReplicateMsg> msg(new ReplicateMsg());
+        msg->set_op_type(NO_OP);
+        msg->mutable_noop_request();
+        msg->set_timestamp(clock_->Now().ToUint64());
+        scoped_refptr<ConsensusRound> round = leader->NewRound(std::move(msg), replicated_cb);
+        round->BindToTerm(term);
+        if (!batched) {
+          CHECK_OK(leader->Replicate(round));
+          continue;
+        }
+        batch.push_back(std::move(round));
+        if (batch.size() == kBatchSize || i == kRoundsPerThread - 1) {
+          CHECK_OK(leader->ReplicateBatch(batch));
+          batch.clear();
+        }
+      }
+    };
+
+    LOG_TIMING(INFO, Substitute("replicating $0 rounds from $1 threads $2",
+                                kNumThreads * kRoundsPerThread, kNumThreads,
+                                batched ? Substitute("in batches of $0", kBatchSize)
+                                        : "one at a time")) {
+      vector<std::thread> threads;
+      for (int i = 0; i < kNumThreads; i++) {
+        threads.emplace_back(client);
+      }
+      for (auto& t : threads) {
+        t.join();
+      }
+      replicated.Wait();
+    }
+    ASSERT_EQ(0, num_failed);
+  }
+
+  // A batch which can't be admitted as a whole isn't admitted at all.
+  const int64_t last_index = leader->GetLastOpId(RECEIVED_OPID)->index();
+  vector<scoped_refptr<ConsensusRound>> batch;
+  for (int i = 0; i < 2; i++) {
+    gscoped_ptr<ReplicateMsg> msg(new ReplicateMsg());
+    msg->set_op_type(NO_OP);
+    msg->mutable_noop_request();
+    msg->set_timestamp(clock_->Now().ToUint64());
+    batch.push_back(leader->NewRound(std::move(msg), &DoNothingStatusCB));
+  }
+  batch[1]->BindToTerm(term + 1);
+  Status s = leader->ReplicateBatch(batch);
+  ASSERT_TRUE(s.IsAborted()) << s.ToString();
+  ASSERT_EQ(last_index, leader->GetLastOpId(RECEIVED_OPID)->index());
+}
+
 // If some communication error happens the leader will resend the request to the
 // peers. This tests that the peers handle repeated requests.
 TEST_F(RaftConsensusQuorumTest, TestReplicasHandleCommunicationErrors) {
@@ -1191,5 +1410,97 @@ TEST_F(RaftConsensusQuorumTest, TestRequestVote) {
   LOG(INFO) << "Follower rejected old heartbeat, as expected: " << SecureShortDebugString(res);
 }
 
+// Test that a heartbeat acknowledged while another update holds the update
+// lock still keeps the follower from voting, since the leader counts the
+// acknowledgement towards its lease.
+TEST_F(RaftConsensusQuorumTest, TestAcknowledgedHeartbeatWithholdsVotes) {
+  FLAGS_raft_heartbeat_interval_ms = 100;
+  ASSERT_OK(BuildAndStartConfig(3));
+
+  OpId last_op_id;
+  shared_ptr<Synchronizer> last_commit_sync;
+  vector<scoped_refptr<ConsensusRound>> rounds;
+  NO_FATALS(ReplicateSequenceOfMessages(
+      10, 2, WAIT_FOR_ALL_REPLICAS, COMMIT_ONE_BY_ONE,
+      &last_op_id, &rounds, &last_commit_sync));
+  ASSERT_OK(last_commit_sync->Wait());
+  WaitForCommitIfNotAlreadyPresent(last_op_id.index(), 0, 2);
+  WaitForCommitIfNotAlreadyPresent(last_op_id.index(), 1, 2);
+
+  // Stop the leader, so that only the heartbeat sent below reaches the
+  // follower.
+  shared_ptr<RaftConsensus> leader;
+  CHECK_OK(peers_->GetPeerByIdx(2, &leader));
+  leader->Shutdown();
+
+  shared_ptr<RaftConsensus> follower;
+  CHECK_OK(peers_->GetPeerByIdx(0, &follower));
+
+  // Hold the update lock, as a large batch waiting on the log would, for
+  // longer than the follower withholds votes after an update.
+  follower->update_lock_.lock();
+  SleepFor(MonoDelta::FromNanoseconds(follower->MinimumElectionTimeout().ToNanoseconds() * 2));
+
+  ConsensusRequestPB req;
+  req.set_tablet_id(kTestTablet);
+  req.set_caller_uuid(leader->peer_uuid());
+  req.set_caller_term(last_op_id.term());
+  req.mutable_preceding_id()->CopyFrom(last_op_id);
+  req.set_committed_index(last_op_id.index());
+  req.set_all_replicated_index(last_op_id.index());
+  ConsensusResponsePB resp;
+  Status s = follower->Update(&req, &resp);
+  follower->update_lock_.unlock();
+  ASSERT_OK(s);
+  ASSERT_FALSE(resp.status().has_error()) << SecureShortDebugString(resp);
+  ASSERT_TRUE(OpIdEquals(last_op_id, resp.status().last_received()));
+
+  VoteRequestPB request;
+  request.set_tablet_id(kTestTablet);
+  request.set_candidate_uuid(fs_managers_[1]->uuid());
+  request.set_candidate_term(last_op_id.term() + 1);
+  request.mutable_candidate_status()->mutable_last_received()->CopyFrom(last_op_id);
+  VoteResponsePB response;
+  ASSERT_OK(follower->RequestVote(&request,
+                                  TabletVotingState(boost::none /* , tablet::TABLET_DATA_READY */),
+                                  &response));
+  ASSERT_FALSE(response.vote_granted());
+  ASSERT_EQ(ConsensusErrorPB::LEADER_IS_ALIVE, response.consensus_error().code());
+}
+
+// Tests which UpdateConsensus requests are classified as heartbeats, and so
+// are given priority by the service.
+TEST(RaftConsensusHeartbeatTest, TestIsHeartbeatRequest) {
+  ConsensusRequestPB req;
+  req.set_tablet_id("tablet");
+  req.set_caller_uuid("leader");
+  req.set_caller_term(1);
+  req.mutable_preceding_id()->CopyFrom(MakeOpId(1, 10));
+  req.set_committed_index(10);
+  req.set_all_replicated_index(10);
+
+  string serialized;
+  ASSERT_TRUE(req.SerializeToString(&serialized));
+  ASSERT_TRUE(RaftConsensus::IsHeartbeatRequest(serialized));
+
+  // A request carrying ops isn't a heartbeat.
+  ConsensusRequestPB with_ops(req);
+  with_ops.mutable_ops()->AddAllocated(
+      CreateDummyReplicate(1, 11, Timestamp(0), 0).release());
+  ASSERT_TRUE(with_ops.SerializeToString(&serialized));
+  ASSERT_FALSE(RaftConsensus::IsHeartbeatRequest(serialized));
+
+  // Nor is one carrying compression dictionaries.
+  ConsensusRequestPB with_dictionaries(req);
+  with_dictionaries.add_compression_dictionaries("dictionary");
+  ASSERT_TRUE(with_dictionaries.SerializeToString(&serialized));
+  ASSERT_FALSE(RaftConsensus::IsHeartbeatRequest(serialized));
+
+  // Nor a malformed request.
+  ASSERT_TRUE(req.SerializeToString(&serialized));
+  serialized.resize(serialized.size() - 1);
+  ASSERT_FALSE(RaftConsensus::IsHeartbeatRequest(serialized));
+}
+
 }  // namespace consensus
 }  // namespace kudu
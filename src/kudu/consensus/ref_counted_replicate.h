@@ -18,9 +18,22 @@
 #ifndef KUDU_CONSENSUS_REF_COUNTED_REPLICATE_H_
 #define KUDU_CONSENSUS_REF_COUNTED_REPLICATE_H_
 
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include <glog/logging.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
+
 #include "kudu/consensus/consensus.pb.h"
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/gutil/gscoped_ptr.h"
+#include "kudu/util/locks.h"
+#include "kudu/util/mem_tracker.h"
+#include "kudu/util/slice.h"
 
 namespace kudu {
 namespace consensus {
@@ -30,12 +43,117 @@ class RefCountedReplicate : public RefCountedThreadSafe<RefCountedReplicate> {
  public:
   explicit RefCountedReplicate(ReplicateMsg* msg) : msg_(msg) {}
 
+  ~RefCountedReplicate() {
+    UntrackEncoding();
+  }
+
   ReplicateMsg* get() {
     return msg_.get();
   }
 
+  // Returns the message in the wire format of an element of
+  // ConsensusRequestPB.ops, i.e. the field tag and length followed by the
+  // serialized message. This is computed on the first call and shared by all
+  // later callers, so that an op sent to several peers is only serialized
+  // once. The encoding is immutable, and may be attached to outbound RPCs
+  // which outlive this object. The message must not be modified after this
+  // has been called.
+  const std::shared_ptr<const std::string>& ConsensusRequestOpEncoding() {
+    std::call_once(encode_once_, [this]() {
+      using google::protobuf::io::CodedOutputStream;
+      using google::protobuf::internal::WireFormatLite;
+      const uint32_t msg_size = msg_->ByteSize();
+      std::string encoded;
+      encoded.resize(
+          WireFormatLite::TagSize(ConsensusRequestPB::kOpsFieldNumber,
+                                  WireFormatLite::TYPE_MESSAGE) +
+          CodedOutputStream::VarintSize32(msg_size) + msg_size);
+      uint8_t* dst = reinterpret_cast<uint8_t*>(&encoded[0]);
+      dst = WireFormatLite::WriteTagToArray(ConsensusRequestPB::kOpsFieldNumber,
+                                            WireFormatLite::WIRETYPE_LENGTH_DELIMITED,
+                                            dst);
+      dst = CodedOutputStream::WriteVarint32ToArray(msg_size, dst);
+      dst = msg_->SerializeWithCachedSizesToArray(dst);
+      DCHECK_EQ(reinterpret_cast<uint8_t*>(&encoded[0]) + encoded.size(), dst);
+      encoded_ = std::make_shared<const std::string>(std::move(encoded));
+
+      std::lock_guard<simple_spinlock> l(tracker_lock_);
+      encoded_built_ = true;
+      ConsumeEncodingUnlocked();
+    });
+    return encoded_;
+  }
+
+  // Charges the memory used by the encoding returned by
+  // ConsensusRequestOpEncoding() to 'tracker', whether the encoding has
+  // already been built or is built later, until UntrackEncoding() is called.
+  // Used by the LogCache to account for the encodings of the ops it caches.
+  void TrackEncoding(std::shared_ptr<MemTracker> tracker) {
+    std::lock_guard<simple_spinlock> l(tracker_lock_);
+    DCHECK(!tracker_);
+    tracker_ = std::move(tracker);
+    if (encoded_built_) {
+      ConsumeEncodingUnlocked();
+    }
+  }
+
+  // Releases the memory charged to the tracker set by TrackEncoding(), if
+  // any, and stops charging it. Returns the number of bytes released.
+  int64_t UntrackEncoding() {
+    std::lock_guard<simple_spinlock> l(tracker_lock_);
+    const int64_t bytes = tracked_bytes_;
+    if (bytes > 0) {
+      tracker_->Release(bytes);
+      tracked_bytes_ = 0;
+    }
+    tracker_.reset();
+    return bytes;
+  }
+
+  // Returns the message as it was serialized by the leader, if it was set with
+  // set_received_bytes() and hasn't been cleared since, or an empty slice.
+  const Slice& received_bytes() const {
+    return received_bytes_;
+  }
+
+  // Sets 'bytes' as the message serialized by the leader, as received in a
+  // ConsensusRequestPB, so that the log can write them out as they are rather
+  // than serialize the message again. The bytes aren't copied: they must stay
+  // valid, and the message unmodified, until the message has been appended to
+  // the log. Must be called before the message is shared with other threads.
+  void set_received_bytes(const Slice& bytes) {
+    received_bytes_ = bytes;
+  }
+
+  // Clears the bytes set with set_received_bytes(), e.g. before they become
+  // invalid or once they no longer match the message.
+  void clear_received_bytes() {
+    received_bytes_.clear();
+  }
+
  private:
   gscoped_ptr<ReplicateMsg> msg_;
+
+  // See received_bytes().
+  Slice received_bytes_;
+
+  void ConsumeEncodingUnlocked() {
+    if (tracker_) {
+      tracked_bytes_ = encoded_->capacity();
+      tracker_->Consume(tracked_bytes_);
+    }
+  }
+
+  // See ConsensusRequestOpEncoding().
+  std::once_flag encode_once_;
+  std::shared_ptr<const std::string> encoded_;
+
+  // See TrackEncoding(). Protected by 'tracker_lock_', as is 'encoded_built_',
+  // which is set once 'encoded_' may be read.
+  simple_spinlock tracker_lock_;
+  std::shared_ptr<MemTracker> tracker_;
+  int64_t tracked_bytes_ = 0;
+  bool encoded_built_ = false;
 };
 
 typedef scoped_refptr<RefCountedReplicate> ReplicateRefPtr;
@@ -0,0 +1,112 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/watermark_tracker.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "kudu/gutil/strings/substitute.h"
+#include "kudu/util/random.h"
+#include "kudu/util/test_util.h"
+
+using std::string;
+using std::vector;
+using strings::Substitute;
+
+namespace kudu {
+namespace consensus {
+
+class WatermarkTrackerTest : public KuduTest {
+};
+
+TEST_F(WatermarkTrackerTest, TestBasics) {
+  WatermarkTracker tracker;
+  ASSERT_TRUE(tracker.empty());
+  ASSERT_EQ("[]", tracker.ToString());
+
+  tracker.Set("a", 5);
+  tracker.Set("b", 3);
+  tracker.Set("c", 7);
+  tracker.Set("d", 5);
+  ASSERT_EQ(4, tracker.size());
+  ASSERT_EQ("[3, 5, 5, 7]", tracker.ToString());
+  ASSERT_EQ(7, tracker.NthHighest(1));
+  ASSERT_EQ(5, tracker.NthHighest(2));
+  ASSERT_EQ(5, tracker.NthHighest(3));
+  ASSERT_EQ(3, tracker.NthHighest(4));
+
+  // Moving a peer's watermark replaces its previous one.
+  tracker.Set("b", 8);
+  ASSERT_EQ(4, tracker.size());
+  ASSERT_EQ("[5, 5, 7, 8]", tracker.ToString());
+  ASSERT_EQ(5, tracker.NthHighest(4));
+
+  // Watermarks may move backwards too.
+  tracker.Set("c", 1);
+  ASSERT_EQ("[1, 5, 5, 8]", tracker.ToString());
+
+  ASSERT_TRUE(tracker.Remove("a"));
+  ASSERT_FALSE(tracker.Remove("a"));
+  ASSERT_EQ("[1, 5, 8]", tracker.ToString());
+  ASSERT_EQ(5, tracker.NthHighest(2));
+
+  tracker.Clear();
+  ASSERT_TRUE(tracker.empty());
+  tracker.Set("a", 2);
+  ASSERT_EQ(2, tracker.NthHighest(1));
+}
+
+// Compares the tracker against sorting the watermarks, over random updates.
+TEST_F(WatermarkTrackerTest, TestRandomizedAgainstSort) {
+  const int kNumPeers = 50;
+  const int kNumUpdates = AllowSlowTests() ? 100000 : 10000;
+  Random rng(SeedRandom());
+
+  WatermarkTracker tracker;
+  vector<int64_t> watermarks(kNumPeers, -1);
+  for (int i = 0; i < kNumUpdates; i++) {
+    int peer = rng.Uniform(kNumPeers);
+    const string uuid = Substitute("peer-$0", peer);
+    if (rng.OneIn(10)) {
+      ASSERT_EQ(watermarks[peer] != -1, tracker.Remove(uuid));
+      watermarks[peer] = -1;
+    } else {
+      // Use a small range of indexes so that peers share them often.
+      watermarks[peer] = rng.Uniform(20);
+      tracker.Set(uuid, watermarks[peer]);
+    }
+
+    vector<int64_t> sorted;
+    std::copy_if(watermarks.begin(), watermarks.end(), std::back_inserter(sorted),
+                 [](int64_t w) { return w != -1; });
+    std::sort(sorted.begin(), sorted.end(), std::greater<int64_t>());
+    ASSERT_EQ(sorted.size(), tracker.size());
+    for (int n = 1; n <= sorted.size(); n++) {
+      ASSERT_EQ(sorted[n - 1], tracker.NthHighest(n)) << "n = " << n;
+    }
+  }
+}
+
+} // namespace consensus
+} // namespace kudu
@@ -0,0 +1,205 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/consensus/watermark_tracker.h"
+
+#include <functional>
+#include <string>
+#include <utility>
+
+#include <glog/logging.h>
+
+#include "kudu/util/random_util.h"
+
+using std::string;
+using std::unique_ptr;
+
+namespace kudu {
+namespace consensus {
+
+struct WatermarkTracker::Node {
+  Node(int64_t index, uint32_t priority)
+      : index(index),
+        count(1),
+        total(1),
+        priority(priority) {
+  }
+
+  const int64_t index;
+
+  // The number of peers whose watermark is 'index'.
+  int count;
+
+  // The number of peers in the subtree rooted at this node, including 'count'.
+  int total;
+
+  // Nodes are ordered by 'index' as in a binary search tree, and by
+  // 'priority' as in a max-heap. Random priorities keep the tree balanced.
+  const uint32_t priority;
+
+  unique_ptr<Node> left;
+  unique_ptr<Node> right;
+};
+
+WatermarkTracker::WatermarkTracker()
+    : rng_(GetRandomSeed32()) {
+}
+
+WatermarkTracker::~WatermarkTracker() = default;
+
+void WatermarkTracker::Set(const string& peer_uuid, int64_t index) {
+  auto it = index_by_peer_.find(peer_uuid);
+  if (it != index_by_peer_.end()) {
+    if (it->second == index) {
+      return;
+    }
+    Erase(&root_, it->second);
+    it->second = index;
+  } else {
+    index_by_peer_.emplace(peer_uuid, index);
+  }
+  Insert(&root_, index);
+}
+
+bool WatermarkTracker::Remove(const string& peer_uuid) {
+  auto it = index_by_peer_.find(peer_uuid);
+  if (it == index_by_peer_.end()) {
+    return false;
+  }
+  Erase(&root_, it->second);
+  index_by_peer_.erase(it);
+  return true;
+}
+
+void WatermarkTracker::Clear() {
+  index_by_peer_.clear();
+  root_.reset();
+}
+
+int64_t WatermarkTracker::NthHighest(int n) const {
+  DCHECK_GE(n, 1);
+  DCHECK_LE(n, size());
+  const Node* node = root_.get();
+  while (true) {
+    DCHECK(node);
+    int higher = Total(node->right);
+    if (n <= higher) {
+      node = node->right.get();
+    } else if (n <= higher + node->count) {
+      return node->index;
+    } else {
+      n -= higher + node->count;
+      node = node->left.get();
+    }
+  }
+}
+
+string WatermarkTracker::ToString() const {
+  string ret = "[";
+  std::function<void(const Node*)> append = [&](const Node* node) {
+    if (!node) return;
+    append(node->left.get());
+    for (int i = 0; i < node->count; i++) {
+      if (ret.size() > 1) ret.append(", ");
+      ret.append(std::to_string(node->index));
+    }
+    append(node->right.get());
+  };
+  append(root_.get());
+  ret.append("]");
+  return ret;
+}
+
+int WatermarkTracker::Total(const unique_ptr<Node>& node) {
+  return node ? node->total : 0;
+}
+
+void WatermarkTracker::UpdateTotal(Node* node) {
+  node->total = node->count + Total(node->left) + Total(node->right);
+}
+
+void WatermarkTracker::RotateLeft(unique_ptr<Node>* slot) {
+  unique_ptr<Node> right = std::move((*slot)->right);
+  (*slot)->right = std::move(right->left);
+  UpdateTotal(slot->get());
+  right->left = std::move(*slot);
+  UpdateTotal(right.get());
+  *slot = std::move(right);
+}
+
+void WatermarkTracker::RotateRight(unique_ptr<Node>* slot) {
+  unique_ptr<Node> left = std::move((*slot)->left);
+  (*slot)->left = std::move(left->right);
+  UpdateTotal(slot->get());
+  left->right = std::move(*slot);
+  UpdateTotal(left.get());
+  *slot = std::move(left);
+}
+
+void WatermarkTracker::Insert(unique_ptr<Node>* slot, int64_t index) {
+  Node* node = slot->get();
+  if (!node) {
+    slot->reset(new Node(index, rng_.Next32()));
+    return;
+  }
+  node->total++;
+  if (index == node->index) {
+    node->count++;
+  } else if (index < node->index) {
+    Insert(&node->left, index);
+    if (node->left->priority > node->priority) {
+      RotateRight(slot);
+    }
+  } else {
+    Insert(&node->right, index);
+    if (node->right->priority > node->priority) {
+      RotateLeft(slot);
+    }
+  }
+}
+
+void WatermarkTracker::Erase(unique_ptr<Node>* slot, int64_t index) {
+  Node* node = slot->get();
+  DCHECK(node) << "index " << index << " is not tracked";
+  if (index < node->index) {
+    Erase(&node->left, index);
+  } else if (index > node->index) {
+    Erase(&node->right, index);
+  } else if (node->count > 1) {
+    node->count--;
+  } else if (!node->left) {
+    *slot = std::move(node->right);
+    return;
+  } else if (!node->right) {
+    *slot = std::move(node->left);
+    return;
+  } else {
+    // Rotate the node down below its higher priority child, and remove it
+    // from there.
+    if (node->left->priority > node->right->priority) {
+      RotateRight(slot);
+      Erase(&(*slot)->right, index);
+    } else {
+      RotateLeft(slot);
+      Erase(&(*slot)->left, index);
+    }
+  }
+  (*slot)->total--;
+}
+
+} // namespace consensus
+} // namespace kudu
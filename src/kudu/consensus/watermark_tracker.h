@@ -0,0 +1,91 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/util/random.h"
+
+namespace kudu {
+namespace consensus {
+
+// Tracks the watermark (e.g. the last received op index) of each of a set of
+// peers, and answers "what is the highest index that at least N peers have
+// reached?" without sorting the watermarks on every query.
+//
+// The watermarks are kept in a treap keyed by index, where each node counts
+// the peers at its index and the peers in its subtree. Updating one peer's
+// watermark and querying the N-th highest watermark both take O(log n)
+// expected time.
+//
+// This class is not thread-safe.
+class WatermarkTracker {
+ public:
+  WatermarkTracker();
+  ~WatermarkTracker();
+
+  // Sets the watermark of 'peer_uuid' to 'index', starting to track the peer
+  // if it isn't tracked yet.
+  void Set(const std::string& peer_uuid, int64_t index);
+
+  // Stops tracking 'peer_uuid'. Returns false if the peer wasn't tracked.
+  bool Remove(const std::string& peer_uuid);
+
+  // Stops tracking all peers.
+  void Clear();
+
+  // Returns the number of tracked peers.
+  int size() const { return static_cast<int>(index_by_peer_.size()); }
+
+  bool empty() const { return index_by_peer_.empty(); }
+
+  // Returns the highest index reached by at least 'n' of the tracked peers,
+  // i.e. the n-th highest watermark. 'n' must be between 1 and size().
+  int64_t NthHighest(int n) const;
+
+  // Returns the tracked watermarks in ascending order, e.g. "[3, 5, 5, 7]".
+  std::string ToString() const;
+
+ private:
+  struct Node;
+
+  static int Total(const std::unique_ptr<Node>& node);
+  static void UpdateTotal(Node* node);
+  static void RotateLeft(std::unique_ptr<Node>* slot);
+  static void RotateRight(std::unique_ptr<Node>* slot);
+  void Insert(std::unique_ptr<Node>* slot, int64_t index);
+  static void Erase(std::unique_ptr<Node>* slot, int64_t index);
+
+  // The current watermark of each tracked peer.
+  std::unordered_map<std::string, int64_t> index_by_peer_;
+
+  // The root of the treap, nullptr if no peers are tracked.
+  std::unique_ptr<Node> root_;
+
+  // Source of the nodes' heap priorities.
+  Random rng_;
+
+  DISALLOW_COPY_AND_ASSIGN(WatermarkTracker);
+};
+
+} // namespace consensus
+} // namespace kudu
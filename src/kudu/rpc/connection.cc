@@ -24,10 +24,13 @@
 #include <set>
 #include <string>
 #include <type_traits>
+#include <utility>
+#include <vector>
 
 #include <boost/intrusive/detail/list_iterator.hpp>
 #include <boost/intrusive/list.hpp>
 #include <ev.h>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 
 #include "kudu/gutil/map-util.h"
@@ -42,15 +45,78 @@
 #include "kudu/rpc/rpc_header.pb.h"
 #include "kudu/rpc/rpc_introspection.pb.h"
 #include "kudu/rpc/transfer.h"
+#include "kudu/util/compression/compression.pb.h"
+#include "kudu/util/compression/compression_codec.h"
+#include "kudu/util/flag_tags.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/net/sockaddr.h"
 #include "kudu/util/net/socket.h"
 #include "kudu/util/status.h"
+#include "kudu/util/string_case.h"
+
+DEFINE_bool(rpc_zerocopy_send, false,
+            "Whether to write large outbound RPC transfers, such as big consensus "
+            "batches, with MSG_ZEROCOPY. This saves copying the payload into the "
+            "kernel, at the cost of tracking when the kernel is done with it. "
+            "Requires Linux 4.14 or later, and is never used on TLS connections. "
+            "See --rpc_zerocopy_min_transfer_bytes.");
+TAG_FLAG(rpc_zerocopy_send, experimental);
+
+DEFINE_int32(rpc_zerocopy_min_transfer_bytes, 256 * 1024,
+             "The minimum size of an outbound RPC transfer to write with "
+             "MSG_ZEROCOPY when --rpc_zerocopy_send is enabled. For smaller "
+             "transfers, the cost of the completion notification outweighs "
+             "the saved copy.");
+TAG_FLAG(rpc_zerocopy_min_transfer_bytes, experimental);
+TAG_FLAG(rpc_zerocopy_min_transfer_bytes, runtime);
+
+DEFINE_string(rpc_compression_codec, "none",
+              "The codec to compress outbound RPC transfers with: LZ4, ZSTD or "
+              "NONE. Only transfers of at least --rpc_compression_min_transfer_bytes "
+              "are compressed, and only on connections whose remote end supports "
+              "the codec and which aren't encrypted, unless "
+              "--rpc_compress_encrypted_connections is set. Takes effect for "
+              "connections negotiated after it is set.");
+TAG_FLAG(rpc_compression_codec, experimental);
+TAG_FLAG(rpc_compression_codec, runtime);
+
+static bool ValidateRpcCompressionCodec(const char* flagname, const std::string& value) {
+  std::string codec;
+  kudu::ToUpperCase(value, &codec);
+  if (codec == "NONE" || codec == "LZ4" || codec == "ZSTD") {
+    return true;
+  }
+  LOG(ERROR) << "Invalid value for --" << flagname << ": " << value
+             << ". Must be one of LZ4, ZSTD or NONE.";
+  return false;
+}
+
+DEFINE_validator(rpc_compression_codec, &ValidateRpcCompressionCodec);
+
+DEFINE_bool(rpc_compress_encrypted_connections, false,
+            "Whether --rpc_compression_codec also applies to TLS-encrypted "
+            "connections. WARNING: the size of a compressed message reveals "
+            "how much of it repeats other parts of it, so an attacker who can "
+            "inject data into requests and observe the size of the encrypted "
+            "traffic may recover secrets sent alongside it (as in the CRIME "
+            "and BREACH attacks on TLS). Only enable this if no untrusted "
+            "party can influence the contents of RPCs.");
+TAG_FLAG(rpc_compress_encrypted_connections, experimental);
+TAG_FLAG(rpc_compress_encrypted_connections, unsafe);
+
+DEFINE_int32(rpc_compression_min_transfer_bytes, 32 * 1024,
+             "The minimum size of an outbound RPC transfer to compress when "
+             "--rpc_compression_codec is set. Smaller transfers are sent as is, "
+             "as are calls whose payload is already compressed.");
+TAG_FLAG(rpc_compression_min_transfer_bytes, experimental);
+TAG_FLAG(rpc_compression_min_transfer_bytes, runtime);
 
 using std::includes;
+using std::pair;
 using std::set;
 using std::shared_ptr;
 using std::unique_ptr;
+using std::vector;
 using strings::Substitute;
 
 namespace kudu {
@@ -72,6 +138,10 @@ Connection::Connection(ReactorThread *reactor_thread,
       direction_(direction),
       last_activity_time_(MonoTime::Now()),
       is_epoll_registered_(false),
+      zerocopy_enabled_(false),
+      compression_codec_(nullptr),
+      zerocopy_next_seq_(0),
+      zerocopy_completed_seq_(0),
       next_call_id_(1),
       credentials_policy_(policy),
       negotiation_complete_(false),
@@ -102,6 +172,7 @@ void Connection::EpollRegister(ev::loop_ref& loop) {
 Connection::~Connection() {
   // Must clear the outbound_transfers_ list before deleting.
   CHECK(outbound_transfers_.begin() == outbound_transfers_.end());
+  CHECK(zerocopy_transfers_.begin() == zerocopy_transfers_.end());
 
   // It's crucial that the connection is Shutdown first -- otherwise
   // our destructor will end up calling read_io_.stop() and write_io_.stop()
@@ -118,7 +189,7 @@ bool Connection::Idle() const {
     return false;
   }
   // check if we still need to send something
-  if (!outbound_transfers_.empty()) {
+  if (!outbound_transfers_.empty() || !zerocopy_transfers_.empty()) {
     return false;
   }
   // can't kill a connection if calls are waiting response
@@ -179,6 +250,22 @@ void Connection::Shutdown(const Status &status,
     delete t;
   }
 
+  // The payload of zero-copy writes which haven't completed is freed along
+  // with their transfers, but the kernel may still send it from that memory.
+  // Reset the connection on close so that the peer never receives a message
+  // that got modified meanwhile.
+  if (socket_ && zerocopy_next_seq_ != zerocopy_completed_seq_) {
+    Status s = socket_->SetAbortOnClose();
+    if (PREDICT_FALSE(!s.ok())) {
+      VLOG(2) << "Error setting abort on close: " << s.ToString();
+    }
+  }
+  while (!zerocopy_transfers_.empty()) {
+    OutboundTransfer *t = &zerocopy_transfers_.front();
+    zerocopy_transfers_.pop_front();
+    delete t;
+  }
+
   read_io_.stop();
   write_io_.stop();
   is_epoll_registered_ = false;
@@ -285,7 +372,27 @@ struct CallTransferCallbacks : public TransferCallbacks {
                                  Connection *conn)
       : call_(std::move(call)), conn_(conn) {}
 
+  virtual void NotifyTransferSent() override {
+    MarkSent();
+  }
+
   virtual void NotifyTransferFinished() override {
+    MarkSent();
+    delete this;
+  }
+
+  virtual void NotifyTransferAborted(const Status &status) override {
+    VLOG(1) << "Transfer of RPC call " << call_->ToString() << " aborted: "
+            << status.ToString();
+    delete this;
+  }
+
+ private:
+  void MarkSent() {
+    if (sent_) {
+      return;
+    }
+    sent_ = true;
     // TODO: would be better to cancel the transfer while it is still on the queue if we
     // timed out before the transfer started, but there is still a race in the case of
     // a partial send that we have to handle here
@@ -296,18 +403,13 @@ struct CallTransferCallbacks : public TransferCallbacks {
       // Test cancellation when 'call_' is in 'SENT' state.
       conn_->MaybeInjectCancellation(call_);
     }
-    delete this;
   }
 
-  virtual void NotifyTransferAborted(const Status &status) override {
-    VLOG(1) << "Transfer of RPC call " << call_->ToString() << " aborted: "
-            << status.ToString();
-    delete this;
-  }
-
- private:
+  // Holds on to the call, and so the request payload, until the transfer
+  // finishes, which is after the call is sent in the case of zero-copy writes.
   shared_ptr<OutboundCall> call_;
   Connection* conn_;
+  bool sent_ = false;
 };
 
 void Connection::QueueOutboundCall(shared_ptr<OutboundCall> call) {
@@ -336,7 +438,8 @@ void Connection::QueueOutboundCall(shared_ptr<OutboundCall> call) {
 
   // Serialize the actual bytes to be put on the wire.
   TransferPayload tmp_slices;
-  size_t n_slices = call->SerializeTo(&tmp_slices);
+  vector<Slice> tmp_long_slices;
+  size_t n_slices = call->SerializeTo(&tmp_slices, &tmp_long_slices);
 
   call->SetQueued();
 
@@ -394,7 +497,8 @@ void Connection::QueueOutboundCall(shared_ptr<OutboundCall> call) {
   TransferCallbacks *cb = new CallTransferCallbacks(std::move(call), this);
   awaiting_response_[call_id] = car.release();
   QueueOutbound(gscoped_ptr<OutboundTransfer>(
-      OutboundTransfer::CreateForCallRequest(call_id, tmp_slices, n_slices, cb)));
+      OutboundTransfer::CreateForCallRequest(call_id, tmp_slices, n_slices, cb,
+                                             std::move(tmp_long_slices))));
 }
 
 // Callbacks for sending an RPC call response from the server.
@@ -504,9 +608,21 @@ void Connection::ReadHandler(ev::io &watcher, int revents) {
   }
   last_activity_time_ = reactor_thread_->cur_time();
 
+  // The kernel signals completion notifications in the socket's error queue
+  // as a read event.
+  if (zerocopy_next_seq_ != zerocopy_completed_seq_) {
+    Status s = ProcessZeroCopyCompletions();
+    if (PREDICT_FALSE(!s.ok())) {
+      KLOG_EVERY_N_SECS(WARNING, 300) << ToString() << " zero-copy error [EVERY 300 seconds]: "
+                                      << s.ToString();
+      reactor_thread_->DestroyConnection(this, s);
+      return;
+    }
+  }
+
   while (true) {
     if (!inbound_) {
-      inbound_.reset(new InboundTransfer());
+      inbound_.reset(new InboundTransfer(reactor_thread_->inbound_buffer_pool()));
     }
     Status status = inbound_->ReceiveBuffer(*socket_);
     if (PREDICT_FALSE(!status.ok())) {
@@ -524,6 +640,18 @@ void Connection::ReadHandler(ev::io &watcher, int revents) {
     }
     DVLOG(3) << ToString() << ": finished reading " << inbound_->data().size() << " bytes";
 
+    if (inbound_->compressed()) {
+      size_t compressed_length = inbound_->data().size();
+      status = inbound_->Decompress();
+      if (PREDICT_FALSE(!status.ok())) {
+        KLOG_EVERY_N_SECS(WARNING, 300) << ToString() << " recv error [EVERY 300 seconds]: "
+                                        << status.ToString();
+        reactor_thread_->DestroyConnection(this, status);
+        return;
+      }
+      reactor_thread_->RecordTransferDecompressed(compressed_length, inbound_->data().size());
+    }
+
     if (direction_ == ConnectionDirection::CLIENT) {
       HandleCallResponse(std::move(inbound_));
     } else if (direction_ == ConnectionDirection::SERVER) {
@@ -618,6 +746,7 @@ void Connection::WriteHandler(ev::io &watcher, int revents) {
     transfer = &(outbound_transfers_.front());
 
     if (!transfer->TransferStarted()) {
+      bool compressible = true;
 
       if (transfer->is_for_outbound_call()) {
         CallAwaitingResponse* car = FindOrDie(awaiting_response_, transfer->call_id());
@@ -650,14 +779,29 @@ void Connection::WriteHandler(ev::io &watcher, int revents) {
         }
 
         car->call->SetSending();
+        compressible = car->call->compressible();
 
         // Test cancellation when 'call_' is in 'SENDING' state.
         MaybeInjectCancellation(car->call);
       }
+
+      if (compression_codec_ && compressible &&
+          transfer->TotalLength() >= FLAGS_rpc_compression_min_transfer_bytes) {
+        int32_t uncompressed_length = transfer->TotalLength();
+        if (transfer->Compress(compression_codec_)) {
+          reactor_thread_->RecordTransferCompressed(uncompressed_length,
+                                                    transfer->TotalLength());
+        }
+      }
     }
 
     last_activity_time_ = reactor_thread_->cur_time();
-    Status status = transfer->SendBuffer(*socket_);
+    uint32_t* zerocopy_seq = nullptr;
+    if (zerocopy_enabled_ &&
+        transfer->TotalLength() >= FLAGS_rpc_zerocopy_min_transfer_bytes) {
+      zerocopy_seq = &zerocopy_next_seq_;
+    }
+    Status status = transfer->SendBuffer(*socket_, zerocopy_seq);
     if (PREDICT_FALSE(!status.ok())) {
       KLOG_EVERY_N_SECS(WARNING, 300) << ToString() << " send error [EVERY 300 seconds]: " << status.ToString();
       reactor_thread_->DestroyConnection(this, status);
@@ -670,7 +814,11 @@ void Connection::WriteHandler(ev::io &watcher, int revents) {
     }
 
     outbound_transfers_.pop_front();
-    delete transfer;
+    if (transfer->AwaitingZeroCopyCompletion()) {
+      zerocopy_transfers_.push_back(*transfer);
+    } else {
+      delete transfer;
+    }
   }
 
   // If we were able to write all of our outbound transfers,
@@ -730,6 +878,70 @@ void Connection::CompleteNegotiation(Status negotiation_status,
 void Connection::MarkNegotiationComplete() {
   DCHECK(reactor_thread_->IsCurrentThread());
   negotiation_complete_ = true;
+
+  // Compress with the configured codec if the remote end can decompress it.
+  // Peers without compression support don't advertise either codec. Encrypted
+  // connections aren't compressed unless explicitly allowed, since the size of
+  // the compressed messages may leak their contents.
+  CompressionType codec_type = GetCompressionCodecType(FLAGS_rpc_compression_codec);
+  RpcFeatureFlag codec_feature = codec_type == LZ4 ? LZ4_COMPRESSION :
+                                 codec_type == ZSTD ? ZSTD_COMPRESSION : UNKNOWN;
+  if (codec_feature != UNKNOWN && ContainsKey(remote_features_, codec_feature) &&
+      (!socket_->IsEncrypted() || FLAGS_rpc_compress_encrypted_connections)) {
+    CHECK_OK(GetCompressionCodec(codec_type, &compression_codec_));
+  }
+
+  if (FLAGS_rpc_zerocopy_send && socket_->SupportsZeroCopy()) {
+    Status s = socket_->SetZeroCopy(true);
+    if (PREDICT_TRUE(s.ok())) {
+      zerocopy_enabled_ = true;
+    } else {
+      KLOG_EVERY_N_SECS(WARNING, 300) << "Unable to enable MSG_ZEROCOPY on " << ToString()
+                                      << ": " << s.ToString();
+    }
+  }
+}
+
+Status Connection::ProcessZeroCopyCompletions() {
+  DCHECK(reactor_thread_->IsCurrentThread());
+  vector<pair<uint32_t, uint32_t>> completed;
+  bool copied = false;
+  RETURN_NOT_OK(socket_->RecvZeroCopyCompletions(&completed, &copied));
+  for (const auto& range : completed) {
+    MarkZeroCopyCompleted(range.first, range.second);
+  }
+  if (copied && zerocopy_enabled_) {
+    // The kernel falls back to copying e.g. for loopback connections, and
+    // would then have been better off with a plain write.
+    VLOG(1) << ToString() << ": kernel copied zero-copy writes, disabling MSG_ZEROCOPY";
+    zerocopy_enabled_ = false;
+  }
+
+  while (!zerocopy_transfers_.empty()) {
+    OutboundTransfer* transfer = &zerocopy_transfers_.front();
+    // Compare the IDs modulo 2^32, as they wrap around.
+    if (static_cast<int32_t>(zerocopy_completed_seq_ - transfer->zerocopy_seq_end()) < 0) {
+      break;
+    }
+    zerocopy_transfers_.pop_front();
+    transfer->NotifyZeroCopyCompleted();
+    delete transfer;
+  }
+  return Status::OK();
+}
+
+void Connection::MarkZeroCopyCompleted(uint32_t first, uint32_t last) {
+  if (first != zerocopy_completed_seq_) {
+    zerocopy_completed_ranges_.emplace(first, last);
+    return;
+  }
+  zerocopy_completed_seq_ = last + 1;
+  auto it = zerocopy_completed_ranges_.find(zerocopy_completed_seq_);
+  while (it != zerocopy_completed_ranges_.end()) {
+    zerocopy_completed_seq_ = it->second + 1;
+    zerocopy_completed_ranges_.erase(it);
+    it = zerocopy_completed_ranges_.find(zerocopy_completed_seq_);
+  }
 }
 
 Status Connection::DumpPB(const DumpRunningRpcsRequestPB& req,
@@ -21,6 +21,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <limits>
+#include <map>
 #include <memory>
 #include <set>
 #include <string>
@@ -49,6 +50,8 @@
 
 namespace kudu {
 
+class CompressionCodec;
+
 namespace rpc {
 
 class DumpRunningRpcsRequestPB;
@@ -288,6 +291,14 @@ class Connection : public RefCountedThreadSafe<Connection> {
   // This must be called from the reactor thread.
   void QueueOutbound(gscoped_ptr<OutboundTransfer> transfer);
 
+  // Reads the completion notifications of our zero-copy writes from the
+  // socket, and finishes the transfers whose writes have all completed.
+  Status ProcessZeroCopyCompletions();
+
+  // Records that the zero-copy writes with IDs 'first' through 'last' have
+  // completed.
+  void MarkZeroCopyCompleted(uint32_t first, uint32_t last);
+
   // Internal test function for injecting cancellation request when 'call'
   // reaches state specified in 'FLAGS_rpc_inject_cancellation_state'.
   void MaybeInjectCancellation(const std::shared_ptr<OutboundCall> &call);
@@ -331,6 +342,29 @@ class Connection : public RefCountedThreadSafe<Connection> {
   // waiting to be sent
   boost::intrusive::list<OutboundTransfer> outbound_transfers_; // NOLINT(*)
 
+  // Whether large outbound transfers are written with MSG_ZEROCOPY. See
+  // --rpc_zerocopy_send.
+  bool zerocopy_enabled_;
+
+  // The codec that large outbound transfers are compressed with, or nullptr
+  // if they aren't compressed. See --rpc_compression_codec.
+  const CompressionCodec* compression_codec_;
+
+  // The ID the socket will assign to our next zero-copy write.
+  uint32_t zerocopy_next_seq_;
+
+  // All of the zero-copy writes with IDs before this one have completed.
+  uint32_t zerocopy_completed_seq_;
+
+  // Ranges of zero-copy writes that completed before some write preceding
+  // them did, keyed by first ID. The kernel reports TCP completions in order
+  // in practice, so this is normally empty.
+  std::map<uint32_t, uint32_t> zerocopy_completed_ranges_;
+
+  // Transfers that were entirely written with zero-copy writes which haven't
+  // all completed yet, in the order they were sent.
+  boost::intrusive::list<OutboundTransfer> zerocopy_transfers_; // NOLINT(*)
+
   // Calls which have been sent and are now waiting for a response.
   car_map_t awaiting_response_;
 
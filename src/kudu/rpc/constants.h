@@ -46,6 +46,14 @@ static const uint8_t kHeaderFlagsLength = 3;
 // There is a 4-byte length prefix before any packet.
 static const uint8_t kMsgLengthPrefixLength = 4;
 
+// Set in the length prefix of a compressed packet. See
+// RpcFeatureFlag::LZ4_COMPRESSION.
+static const uint32_t kCompressedMsgFlag = 1U << 31;
+
+// A compressed packet's codec and uncompressed length follow its length
+// prefix.
+static const uint8_t kCompressedMsgHeaderLength = 5;
+
 // The set of RPC features that this server build supports.
 // Non-const for testing.
 extern std::set<RpcFeatureFlag> kSupportedServerRpcFeatureFlags;
@@ -0,0 +1,132 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/rpc/inbound_buffer_pool.h"
+
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <gflags/gflags_declare.h>
+#include <gtest/gtest.h>
+
+#include "kudu/util/mem_tracker.h"
+#include "kudu/util/test_util.h"
+
+DECLARE_int32(rpc_inbound_buffer_pool_max_cached_mb);
+
+using std::shared_ptr;
+using std::thread;
+using std::vector;
+
+namespace kudu {
+namespace rpc {
+
+class InboundBufferPoolTest : public KuduTest {
+ protected:
+  static int64_t TrackedBytes() {
+    return MemTracker::FindOrCreateGlobalTracker(-1, "rpc_inbound_buffers")->consumption();
+  }
+};
+
+TEST_F(InboundBufferPoolTest, TestSmallBuffersAreNotPooled) {
+  shared_ptr<InboundBufferPool> pool = InboundBufferPool::Create();
+  int64_t tracked_before = TrackedBytes();
+  {
+    InboundBuffer buf = pool->Allocate(100);
+    ASSERT_EQ(100, buf.capacity());
+    ASSERT_EQ(tracked_before, TrackedBytes());
+  }
+  ASSERT_EQ(0, pool->cached_bytes());
+}
+
+TEST_F(InboundBufferPoolTest, TestBuffersAreReused) {
+  shared_ptr<InboundBufferPool> pool = InboundBufferPool::Create();
+  int64_t tracked_before = TrackedBytes();
+
+  const size_t kSize = 1024 * 1024 + 1;
+  uint8_t* data;
+  {
+    InboundBuffer buf = pool->Allocate(kSize);
+    data = buf.data();
+    // Sizes are rounded up to the next power of two.
+    ASSERT_EQ(2 * 1024 * 1024, buf.capacity());
+    ASSERT_EQ(tracked_before + buf.capacity(), TrackedBytes());
+  }
+  ASSERT_EQ(2 * 1024 * 1024, pool->cached_bytes());
+
+  // A buffer of the same size class reuses the cached buffer.
+  {
+    InboundBuffer buf = pool->Allocate(2 * 1024 * 1024);
+    ASSERT_EQ(data, buf.data());
+    ASSERT_EQ(0, pool->cached_bytes());
+
+    // Moving the buffer doesn't return it to the pool.
+    InboundBuffer moved = std::move(buf);
+    ASSERT_EQ(data, moved.data());
+    ASSERT_EQ(nullptr, buf.data());
+    ASSERT_EQ(0, pool->cached_bytes());
+  }
+  ASSERT_EQ(2 * 1024 * 1024, pool->cached_bytes());
+
+  // Destroying the pool frees the cached buffers.
+  pool.reset();
+  ASSERT_EQ(tracked_before, TrackedBytes());
+}
+
+TEST_F(InboundBufferPoolTest, TestMaxCachedBytes) {
+  FLAGS_rpc_inbound_buffer_pool_max_cached_mb = 1;
+  shared_ptr<InboundBufferPool> pool = InboundBufferPool::Create();
+  int64_t tracked_before = TrackedBytes();
+  {
+    vector<InboundBuffer> bufs;
+    for (int i = 0; i < 4; i++) {
+      bufs.emplace_back(pool->Allocate(512 * 1024));
+    }
+    ASSERT_EQ(tracked_before + 4 * 512 * 1024, TrackedBytes());
+  }
+  // Only as many buffers as fit in the limit are kept.
+  ASSERT_EQ(1024 * 1024, pool->cached_bytes());
+  ASSERT_EQ(tracked_before + 1024 * 1024, TrackedBytes());
+}
+
+// Buffers may be returned to the pool from other threads than the one
+// allocating them, and may outlive the pool's owner.
+TEST_F(InboundBufferPoolTest, TestReleaseFromOtherThreads) {
+  shared_ptr<InboundBufferPool> pool = InboundBufferPool::Create();
+  int64_t tracked_before = TrackedBytes();
+  vector<InboundBuffer> bufs;
+  for (int i = 0; i < 8; i++) {
+    bufs.emplace_back(pool->Allocate(InboundBufferPool::kMinPooledSize));
+  }
+  pool.reset();
+  vector<thread> threads;
+  for (auto& buf : bufs) {
+    threads.emplace_back([&buf]() {
+      buf.Reset();
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  ASSERT_EQ(tracked_before, TrackedBytes());
+}
+
+} // namespace rpc
+} // namespace kudu
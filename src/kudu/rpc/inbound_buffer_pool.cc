@@ -0,0 +1,160 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/rpc/inbound_buffer_pool.h"
+
+#include <algorithm>
+#include <mutex>
+#include <utility>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "kudu/gutil/bits.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/mem_tracker.h"
+
+DEFINE_int32(rpc_inbound_buffer_pool_max_cached_mb, 64,
+             "The maximum number of megabytes of unused inbound RPC buffers each "
+             "reactor thread keeps for reuse by later calls. If 0, inbound RPC "
+             "buffers are freed as soon as their calls are done.");
+TAG_FLAG(rpc_inbound_buffer_pool_max_cached_mb, advanced);
+TAG_FLAG(rpc_inbound_buffer_pool_max_cached_mb, runtime);
+
+using std::shared_ptr;
+
+namespace kudu {
+namespace rpc {
+
+constexpr size_t InboundBufferPool::kMinPooledSize;
+constexpr size_t InboundBufferPool::kMaxPooledSize;
+
+InboundBuffer::InboundBuffer(uint8_t* data, size_t capacity, shared_ptr<InboundBufferPool> pool)
+    : data_(data),
+      capacity_(capacity),
+      pool_(std::move(pool)) {
+}
+
+InboundBuffer::InboundBuffer(InboundBuffer&& other) noexcept
+    : data_(other.data_),
+      capacity_(other.capacity_),
+      pool_(std::move(other.pool_)) {
+  other.data_ = nullptr;
+  other.capacity_ = 0;
+}
+
+InboundBuffer& InboundBuffer::operator=(InboundBuffer&& other) noexcept {
+  if (this != &other) {
+    Reset();
+    data_ = other.data_;
+    capacity_ = other.capacity_;
+    pool_ = std::move(other.pool_);
+    other.data_ = nullptr;
+    other.capacity_ = 0;
+  }
+  return *this;
+}
+
+InboundBuffer::~InboundBuffer() {
+  Reset();
+}
+
+InboundBuffer InboundBuffer::Allocate(size_t size) {
+  return InboundBuffer(new uint8_t[size], size, nullptr);
+}
+
+void InboundBuffer::Reset() {
+  if (!data_) {
+    return;
+  }
+  if (pool_) {
+    pool_->Release(data_, capacity_);
+    pool_.reset();
+  } else {
+    delete[] data_;
+  }
+  data_ = nullptr;
+  capacity_ = 0;
+}
+
+shared_ptr<InboundBufferPool> InboundBufferPool::Create() {
+  return shared_ptr<InboundBufferPool>(new InboundBufferPool());
+}
+
+InboundBufferPool::InboundBufferPool()
+    : mem_tracker_(MemTracker::FindOrCreateGlobalTracker(-1, "rpc_inbound_buffers")),
+      free_lists_(SizeClass(kMaxPooledSize) + 1),
+      cached_bytes_(0) {
+}
+
+InboundBufferPool::~InboundBufferPool() {
+  for (const auto& free_list : free_lists_) {
+    for (uint8_t* data : free_list) {
+      delete[] data;
+    }
+  }
+  mem_tracker_->Release(cached_bytes_);
+}
+
+int InboundBufferPool::SizeClass(size_t size) {
+  DCHECK_GE(size, kMinPooledSize);
+  DCHECK_LE(size, kMaxPooledSize);
+  return Bits::Log2Ceiling64(size) - Bits::Log2Ceiling64(kMinPooledSize);
+}
+
+InboundBuffer InboundBufferPool::Allocate(size_t size) {
+  if (size < kMinPooledSize || size > kMaxPooledSize) {
+    return InboundBuffer::Allocate(size);
+  }
+  int size_class = SizeClass(size);
+  size_t capacity = kMinPooledSize << size_class;
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    auto& free_list = free_lists_[size_class];
+    if (!free_list.empty()) {
+      uint8_t* data = free_list.back();
+      free_list.pop_back();
+      cached_bytes_ -= capacity;
+      return InboundBuffer(data, capacity, shared_from_this());
+    }
+  }
+  mem_tracker_->Consume(capacity);
+  return InboundBuffer(new uint8_t[capacity], capacity, shared_from_this());
+}
+
+void InboundBufferPool::Release(uint8_t* data, size_t capacity) {
+  const size_t max_cached_bytes = static_cast<size_t>(
+      std::max(FLAGS_rpc_inbound_buffer_pool_max_cached_mb, 0)) * 1024 * 1024;
+  {
+    std::lock_guard<simple_spinlock> l(lock_);
+    if (cached_bytes_ + capacity <= max_cached_bytes) {
+      free_lists_[SizeClass(capacity)].push_back(data);
+      cached_bytes_ += capacity;
+      return;
+    }
+  }
+  delete[] data;
+  mem_tracker_->Release(capacity);
+}
+
+size_t InboundBufferPool::cached_bytes() const {
+  std::lock_guard<simple_spinlock> l(lock_);
+  return cached_bytes_;
+}
+
+} // namespace rpc
+} // namespace kudu
@@ -0,0 +1,127 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/util/locks.h"
+
+namespace kudu {
+
+class MemTracker;
+
+namespace rpc {
+
+class InboundBufferPool;
+
+// A buffer holding the bytes of one inbound RPC transfer. If the buffer came
+// from an InboundBufferPool, it is returned to the pool when destroyed,
+// which may happen on any thread.
+class InboundBuffer {
+ public:
+  InboundBuffer() = default;
+  InboundBuffer(InboundBuffer&& other) noexcept;
+  InboundBuffer& operator=(InboundBuffer&& other) noexcept;
+  ~InboundBuffer();
+
+  // Allocates a buffer of 'size' bytes that doesn't belong to any pool.
+  static InboundBuffer Allocate(size_t size);
+
+  uint8_t* data() const { return data_; }
+  size_t capacity() const { return capacity_; }
+
+  // Frees the buffer, or returns it to its pool.
+  void Reset();
+
+ private:
+  friend class InboundBufferPool;
+
+  InboundBuffer(uint8_t* data, size_t capacity, std::shared_ptr<InboundBufferPool> pool);
+
+  uint8_t* data_ = nullptr;
+  size_t capacity_ = 0;
+
+  // The pool this buffer is returned to, or nullptr if it isn't pooled.
+  std::shared_ptr<InboundBufferPool> pool_;
+
+  DISALLOW_COPY_AND_ASSIGN(InboundBuffer);
+};
+
+// A pool of buffers for the inbound transfers of one reactor.
+//
+// Large inbound calls (e.g. UpdateConsensus batches) would otherwise cost a
+// large allocation, and the page faults to back it, on the reactor thread for
+// every call. Buffers of at least kMinPooledSize bytes are instead rounded up
+// to a power-of-two size class and, once the call that used them is done,
+// kept on that class's free list for reuse, up to
+// --rpc_inbound_buffer_pool_max_cached_mb bytes in total. Smaller buffers
+// aren't pooled.
+//
+// The pooled buffers, in use or cached, are accounted to the
+// "rpc_inbound_buffers" MemTracker.
+//
+// This class is thread-safe.
+class InboundBufferPool : public std::enable_shared_from_this<InboundBufferPool> {
+ public:
+  // The smallest buffer that is pooled.
+  static constexpr size_t kMinPooledSize = 64 * 1024;
+
+  // The largest buffer that is pooled.
+  static constexpr size_t kMaxPooledSize = 128 * 1024 * 1024;
+
+  static std::shared_ptr<InboundBufferPool> Create();
+
+  ~InboundBufferPool();
+
+  // Returns a buffer of at least 'size' bytes, reusing a cached one if
+  // possible.
+  InboundBuffer Allocate(size_t size);
+
+  // Returns the number of bytes in cached, unused buffers.
+  size_t cached_bytes() const;
+
+ private:
+  friend class InboundBuffer;
+
+  InboundBufferPool();
+
+  // Returns the index of the smallest size class of at least 'size' bytes.
+  // 'size' must be between kMinPooledSize and kMaxPooledSize.
+  static int SizeClass(size_t size);
+
+  // Returns a buffer previously handed out by Allocate() to the pool.
+  void Release(uint8_t* data, size_t capacity);
+
+  const std::shared_ptr<MemTracker> mem_tracker_;
+
+  mutable simple_spinlock lock_;
+
+  // Cached buffers, indexed by size class. Protected by 'lock_'.
+  std::vector<std::vector<uint8_t*>> free_lists_;
+
+  // The number of bytes in 'free_lists_'. Protected by 'lock_'.
+  size_t cached_bytes_;
+
+  DISALLOW_COPY_AND_ASSIGN(InboundBufferPool);
+};
+
+} // namespace rpc
+} // namespace kudu
@@ -325,9 +325,12 @@ class Messenger {
   const scoped_refptr<RpcService> rpc_service(const std::string& service_name) const;
 
  private:
+  FRIEND_TEST(ReactorTest, TestBusyPollingStopsWhenLoadDrops);
   FRIEND_TEST(TestRpc, TestConnectionKeepalive);
   FRIEND_TEST(TestRpc, TestConnectionAlwaysKeepalive);
   FRIEND_TEST(TestRpc, TestClientConnectionsMetrics);
+  FRIEND_TEST(TestRpc, TestCompressedTransfers);
+  FRIEND_TEST(TestRpc, TestCompressionIsSkipped);
   FRIEND_TEST(TestRpc, TestCredentialsPolicy);
   FRIEND_TEST(TestRpc, TestReopenOutboundConnections);
 
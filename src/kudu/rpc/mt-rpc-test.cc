@@ -183,7 +183,7 @@ class BogusServicePool : public ServicePool {
                    size_t service_queue_length)
     : ServicePool(std::move(service), metric_entity, service_queue_length) {
   }
-  virtual Status Init(int num_threads) override {
+  virtual Status Init(int num_threads, int num_high_priority_threads) override {
     // Do nothing
     return Status::OK();
   }
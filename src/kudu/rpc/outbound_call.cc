@@ -87,7 +87,8 @@ OutboundCall::OutboundCall(const ConnectionId& conn_id,
       callback_(std::move(callback)),
       controller_(DCHECK_NOTNULL(controller)),
       response_(DCHECK_NOTNULL(response_storage)),
-      cancellation_requested_(false) {
+      cancellation_requested_(false),
+      compressible_(controller->compressible()) {
   DVLOG(4) << "OutboundCall " << this << " constructed with state_: " << StateName(state_)
            << " and RPC timeout: "
            << (controller->timeout().Initialized() ? controller->timeout().ToString() : "none");
@@ -109,7 +110,7 @@ OutboundCall::~OutboundCall() {
   DVLOG(4) << "OutboundCall " << this << " destroyed with state_: " << StateName(state_);
 }
 
-size_t OutboundCall::SerializeTo(TransferPayload* slices) {
+size_t OutboundCall::SerializeTo(TransferPayload* slices, vector<Slice>* long_slices) {
   DCHECK_LT(0, request_buf_.size())
       << "Must call SetRequestPayload() before SerializeTo()";
 
@@ -124,30 +125,48 @@ size_t OutboundCall::SerializeTo(TransferPayload* slices) {
 
   DCHECK_LE(0, sidecar_byte_size_);
   serialization::SerializeHeader(
-      header_, sidecar_byte_size_ + request_buf_.size(), &header_buf_);
+      header_, sidecar_byte_size_ + request_buf_.size() + serialized_fields_size_, &header_buf_);
 
-  size_t n_slices = 2 + sidecars_.size();
-  DCHECK_LE(n_slices, slices->size());
-  auto slice_iter = slices->begin();
+  const size_t n_slices = 2 + serialized_fields_.size() + sidecars_.size();
+  Slice* slice_iter;
+  if (PREDICT_TRUE(n_slices <= slices->size())) {
+    slice_iter = slices->data();
+  } else {
+    long_slices->resize(n_slices);
+    slice_iter = long_slices->data();
+  }
+  Slice* const slices_begin = slice_iter;
   *slice_iter++ = Slice(header_buf_);
   *slice_iter++ = Slice(request_buf_);
+  for (auto& fields : serialized_fields_) {
+    *slice_iter++ = fields->AsSlice();
+  }
   for (auto& sidecar : sidecars_) {
     *slice_iter++ = sidecar->AsSlice();
   }
-  DCHECK_EQ(slice_iter - slices->begin(), n_slices);
+  DCHECK_EQ(slice_iter - slices_begin, n_slices);
   return n_slices;
 }
 
 void OutboundCall::SetRequestPayload(const Message& req,
-    vector<unique_ptr<RpcSidecar>>&& sidecars) {
+    vector<unique_ptr<RpcSidecar>>&& sidecars,
+    vector<unique_ptr<RpcSidecar>> serialized_fields) {
   DCHECK_EQ(-1, sidecar_byte_size_);
 
   sidecars_ = move(sidecars);
   DCHECK_LE(sidecars_.size(), TransferLimits::kMaxSidecars);
+  serialized_fields_ = move(serialized_fields);
+
+  // The serialized fields directly follow 'req' on the wire, so as far as the
+  // receiver is concerned they are part of the request message.
+  serialized_fields_size_ = 0;
+  for (const unique_ptr<RpcSidecar>& fields : serialized_fields_) {
+    serialized_fields_size_ += fields->AsSlice().size();
+  }
 
   // Compute total size of sidecar payload so that extra space can be reserved as part of
   // the request body.
-  uint32_t message_size = req.ByteSize();
+  uint32_t message_size = req.ByteSize() + serialized_fields_size_;
   sidecar_byte_size_ = 0;
   for (const unique_ptr<RpcSidecar>& car: sidecars_) {
     header_.add_sidecar_offsets(sidecar_byte_size_ + message_size);
@@ -156,7 +175,8 @@ void OutboundCall::SetRequestPayload(const Message& req,
     sidecar_byte_size_ += sidecar_bytes;
   }
 
-  serialization::SerializeMessage(req, &request_buf_, sidecar_byte_size_, true);
+  serialization::SerializeMessage(
+      req, &request_buf_, sidecar_byte_size_ + serialized_fields_size_, true);
 }
 
 Status OutboundCall::status() const {
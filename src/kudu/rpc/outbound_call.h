@@ -92,10 +92,15 @@ class OutboundCall {
   // Serialize the given request PB into this call's internal storage, and assume
   // ownership of any sidecars that should accompany this request.
   //
+  // 'serialized_fields' hold already serialized fields of the request message
+  // which are sent right after 'req', as part of the same message. See
+  // RpcController::SetOutboundSerializedFields().
+  //
   // Because the request data is fully serialized by this call, 'req' may be subsequently
   // mutated with no ill effects.
   void SetRequestPayload(const google::protobuf::Message& req,
-      std::vector<std::unique_ptr<RpcSidecar>>&& sidecars);
+      std::vector<std::unique_ptr<RpcSidecar>>&& sidecars,
+      std::vector<std::unique_ptr<RpcSidecar>> serialized_fields = {});
 
   // Assign the call ID for this call. This is called from the reactor
   // thread once a connection has been assigned. Must only be called once.
@@ -106,8 +111,10 @@ class OutboundCall {
 
   // Serialize the call for the wire. Requires that SetRequestPayload()
   // is called first. This is called from the Reactor thread.
-  // Returns the number of slices in the serialized call.
-  size_t SerializeTo(TransferPayload* slices);
+  // Returns the number of slices in the serialized call. If there are more
+  // slices than fit in 'slices', e.g. because of many serialized fields, they
+  // are all put in 'long_slices' instead.
+  size_t SerializeTo(TransferPayload* slices, std::vector<Slice>* long_slices);
 
   // Mark in the call that cancellation has been requested. If the call hasn't yet
   // started sending or has finished sending the RPC request but is waiting for a
@@ -152,6 +159,12 @@ class OutboundCall {
     return required_rpc_features_;
   }
 
+  // Whether the call's request is worth compressing. See
+  // RpcController::compressible().
+  bool compressible() const {
+    return compressible_;
+  }
+
   std::string ToString() const;
 
   void DumpPB(const DumpRunningRpcsRequestPB& req, RpcCallInProgressPB* resp);
@@ -270,6 +283,13 @@ class OutboundCall {
   // Otherwise NULL.
   gscoped_ptr<CallResponse> call_response_;
 
+  // Already serialized fields of the request message, sent between
+  // 'request_buf_' and the sidecars.
+  std::vector<std::unique_ptr<RpcSidecar>> serialized_fields_;
+
+  // The total size of 'serialized_fields_'.
+  size_t serialized_fields_size_ = 0;
+
   // All sidecars to be sent with this call.
   std::vector<std::unique_ptr<RpcSidecar>> sidecars_;
 
@@ -280,6 +300,9 @@ class OutboundCall {
   // True if cancellation was requested on this call.
   bool cancellation_requested_;
 
+  // Copied from the controller when the call is created.
+  const bool compressible_;
+
   DISALLOW_COPY_AND_ASSIGN(OutboundCall);
 };
 
@@ -79,6 +79,15 @@ optional<string> GetAuthzMethod(const MethodDescriptor& method) {
   return boost::none;
 }
 
+// Return the name of the priority predicate specified for this RPC method,
+// or boost::none if none is specified.
+optional<string> GetPriorityPredicate(const MethodDescriptor& method) {
+  if (method.options().HasExtension(priority_predicate)) {
+    return method.options().GetExtension(priority_predicate);
+  }
+  return boost::none;
+}
+
 } // anonymous namespace
 
 class Substituter {
@@ -208,6 +217,14 @@ class MethodSubstitutions : public Substituter {
     bool track_result = static_cast<bool>(method_->options().GetExtension(track_rpc_result));
     (*map)["track_result"] = track_result ? " true" : "false";
     (*map)["authz_method"] = GetAuthzMethod(*method_).get_value_or("AuthorizeAllowAll");
+    (*map)["priority_class"] =
+        RpcPriorityClass_Name(method_->options().GetExtension(priority_class));
+    if (auto m = GetPriorityPredicate(*method_)) {
+      (*map)["priority_predicate"] = strings::Substitute(
+          "[this](const ::kudu::Slice& req) { return this->$0(req); }", m.get());
+    } else {
+      (*map)["priority_predicate"] = "nullptr";
+    }
   }
 
   // Strips the package from method arguments if they are in the same package as
@@ -391,6 +408,7 @@ class CodeGenerator : public ::google::protobuf::compiler::CodeGenerator {
         );
 
       set<string> authz_methods;
+      set<string> priority_predicates;
       for (int method_idx = 0; method_idx < service->method_count();
            ++method_idx) {
         const MethodDescriptor *method = service->method(method_idx);
@@ -404,6 +422,9 @@ class CodeGenerator : public ::google::protobuf::compiler::CodeGenerator {
         if (auto m = GetAuthzMethod(*method)) {
           authz_methods.insert(m.get());
         }
+        if (auto m = GetPriorityPredicate(*method)) {
+          priority_predicates.insert(m.get());
+        }
       }
 
       if (!authz_methods.empty()) {
@@ -418,6 +439,17 @@ class CodeGenerator : public ::google::protobuf::compiler::CodeGenerator {
         "     google::protobuf::Message* resp, ::kudu::rpc::RpcContext *context) = 0;\n");
       }
 
+      if (!priority_predicates.empty()) {
+        printer->Print(
+        "\n\n"
+        "  // Priority predicates\n"
+        "  // -------------------\n\n");
+      }
+      for (const string& m : priority_predicates) {
+        printer->Print({ {"m", m} },
+        "  virtual bool $m$(const ::kudu::Slice& serialized_request) const = 0;\n");
+      }
+
       Print(printer, *subs,
         "\n"
         "};\n"
@@ -514,6 +546,8 @@ class CodeGenerator : public ::google::protobuf::compiler::CodeGenerator {
               "                           ctx);\n"
               "    };\n"
               "    mi->track_result = $track_result$;\n"
+              "    mi->priority_class = kudu::rpc::$priority_class$;\n"
+              "    mi->priority_predicate = $priority_predicate$;\n"
               "    mi->handler_latency_histogram =\n"
               "        METRIC_handler_latency_$rpc_full_name_plainchars$.Instantiate(entity);\n"
               "    mi->func = [this](const Message* req, Message* resp, RpcContext* ctx) {\n"
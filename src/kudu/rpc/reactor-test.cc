@@ -19,17 +19,23 @@
 
 #include <boost/bind.hpp> // IWYU pragma: keep
 #include <boost/function.hpp>
+#include <gflags/gflags_declare.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 
 #include "kudu/rpc/messenger.h"
+#include "kudu/rpc/reactor.h"
 #include "kudu/rpc/rpc-test-base.h"
 #include "kudu/util/countdown_latch.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/status.h"
 #include "kudu/util/test_macros.h"
+#include "kudu/util/test_util.h"
 #include "kudu/util/thread.h"
 
+DECLARE_int32(rpc_reactor_busy_poll_us);
+DECLARE_int32(rpc_reactor_busy_poll_min_load_percent);
+
 using std::shared_ptr;
 
 namespace kudu {
@@ -108,5 +114,52 @@ TEST_F(ReactorTest, TestReschedulesOnSameReactorThread) {
   latch_.Wait();
 }
 
+// Tasks should keep running, on time, while the reactor threads busy poll.
+TEST_F(ReactorTest, TestFunctionsAreCalledWhileBusyPolling) {
+  FLAGS_rpc_reactor_busy_poll_us = 1000;
+  FLAGS_rpc_reactor_busy_poll_min_load_percent = 0;
+  ASSERT_OK(CreateMessenger("busy_polling_messenger", &messenger_, 4));
+
+  // Span several load measurements, so that the reactors start busy polling
+  // partway through.
+  for (int i = 0; i < 20; i++) {
+    latch_.Reset(1);
+    MonoTime before = MonoTime::Now();
+    messenger_->ScheduleOnReactor(
+        boost::bind(&ReactorTest::ScheduledTask, this, _1, Status::OK()),
+        MonoDelta::FromMilliseconds(20));
+    latch_.Wait();
+    ASSERT_GE((MonoTime::Now() - before).ToMilliseconds(), 20);
+  }
+}
+
+// Once the load drops below --rpc_reactor_busy_poll_min_load_percent, the
+// reactor stops busy polling and blocks again.
+TEST_F(ReactorTest, TestBusyPollingStopsWhenLoadDrops) {
+  FLAGS_rpc_reactor_busy_poll_us = 1000;
+  FLAGS_rpc_reactor_busy_poll_min_load_percent = 0;
+  ASSERT_OK(CreateMessenger("busy_polling_messenger", &messenger_, 1));
+
+  ReactorMetrics metrics;
+  ASSERT_EVENTUALLY([&]() {
+    ASSERT_OK(messenger_->reactors_[0]->GetMetrics(&metrics));
+    ASSERT_TRUE(metrics.busy_polling_);
+  });
+
+  // The reactor is idle: polling without finding anything counts as waiting,
+  // so its load is far below this.
+  FLAGS_rpc_reactor_busy_poll_min_load_percent = 50;
+  ASSERT_EVENTUALLY([&]() {
+    ASSERT_OK(messenger_->reactors_[0]->GetMetrics(&metrics));
+    ASSERT_FALSE(metrics.busy_polling_);
+  });
+
+  // Tasks still run once the reactor blocks again.
+  messenger_->ScheduleOnReactor(
+      boost::bind(&ReactorTest::ScheduledTask, this, _1, Status::OK()),
+      MonoDelta::FromMilliseconds(10));
+  latch_.Wait();
+}
+
 } // namespace rpc
 } // namespace kudu
@@ -17,6 +17,7 @@
 
 #include "kudu/rpc/reactor.h"
 
+#include <atomic>
 #include <cerrno>
 #include <memory>
 #include <mutex>
@@ -37,6 +38,7 @@
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/rpc/client_negotiation.h"
 #include "kudu/rpc/connection.h"
+#include "kudu/rpc/inbound_buffer_pool.h"
 #include "kudu/rpc/messenger.h"
 #include "kudu/rpc/negotiation.h"
 #include "kudu/rpc/outbound_call.h"
@@ -80,6 +82,22 @@ DEFINE_bool(rpc_reopen_outbound_connections, false,
 TAG_FLAG(rpc_reopen_outbound_connections, unsafe);
 TAG_FLAG(rpc_reopen_outbound_connections, runtime);
 
+DEFINE_int32(rpc_reactor_busy_poll_us, 0,
+             "If greater than 0, a reactor thread whose load is at least "
+             "--rpc_reactor_busy_poll_min_load_percent keeps polling for network "
+             "activity without blocking until none has arrived for this many "
+             "microseconds. This trades CPU for lower latency of RPCs handled by "
+             "busy reactors. If 0, reactor threads always block while awaiting "
+             "network activity.");
+TAG_FLAG(rpc_reactor_busy_poll_us, experimental);
+
+DEFINE_int32(rpc_reactor_busy_poll_min_load_percent, 20,
+             "The reactor load percentage, as measured by the reactor_load_percent "
+             "metric, at or above which a reactor thread busy polls. Only "
+             "used if --rpc_reactor_busy_poll_us is greater than 0.");
+TAG_FLAG(rpc_reactor_busy_poll_min_load_percent, experimental);
+TAG_FLAG(rpc_reactor_busy_poll_min_load_percent, runtime);
+
 METRIC_DEFINE_histogram(server, reactor_load_percent,
                         "Reactor Thread Load Percentage",
                         kudu::MetricUnit::kUnits,
@@ -97,10 +115,45 @@ METRIC_DEFINE_histogram(server, reactor_active_latency_us,
                         "to the latency of both inbound and outbound RPCs.",
                         1000000, 2);
 
+METRIC_DEFINE_histogram(server, reactor_compression_percent,
+                        "Reactor Transfer Compression Percentage",
+                        kudu::MetricUnit::kUnits,
+                        "The size of each compressed outbound RPC transfer as a "
+                        "percentage of its size before compression. See "
+                        "--rpc_compression_codec.", 100, 2);
+
+METRIC_DEFINE_counter(server, reactor_uncompressed_bytes_sent,
+                      "Reactor Uncompressed Bytes Sent",
+                      kudu::MetricUnit::kBytes,
+                      "Size of the outbound RPC transfers that were compressed, "
+                      "before compression.");
+
+METRIC_DEFINE_counter(server, reactor_compressed_bytes_sent,
+                      "Reactor Compressed Bytes Sent",
+                      kudu::MetricUnit::kBytes,
+                      "Size of the outbound RPC transfers that were compressed, "
+                      "after compression.");
+
+METRIC_DEFINE_counter(server, reactor_compressed_bytes_received,
+                      "Reactor Compressed Bytes Received",
+                      kudu::MetricUnit::kBytes,
+                      "Size of the compressed inbound RPC transfers, before "
+                      "decompression.");
+
+METRIC_DEFINE_counter(server, reactor_uncompressed_bytes_received,
+                      "Reactor Uncompressed Bytes Received",
+                      kudu::MetricUnit::kBytes,
+                      "Size of the compressed inbound RPC transfers, after "
+                      "decompression.");
+
 namespace kudu {
 namespace rpc {
 
 namespace {
+
+// The value of Reactor::pending_tasks_ once the reactor no longer accepts tasks.
+ReactorTask* const kClosedTaskQueue = reinterpret_cast<ReactorTask*>(1);
+
 Status ShutdownError(bool aborted) {
   const char* msg = "reactor is shutting down";
   return aborted ?
@@ -133,13 +186,24 @@ ReactorThread::ReactorThread(Reactor *reactor, const MessengerBuilder& bld)
     connection_keepalive_time_(bld.connection_keepalive_time_),
     coarse_timer_granularity_(bld.coarse_timer_granularity_),
     total_client_conns_cnt_(0),
-    total_server_conns_cnt_(0) {
+    total_server_conns_cnt_(0),
+    inbound_buffer_pool_(InboundBufferPool::Create()) {
 
   if (bld.metric_entity_) {
     invoke_us_histogram_ =
         METRIC_reactor_active_latency_us.Instantiate(bld.metric_entity_);
     load_percent_histogram_ =
         METRIC_reactor_load_percent.Instantiate(bld.metric_entity_);
+    compression_percent_histogram_ =
+        METRIC_reactor_compression_percent.Instantiate(bld.metric_entity_);
+    uncompressed_bytes_sent_ =
+        METRIC_reactor_uncompressed_bytes_sent.Instantiate(bld.metric_entity_);
+    compressed_bytes_sent_ =
+        METRIC_reactor_compressed_bytes_sent.Instantiate(bld.metric_entity_);
+    compressed_bytes_received_ =
+        METRIC_reactor_compressed_bytes_received.Instantiate(bld.metric_entity_);
+    uncompressed_bytes_received_ =
+        METRIC_reactor_uncompressed_bytes_received.Instantiate(bld.metric_entity_);
   }
 }
 
@@ -172,14 +236,20 @@ void ReactorThread::InvokePendingCb(struct ev_loop* loop) {
   // Calculate the number of cycles spent calling our callbacks.
   // This is called quite frequently so we use CycleClock rather than MonoTime
   // since it's a bit faster.
+  // libev calls this on every iteration of the loop, even if no watcher is
+  // pending, e.g. when busy polling finds nothing.
+  const bool has_pending = ev_pending_count(loop) > 0;
   int64_t start = CycleClock::Now();
   ev_invoke_pending(loop);
   int64_t dur_cycles = CycleClock::Now() - start;
 
   // Contribute this to our histogram.
   ReactorThread* thr = static_cast<ReactorThread*>(ev_userdata(loop));
-  if (thr->invoke_us_histogram_) {
-    thr->invoke_us_histogram_->Increment(dur_cycles * 1000000 / base::CyclesPerSecond());
+  if (has_pending) {
+    thr->num_pending_invocations_++;
+    if (thr->invoke_us_histogram_) {
+      thr->invoke_us_histogram_->Increment(dur_cycles * 1000000 / base::CyclesPerSecond());
+    }
   }
 }
 
@@ -270,9 +340,37 @@ Status ReactorThread::GetMetrics(ReactorMetrics* metrics) {
   metrics->num_server_connections_ = server_conns_.size();
   metrics->total_client_connections_ = total_client_conns_cnt_;
   metrics->total_server_connections_ = total_server_conns_cnt_;
+  metrics->uncompressed_bytes_sent_ = total_uncompressed_bytes_sent_;
+  metrics->compressed_bytes_sent_ = total_compressed_bytes_sent_;
+  metrics->compressed_bytes_received_ = total_compressed_bytes_received_;
+  metrics->uncompressed_bytes_received_ = total_uncompressed_bytes_received_;
+  metrics->busy_polling_ = busy_polling_;
   return Status::OK();
 }
 
+void ReactorThread::RecordTransferCompressed(int64_t uncompressed_bytes,
+                                             int64_t compressed_bytes) {
+  DCHECK(IsCurrentThread());
+  total_uncompressed_bytes_sent_ += uncompressed_bytes;
+  total_compressed_bytes_sent_ += compressed_bytes;
+  if (compression_percent_histogram_) {
+    compression_percent_histogram_->Increment(compressed_bytes * 100 / uncompressed_bytes);
+    uncompressed_bytes_sent_->IncrementBy(uncompressed_bytes);
+    compressed_bytes_sent_->IncrementBy(compressed_bytes);
+  }
+}
+
+void ReactorThread::RecordTransferDecompressed(int64_t compressed_bytes,
+                                               int64_t uncompressed_bytes) {
+  DCHECK(IsCurrentThread());
+  total_compressed_bytes_received_ += compressed_bytes;
+  total_uncompressed_bytes_received_ += uncompressed_bytes;
+  if (compressed_bytes_received_) {
+    compressed_bytes_received_->IncrementBy(compressed_bytes);
+    uncompressed_bytes_received_->IncrementBy(uncompressed_bytes);
+  }
+}
+
 Status ReactorThread::DumpRunningRpcs(const DumpRunningRpcsRequestPB& req,
                                       DumpRunningRpcsResponsePB* resp) {
   DCHECK(IsCurrentThread());
@@ -303,6 +401,7 @@ void ReactorThread::AsyncHandler(ev::async& /*watcher*/, int /*revents*/) {
 
   if (PREDICT_FALSE(reactor_->closing())) {
     ShutdownInternal();
+    stopping_ = true;
     loop_.break_loop(); // break the epoll loop and terminate the thread
     return;
   }
@@ -391,9 +490,12 @@ void ReactorThread::TimerHandler(ev::timer& /*watcher*/, int revents) {
     int64_t poll_cycles_delta = total_poll_cycles_ - last_load_measurement_.poll_cycles;
     double poll_fraction = static_cast<double>(poll_cycles_delta) / cycles_delta;
     double active_fraction = 1 - poll_fraction;
+    int load_percent = static_cast<int>(active_fraction * 100);
     if (load_percent_histogram_) {
-      load_percent_histogram_->Increment(static_cast<int>(active_fraction * 100));
+      load_percent_histogram_->Increment(load_percent);
     }
+    busy_polling_ = FLAGS_rpc_reactor_busy_poll_us > 0 &&
+        load_percent >= FLAGS_rpc_reactor_busy_poll_min_load_percent;
   }
   last_load_measurement_.time_cycles = now_cycles;
   last_load_measurement_.poll_cycles = total_poll_cycles_;
@@ -474,7 +576,11 @@ void ReactorThread::RunThread() {
   ThreadRestrictions::SetWaitAllowed(false);
   ThreadRestrictions::SetIOAllowed(false);
   DVLOG(6) << "Calling ReactorThread::RunThread()...";
-  loop_.run(0);
+  if (FLAGS_rpc_reactor_busy_poll_us > 0) {
+    RunBusyPollLoop();
+  } else {
+    loop_.run(0);
+  }
   VLOG(1) << name() << " thread exiting.";
 
   // No longer need the messenger. This causes the messenger to
@@ -482,6 +588,36 @@ void ReactorThread::RunThread() {
   reactor_->messenger_.reset();
 }
 
+void ReactorThread::RunBusyPollLoop() {
+  const int64_t busy_poll_cycles =
+      static_cast<int64_t>(FLAGS_rpc_reactor_busy_poll_us) * base::CyclesPerSecond() / 1000000;
+  while (!stopping_) {
+    // Block until there's something to do.
+    loop_.run(ev::ONCE);
+
+    // Then, if the reactor is busy, keep polling until nothing has happened
+    // for a while, since more activity is likely to follow shortly.
+    int64_t last_activity_cycles = CycleClock::Now();
+    while (busy_polling_ && !stopping_) {
+      int64_t num_invocations = num_pending_invocations_;
+      int64_t poll_cycles = total_poll_cycles_;
+      int64_t start_cycles = CycleClock::Now();
+      loop_.run(ev::NOWAIT);
+      int64_t end_cycles = CycleClock::Now();
+      if (num_pending_invocations_ != num_invocations) {
+        last_activity_cycles = end_cycles;
+        continue;
+      }
+      // Nothing happened: count the iteration as time spent waiting, as if
+      // the reactor had been blocked in epoll_wait().
+      total_poll_cycles_ = poll_cycles + (end_cycles - start_cycles);
+      if (end_cycles - last_activity_cycles >= busy_poll_cycles) {
+        break;
+      }
+    }
+  }
+}
+
 bool ReactorThread::FindConnection(const ConnectionId& conn_id,
                                    CredentialsPolicy cred_policy,
                                    scoped_refptr<Connection>* conn) {
@@ -718,6 +854,7 @@ Reactor::Reactor(shared_ptr<Messenger> messenger,
     : messenger_(std::move(messenger)),
       name_(StringPrintf("%s_R%03d", messenger_->name().c_str(), index)),
       closing_(false),
+      pending_tasks_(nullptr),
       thread_(this, bld) {
   static std::once_flag libev_once;
   std::call_once(libev_once, DoInitLibEv);
@@ -729,22 +866,23 @@ Status Reactor::Init() {
 }
 
 void Reactor::Shutdown(Messenger::ShutdownMode mode) {
-  {
-    std::lock_guard<LockType> l(lock_);
-    if (closing_) {
-      return;
-    }
-    closing_ = true;
+  if (closing_.exchange(true)) {
+    return;
   }
 
   thread_.Shutdown(mode);
 
   // Abort all pending tasks. No new tasks can get scheduled after this
-  // because ScheduleReactorTask() tests the closing_ flag set above.
+  // because ScheduleReactorTask() tests for the sentinel set here.
+  ReactorTask* head = pending_tasks_.exchange(kClosedTaskQueue, std::memory_order_acquire);
+  boost::intrusive::list<ReactorTask> tasks;
+  for (; head != nullptr; head = head->next_pending_) {
+    tasks.push_front(*head);
+  }
   Status aborted = ShutdownError(true);
-  while (!pending_tasks_.empty()) {
-    ReactorTask& task = pending_tasks_.front();
-    pending_tasks_.pop_front();
+  while (!tasks.empty()) {
+    ReactorTask& task = tasks.front();
+    tasks.pop_front();
     task.Abort(aborted);
   }
 }
@@ -758,7 +896,6 @@ const std::string& Reactor::name() const {
 }
 
 bool Reactor::closing() const {
-  std::lock_guard<LockType> l(lock_);
   return closing_;
 }
 
@@ -892,25 +1029,36 @@ void Reactor::QueueCancellation(const shared_ptr<OutboundCall>& call) {
 }
 
 void Reactor::ScheduleReactorTask(ReactorTask *task) {
-  {
-    std::unique_lock<LockType> l(lock_);
-    if (closing_) {
-      // We guarantee the reactor lock is not taken when calling Abort().
-      l.unlock();
+  ReactorTask* head = pending_tasks_.load(std::memory_order_relaxed);
+  do {
+    if (PREDICT_FALSE(closing_ || head == kClosedTaskQueue)) {
       task->Abort(ShutdownError(false));
       return;
     }
-    pending_tasks_.push_back(*task);
+    task->next_pending_ = head;
+  } while (!pending_tasks_.compare_exchange_weak(head, task,
+                                                 std::memory_order_release,
+                                                 std::memory_order_relaxed));
+  // Only the task which makes the queue non-empty needs to wake the reactor:
+  // the wakeup it sends drains any tasks queued behind it as well.
+  if (head == nullptr) {
+    thread_.WakeThread();
   }
-  thread_.WakeThread();
 }
 
 bool Reactor::DrainTaskQueue(boost::intrusive::list<ReactorTask> *tasks) { // NOLINT(*)
-  std::lock_guard<LockType> l(lock_);
-  if (closing_) {
-    return false;
+  ReactorTask* head = pending_tasks_.load(std::memory_order_relaxed);
+  do {
+    if (closing_ || head == kClosedTaskQueue) {
+      return false;
+    }
+  } while (!pending_tasks_.compare_exchange_weak(head, nullptr,
+                                                 std::memory_order_acquire,
+                                                 std::memory_order_relaxed));
+  // The stack holds the most recently scheduled task first.
+  for (; head != nullptr; head = head->next_pending_) {
+    tasks->push_front(*head);
   }
-  tasks->swap(pending_tasks_);
   return true;
 }
 
@@ -17,6 +17,7 @@
 #ifndef KUDU_RPC_REACTOR_H
 #define KUDU_RPC_REACTOR_H
 
+#include <atomic>
 #include <cstdint>
 #include <list>
 #include <memory>
@@ -32,9 +33,9 @@
 #include "kudu/gutil/ref_counted.h"
 #include "kudu/rpc/connection.h"
 #include "kudu/rpc/connection_id.h"
+#include "kudu/rpc/inbound_buffer_pool.h"
 #include "kudu/rpc/messenger.h"
 #include "kudu/rpc/rpc_header.pb.h"
-#include "kudu/util/locks.h"
 #include "kudu/util/metrics.h"
 #include "kudu/util/monotime.h"
 #include "kudu/util/status.h"
@@ -68,6 +69,18 @@ struct ReactorMetrics {
   uint64_t total_client_connections_;
   // Total number of server RPC connections opened during Reactor's lifetime.
   uint64_t total_server_connections_;
+
+  // Size of the outbound transfers that were compressed, before and after
+  // compression.
+  uint64_t uncompressed_bytes_sent_;
+  uint64_t compressed_bytes_sent_;
+  // Size of the inbound transfers that were decompressed, before and after
+  // decompression.
+  uint64_t compressed_bytes_received_;
+  uint64_t uncompressed_bytes_received_;
+
+  // Whether the reactor currently busy polls.
+  bool busy_polling_;
 };
 
 // A task which can be enqueued to run on the reactor thread.
@@ -82,13 +95,18 @@ class ReactorTask : public boost::intrusive::list_base_hook<> {
   // task could be processed. This may or may not run on the reactor thread
   // itself.
   //
-  // The Reactor guarantees that the Reactor lock is free when this
-  // method is called.
+  // This method is never called while the task is still on the Reactor's
+  // queue of pending tasks.
   virtual void Abort(const Status &abort_status) {}
 
   virtual ~ReactorTask();
 
  private:
+  friend class Reactor;
+
+  // The next older task on the Reactor's queue of pending tasks.
+  ReactorTask* next_pending_ = nullptr;
+
   DISALLOW_COPY_AND_ASSIGN(ReactorTask);
 };
 
@@ -196,6 +214,22 @@ class ReactorThread {
   // Must be called from the reactor thread.
   Status GetMetrics(ReactorMetrics *metrics);
 
+  // Accounts for an outbound transfer that was compressed from
+  // 'uncompressed_bytes' to 'compressed_bytes'.
+  // Must be called from the reactor thread.
+  void RecordTransferCompressed(int64_t uncompressed_bytes, int64_t compressed_bytes);
+
+  // Accounts for an inbound transfer that was decompressed from
+  // 'compressed_bytes' to 'uncompressed_bytes'.
+  // Must be called from the reactor thread.
+  void RecordTransferDecompressed(int64_t compressed_bytes, int64_t uncompressed_bytes);
+
+  // The pool that this reactor's connections allocate inbound transfer
+  // buffers from.
+  const std::shared_ptr<InboundBufferPool>& inbound_buffer_pool() const {
+    return inbound_buffer_pool_;
+  }
+
  private:
   friend class AssignOutboundCallTask;
   friend class CancellationTask;
@@ -205,6 +239,11 @@ class ReactorThread {
   // Run the main event loop of the reactor.
   void RunThread();
 
+  // Runs the event loop like RunThread() does, but, while the reactor is
+  // busy polling (see busy_polling_), keeps polling for new events without
+  // blocking until none have arrived for --rpc_reactor_busy_poll_us.
+  void RunBusyPollLoop();
+
   // When libev has noticed that it needs to wake up an application watcher,
   // it calls this callback. The callback simply calls back into libev's
   // ev_invoke_pending() to trigger all the watcher callbacks, but
@@ -311,6 +350,17 @@ class ReactorThread {
   // Metrics.
   scoped_refptr<Histogram> invoke_us_histogram_;
   scoped_refptr<Histogram> load_percent_histogram_;
+  scoped_refptr<Histogram> compression_percent_histogram_;
+  scoped_refptr<Counter> uncompressed_bytes_sent_;
+  scoped_refptr<Counter> compressed_bytes_sent_;
+  scoped_refptr<Counter> compressed_bytes_received_;
+  scoped_refptr<Counter> uncompressed_bytes_received_;
+
+  // Totals of the above counters, kept even without a metric entity.
+  uint64_t total_uncompressed_bytes_sent_ = 0;
+  uint64_t total_compressed_bytes_sent_ = 0;
+  uint64_t total_compressed_bytes_received_ = 0;
+  uint64_t total_uncompressed_bytes_received_ = 0;
 
   // Total number of client connections opened during Reactor's lifetime.
   uint64_t total_client_conns_cnt_;
@@ -318,14 +368,31 @@ class ReactorThread {
   // Total number of server connections opened during Reactor's lifetime.
   uint64_t total_server_conns_cnt_;
 
+  // See inbound_buffer_pool().
+  const std::shared_ptr<InboundBufferPool> inbound_buffer_pool_;
+
   // Set prior to calling epoll and then reset back to -1 after each invocation
   // completes. Used for accounting total_poll_cycles_.
   int64_t cycle_clock_before_poll_ = -1;
 
   // The total number of cycles spent in epoll_wait() since this thread
-  // started.
+  // started. Busy polling that didn't find any events is also counted here,
+  // so that it doesn't show up as load.
   int64_t total_poll_cycles_ = 0;
 
+  // The number of times InvokePendingCb() found watcher callbacks to run.
+  // Iterations of the event loop which found none don't count, so that an
+  // idle busy polling reactor eventually blocks again.
+  int64_t num_pending_invocations_ = 0;
+
+  // Whether the reactor busy polls for new events rather than blocking in
+  // epoll_wait(). Set by TimerHandler() according to the reactor's load.
+  bool busy_polling_ = false;
+
+  // Set once the reactor thread starts shutting down, to end
+  // RunBusyPollLoop().
+  bool stopping_ = false;
+
   // Accounting for determining load average in each cycle of TimerHandler.
   struct {
     // The cycle-time at which the load average was last calculated.
@@ -381,7 +448,8 @@ class Reactor {
   Status RunOnReactorThread(const boost::function<Status()>& f);
 
   // If the Reactor is closing, returns false.
-  // Otherwise, drains the pending_tasks_ queue into the provided list.
+  // Otherwise, drains the pending_tasks_ queue into the provided list, in the
+  // order in which the tasks were scheduled.
   bool DrainTaskQueue(boost::intrusive::list<ReactorTask> *tasks);
 
   Messenger *messenger() const {
@@ -400,8 +468,6 @@ class Reactor {
 
  private:
   friend class ReactorThread;
-  typedef simple_spinlock LockType;
-  mutable LockType lock_;
 
   // parent messenger
   std::shared_ptr<Messenger> messenger_;
@@ -409,12 +475,16 @@ class Reactor {
   const std::string name_;
 
   // Whether the reactor is shutting down.
-  // Guarded by lock_.
-  bool closing_;
+  std::atomic<bool> closing_;
 
-  // Tasks to be run within the reactor thread.
-  // Guarded by lock_.
-  boost::intrusive::list<ReactorTask> pending_tasks_; // NOLINT(build/include_what_you_use)
+  // Tasks to be run within the reactor thread, as a lock-free stack linked
+  // through ReactorTask::next_pending_, most recently scheduled first. Other
+  // threads push onto it and the reactor thread takes the whole stack at
+  // once, so scheduling a task never waits for a lock held by another thread.
+  //
+  // Once Shutdown() has taken the remaining tasks, this is set to a sentinel
+  // value, after which no more tasks are accepted.
+  std::atomic<ReactorTask*> pending_tasks_;
 
   ReactorThread thread_;
 
@@ -71,7 +71,14 @@ DEFINE_int32(server_reactors, 4,
 
 DEFINE_int32(run_seconds, 1, "Seconds to run the test");
 
+DEFINE_int32(payload_bytes, 0,
+             "If positive, the synchronous benchmark makes Echo calls carrying "
+             "this many bytes, which the server sends back, instead of Add calls. "
+             "Combine with --rpc_zerocopy_send to measure zero-copy writes of "
+             "large transfers.");
+
 DECLARE_bool(rpc_encrypt_loopback_connections);
+DECLARE_bool(rpc_zerocopy_send);
 DEFINE_bool(enable_encryption, false, "Whether to enable TLS encryption for rpc-bench");
 
 METRIC_DECLARE_histogram(reactor_load_percent);
@@ -121,6 +128,10 @@ class RpcBench : public RpcTestBase {
     LOG(INFO) << "Worker threads:   " << FLAGS_worker_threads;
     LOG(INFO) << "Server reactors:  " << FLAGS_server_reactors;
     LOG(INFO) << "Encryption:       " << FLAGS_enable_encryption;
+    if (sync && FLAGS_payload_bytes > 0) {
+      LOG(INFO) << "Payload bytes:    " << FLAGS_payload_bytes;
+      LOG(INFO) << "Zero-copy send:   " << FLAGS_rpc_zerocopy_send;
+    }
     LOG(INFO) << "----------------------------------";
     LOG(INFO) << "Reqs/sec:         " << reqs_per_second;
     LOG(INFO) << "User CPU per req: " << user_cpu_micros_per_req << "us";
@@ -167,6 +178,11 @@ class ClientThread {
 
     CalculatorServiceProxy p(client_messenger, bench_->server_addr_, "localhost");
 
+    if (FLAGS_payload_bytes > 0) {
+      RunEcho(&p);
+      return;
+    }
+
     AddRequestPB req;
     AddResponsePB resp;
     while (Acquire_Load(&bench_->should_run_)) {
@@ -180,6 +196,19 @@ class ClientThread {
     }
   }
 
+  void RunEcho(CalculatorServiceProxy* p) {
+    EchoRequestPB req;
+    req.set_data(string(FLAGS_payload_bytes, 'x'));
+    EchoResponsePB resp;
+    while (Acquire_Load(&bench_->should_run_)) {
+      RpcController controller;
+      controller.set_timeout(MonoDelta::FromSeconds(10));
+      CHECK_OK(p->Echo(req, &resp, &controller));
+      CHECK_EQ(req.data().size(), resp.data().size());
+      request_count_++;
+    }
+  }
+
   unique_ptr<thread> thread_;
   RpcBench *bench_;
   int request_count_;
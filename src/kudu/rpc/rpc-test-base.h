@@ -296,6 +296,10 @@ class CalculatorService : public CalculatorServiceIf {
     context->RespondSuccess();
   }
 
+  bool IsSmallEcho(const Slice& serialized_request) const override {
+    return serialized_request.size() <= 1024;
+  }
+
   void WhoAmI(const WhoAmIRequestPB* /*req*/,
               WhoAmIResponsePB* resp,
               RpcContext* context) override {
@@ -412,6 +416,7 @@ class RpcTestBase : public KuduTest {
  public:
   RpcTestBase()
     : n_worker_threads_(3),
+      n_high_priority_worker_threads_(0),
       service_queue_length_(100),
       n_server_reactor_threads_(3),
       keepalive_time_ms_(1000),
@@ -505,9 +510,10 @@ class RpcTestBase : public KuduTest {
     CHECK_EQ(0, second.compare(Slice(expected)));
   }
 
-  Status DoTestOutgoingSidecar(const Proxy &p, int size1, int size2) {
+  Status DoTestOutgoingSidecar(const Proxy &p, int size1, int size2, bool compressible = true) {
     PushTwoStringsRequestPB request;
     RpcController controller;
+    controller.set_compressible(compressible);
 
     int idx1;
     std::string s1(size1, 'a');
@@ -530,8 +536,9 @@ class RpcTestBase : public KuduTest {
     return Status::OK();
   }
 
-  void DoTestOutgoingSidecarExpectOK(const Proxy &p, int size1, int size2) {
-    CHECK_OK(DoTestOutgoingSidecar(p, size1, size2));
+  void DoTestOutgoingSidecarExpectOK(const Proxy &p, int size1, int size2,
+                                     bool compressible = true) {
+    CHECK_OK(DoTestOutgoingSidecar(p, size1, size2, compressible));
   }
 
   void DoTestExpectTimeout(const Proxy& p,
@@ -636,7 +643,7 @@ class RpcTestBase : public KuduTest {
     scoped_refptr<MetricEntity> metric_entity = server_messenger_->metric_entity();
     service_pool_ = new ServicePool(std::move(service), metric_entity, service_queue_length_);
     server_messenger_->RegisterService(service_name_, service_pool_);
-    RETURN_NOT_OK(service_pool_->Init(n_worker_threads_));
+    RETURN_NOT_OK(service_pool_->Init(n_worker_threads_, n_high_priority_worker_threads_));
 
     return Status::OK();
   }
@@ -648,6 +655,7 @@ class RpcTestBase : public KuduTest {
   std::shared_ptr<kudu::MemTracker> mem_tracker_;
   scoped_refptr<ResultTracker> result_tracker_;
   int n_worker_threads_;
+  int n_high_priority_worker_threads_;
   int service_queue_length_;
   int n_server_reactor_threads_;
   int keepalive_time_ms_;
@@ -18,6 +18,7 @@
 #include "kudu/rpc/rpc-test-base.h"
 
 #include <cerrno>
+#include <climits>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
@@ -73,8 +74,12 @@
 METRIC_DECLARE_histogram(handler_latency_kudu_rpc_test_CalculatorService_Sleep);
 METRIC_DECLARE_histogram(rpc_incoming_queue_time);
 
+DECLARE_bool(rpc_compress_encrypted_connections);
+DECLARE_bool(rpc_encrypt_loopback_connections);
 DECLARE_bool(rpc_reopen_outbound_connections);
+DECLARE_int32(rpc_compression_min_transfer_bytes);
 DECLARE_int32(rpc_negotiation_inject_delay_ms);
+DECLARE_string(rpc_compression_codec);
 
 using std::shared_ptr;
 using std::string;
@@ -451,6 +456,95 @@ TEST_P(TestRpc, TestConnectionKeepalive) {
   ASSERT_EQ(0, metrics.num_client_connections_) << "Client should have 0 client connections";
 }
 
+// Test that large transfers are compressed when --rpc_compression_codec is
+// set, and that they arrive intact.
+TEST_P(TestRpc, TestCompressedTransfers) {
+  // Only run one reactor per messenger, so we can grab the metrics from that
+  // one without having to check all.
+  n_server_reactor_threads_ = 1;
+  FLAGS_rpc_compression_min_transfer_bytes = 1024;
+
+  // Set up server.
+  Sockaddr server_addr;
+  bool enable_ssl = GetParam();
+  ASSERT_OK(StartTestServer(&server_addr, enable_ssl));
+
+  uint64_t total_compressed_bytes_sent = 0;
+  for (const char* codec : { "lz4", "zstd" }) {
+    SCOPED_TRACE(codec);
+    FLAGS_rpc_compression_codec = codec;
+
+    // Set up a client, so that its connection is negotiated with the codec.
+    shared_ptr<Messenger> client_messenger;
+    ASSERT_OK(CreateMessenger("Client", &client_messenger, 1, enable_ssl));
+    Proxy p(client_messenger, server_addr, server_addr.host(),
+            GenericCalculatorService::static_service_name());
+
+    // Small calls aren't compressed.
+    ASSERT_OK(DoTestSyncCall(p, GenericCalculatorService::kAddMethodName));
+    ReactorMetrics metrics;
+    ASSERT_OK(client_messenger->reactors_[0]->GetMetrics(&metrics));
+    ASSERT_EQ(0U, metrics.uncompressed_bytes_sent_);
+
+    // Large calls and responses are.
+    DoTestOutgoingSidecarExpectOK(p, 64 * 1024, 128 * 1024);
+    DoTestSidecar(p, 64 * 1024, 128 * 1024);
+    ASSERT_OK(client_messenger->reactors_[0]->GetMetrics(&metrics));
+    ASSERT_GT(metrics.compressed_bytes_sent_, 0U);
+    ASSERT_LT(metrics.compressed_bytes_sent_, metrics.uncompressed_bytes_sent_ / 10);
+    total_compressed_bytes_sent += metrics.compressed_bytes_sent_;
+  }
+
+  ReactorMetrics metrics;
+  ASSERT_OK(server_messenger_->reactors_[0]->GetMetrics(&metrics));
+  ASSERT_EQ(total_compressed_bytes_sent, metrics.compressed_bytes_received_);
+  ASSERT_GT(metrics.uncompressed_bytes_received_, metrics.compressed_bytes_received_);
+}
+
+// Test that calls whose payload is already compressed aren't compressed again,
+// and that encrypted connections aren't compressed unless explicitly allowed.
+TEST_P(TestRpc, TestCompressionIsSkipped) {
+  n_server_reactor_threads_ = 1;
+  FLAGS_rpc_compression_min_transfer_bytes = 1024;
+  FLAGS_rpc_compression_codec = "lz4";
+  FLAGS_rpc_encrypt_loopback_connections = true;
+
+  Sockaddr server_addr;
+  bool enable_ssl = GetParam();
+  ASSERT_OK(StartTestServer(&server_addr, enable_ssl));
+
+  shared_ptr<Messenger> client_messenger;
+  ASSERT_OK(CreateMessenger("Client", &client_messenger, 1, enable_ssl));
+  Proxy p(client_messenger, server_addr, server_addr.host(),
+          GenericCalculatorService::static_service_name());
+
+  // A call marked as not compressible is sent as is.
+  DoTestOutgoingSidecarExpectOK(p, 64 * 1024, 128 * 1024, /*compressible=*/false);
+  ReactorMetrics metrics;
+  ASSERT_OK(client_messenger->reactors_[0]->GetMetrics(&metrics));
+  ASSERT_EQ(0U, metrics.uncompressed_bytes_sent_);
+
+  // Other calls are compressed, unless the connection is encrypted.
+  DoTestOutgoingSidecarExpectOK(p, 64 * 1024, 128 * 1024);
+  ASSERT_OK(client_messenger->reactors_[0]->GetMetrics(&metrics));
+  if (enable_ssl) {
+    ASSERT_EQ(0U, metrics.uncompressed_bytes_sent_);
+  } else {
+    ASSERT_GT(metrics.uncompressed_bytes_sent_, 0U);
+    return;
+  }
+
+  // Encrypted connections negotiated once it's allowed are compressed.
+  FLAGS_rpc_compress_encrypted_connections = true;
+  shared_ptr<Messenger> compressing_messenger;
+  ASSERT_OK(CreateMessenger("CompressingClient", &compressing_messenger, 1, enable_ssl));
+  Proxy compressing_p(compressing_messenger, server_addr, server_addr.host(),
+                      GenericCalculatorService::static_service_name());
+  DoTestOutgoingSidecarExpectOK(compressing_p, 64 * 1024, 128 * 1024);
+  ASSERT_OK(compressing_messenger->reactors_[0]->GetMetrics(&metrics));
+  ASSERT_GT(metrics.uncompressed_bytes_sent_, 0U);
+}
+
 // Test that idle connection is kept alive when 'keepalive_time_ms_' is set to -1.
 TEST_P(TestRpc, TestConnectionAlwaysKeepalive) {
   // Only run one reactor per messenger, so we can grab the metrics from that
@@ -724,6 +818,81 @@ TEST_P(TestRpc, TestRpcSidecar) {
   DoTestOutgoingSidecarExpectOK(p, 3000 * 1024, 2000 * 1024);
 }
 
+// Test that serialized fields attached to the controller are received as part
+// of the request message, and that sidecars sent along with them are still
+// found at the right offsets.
+TEST_P(TestRpc, TestOutboundSerializedFields) {
+  // Set up server.
+  Sockaddr server_addr;
+  bool enable_ssl = GetParam();
+  ASSERT_OK(StartTestServer(&server_addr, enable_ssl));
+
+  // Set up client.
+  shared_ptr<Messenger> client_messenger;
+  ASSERT_OK(CreateMessenger("Client", &client_messenger, 1, enable_ssl));
+  Proxy p(client_messenger, server_addr, server_addr.host(),
+          GenericCalculatorService::static_service_name());
+
+  RpcController controller;
+  int idx1;
+  string s1(123, 'a');
+  ASSERT_OK(controller.AddOutboundSidecar(RpcSidecar::FromSlice(Slice(s1)), &idx1));
+  int idx2;
+  string s2(4567, 'b');
+  ASSERT_OK(controller.AddOutboundSidecar(RpcSidecar::FromSlice(Slice(s2)), &idx2));
+
+  // Only one of the required fields is set in the request itself; the other
+  // one is sent pre-serialized.
+  PushTwoStringsRequestPB fields;
+  fields.set_sidecar2_idx(idx2);
+  string serialized_fields = fields.SerializePartialAsString();
+  vector<unique_ptr<RpcSidecar>> serialized;
+  serialized.emplace_back(RpcSidecar::FromSlice(Slice(serialized_fields)));
+  controller.SetOutboundSerializedFields(std::move(serialized));
+
+  PushTwoStringsRequestPB request;
+  request.set_sidecar1_idx(idx1);
+  PushTwoStringsResponsePB resp;
+  ASSERT_OK(p.SyncRequest(GenericCalculatorService::kPushTwoStringsMethodName,
+                          request, &resp, &controller));
+  ASSERT_EQ(s1, resp.data1());
+  ASSERT_EQ(s2, resp.data2());
+}
+
+// Test sending a request made of more serialized fields than fit in a
+// TransferPayload, or in a single writev() call.
+TEST_P(TestRpc, TestManyOutboundSerializedFields) {
+  // Set up server.
+  Sockaddr server_addr;
+  bool enable_ssl = GetParam();
+  ASSERT_OK(StartTestServer(&server_addr, enable_ssl));
+
+  // Set up client.
+  shared_ptr<Messenger> client_messenger;
+  ASSERT_OK(CreateMessenger("Client", &client_messenger, 1, enable_ssl));
+  Proxy p(client_messenger, server_addr, server_addr.host(),
+          GenericCalculatorService::static_service_name());
+
+  // Each of the serialized fields sets 'y' again: the last one wins.
+  const int kNumFields = IOV_MAX * 2 + 1;
+  RpcController controller;
+  vector<unique_ptr<RpcSidecar>> serialized;
+  for (int i = 1; i <= kNumFields; i++) {
+    AddRequestPB fields;
+    fields.set_y(i);
+    serialized.emplace_back(RpcSidecar::FromSharedString(
+        std::make_shared<const string>(fields.SerializePartialAsString())));
+  }
+  controller.SetOutboundSerializedFields(std::move(serialized));
+
+  rpc_test::AddRequestPartialPB request;
+  request.set_x(10);
+  AddResponsePB resp;
+  ASSERT_OK(p.SyncRequest(GenericCalculatorService::kAddMethodName,
+                          request, &resp, &controller));
+  ASSERT_EQ(10 + kNumFields, resp.result());
+}
+
 TEST_P(TestRpc, TestRpcSidecarLimits) {
   {
     // Test that the limits on the number of sidecars is respected.
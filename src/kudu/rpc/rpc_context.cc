@@ -155,6 +155,10 @@ Status RpcContext::GetInboundSidecar(int idx, Slice* slice) const {
   return call_->GetInboundSidecar(idx, slice);
 }
 
+const Slice& RpcContext::serialized_request() const {
+  return call_->serialized_request();
+}
+
 const RemoteUser& RpcContext::remote_user() const {
   return call_->remote_user();
 }
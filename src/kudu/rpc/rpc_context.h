@@ -171,6 +171,11 @@ class RpcContext {
   // of bounds.
   Status GetInboundSidecar(int idx, Slice* slice) const;
 
+  // Returns the request as it was received, serialized. It is an error to call
+  // this after DiscardTransfer(), and the returned slice is invalidated by it,
+  // as well as once the call is responded to.
+  const Slice& serialized_request() const;
+
   // Return the identity of remote user who made this call.
   const RemoteUser& remote_user() const;
 
@@ -21,6 +21,7 @@
 #include <mutex>
 #include <ostream>
 #include <utility>
+#include <vector>
 
 #include <glog/logging.h>
 
@@ -35,13 +36,16 @@
 
 
 using std::unique_ptr;
+using std::vector;
 using strings::Substitute;
 namespace kudu {
 
 namespace rpc {
 
 RpcController::RpcController()
-    : credentials_policy_(CredentialsPolicy::ANY_CREDENTIALS), messenger_(nullptr) {
+    : credentials_policy_(CredentialsPolicy::ANY_CREDENTIALS),
+      compressible_(true),
+      messenger_(nullptr) {
   DVLOG(4) << "RpcController " << this << " constructed";
 }
 
@@ -60,8 +64,10 @@ void RpcController::Swap(RpcController* other) {
 
   std::swap(outbound_sidecars_, other->outbound_sidecars_);
   std::swap(outbound_sidecars_total_bytes_, other->outbound_sidecars_total_bytes_);
+  std::swap(outbound_serialized_fields_, other->outbound_serialized_fields_);
   std::swap(timeout_, other->timeout_);
   std::swap(credentials_policy_, other->credentials_policy_);
+  std::swap(compressible_, other->compressible_);
   std::swap(call_, other->call_);
 }
 
@@ -73,8 +79,10 @@ void RpcController::Reset() {
   call_.reset();
   required_server_features_.clear();
   credentials_policy_ = CredentialsPolicy::ANY_CREDENTIALS;
+  compressible_ = true;
   messenger_ = nullptr;
   outbound_sidecars_total_bytes_ = 0;
+  outbound_serialized_fields_.clear();
 }
 
 bool RpcController::finished() const {
@@ -162,9 +170,15 @@ Status RpcController::AddOutboundSidecar(unique_ptr<RpcSidecar> car, int* idx) {
   return Status::OK();
 }
 
+void RpcController::SetOutboundSerializedFields(vector<unique_ptr<RpcSidecar>> fields) {
+  DCHECK(!call_ || call_->state() == OutboundCall::READY);
+  outbound_serialized_fields_ = std::move(fields);
+}
+
 void RpcController::SetRequestParam(const google::protobuf::Message& req) {
   DCHECK(call_ != nullptr);
-  call_->SetRequestPayload(req, std::move(outbound_sidecars_));
+  call_->SetRequestPayload(req, std::move(outbound_sidecars_),
+                           std::move(outbound_serialized_fields_));
 }
 
 void RpcController::Cancel() {
@@ -210,6 +210,17 @@ class RpcController {
     credentials_policy_ = policy;
   }
 
+  // Whether the request is worth compressing, on connections which compress
+  // large transfers (see --rpc_compression_codec). Requests whose payload is
+  // already compressed should set this to false. Defaults to true.
+  bool compressible() const {
+    return compressible_;
+  }
+
+  void set_compressible(bool compressible) {
+    compressible_ = compressible;
+  }
+
   // Fills the 'sidecar' parameter with the slice pointing to the i-th
   // sidecar upon success.
   //
@@ -225,6 +236,18 @@ class RpcController {
   // exceed TransferLimits::kMaxTotalSidecarBytes.
   Status AddOutboundSidecar(std::unique_ptr<RpcSidecar> car, int* idx);
 
+  // Sets already serialized protobuf fields to be appended to the outbound
+  // request. Each of 'fields' must hold the wire encoding of zero or more
+  // fields of the request message, and they are sent one after the other. Since
+  // protobuf parsers accept fields in any order and merge repeated fields, the
+  // server sees a single request containing both the fields of the request
+  // passed to the proxy and 'fields'. This allows a caller to serialize data
+  // once and send it with many requests, without copying it.
+  //
+  // Unlike sidecars, this needs no support on the server side, and there is no
+  // limit on the number of 'fields'.
+  void SetOutboundSerializedFields(std::vector<std::unique_ptr<RpcSidecar>> fields);
+
   // Cancel the call associated with the RpcController. This function should only be
   // called when there is an outstanding outbound call. It's always safe to call
   // Cancel() after you've sent a call, so long as you haven't called Reset() yet.
@@ -243,7 +266,8 @@ class RpcController {
   friend class Proxy;
 
   // Set the outbound call_'s request parameter, and transfer ownership of
-  // outbound_sidecars_ to call_ in preparation for serialization.
+  // outbound_sidecars_ and outbound_serialized_fields_ to call_ in preparation
+  // for serialization.
   void SetRequestParam(const google::protobuf::Message& req);
 
   // Set the messenger which contains the reactor thread handling the outbound call.
@@ -255,6 +279,9 @@ class RpcController {
   // RPC authentication policy for outbound calls.
   CredentialsPolicy credentials_policy_;
 
+  // See compressible().
+  bool compressible_;
+
   mutable simple_spinlock lock_;
 
   // The id of this request.
@@ -274,6 +301,9 @@ class RpcController {
   // of TransferLimits::kMaxTotalSidecarBytes.
   int32_t outbound_sidecars_total_bytes_ = 0;
 
+  // See SetOutboundSerializedFields().
+  std::vector<std::unique_ptr<RpcSidecar>> outbound_serialized_fields_;
+
   DISALLOW_COPY_AND_ASSIGN(RpcController);
 };
 
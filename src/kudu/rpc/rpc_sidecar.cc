@@ -19,6 +19,7 @@
 
 #include <cstdint>
 #include <memory>
+#include <string>
 #include <utility>
 
 #include <google/protobuf/repeated_field.h>
@@ -28,6 +29,8 @@
 #include "kudu/util/faststring.h"
 #include "kudu/util/status.h"
 
+using std::shared_ptr;
+using std::string;
 using std::unique_ptr;
 
 namespace kudu {
@@ -54,6 +57,15 @@ class FaststringSidecar : public RpcSidecar {
   const unique_ptr<faststring> data_;
 };
 
+class SharedStringSidecar : public RpcSidecar {
+ public:
+  explicit SharedStringSidecar(shared_ptr<const string> data) : data_(std::move(data)) { }
+  Slice AsSlice() const override { return *data_; }
+
+ private:
+  const shared_ptr<const string> data_;
+};
+
 unique_ptr<RpcSidecar> RpcSidecar::FromFaststring(unique_ptr<faststring> data) {
   return unique_ptr<RpcSidecar>(new FaststringSidecar(std::move(data)));
 }
@@ -62,6 +74,10 @@ unique_ptr<RpcSidecar> RpcSidecar::FromSlice(Slice slice) {
   return unique_ptr<RpcSidecar>(new SliceSidecar(slice));
 }
 
+unique_ptr<RpcSidecar> RpcSidecar::FromSharedString(shared_ptr<const string> data) {
+  return unique_ptr<RpcSidecar>(new SharedStringSidecar(std::move(data)));
+}
+
 
 Status RpcSidecar::ParseSidecars(
     const ::google::protobuf::RepeatedField<::google::protobuf::uint32>& offsets,
@@ -18,6 +18,7 @@
 #define KUDU_RPC_RPC_SIDECAR_H
 
 #include <memory>
+#include <string>
 
 #include <google/protobuf/repeated_field.h> // IWYU pragma: keep
 #include <google/protobuf/stubs/port.h>
@@ -52,6 +53,8 @@ class RpcSidecar {
  public:
   static std::unique_ptr<RpcSidecar> FromFaststring(std::unique_ptr<faststring> data);
   static std::unique_ptr<RpcSidecar> FromSlice(Slice slice);
+  // Shares ownership of 'data', which may be attached to several calls at once.
+  static std::unique_ptr<RpcSidecar> FromSharedString(std::shared_ptr<const std::string> data);
 
   // Utility method to parse a series of sidecar slices into 'sidecars' from 'buffer' and
   // a set of offsets. 'sidecars' must have length >= TransferLimits::kMaxSidecars, and
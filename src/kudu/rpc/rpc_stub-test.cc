@@ -67,6 +67,9 @@
 #include "kudu/util/user.h"
 
 DEFINE_bool(is_panic_test_child, false, "Used by TestRpcPanic");
+DECLARE_bool(rpc_zerocopy_send);
+DECLARE_int32(rpc_zerocopy_min_transfer_bytes);
+DECLARE_double(socket_inject_zerocopy_enobufs_fraction);
 DECLARE_bool(socket_inject_short_recvs);
 
 using kudu::pb_util::SecureDebugString;
@@ -86,6 +89,7 @@ class RpcStubTest : public RpcTestBase {
     // Use a shorter queue length since some tests below need to start enough
     // threads to saturate the queue.
     service_queue_length_ = 10;
+    n_high_priority_worker_threads_ = 1;
     ASSERT_OK(StartTestServerWithGeneratedCode(&server_addr_));
     ASSERT_OK(CreateMessenger("Client", &client_messenger_));
   }
@@ -157,6 +161,75 @@ TEST_F(RpcStubTest, TestBigCallData) {
   }
 }
 
+// Like the above, but with the calls and responses written with MSG_ZEROCOPY.
+// The kernel may not support it, or fall back to copying on loopback
+// connections, but the transfers must arrive intact either way.
+TEST_F(RpcStubTest, TestBigCallDataZeroCopy) {
+  FLAGS_rpc_zerocopy_send = true;
+  FLAGS_rpc_zerocopy_min_transfer_bytes = 1024 * 1024;
+  const int kNumSentAtOnce = 20;
+  const size_t kMessageSize = 5 * 1024 * 1024;
+
+  CalculatorServiceProxy p(client_messenger_, server_addr_, server_addr_.host());
+
+  vector<unique_ptr<EchoRequestPB>> reqs;
+  vector<unique_ptr<EchoResponsePB>> resps;
+  vector<unique_ptr<RpcController>> controllers;
+
+  CountDownLatch latch(kNumSentAtOnce);
+  for (int i = 0; i < kNumSentAtOnce; i++) {
+    reqs.emplace_back(new EchoRequestPB);
+    reqs.back()->set_data(string(kMessageSize, 'a' + i));
+    resps.emplace_back(new EchoResponsePB);
+    controllers.emplace_back(new RpcController);
+
+    p.EchoAsync(*reqs.back(), resps.back().get(), controllers.back().get(),
+                boost::bind(&CountDownLatch::CountDown, boost::ref(latch)));
+  }
+
+  latch.Wait();
+
+  for (int i = 0; i < kNumSentAtOnce; i++) {
+    ASSERT_OK(controllers[i]->status());
+    ASSERT_EQ(reqs[i]->data(), resps[i]->data());
+  }
+}
+
+// Like the above, but with many of the MSG_ZEROCOPY writes failing with
+// ENOBUFS, as they do when the socket's optmem limit is exceeded. Those writes
+// fall back to copying instead of failing the connection.
+TEST_F(RpcStubTest, TestBigCallDataZeroCopyENOBUFS) {
+  FLAGS_rpc_zerocopy_send = true;
+  FLAGS_rpc_zerocopy_min_transfer_bytes = 1024 * 1024;
+  FLAGS_socket_inject_zerocopy_enobufs_fraction = 0.5;
+  const int kNumSentAtOnce = 20;
+  const size_t kMessageSize = 5 * 1024 * 1024;
+
+  CalculatorServiceProxy p(client_messenger_, server_addr_, server_addr_.host());
+
+  vector<unique_ptr<EchoRequestPB>> reqs;
+  vector<unique_ptr<EchoResponsePB>> resps;
+  vector<unique_ptr<RpcController>> controllers;
+
+  CountDownLatch latch(kNumSentAtOnce);
+  for (int i = 0; i < kNumSentAtOnce; i++) {
+    reqs.emplace_back(new EchoRequestPB);
+    reqs.back()->set_data(string(kMessageSize, 'a' + i));
+    resps.emplace_back(new EchoResponsePB);
+    controllers.emplace_back(new RpcController);
+
+    p.EchoAsync(*reqs.back(), resps.back().get(), controllers.back().get(),
+                boost::bind(&CountDownLatch::CountDown, boost::ref(latch)));
+  }
+
+  latch.Wait();
+
+  for (int i = 0; i < kNumSentAtOnce; i++) {
+    ASSERT_OK(controllers[i]->status());
+    ASSERT_EQ(reqs[i]->data(), resps[i]->data());
+  }
+}
+
 TEST_F(RpcStubTest, TestRespondDeferred) {
   CalculatorServiceProxy p(client_messenger_, server_addr_, server_addr_.host());
 
@@ -506,6 +579,57 @@ TEST_F(RpcStubTest, TestDontHandleTimedOutCalls) {
   });
 }
 
+// Test that small calls of a high priority method are handled by the reserved
+// worker threads while all the normal priority worker threads are busy.
+TEST_F(RpcStubTest, TestHighPriorityCallsSkipBusyWorkers) {
+  CalculatorServiceProxy p(client_messenger_, server_addr_, server_addr_.host());
+  vector<AsyncSleep*> sleeps;
+  ElementDeleter d(&sleeps);
+
+  // Occupy the normal priority worker threads.
+  for (int i = 0; i < n_worker_threads_; i++) {
+    gscoped_ptr<AsyncSleep> sleep(new AsyncSleep);
+    sleep->rpc.set_timeout(MonoDelta::FromSeconds(10));
+    sleep->req.set_sleep_micros(2000*1000); // 2sec
+    p.SleepAsync(sleep->req, &sleep->resp, &sleep->rpc,
+                 boost::bind(&CountDownLatch::CountDown, &sleep->latch));
+    sleeps.push_back(sleep.release());
+  }
+  const Histogram* queue_time_metric = service_pool_->IncomingQueueTimeMetricForTests();
+  while (queue_time_metric->TotalCount() < n_worker_threads_) {
+    SleepFor(MonoDelta::FromMilliseconds(1));
+  }
+
+  // A small Echo is high priority, so it's handled before the sleeps finish.
+  {
+    RpcController rpc;
+    rpc.set_timeout(MonoDelta::FromSeconds(1));
+    EchoRequestPB req;
+    req.set_data("hello");
+    EchoResponsePB resp;
+    ASSERT_OK(p.Echo(req, &resp, &rpc));
+    ASSERT_EQ("hello", resp.data());
+  }
+  ASSERT_EQ(1, service_pool_->HighPriorityIncomingQueueTimeMetricForTests()->TotalCount());
+
+  // A large Echo fails the method's priority predicate, so it waits in the
+  // normal priority queue.
+  {
+    RpcController rpc;
+    rpc.set_timeout(MonoDelta::FromSeconds(10));
+    EchoRequestPB req;
+    req.set_data(string(4096, 'x'));
+    EchoResponsePB resp;
+    ASSERT_OK(p.Echo(req, &resp, &rpc));
+  }
+  ASSERT_EQ(1, service_pool_->HighPriorityIncomingQueueTimeMetricForTests()->TotalCount());
+  ASSERT_EQ(n_worker_threads_ + 1, static_cast<int>(queue_time_metric->TotalCount()));
+
+  for (AsyncSleep* s : sleeps) {
+    s->latch.Wait();
+  }
+}
+
 // Test which ensures that the RPC queue accepts requests with the earliest
 // deadline first (EDF), and upon overflow rejects requests with the latest deadlines.
 //
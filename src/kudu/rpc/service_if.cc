@@ -149,6 +149,15 @@ RpcMethodInfo* GeneratedServiceIf::LookupMethod(const RemoteMethod& method) {
   return it->second.get();
 }
 
+bool GeneratedServiceIf::HasPriorityMethods() const {
+  for (const auto& entry : methods_by_name_) {
+    if (entry.second->priority_class != NORMAL_PRIORITY) {
+      return true;
+    }
+  }
+  return false;
+}
+
 
 } // namespace rpc
 } // namespace kudu
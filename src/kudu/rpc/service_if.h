@@ -26,7 +26,9 @@
 #include <google/protobuf/message.h>
 
 #include "kudu/gutil/ref_counted.h"
+#include "kudu/rpc/rpc_header.pb.h"
 #include "kudu/util/metrics.h"
+#include "kudu/util/slice.h"
 
 namespace kudu {
 namespace rpc {
@@ -52,6 +54,14 @@ struct RpcMethodInfo : public RefCountedThreadSafe<RpcMethodInfo> {
   // Whether we should track this method's result, using ResultTracker.
   bool track_result;
 
+  // The priority class this method's calls are queued for.
+  RpcPriorityClass priority_class = NORMAL_PRIORITY;
+
+  // If set, calls for whose serialized request this returns false are queued
+  // as NORMAL_PRIORITY regardless of 'priority_class'. It's called on the
+  // reactor thread, and must be cheap.
+  std::function<bool(const Slice& serialized_request)> priority_predicate;
+
   // The authorization function for this RPC. If this function
   // returns false, the RPC has already been handled (i.e. rejected)
   // by the authorization function.
@@ -85,6 +95,12 @@ class ServiceIf {
     return nullptr;
   }
 
+  // Returns true if any of this service's methods has a priority class
+  // other than NORMAL_PRIORITY.
+  virtual bool HasPriorityMethods() const {
+    return false;
+  }
+
   // Default authorization method, which just allows all RPCs.
   //
   // See docs/design-docs/rpc.md for details on how to add custom
@@ -114,6 +130,8 @@ class GeneratedServiceIf : public ServiceIf {
 
   RpcMethodInfo* LookupMethod(const RemoteMethod& method) override;
 
+  bool HasPriorityMethods() const override;
+
   // Returns the mapping from method names to method infos.
   typedef std::unordered_map<std::string, scoped_refptr<RpcMethodInfo>> MethodInfoMap;
   const MethodInfoMap& methods_by_name() const { return methods_by_name_; }
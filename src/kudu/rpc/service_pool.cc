@@ -56,6 +56,13 @@ METRIC_DEFINE_histogram(server, rpc_incoming_queue_time,
                         "Number of microseconds incoming RPC requests spend in the worker queue",
                         60000000LU, 3);
 
+METRIC_DEFINE_histogram(server, rpc_incoming_queue_time_high_priority,
+                        "High Priority RPC Queue Time",
+                        kudu::MetricUnit::kMicroseconds,
+                        "Number of microseconds incoming RPC requests of the high "
+                        "priority class spend in the worker queue",
+                        60000000LU, 3);
+
 METRIC_DEFINE_counter(server, rpcs_timed_out_in_queue,
                       "RPC Queue Timeouts",
                       kudu::MetricUnit::kRequests,
@@ -75,8 +82,11 @@ ServicePool::ServicePool(gscoped_ptr<ServiceIf> service,
                          const scoped_refptr<MetricEntity>& entity,
                          size_t service_queue_length)
   : service_(std::move(service)),
+    service_queue_length_(service_queue_length),
     service_queue_(service_queue_length),
     incoming_queue_time_(METRIC_rpc_incoming_queue_time.Instantiate(entity)),
+    high_priority_incoming_queue_time_(
+        METRIC_rpc_incoming_queue_time_high_priority.Instantiate(entity)),
     rpcs_timed_out_in_queue_(METRIC_rpcs_timed_out_in_queue.Instantiate(entity)),
     rpcs_queue_overflow_(METRIC_rpcs_queue_overflow.Instantiate(entity)),
     closing_(false),
@@ -87,18 +97,32 @@ ServicePool::~ServicePool() {
   Shutdown();
 }
 
-Status ServicePool::Init(int num_threads) {
+Status ServicePool::Init(int num_threads, int num_high_priority_threads) {
   for (int i = 0; i < num_threads; i++) {
     scoped_refptr<kudu::Thread> new_thread;
     CHECK_OK(kudu::Thread::Create("service pool", "rpc worker",
-        &ServicePool::RunThread, this, &new_thread));
+        &ServicePool::RunThread, this, &service_queue_,
+        incoming_queue_time_.get(), &new_thread));
     threads_.push_back(new_thread);
   }
+  if (num_high_priority_threads > 0 && service_->HasPriorityMethods()) {
+    high_priority_queue_.reset(new LifoServiceQueue(service_queue_length_));
+    for (int i = 0; i < num_high_priority_threads; i++) {
+      scoped_refptr<kudu::Thread> new_thread;
+      CHECK_OK(kudu::Thread::Create("service pool", "rpc high-priority worker",
+          &ServicePool::RunThread, this, high_priority_queue_.get(),
+          high_priority_incoming_queue_time_.get(), &new_thread));
+      threads_.push_back(new_thread);
+    }
+  }
   return Status::OK();
 }
 
 void ServicePool::Shutdown() {
   service_queue_.Shutdown();
+  if (high_priority_queue_) {
+    high_priority_queue_->Shutdown();
+  }
 
   MutexLock lock(shutdown_lock_);
   if (closing_) return;
@@ -114,18 +138,23 @@ void ServicePool::Shutdown() {
   while (service_queue_.BlockingGet(&incoming)) {
     incoming.release()->RespondFailure(ErrorStatusPB::FATAL_SERVER_SHUTTING_DOWN, status);
   }
+  if (high_priority_queue_) {
+    while (high_priority_queue_->BlockingGet(&incoming)) {
+      incoming.release()->RespondFailure(ErrorStatusPB::FATAL_SERVER_SHUTTING_DOWN, status);
+    }
+  }
 
   service_->Shutdown();
 }
 
-void ServicePool::RejectTooBusy(InboundCall* c) {
+void ServicePool::RejectTooBusy(InboundCall* c, const LifoServiceQueue& queue) {
   string err_msg =
       Substitute("$0 request on $1 from $2 dropped due to backpressure. "
                  "The service queue is full; it has $3 items.",
                  c->remote_method().method_name(),
                  service_->service_name(),
                  c->remote_address().ToString(),
-                 service_queue_.max_size());
+                 queue.max_size());
   rpcs_queue_overflow_->Increment();
   KLOG_EVERY_N_SECS(WARNING, 300) << err_msg;
   c->RespondFailure(ErrorStatusPB::ERROR_SERVER_TOO_BUSY,
@@ -135,7 +164,7 @@ void ServicePool::RejectTooBusy(InboundCall* c) {
     // throttle, as don't want to flood log with lines if
     // pool is always at edge of queue.
     KLOG_EVERY_N_SECS(WARNING, 600) << err_msg << " Contents of service queue:\n"
-        << service_queue_.ToString();
+        << queue.ToString();
     logged_busy_ = true;
   }
 
@@ -145,9 +174,25 @@ void ServicePool::RejectTooBusy(InboundCall* c) {
 }
 
 std::string ServicePool::RpcServiceQueueToString() const {
+  if (high_priority_queue_) {
+    return Substitute("$0\nHigh priority:\n$1",
+                      service_queue_.ToString(), high_priority_queue_->ToString());
+  }
   return service_queue_.ToString();
 }
 
+LifoServiceQueue* ServicePool::QueueFor(InboundCall* c) {
+  if (high_priority_queue_) {
+    const RpcMethodInfo* method_info = c->method_info();
+    if (method_info && method_info->priority_class == HIGH_PRIORITY &&
+        (!method_info->priority_predicate ||
+         method_info->priority_predicate(c->serialized_request()))) {
+      return high_priority_queue_.get();
+    }
+  }
+  return &service_queue_;
+}
+
 RpcMethodInfo* ServicePool::LookupMethod(const RemoteMethod& method) {
   return service_->LookupMethod(method);
 }
@@ -172,16 +217,17 @@ Status ServicePool::QueueInboundCall(gscoped_ptr<InboundCall> call) {
 
   TRACE_TO(c->trace(), "Inserting onto call queue");
 
-  // Queue message on service queue
+  // Queue message on the service queue of its priority class.
+  LifoServiceQueue* queue = QueueFor(c);
   boost::optional<InboundCall*> evicted;
-  auto queue_status = service_queue_.Put(c, &evicted);
+  auto queue_status = queue->Put(c, &evicted);
   if (queue_status == QUEUE_FULL) {
-    RejectTooBusy(c);
+    RejectTooBusy(c, *queue);
     return Status::OK();
   }
 
   if (PREDICT_FALSE(evicted != boost::none)) {
-    RejectTooBusy(*evicted);
+    RejectTooBusy(*evicted, *queue);
   }
 
   // success in enqueu. Clear the printed state for busy
@@ -205,15 +251,15 @@ Status ServicePool::QueueInboundCall(gscoped_ptr<InboundCall> call) {
   return status;
 }
 
-void ServicePool::RunThread() {
+void ServicePool::RunThread(LifoServiceQueue* queue, Histogram* queue_time) {
   while (true) {
     std::unique_ptr<InboundCall> incoming;
-    if (!service_queue_.BlockingGet(&incoming)) {
+    if (!queue->BlockingGet(&incoming)) {
       VLOG(1) << "ServicePool: messenger shutting down.";
       return;
     }
 
-    incoming->RecordHandlingStarted(incoming_queue_time_.get());
+    incoming->RecordHandlingStarted(queue_time);
     ADOPT_TRACE(incoming->trace());
 
     if (PREDICT_FALSE(incoming->ClientTimedOut())) {
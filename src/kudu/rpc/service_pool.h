@@ -21,6 +21,7 @@
 #include <atomic>
 #include <cstddef>
 #include <functional>
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
@@ -70,7 +71,12 @@ class ServicePool : public RpcService {
   }
 
   // Start up the thread pool.
-  virtual Status Init(int num_threads);
+  //
+  // If 'num_high_priority_threads' is positive and the service has methods
+  // of a priority class above NORMAL_PRIORITY, the calls of those methods are
+  // queued separately and handled by that many additional threads, so they
+  // never wait behind calls of normal priority.
+  virtual Status Init(int num_threads, int num_high_priority_threads = 0);
 
   // Shut down the queue and the thread pool.
   virtual void Shutdown();
@@ -87,6 +93,10 @@ class ServicePool : public RpcService {
     return incoming_queue_time_.get();
   }
 
+  const Histogram* HighPriorityIncomingQueueTimeMetricForTests() const {
+    return high_priority_incoming_queue_time_.get();
+  }
+
   const Counter* RpcsQueueOverflowMetric() const {
     return rpcs_queue_overflow_.get();
   }
@@ -99,13 +109,23 @@ class ServicePool : public RpcService {
   std::string RpcServiceQueueToString() const;
 
  private:
-  void RunThread();
-  void RejectTooBusy(InboundCall* c);
+  void RunThread(LifoServiceQueue* queue, Histogram* queue_time);
+  void RejectTooBusy(InboundCall* c, const LifoServiceQueue& queue);
+
+  // Returns the queue that 'c' should wait in, according to the priority
+  // class of its method and the method's priority predicate, if any.
+  LifoServiceQueue* QueueFor(InboundCall* c);
 
   gscoped_ptr<ServiceIf> service_;
   std::vector<scoped_refptr<kudu::Thread> > threads_;
+  const size_t service_queue_length_;
   LifoServiceQueue service_queue_;
   scoped_refptr<Histogram> incoming_queue_time_;
+
+  // The queue of HIGH_PRIORITY calls, and the time they spend in it. Only
+  // set if the pool reserves threads for HIGH_PRIORITY calls.
+  std::unique_ptr<LifoServiceQueue> high_priority_queue_;
+  scoped_refptr<Histogram> high_priority_incoming_queue_time_;
   scoped_refptr<Counter> rpcs_timed_out_in_queue_;
   scoped_refptr<Counter> rpcs_queue_overflow_;
 
@@ -20,10 +20,15 @@
 #include <sys/uio.h>
 
 #include <algorithm>
+#include <cerrno>
+#include <climits>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <limits>
 #include <set>
+#include <utility>
+#include <vector>
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
@@ -32,6 +37,8 @@
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/strings/substitute.h"
 #include "kudu/rpc/constants.h"
+#include "kudu/util/compression/compression.pb.h"
+#include "kudu/util/compression/compression_codec.h"
 #include "kudu/util/flag_tags.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/net/socket.h"
@@ -63,6 +70,8 @@ namespace rpc {
 using std::ostringstream;
 using std::set;
 using std::string;
+using std::unique_ptr;
+using std::vector;
 using strings::Substitute;
 
 #define RETURN_ON_ERROR_OR_SOCKET_NOT_READY(status)               \
@@ -79,10 +88,11 @@ using strings::Substitute;
 TransferCallbacks::~TransferCallbacks()
 {}
 
-InboundTransfer::InboundTransfer()
-  : total_length_(kMsgLengthPrefixLength),
-    cur_offset_(0) {
-  buf_.resize(kMsgLengthPrefixLength);
+InboundTransfer::InboundTransfer(std::shared_ptr<InboundBufferPool> buffer_pool)
+  : buffer_pool_(std::move(buffer_pool)),
+    total_length_(kMsgLengthPrefixLength),
+    cur_offset_(0),
+    compressed_(false) {
 }
 
 Status InboundTransfer::ReceiveBuffer(Socket &socket) {
@@ -90,7 +100,7 @@ Status InboundTransfer::ReceiveBuffer(Socket &socket) {
     // receive uint32 length prefix
     int32_t rem = kMsgLengthPrefixLength - cur_offset_;
     int32_t nread;
-    Status status = socket.Recv(&buf_[cur_offset_], rem, &nread);
+    Status status = socket.Recv(&length_prefix_[cur_offset_], rem, &nread);
     RETURN_ON_ERROR_OR_SOCKET_NOT_READY(status);
     if (nread == 0) {
       return Status::OK();
@@ -108,7 +118,9 @@ Status InboundTransfer::ReceiveBuffer(Socket &socket) {
 
     // The length prefix doesn't include its own 4 bytes, so we have to
     // add that back in.
-    total_length_ = NetworkByteOrder::Load32(&buf_[0]) + kMsgLengthPrefixLength;
+    uint32_t length_prefix = NetworkByteOrder::Load32(length_prefix_);
+    compressed_ = length_prefix & kCompressedMsgFlag;
+    total_length_ = (length_prefix & ~kCompressedMsgFlag) + kMsgLengthPrefixLength;
     if (total_length_ > FLAGS_rpc_max_message_size) {
       return Status::NetworkError(Substitute(
           "RPC frame had a length of $0, but we only support messages up to $1 bytes "
@@ -118,7 +130,9 @@ Status InboundTransfer::ReceiveBuffer(Socket &socket) {
       return Status::NetworkError(Substitute("RPC frame had invalid length of $0",
                                              total_length_));
     }
-    buf_.resize(total_length_);
+    buf_ = buffer_pool_ ? buffer_pool_->Allocate(total_length_)
+                        : InboundBuffer::Allocate(total_length_);
+    memcpy(buf_.data(), length_prefix_, kMsgLengthPrefixLength);
 
     // Fall through to receive the message body, which is likely to be already
     // available on the socket.
@@ -133,13 +147,59 @@ Status InboundTransfer::ReceiveBuffer(Socket &socket) {
   // currently only used for unit tests.
   int32_t rem = std::min(total_length_ - cur_offset_,
       static_cast<uint32_t>(std::numeric_limits<int32_t>::max()));
-  Status status = socket.Recv(&buf_[cur_offset_], rem, &nread);
+  Status status = socket.Recv(buf_.data() + cur_offset_, rem, &nread);
   RETURN_ON_ERROR_OR_SOCKET_NOT_READY(status);
   cur_offset_ += nread;
 
   return Status::OK();
 }
 
+Status InboundTransfer::Decompress() {
+  DCHECK(TransferFinished());
+  DCHECK(compressed_);
+  if (total_length_ <= kMsgLengthPrefixLength + kCompressedMsgHeaderLength) {
+    return Status::NetworkError(Substitute("compressed RPC frame had invalid length of $0",
+                                           total_length_));
+  }
+  const uint8_t* header = buf_.data() + kMsgLengthPrefixLength;
+  CompressionType codec_type = static_cast<CompressionType>(header[0]);
+  if (codec_type != LZ4 && codec_type != ZSTD) {
+    return Status::NetworkError(Substitute("RPC frame was compressed with unsupported codec $0",
+                                           header[0]));
+  }
+  const CompressionCodec* codec;
+  RETURN_NOT_OK(GetCompressionCodec(codec_type, &codec));
+
+  uint32_t uncompressed_length = NetworkByteOrder::Load32(header + 1);
+  int64_t uncompressed_total_length =
+      static_cast<int64_t>(uncompressed_length) + kMsgLengthPrefixLength;
+  if (uncompressed_total_length > FLAGS_rpc_max_message_size) {
+    return Status::NetworkError(Substitute(
+        "RPC frame had an uncompressed length of $0, but we only support messages up to $1 "
+        "bytes long.", uncompressed_total_length, FLAGS_rpc_max_message_size));
+  }
+  if (uncompressed_length == 0) {
+    return Status::NetworkError("compressed RPC frame had an uncompressed length of 0");
+  }
+
+  InboundBuffer uncompressed = buffer_pool_ ?
+      buffer_pool_->Allocate(uncompressed_total_length) :
+      InboundBuffer::Allocate(uncompressed_total_length);
+  NetworkByteOrder::Store32(uncompressed.data(), uncompressed_length);
+  Slice compressed(header + kCompressedMsgHeaderLength,
+                   total_length_ - kMsgLengthPrefixLength - kCompressedMsgHeaderLength);
+  RETURN_NOT_OK_PREPEND(codec->Uncompress(compressed,
+                                          uncompressed.data() + kMsgLengthPrefixLength,
+                                          uncompressed_length),
+                        "could not decompress RPC frame");
+
+  buf_ = std::move(uncompressed);
+  total_length_ = uncompressed_total_length;
+  cur_offset_ = uncompressed_total_length;
+  compressed_ = false;
+  return Status::OK();
+}
+
 bool InboundTransfer::TransferStarted() const {
   return cur_offset_ != 0;
 }
@@ -155,36 +215,49 @@ string InboundTransfer::StatusAsString() const {
 OutboundTransfer* OutboundTransfer::CreateForCallRequest(int32_t call_id,
                                                          const TransferPayload &payload,
                                                          size_t n_payload_slices,
-                                                         TransferCallbacks *callbacks) {
-  return new OutboundTransfer(call_id, payload, n_payload_slices, callbacks);
+                                                         TransferCallbacks *callbacks,
+                                                         vector<Slice> long_payload) {
+  return new OutboundTransfer(call_id, payload, n_payload_slices, callbacks,
+                              std::move(long_payload));
 }
 
 OutboundTransfer* OutboundTransfer::CreateForCallResponse(const TransferPayload &payload,
                                                           size_t n_payload_slices,
                                                           TransferCallbacks *callbacks) {
-  return new OutboundTransfer(kInvalidCallId, payload, n_payload_slices, callbacks);
+  return new OutboundTransfer(kInvalidCallId, payload, n_payload_slices, callbacks, {});
 }
 
 OutboundTransfer::OutboundTransfer(int32_t call_id,
                                    const TransferPayload &payload,
                                    size_t n_payload_slices,
-                                   TransferCallbacks *callbacks)
-  : cur_slice_idx_(0),
+                                   TransferCallbacks *callbacks,
+                                   vector<Slice> long_payload)
+  : long_payload_slices_(std::move(long_payload)),
+    cur_slice_idx_(0),
     cur_offset_in_slice_(0),
     callbacks_(callbacks),
     call_id_(call_id),
     started_(false),
-    aborted_(false) {
-
+    aborted_(false),
+    finish_notified_(false),
+    used_zerocopy_(false),
+    zerocopy_seq_end_(0) {
+
+  if (!long_payload_slices_.empty()) {
+    slices_ = long_payload_slices_.data();
+    n_payload_slices_ = long_payload_slices_.size();
+    return;
+  }
+  slices_ = payload_slices_.data();
   n_payload_slices_ = n_payload_slices;
   CHECK_LE(n_payload_slices_, payload_slices_.size());
   for (int i = 0; i < n_payload_slices; i++) {
-    payload_slices_[i] = payload[i];
+    slices_[i] = payload[i];
   }
 }
 
 OutboundTransfer::~OutboundTransfer() {
-  if (!TransferFinished() && !aborted_) {
+  if (!finish_notified_ && !aborted_) {
     callbacks_->NotifyTransferAborted(
       Status::RuntimeError("RPC transfer destroyed before it finished sending"));
   }
@@ -197,16 +270,67 @@ void OutboundTransfer::Abort(const Status &status) {
   aborted_ = true;
 }
 
-Status OutboundTransfer::SendBuffer(Socket &socket) {
+bool OutboundTransfer::Compress(const CompressionCodec* codec) {
+  DCHECK(!started_);
+  DCHECK_GT(n_payload_slices_, 0);
+  DCHECK_GE(slices_[0].size(), kMsgLengthPrefixLength);
+
+  // Compress the message without its length prefix, which is rewritten below.
+  vector<Slice> message;
+  message.reserve(n_payload_slices_);
+  size_t message_length = 0;
+  for (int i = 0; i < n_payload_slices_; i++) {
+    Slice slice = slices_[i];
+    if (i == 0) {
+      slice.remove_prefix(kMsgLengthPrefixLength);
+    }
+    if (!slice.empty()) {
+      message.push_back(slice);
+      message_length += slice.size();
+    }
+  }
+  if (message.empty()) {
+    return false;
+  }
+
+  const size_t header_length = kMsgLengthPrefixLength + kCompressedMsgHeaderLength;
+  unique_ptr<uint8_t[]> buf(new uint8_t[header_length +
+                                        codec->MaxCompressedLength(message_length)]);
+  size_t compressed_length;
+  Status s = codec->Compress(message, buf.get() + header_length, &compressed_length);
+  if (PREDICT_FALSE(!s.ok())) {
+    KLOG_EVERY_N_SECS(WARNING, 300) << "Unable to compress RPC transfer [EVERY 300 seconds]: "
+                                    << s.ToString();
+    return false;
+  }
+  if (compressed_length + kCompressedMsgHeaderLength >= message_length) {
+    return false;
+  }
+
+  NetworkByteOrder::Store32(buf.get(),
+                            (compressed_length + kCompressedMsgHeaderLength) | kCompressedMsgFlag);
+  buf[kMsgLengthPrefixLength] = static_cast<uint8_t>(codec->type());
+  NetworkByteOrder::Store32(buf.get() + kMsgLengthPrefixLength + 1, message_length);
+
+  compressed_payload_ = std::move(buf);
+  slices_ = payload_slices_.data();
+  slices_[0] = Slice(compressed_payload_.get(), header_length + compressed_length);
+  n_payload_slices_ = 1;
+  return true;
+}
+
+Status OutboundTransfer::SendBuffer(Socket &socket, uint32_t* zerocopy_seq) {
   CHECK_LT(cur_slice_idx_, n_payload_slices_);
 
   started_ = true;
-  int n_iovecs = n_payload_slices_ - cur_slice_idx_;
+  // writev() fails if passed more than IOV_MAX buffers: the remaining slices
+  // are sent by later calls.
+  int n_iovecs = std::min<int>(n_payload_slices_ - cur_slice_idx_, IOV_MAX);
   struct iovec iovec[n_iovecs];
   {
     int offset_in_slice = cur_offset_in_slice_;
     for (int i = 0; i < n_iovecs; i++) {
-      Slice &slice = payload_slices_[cur_slice_idx_ + i];
+      Slice &slice = slices_[cur_slice_idx_ + i];
       iovec[i].iov_base = slice.mutable_data() + offset_in_slice;
       iovec[i].iov_len = slice.size() - offset_in_slice;
 
@@ -215,12 +339,24 @@ Status OutboundTransfer::SendBuffer(Socket &socket) {
   }
 
   int64_t written;
-  Status status = socket.Writev(iovec, n_iovecs, &written);
+  Status status = zerocopy_seq ? socket.WritevZeroCopy(iovec, n_iovecs, &written)
+                               : socket.Writev(iovec, n_iovecs, &written);
+  if (zerocopy_seq && PREDICT_FALSE(status.IsNetworkError() &&
+                                    status.posix_code() == ENOBUFS)) {
+    // Too many zero-copy writes are awaiting completion on the socket. The
+    // failed write was not assigned an ID, so copy the bytes instead.
+    zerocopy_seq = nullptr;
+    status = socket.Writev(iovec, n_iovecs, &written);
+  }
   RETURN_ON_ERROR_OR_SOCKET_NOT_READY(status);
+  if (zerocopy_seq) {
+    used_zerocopy_ = true;
+    zerocopy_seq_end_ = ++(*zerocopy_seq);
+  }
 
   // Adjust our accounting of current writer position.
   for (int i = cur_slice_idx_; i < n_payload_slices_; i++) {
-    Slice &slice = payload_slices_[i];
+    Slice &slice = slices_[i];
     int rem_in_slice = slice.size() - cur_offset_in_slice_;
     DCHECK_GE(rem_in_slice, 0);
 
@@ -237,16 +373,27 @@ Status OutboundTransfer::SendBuffer(Socket &socket) {
   }
 
   if (cur_slice_idx_ == n_payload_slices_) {
-    callbacks_->NotifyTransferFinished();
     DCHECK_EQ(0, cur_offset_in_slice_);
+    if (!used_zerocopy_) {
+      finish_notified_ = true;
+      callbacks_->NotifyTransferFinished();
+    } else {
+      callbacks_->NotifyTransferSent();
+    }
   } else {
     DCHECK_LT(cur_slice_idx_, n_payload_slices_);
-    DCHECK_LT(cur_offset_in_slice_, payload_slices_[cur_slice_idx_].size());
+    DCHECK_LT(cur_offset_in_slice_, slices_[cur_slice_idx_].size());
   }
 
   return Status::OK();
 }
 
+void OutboundTransfer::NotifyZeroCopyCompleted() {
+  DCHECK(AwaitingZeroCopyCompletion());
+  finish_notified_ = true;
+  callbacks_->NotifyTransferFinished();
+}
+
 bool OutboundTransfer::TransferStarted() const {
   return started_;
 }
@@ -266,7 +413,7 @@ string OutboundTransfer::HexDump() const {
 
   string ret;
   for (int i = 0; i < n_payload_slices_; i++) {
-    ret.append(payload_slices_[i].ToDebugString());
+    ret.append(slices_[i].ToDebugString());
   }
   return ret;
 }
@@ -274,7 +421,7 @@ string OutboundTransfer::HexDump() const {
 int32_t OutboundTransfer::TotalLength() const {
   int32_t ret = 0;
   for (int i = 0; i < n_payload_slices_; i++) {
-    ret += payload_slices_[i].size();
+    ret += slices_[i].size();
   }
   return ret;
 }
@@ -22,7 +22,9 @@
 #include <cstddef>
 #include <cstdint>
 #include <limits.h>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include <boost/intrusive/list_hook.hpp>
 #include <gflags/gflags_declare.h>
@@ -30,7 +32,7 @@
 
 #include "kudu/gutil/macros.h"
 #include "kudu/rpc/constants.h"
-#include "kudu/util/faststring.h"
+#include "kudu/rpc/inbound_buffer_pool.h"
 #include "kudu/util/slice.h"
 #include "kudu/util/status.h"
 
@@ -38,6 +40,7 @@ DECLARE_int64(rpc_max_message_size);
 
 namespace kudu {
 
+class CompressionCodec;
 class Socket;
 
 namespace rpc {
@@ -48,7 +51,7 @@ class TransferLimits {
  public:
   enum {
     kMaxSidecars = 10,
-    kMaxPayloadSlices = kMaxSidecars + 2, // (header + msg)
+    kMaxPayloadSlices = kMaxSidecars + 3, // (header + msg + serialized msg fields)
     kMaxTotalSidecarBytes = INT_MAX
   };
 
@@ -63,10 +66,15 @@ typedef std::array<Slice, TransferLimits::kMaxPayloadSlices> TransferPayload;
 // Inbound Transfer objects are created by a Connection receiving data. When the
 // message is fully received, it is either parsed as a call, or a call response,
 // and the InboundTransfer object itself is handed off.
+//
+// The message is received into a buffer from the receiving reactor's
+// InboundBufferPool, if any. The buffer is returned to the pool when the
+// transfer is destroyed, so slices of data() (e.g. an InboundCall's
+// serialized request and sidecars) stay valid until then.
 class InboundTransfer {
  public:
 
-  InboundTransfer();
+  explicit InboundTransfer(std::shared_ptr<InboundBufferPool> buffer_pool = nullptr);
 
   // read from the socket into our buffer
   Status ReceiveBuffer(Socket &socket);
@@ -77,8 +85,23 @@ class InboundTransfer {
   // Return true if the entire transfer has been sent.
   bool TransferFinished() const;
 
+  // Return true if the received message is compressed. Only meaningful once
+  // the transfer has finished.
+  bool compressed() const {
+    return compressed_;
+  }
+
+  // Decompresses the received message, after which data() returns the
+  // message as it was before the sender compressed it. Must only be called
+  // once the transfer has finished, and if compressed().
+  Status Decompress();
+
+  // Return the bytes received so far, including the length prefix.
   Slice data() const {
-    return Slice(buf_);
+    if (!buf_.data()) {
+      return Slice(length_prefix_, cur_offset_);
+    }
+    return Slice(buf_.data(), cur_offset_);
   }
 
   // Return a string indicating the status of this transfer (number of bytes received, etc)
@@ -89,11 +112,23 @@ class InboundTransfer {
 
   Status ProcessInboundHeader();
 
-  faststring buf_;
+  // The pool the message buffer is allocated from, or nullptr if it is
+  // allocated on its own.
+  const std::shared_ptr<InboundBufferPool> buffer_pool_;
+
+  // Receives the length prefix, before the message buffer is allocated.
+  uint8_t length_prefix_[kMsgLengthPrefixLength];
+
+  // The whole message, including the length prefix. Allocated once the
+  // length prefix is received.
+  InboundBuffer buf_;
 
   uint32_t total_length_;
   uint32_t cur_offset_;
 
+  // Whether the length prefix marks the message as compressed.
+  bool compressed_;
+
   DISALLOW_COPY_AND_ASSIGN(InboundTransfer);
 };
 
@@ -118,11 +153,14 @@ class OutboundTransfer : public boost::intrusive::list_base_hook<> {
   // slices.
   // ------------------------------------------------------------
 
-  // Create an outbound transfer for a call request.
+  // Create an outbound transfer for a call request. If 'long_payload' is
+  // non-empty, its slices are sent instead of those of 'payload', for requests
+  // with more than kMaxPayloadSlices slices.
   static OutboundTransfer* CreateForCallRequest(int32_t call_id,
                                                 const TransferPayload &payload,
                                                 size_t n_payload_slices,
-                                                TransferCallbacks *callbacks);
+                                                TransferCallbacks *callbacks,
+                                                std::vector<Slice> long_payload = {});
 
   // Create an outbound transfer for a call response.
   // See above for details.
@@ -138,8 +176,23 @@ class OutboundTransfer : public boost::intrusive::list_base_hook<> {
   // This triggers TransferCallbacks::NotifyTransferAborted.
   void Abort(const Status &status);
 
+  // Replaces the payload with a compressed copy of it, compressed with
+  // 'codec', unless that turns out no smaller than the payload. Returns true
+  // if the payload was replaced. Must be called before the transfer starts.
+  //
+  // The caller must only do this if the remote end advertised support for
+  // the codec during negotiation.
+  bool Compress(const CompressionCodec* codec);
+
   // send from our buffers into the sock
-  Status SendBuffer(Socket &socket);
+  //
+  // If 'zerocopy_seq' is non-null, the bytes are written with MSG_ZEROCOPY,
+  // and '*zerocopy_seq' is the ID the socket assigns to the next zero-copy
+  // write, which is incremented for each write made. In that case, once all
+  // the bytes are sent, TransferCallbacks::NotifyTransferSent() is called
+  // instead of NotifyTransferFinished(), which is deferred until
+  // NotifyZeroCopyCompleted().
+  Status SendBuffer(Socket &socket, uint32_t* zerocopy_seq = nullptr);
 
   // Return true if any bytes have yet been sent.
   bool TransferStarted() const;
@@ -147,6 +200,22 @@ class OutboundTransfer : public boost::intrusive::list_base_hook<> {
   // Return true if the entire transfer has been sent.
   bool TransferFinished() const;
 
+  // Return true if the entire transfer has been sent, but the kernel may
+  // still be reading the payload of its zero-copy writes.
+  bool AwaitingZeroCopyCompletion() const {
+    return TransferFinished() && !finish_notified_;
+  }
+
+  // One past the ID of the last zero-copy write of this transfer. Only
+  // meaningful if AwaitingZeroCopyCompletion().
+  uint32_t zerocopy_seq_end() const {
+    return zerocopy_seq_end_;
+  }
+
+  // Called once all of this transfer's zero-copy writes have completed.
+  // This triggers TransferCallbacks::NotifyTransferFinished.
+  void NotifyZeroCopyCompleted();
+
   // Return the total number of bytes to be sent (including those already sent)
   int32_t TotalLength() const;
 
@@ -167,13 +236,21 @@ class OutboundTransfer : public boost::intrusive::list_base_hook<> {
   OutboundTransfer(int32_t call_id,
                    const TransferPayload& payload,
                    size_t n_payload_slices,
-                   TransferCallbacks *callbacks);
+                   TransferCallbacks *callbacks,
+                   std::vector<Slice> long_payload);
 
   // Slices to send. Uses an array here instead of a vector to avoid an expensive
-  // vector construction (improved performance a couple percent).
+  // vector construction (improved performance a couple percent). Only payloads
+  // which don't fit in the array use 'long_payload_slices_' instead.
   TransferPayload payload_slices_;
+  std::vector<Slice> long_payload_slices_;
+  // Points to the slices in use, in either of the above.
+  Slice* slices_;
   size_t n_payload_slices_;
 
+  // The compressed payload, if Compress() replaced the payload.
+  std::unique_ptr<uint8_t[]> compressed_payload_;
+
   // The current slice that is being sent.
   int32_t cur_slice_idx_;
   // The number of bytes in the above slice which has already been sent.
@@ -192,6 +269,15 @@ class OutboundTransfer : public boost::intrusive::list_base_hook<> {
 
   bool aborted_;
 
+  // True once TransferCallbacks::NotifyTransferFinished has been called.
+  bool finish_notified_;
+
+  // True if any of the transfer's bytes were written with MSG_ZEROCOPY.
+  bool used_zerocopy_;
+
+  // See zerocopy_seq_end().
+  uint32_t zerocopy_seq_end_;
+
   DISALLOW_COPY_AND_ASSIGN(OutboundTransfer);
 };
 
@@ -203,6 +289,11 @@ struct TransferCallbacks {
   // The transfer finished successfully.
   virtual void NotifyTransferFinished() = 0;
 
+  // All of the transfer's bytes were written to the socket with MSG_ZEROCOPY,
+  // but the kernel may still read the payload memory, which must remain
+  // intact until NotifyTransferFinished() is called.
+  virtual void NotifyTransferSent() {}
+
   // The transfer was aborted (e.g because the connection died or an error occurred).
   virtual void NotifyTransferAborted(const Status &status) = 0;
 };
@@ -44,6 +44,12 @@ class TlsSocket : public Socket {
 
   Status Recv(uint8_t *buf, int32_t amt, int32_t *nread) override WARN_UNUSED_RESULT;
 
+  // The kernel only sees the encrypted records, which are written from
+  // OpenSSL's own buffers.
+  bool SupportsZeroCopy() const override { return false; }
+
+  bool IsEncrypted() const override { return true; }
+
   Status Close() override WARN_UNUSED_RESULT;
 
  private:
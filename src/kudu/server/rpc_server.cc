@@ -71,6 +71,13 @@ DEFINE_int32(rpc_num_service_threads, 10,
              "Number of RPC worker threads to run");
 TAG_FLAG(rpc_num_service_threads, advanced);
 
+DEFINE_int32(rpc_num_high_priority_service_threads, 2,
+             "Number of RPC worker threads reserved for each service's high "
+             "priority RPCs, such as consensus votes and heartbeats. These "
+             "RPCs are queued separately from the others, so they are not "
+             "delayed behind bulk requests. If 0, all RPCs share one queue.");
+TAG_FLAG(rpc_num_high_priority_service_threads, advanced);
+
 DEFINE_int32(rpc_service_queue_length, 50,
              "Default length of queue for incoming RPC requests");
 TAG_FLAG(rpc_service_queue_length, advanced);
@@ -91,6 +98,7 @@ RpcServerOptions::RpcServerOptions()
     rpc_advertised_addresses(FLAGS_rpc_advertised_addresses),
     num_acceptors_per_address(FLAGS_rpc_num_acceptors_per_address),
     num_service_threads(FLAGS_rpc_num_service_threads),
+    num_high_priority_service_threads(FLAGS_rpc_num_high_priority_service_threads),
     default_port(0),
     service_queue_length(FLAGS_rpc_service_queue_length),
     rpc_reuseport(FLAGS_rpc_reuseport) {
@@ -154,7 +162,8 @@ Status RpcServer::RegisterService(gscoped_ptr<rpc::ServiceIf> service) {
   scoped_refptr<rpc::ServicePool> service_pool =
     new rpc::ServicePool(std::move(service), messenger_->metric_entity(),
                          options_.service_queue_length);
-  RETURN_NOT_OK(service_pool->Init(options_.num_service_threads));
+  RETURN_NOT_OK(service_pool->Init(options_.num_service_threads,
+                                   options_.num_high_priority_service_threads));
   auto* service_pool_raw_ptr = service_pool.get();
   service_pool->set_too_busy_hook([this, service_pool_raw_ptr]() {
       if (too_busy_hook_) {
@@ -50,6 +50,7 @@ struct RpcServerOptions {
   std::string rpc_advertised_addresses;
   uint32_t num_acceptors_per_address;
   uint32_t num_service_threads;
+  uint32_t num_high_priority_service_threads;
   uint16_t default_port;
   size_t service_queue_length;
   bool rpc_reuseport;
@@ -274,6 +274,10 @@ bool ConsensusServiceImpl::AuthorizeServiceUser(const google::protobuf::Message*
   return server_->Authorize(rpc, ServerBase::SUPER_USER | ServerBase::SERVICE_USER);
 }
 
+bool ConsensusServiceImpl::IsHeartbeat(const Slice& serialized_request) const {
+  return RaftConsensus::IsHeartbeatRequest(serialized_request);
+}
+
 void ConsensusServiceImpl::UpdateConsensus(const ConsensusRequestPB* req,
                                            ConsensusResponsePB* resp,
                                            rpc::RpcContext* context) {
@@ -292,7 +296,7 @@ void ConsensusServiceImpl::UpdateConsensus(const ConsensusRequestPB* req,
     return;
   }
 
-  Status s = consensus->Update(req, resp);
+  Status s = consensus->Update(req, resp, context->serialized_request());
   if (PREDICT_FALSE(!s.ok())) {
     // Clear the response first, since a partially-filled response could
     // result in confusing a caller, or in having missing required fields
@@ -505,6 +509,29 @@ void ConsensusServiceImpl::GetLastOpId(const consensus::GetLastOpIdRequestPB *re
   context->RespondSuccess();
 }
 
+void ConsensusServiceImpl::ReadIndex(const consensus::ReadIndexRequestPB* req,
+                                     consensus::ReadIndexResponsePB* resp,
+                                     rpc::RpcContext* context) {
+  DVLOG(3) << "Received ReadIndex RPC: " << SecureDebugString(*req);
+  if (!CheckUuidMatchOrRespond(tablet_manager_, "ReadIndex", req, resp, context)) {
+    return;
+  }
+
+  shared_ptr<RaftConsensus> consensus;
+  if (!GetConsensusOrRespond(tablet_manager_, resp, context, &consensus)) return;
+  consensus->LeaderReadIndexAsync([resp, context](const Status& s, int64_t read_index) {
+    if (PREDICT_FALSE(!s.ok())) {
+      SetupErrorAndRespond(resp->mutable_error(), s,
+                           s.IsIllegalState() ? ServerErrorPB::NOT_THE_LEADER
+                                              : ServerErrorPB::UNKNOWN_ERROR,
+                           context);
+      return;
+    }
+    resp->set_read_index(read_index);
+    context->RespondSuccess();
+  }, context->GetClientDeadline());
+}
+
 void ConsensusServiceImpl::GetConsensusState(const consensus::GetConsensusStateRequestPB* req,
                                              consensus::GetConsensusStateResponsePB* resp,
                                              rpc::RpcContext* context) {
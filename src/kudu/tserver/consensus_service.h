@@ -33,6 +33,7 @@ class Message;
 
 namespace kudu {
 
+class Slice;
 class Status;
 
 namespace server {
@@ -53,6 +54,8 @@ class GetNodeInstanceRequestPB;
 class GetNodeInstanceResponsePB;
 class LeaderStepDownRequestPB;
 class LeaderStepDownResponsePB;
+class ReadIndexRequestPB;
+class ReadIndexResponsePB;
 class RunLeaderElectionRequestPB;
 class RunLeaderElectionResponsePB;
 class StartTabletCopyRequestPB;
@@ -83,6 +86,11 @@ class ConsensusServiceImpl : public consensus::ConsensusServiceIf {
                             google::protobuf::Message* resp,
                             rpc::RpcContext* context) override;
 
+  // Whether 'serialized_request', an UpdateConsensus request, carries no ops
+  // nor compression dictionaries. Only the tags of its top-level fields are
+  // read, so this is cheap regardless of the size of the request.
+  bool IsHeartbeat(const Slice& serialized_request) const override;
+
   virtual void UpdateConsensus(const consensus::ConsensusRequestPB* req,
                                consensus::ConsensusResponsePB* resp,
                                rpc::RpcContext* context) override;
@@ -123,6 +131,10 @@ class ConsensusServiceImpl : public consensus::ConsensusServiceIf {
                            consensus::GetLastOpIdResponsePB* resp,
                            rpc::RpcContext* context) override;
 
+  virtual void ReadIndex(const consensus::ReadIndexRequestPB* req,
+                         consensus::ReadIndexResponsePB* resp,
+                         rpc::RpcContext* context) override;
+
   virtual void GetConsensusState(const consensus::GetConsensusStateRequestPB* req,
                                  consensus::GetConsensusStateResponsePB* resp,
                                  rpc::RpcContext* context) override;
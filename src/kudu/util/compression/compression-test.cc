@@ -18,11 +18,13 @@
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <string>
 #include <vector>
 
 #include <gtest/gtest.h>
 
 #include "kudu/gutil/gscoped_ptr.h"
+#include "kudu/gutil/strings/substitute.h"
 #include "kudu/util/compression/compression.pb.h"
 #include "kudu/util/compression/compression_codec.h"
 #include "kudu/util/slice.h"
@@ -31,7 +33,9 @@
 
 namespace kudu {
 
+using std::string;
 using std::vector;
+using strings::Substitute;
 
 class TestCompression : public KuduTest {};
 
@@ -87,4 +91,59 @@ TEST_F(TestCompression, TestZlibCompressionCodec) {
   TestCompressionCodec(ZLIB);
 }
 
+TEST_F(TestCompression, TestZstdCompressionCodec) {
+  TestCompressionCodec(ZSTD);
+}
+
+TEST_F(TestCompression, TestZstdDictionary) {
+  // Small, similar records are where a dictionary pays off.
+  vector<string> records;
+  for (int i = 0; i < 2000; i++) {
+    records.emplace_back(Substitute(
+        "{\"table\":\"metrics\",\"op\":\"INSERT\",\"host\":\"host-$0.example.com\","
+        "\"ts\":$1,\"value\":$2,\"tags\":[\"region-$3\",\"rack-$4\"]}",
+        i % 50, 1500000000 + i * 17, i * 31 % 1000, i % 4, i % 16));
+  }
+  vector<Slice> samples(records.begin(), records.end());
+  string dictionary;
+  ASSERT_OK(TrainZstdDictionary(samples, 4096, &dictionary));
+  ASSERT_FALSE(dictionary.empty());
+
+  // Only registered dictionaries can be used.
+  const CompressionCodec* dict_codec;
+  uint32_t dict_id;
+  ASSERT_OK(RegisterZstdDictionary(dictionary, &dict_id));
+  ASSERT_NE(0, dict_id);
+  ASSERT_TRUE(GetZstdDictionaryCodec(dict_id + 1, &dict_codec).IsNotFound());
+  ASSERT_OK(GetZstdDictionaryCodec(dict_id, &dict_codec));
+  ASSERT_EQ(ZSTD, dict_codec->type());
+  ASSERT_EQ(dict_id, dict_codec->dictionary_id());
+
+  // Registering the same dictionary again is a no-op.
+  uint32_t dict_id2;
+  ASSERT_OK(RegisterZstdDictionary(dictionary, &dict_id2));
+  ASSERT_EQ(dict_id, dict_id2);
+
+  const CompressionCodec* plain_codec;
+  ASSERT_OK(GetCompressionCodec(ZSTD, &plain_codec));
+  ASSERT_EQ(0, plain_codec->dictionary_id());
+
+  const Slice& input = samples[1234];
+  gscoped_array<uint8_t> cbuffer(new uint8_t[dict_codec->MaxCompressedLength(input.size())]);
+  gscoped_array<uint8_t> ubuffer(new uint8_t[input.size()]);
+  size_t dict_compressed;
+  ASSERT_OK(dict_codec->Compress(input, cbuffer.get(), &dict_compressed));
+
+  // The dictionary id is recorded in the frame, so the plain codec can
+  // uncompress it as well.
+  ASSERT_OK(plain_codec->Uncompress(Slice(cbuffer.get(), dict_compressed),
+                                    ubuffer.get(), input.size()));
+  ASSERT_EQ(0, memcmp(input.data(), ubuffer.get(), input.size()));
+
+  size_t plain_compressed;
+  gscoped_array<uint8_t> pbuffer(new uint8_t[plain_codec->MaxCompressedLength(input.size())]);
+  ASSERT_OK(plain_codec->Compress(input, pbuffer.get(), &plain_compressed));
+  ASSERT_LT(dict_compressed, plain_compressed);
+}
+
 } // namespace kudu
@@ -18,26 +18,64 @@
 #include "kudu/util/compression/compression_codec.h"
 
 #include <memory>
+#include <mutex>
 #include <ostream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <lz4.h>
 #include <snappy-sinksource.h>
 #include <snappy.h>
+#include <zdict.h>
 #include <zlib.h>
+#include <zstd.h>
 
+#include "kudu/gutil/map-util.h"
 #include "kudu/gutil/port.h"
 #include "kudu/gutil/singleton.h"
+#include "kudu/gutil/strings/split.h"
+#include "kudu/gutil/strings/substitute.h"
 #include "kudu/gutil/stringprintf.h"
+#include "kudu/util/env.h"
 #include "kudu/util/faststring.h"
+#include "kudu/util/flag_tags.h"
+#include "kudu/util/locks.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/string_case.h"
+#include "kudu/util/threadlocal.h"
+
+DEFINE_int32(zstd_compression_level, 3,
+             "Compression level used by the zstd codec. Higher levels compress "
+             "better at the cost of speed; negative levels trade ratio for speed.");
+TAG_FLAG(zstd_compression_level, advanced);
+TAG_FLAG(zstd_compression_level, runtime);
+
+static bool ValidateZstdCompressionLevel(const char* flagname, int32_t value) {
+  if (value < ZSTD_minCLevel() || value > ZSTD_maxCLevel()) {
+    LOG(ERROR) << "Invalid value for " << flagname << ": " << value
+               << ", must be between " << ZSTD_minCLevel() << " and " << ZSTD_maxCLevel();
+    return false;
+  }
+  return true;
+}
+DEFINE_validator(zstd_compression_level, &ValidateZstdCompressionLevel);
+
+DEFINE_string(zstd_dictionary_files, "",
+              "Comma-separated list of files containing zstd dictionaries, e.g. "
+              "as produced by TrainZstdDictionary(), which are registered before "
+              "the zstd codec is first used. Data compressed with a dictionary can "
+              "only be uncompressed where it is registered.");
+TAG_FLAG(zstd_dictionary_files, advanced);
 
 namespace kudu {
 
+using std::string;
+using std::unique_ptr;
 using std::vector;
+using strings::Substitute;
 
 CompressionCodec::CompressionCodec() {
 }
@@ -244,6 +282,273 @@ class ZlibCodec : public CompressionCodec {
   }
 };
 
+// Per-thread zstd contexts, which are expensive enough to create that they
+// shouldn't be created for every call.
+struct ZstdContexts {
+  ZstdContexts()
+      : cctx(ZSTD_createCCtx()),
+        dctx(ZSTD_createDCtx()) {
+    CHECK(cctx && dctx) << "could not allocate zstd contexts";
+  }
+  ~ZstdContexts() {
+    ZSTD_freeCCtx(cctx);
+    ZSTD_freeDCtx(dctx);
+  }
+
+  ZSTD_CCtx* cctx;
+  ZSTD_DCtx* dctx;
+};
+
+ZstdContexts* GetZstdContexts() {
+  BLOCK_STATIC_THREAD_LOCAL(ZstdContexts, contexts);
+  return contexts;
+}
+
+// A zstd codec, optionally compressing with a dictionary.
+class ZstdCodec : public CompressionCodec {
+ public:
+  static ZstdCodec *GetSingleton() {
+    return Singleton<ZstdCodec>::get();
+  }
+
+  ZstdCodec()
+      : dict_id_(0),
+        ddict_(nullptr),
+        cdict_level_(0) {
+  }
+
+  ZstdCodec(uint32_t dict_id, string dictionary)
+      : dict_id_(dict_id),
+        dictionary_(std::move(dictionary)),
+        ddict_(ZSTD_createDDict(dictionary_.data(), dictionary_.size())),
+        cdict_level_(0) {
+    CHECK(ddict_) << "could not load zstd dictionary " << dict_id_;
+  }
+
+  ~ZstdCodec() {
+    if (ddict_) {
+      ZSTD_freeDDict(ddict_);
+    }
+  }
+
+  Status Compress(const Slice& input,
+                  uint8_t *compressed, size_t *compressed_length) const override {
+    ZSTD_CCtx* cctx = GetZstdContexts()->cctx;
+    const size_t capacity = MaxCompressedLength(input.size());
+    size_t n;
+    if (dict_id_ == 0) {
+      n = ZSTD_compressCCtx(cctx, compressed, capacity, input.data(), input.size(),
+                            FLAGS_zstd_compression_level);
+    } else {
+      std::shared_ptr<ZSTD_CDict> cdict = GetCDict();
+      n = ZSTD_compress_usingCDict(cctx, compressed, capacity, input.data(), input.size(),
+                                   cdict.get());
+    }
+    if (ZSTD_isError(n)) {
+      return Status::RuntimeError("unable to compress the buffer", ZSTD_getErrorName(n));
+    }
+    *compressed_length = n;
+    return Status::OK();
+  }
+
+  Status Compress(const vector<Slice>& input_slices,
+                  uint8_t *compressed, size_t *compressed_length) const override {
+    if (input_slices.size() == 1) {
+      return Compress(input_slices[0], compressed, compressed_length);
+    }
+
+    SlicesSource source(input_slices);
+    faststring buffer;
+    source.Dump(&buffer);
+    return Compress(Slice(buffer.data(), buffer.size()), compressed, compressed_length);
+  }
+
+  Status Uncompress(const Slice& compressed,
+                    uint8_t *uncompressed, size_t uncompressed_length) const override;
+
+  size_t MaxCompressedLength(size_t source_bytes) const override {
+    return ZSTD_compressBound(source_bytes);
+  }
+
+  CompressionType type() const override {
+    return ZSTD;
+  }
+
+  uint32_t dictionary_id() const override {
+    return dict_id_;
+  }
+
+  const string& dictionary() const {
+    return dictionary_;
+  }
+
+  Status UncompressWithDictionary(const Slice& compressed,
+                                  uint8_t *uncompressed, size_t uncompressed_length) const {
+    DCHECK(ddict_);
+    size_t n = ZSTD_decompress_usingDDict(GetZstdContexts()->dctx,
+                                          uncompressed, uncompressed_length,
+                                          compressed.data(), compressed.size(), ddict_);
+    return CheckUncompressed(n, uncompressed_length);
+  }
+
+  static Status CheckUncompressed(size_t n, size_t uncompressed_length) {
+    if (ZSTD_isError(n)) {
+      return Status::Corruption("unable to uncompress the buffer", ZSTD_getErrorName(n));
+    }
+    if (n != uncompressed_length) {
+      return Status::Corruption(Substitute("uncompressed $0 bytes, expected $1",
+                                           n, uncompressed_length));
+    }
+    return Status::OK();
+  }
+
+ private:
+  // Returns the digested dictionary for the current compression level,
+  // rebuilding it if the level changed.
+  std::shared_ptr<ZSTD_CDict> GetCDict() const {
+    const int level = FLAGS_zstd_compression_level;
+    std::lock_guard<simple_spinlock> l(cdict_lock_);
+    if (!cdict_ || cdict_level_ != level) {
+      ZSTD_CDict* cdict = ZSTD_createCDict(dictionary_.data(), dictionary_.size(), level);
+      CHECK(cdict) << "could not load zstd dictionary " << dict_id_;
+      cdict_.reset(cdict, ZSTD_freeCDict);
+      cdict_level_ = level;
+    }
+    return cdict_;
+  }
+
+  const uint32_t dict_id_;
+  const string dictionary_;
+  ZSTD_DDict* const ddict_;
+
+  mutable simple_spinlock cdict_lock_;
+  mutable std::shared_ptr<ZSTD_CDict> cdict_;
+  mutable int cdict_level_;
+};
+
+// The zstd dictionaries registered in this process, keyed by id.
+class ZstdDictionaryRegistry {
+ public:
+  static ZstdDictionaryRegistry *GetSingleton() {
+    return Singleton<ZstdDictionaryRegistry>::get();
+  }
+
+  Status Register(const Slice& dictionary, uint32_t* dict_id) {
+    uint32_t id = ZDICT_getDictID(dictionary.data(), dictionary.size());
+    if (id == 0) {
+      return Status::InvalidArgument("not a zstd dictionary");
+    }
+    std::lock_guard<simple_spinlock> l(lock_);
+    const auto& existing = FindOrNull(codecs_, id);
+    if (existing) {
+      if ((*existing)->dictionary() != dictionary) {
+        return Status::IllegalState(
+            Substitute("a different zstd dictionary with id $0 is already registered", id));
+      }
+    } else {
+      codecs_.emplace(id, unique_ptr<ZstdCodec>(new ZstdCodec(id, dictionary.ToString())));
+    }
+    *dict_id = id;
+    return Status::OK();
+  }
+
+  const ZstdCodec* Find(uint32_t dict_id) {
+    std::lock_guard<simple_spinlock> l(lock_);
+    const auto& codec = FindOrNull(codecs_, dict_id);
+    return codec ? codec->get() : nullptr;
+  }
+
+ private:
+  friend class Singleton<ZstdDictionaryRegistry>;
+
+  ZstdDictionaryRegistry() {
+    vector<string> paths = strings::Split(FLAGS_zstd_dictionary_files, ",",
+                                          strings::SkipEmpty());
+    for (const string& path : paths) {
+      faststring dictionary;
+      uint32_t dict_id;
+      Status s = ReadFileToString(Env::Default(), path, &dictionary);
+      if (s.ok()) {
+        s = Register(Slice(dictionary), &dict_id);
+      }
+      if (!s.ok()) {
+        LOG(ERROR) << "Unable to load zstd dictionary from " << path << ": " << s.ToString();
+        continue;
+      }
+      LOG(INFO) << "Loaded zstd dictionary " << dict_id << " from " << path;
+    }
+  }
+
+  simple_spinlock lock_;
+  std::unordered_map<uint32_t, unique_ptr<ZstdCodec>> codecs_;
+};
+
+Status ZstdCodec::Uncompress(const Slice& compressed,
+                             uint8_t *uncompressed, size_t uncompressed_length) const {
+  // The frame says which dictionary, if any, it was compressed with.
+  uint32_t frame_dict_id = ZSTD_getDictID_fromFrame(compressed.data(), compressed.size());
+  if (frame_dict_id == 0) {
+    size_t n = ZSTD_decompressDCtx(GetZstdContexts()->dctx,
+                                   uncompressed, uncompressed_length,
+                                   compressed.data(), compressed.size());
+    return CheckUncompressed(n, uncompressed_length);
+  }
+  if (frame_dict_id == dict_id_) {
+    return UncompressWithDictionary(compressed, uncompressed, uncompressed_length);
+  }
+  const ZstdCodec* codec = ZstdDictionaryRegistry::GetSingleton()->Find(frame_dict_id);
+  if (!codec) {
+    return Status::NotFound(
+        Substitute("unable to uncompress the buffer: zstd dictionary $0 is not registered",
+                   frame_dict_id));
+  }
+  return codec->UncompressWithDictionary(compressed, uncompressed, uncompressed_length);
+}
+
+Status TrainZstdDictionary(const vector<Slice>& samples, size_t max_size,
+                           string* dictionary) {
+  // The trainer takes the samples concatenated in a single buffer.
+  faststring buffer;
+  vector<size_t> sample_sizes;
+  sample_sizes.reserve(samples.size());
+  for (const Slice& sample : samples) {
+    buffer.append(sample.data(), sample.size());
+    sample_sizes.push_back(sample.size());
+  }
+
+  dictionary->resize(max_size);
+  size_t n = ZDICT_trainFromBuffer(&(*dictionary)[0], max_size, buffer.data(),
+                                   sample_sizes.data(), sample_sizes.size());
+  if (ZDICT_isError(n)) {
+    dictionary->clear();
+    return Status::InvalidArgument("unable to train zstd dictionary", ZDICT_getErrorName(n));
+  }
+  dictionary->resize(n);
+  return Status::OK();
+}
+
+Status RegisterZstdDictionary(const Slice& dictionary, uint32_t* dict_id) {
+  return ZstdDictionaryRegistry::GetSingleton()->Register(dictionary, dict_id);
+}
+
+Status GetZstdDictionaryCodec(uint32_t dict_id, const CompressionCodec** codec) {
+  const ZstdCodec* c = ZstdDictionaryRegistry::GetSingleton()->Find(dict_id);
+  if (!c) {
+    return Status::NotFound(Substitute("zstd dictionary $0 is not registered", dict_id));
+  }
+  *codec = c;
+  return Status::OK();
+}
+
+Status GetZstdDictionary(uint32_t dict_id, Slice* dictionary) {
+  const ZstdCodec* c = ZstdDictionaryRegistry::GetSingleton()->Find(dict_id);
+  if (!c) {
+    return Status::NotFound(Substitute("zstd dictionary $0 is not registered", dict_id));
+  }
+  *dictionary = Slice(c->dictionary());
+  return Status::OK();
+}
+
 Status GetCompressionCodec(CompressionType compression,
                            const CompressionCodec** codec) {
   switch (compression) {
@@ -259,6 +564,9 @@ Status GetCompressionCodec(CompressionType compression,
     case ZLIB:
       *codec = ZlibCodec::GetSingleton();
       break;
+    case ZSTD:
+      *codec = ZstdCodec::GetSingleton();
+      break;
     default:
       return Status::NotFound("bad compression type");
   }
@@ -275,6 +583,8 @@ CompressionType GetCompressionCodecType(const std::string& name) {
     return LZ4;
   if (uname == "ZLIB")
     return ZLIB;
+  if (uname == "ZSTD")
+    return ZSTD;
   if (uname == "NONE")
     return NO_COMPRESSION;
 
@@ -61,6 +61,10 @@ class CompressionCodec {
 
   // Return the type of compression implemented by this codec.
   virtual CompressionType type() const = 0;
+
+  // Return the id of the dictionary this codec compresses with, or 0 if it
+  // does not use one.
+  virtual uint32_t dictionary_id() const { return 0; }
  private:
   DISALLOW_COPY_AND_ASSIGN(CompressionCodec);
 };
@@ -74,5 +78,34 @@ Status GetCompressionCodec(CompressionType compression,
 // Returns the compression codec type given the name
 CompressionType GetCompressionCodecType(const std::string& name);
 
+// Zstandard dictionaries.
+//
+// Data compressed with a dictionary records the dictionary's id in its zstd
+// frame header. The ZSTD codec returned by GetCompressionCodec() uncompresses
+// such data as long as the dictionary was registered in this process first,
+// either with RegisterZstdDictionary() or through --zstd_dictionary_files.
+
+// Trains a zstd dictionary of at most 'max_size' bytes on 'samples', which
+// should be representative of the data to be compressed with it.
+Status TrainZstdDictionary(const std::vector<Slice>& samples, size_t max_size,
+                           std::string* dictionary);
+
+// Registers 'dictionary' for use by the ZSTD codecs, setting 'dict_id' to its
+// id. Registering a dictionary with an id already in use is a no-op, unless
+// the contents differ, in which case IllegalState is returned.
+Status RegisterZstdDictionary(const Slice& dictionary, uint32_t* dict_id);
+
+// Returns a ZSTD codec which compresses with the registered dictionary
+// 'dict_id'. Returns NotFound if no such dictionary was registered.
+//
+// Like the codecs returned by GetCompressionCodec(), the returned codec is
+// never destroyed.
+Status GetZstdDictionaryCodec(uint32_t dict_id, const CompressionCodec** codec);
+
+// Sets 'dictionary' to the contents of the registered dictionary 'dict_id',
+// which remain valid for the life of the process. Returns NotFound if no such
+// dictionary was registered.
+Status GetZstdDictionary(uint32_t dict_id, Slice* dictionary);
+
 } // namespace kudu
 #endif
@@ -654,6 +654,81 @@ TEST_F(TestEnv, TestReopen) {
   ASSERT_EQ(first + second, s.ToString());
 }
 
+TEST_F(TestEnv, TestOverwriteExisting) {
+  string test_path = GetTestPath("test_env_wf");
+  ASSERT_NO_FATAL_FAILURE(WriteTestFile(env_, test_path, 4096));
+
+  // Reopen the file to overwrite it from the start. Its old contents should
+  // be treated as preallocated space.
+  WritableFileOptions opts;
+  opts.mode = Env::OPEN_EXISTING;
+  opts.overwrite_existing = true;
+  shared_ptr<WritableFile> writer;
+  ASSERT_OK(env_util::OpenFileForWrite(opts, env_, test_path, &writer));
+  ASSERT_EQ(0, writer->Size());
+  string data = "The quick brown fox";
+  ASSERT_OK(writer->Append(data));
+  ASSERT_EQ(data.length(), writer->Size());
+  uint64_t size;
+  ASSERT_OK(env_->GetFileSize(test_path, &size));
+  ASSERT_EQ(4096, size);
+
+  // Closing the file truncates away the rest of the old contents.
+  ASSERT_OK(writer->Close());
+  faststring contents;
+  ASSERT_OK(ReadFileToString(env_, test_path, &contents));
+  ASSERT_EQ(data, contents.ToString());
+}
+
+TEST_F(TestEnv, TestIoUringWritableFile) {
+  string test_path = GetTestPath("test_env_io_uring");
+  WritableFileOptions opts;
+  opts.use_io_uring = true;
+  opts.direct_io = true;
+  unique_ptr<WritableFile> writer;
+  Status s = env_->NewWritableFile(opts, test_path, &writer);
+  // Skip if the kernel lacks io_uring (ENOSYS), a sandbox forbids it (EPERM),
+  // or the filesystem doesn't support O_DIRECT (EINVAL). Other errors fail.
+  if (s.IsNotSupported() ||
+      (s.IsIOError() && (s.posix_code() == ENOSYS || s.posix_code() == EPERM ||
+                         s.posix_code() == EINVAL))) {
+    LOG(INFO) << "io_uring writable files not available, skipping: " << s.ToString();
+    return;
+  }
+  ASSERT_OK(s);
+
+  // Write a mix of unaligned appends, interleaving flushes and syncs so that
+  // partial tail blocks are carried across writes.
+  string expected;
+  Random rng(SeedRandom());
+  for (int i = 0; i < 200; i++) {
+    string chunk(1 + rng.Uniform(10000), static_cast<char>('a' + (i % 26)));
+    ASSERT_OK(writer->Append(chunk));
+    expected += chunk;
+    ASSERT_EQ(expected.size(), writer->Size());
+    if (i % 7 == 0) {
+      ASSERT_OK(writer->Flush(WritableFile::FLUSH_ASYNC));
+    } else if (i % 11 == 0) {
+      ASSERT_OK(writer->Sync());
+    }
+  }
+  ASSERT_OK(writer->Close());
+
+  // Reopen it and append some more to exercise reading back the tail block.
+  WritableFileOptions reopen_opts = opts;
+  reopen_opts.mode = Env::OPEN_EXISTING;
+  ASSERT_OK(env_->NewWritableFile(reopen_opts, test_path, &writer));
+  ASSERT_EQ(expected.size(), writer->Size());
+  string tail = "jumps over the lazy dog";
+  ASSERT_OK(writer->Append(tail));
+  expected += tail;
+  ASSERT_OK(writer->Close());
+
+  faststring contents;
+  ASSERT_OK(ReadFileToString(env_, test_path, &contents));
+  ASSERT_EQ(expected, contents.ToString());
+}
+
 TEST_F(TestEnv, TestIsDirectory) {
   string dir = GetTestPath("a_directory");
   ASSERT_OK(env_->CreateDir(dir));
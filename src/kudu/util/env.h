@@ -454,9 +454,25 @@ struct WritableFileOptions {
   // See CreateMode for details.
   Env::CreateMode mode;
 
+  // Write the file through io_uring, buffering appends until the file is
+  // flushed or synced. Opening the file fails with NotSupported if this build
+  // has no io_uring support.
+  bool use_io_uring;
+
+  // Only valid with 'use_io_uring': bypass the page cache using O_DIRECT.
+  bool direct_io;
+
+  // Only valid with OPEN_EXISTING: start writing at offset 0 rather than at
+  // the end of the file. The existing contents are treated as preallocated
+  // space; they are overwritten by appends and truncated away on Close().
+  bool overwrite_existing;
+
   WritableFileOptions()
     : sync_on_close(false),
-      mode(Env::CREATE_IF_NON_EXISTING_TRUNCATE) { }
+      mode(Env::CREATE_IF_NON_EXISTING_TRUNCATE),
+      use_io_uring(false),
+      direct_io(false),
+      overwrite_existing(false) { }
 };
 
 // Options specified when a file is opened for random access.
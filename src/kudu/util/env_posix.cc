@@ -17,6 +17,7 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cerrno>
 #include <cstdint>
 #include <cstdio>
@@ -54,6 +55,7 @@
 #include "kudu/util/fault_injection.h"
 #include "kudu/util/flag_tags.h"
 #include "kudu/util/flags.h"
+#include "kudu/util/io_uring.h"
 #include "kudu/util/logging.h"
 #include "kudu/util/malloc.h"
 #include "kudu/util/monotime.h"
@@ -174,6 +176,13 @@ DEFINE_bool(never_fsync, false,
 TAG_FLAG(never_fsync, advanced);
 TAG_FLAG(never_fsync, unsafe);
 
+DEFINE_int32(env_io_uring_buffer_size_kb, 1024,
+              "Size of the aligned staging buffer used by io_uring-backed "
+              "writable files. Appends are accumulated in this buffer and "
+              "written out when it fills up or when the file is synced.");
+TAG_FLAG(env_io_uring_buffer_size_kb, advanced);
+TAG_FLAG(env_io_uring_buffer_size_kb, experimental);
+
 DEFINE_int32(env_inject_short_read_bytes, 0,
              "The number of bytes less than the requested bytes to read");
 TAG_FLAG(env_inject_short_read_bytes, hidden);
@@ -641,12 +650,12 @@ class PosixRandomAccessFile: public RandomAccessFile {
 class PosixWritableFile : public WritableFile {
  public:
   PosixWritableFile(string fname, int fd, uint64_t file_size,
-                    bool sync_on_close)
+                    uint64_t pre_allocated_size, bool sync_on_close)
       : filename_(std::move(fname)),
         fd_(fd),
         sync_on_close_(sync_on_close),
         filesize_(file_size),
-        pre_allocated_size_(0),
+        pre_allocated_size_(pre_allocated_size),
         pending_sync_(false),
         closed_(false) {}
 
@@ -759,8 +768,7 @@ class PosixWritableFile : public WritableFile {
     TRACE_EVENT1("io", "PosixWritableFile::Sync", "path", filename_);
     ThreadRestrictions::AssertIOAllowed();
     LOG_SLOW_EXECUTION(WARNING, 1000, Substitute("sync call for $0", filename_)) {
-      if (pending_sync_) {
-        pending_sync_ = false;
+      if (pending_sync_.exchange(false)) {
         RETURN_NOT_OK(DoSync(fd_, filename_));
       }
     }
@@ -780,9 +788,319 @@ class PosixWritableFile : public WritableFile {
 
   uint64_t filesize_;
   uint64_t pre_allocated_size_;
+
+  // Atomic so that Sync() may be called from a different thread than the
+  // one appending (e.g. the WAL's pipelined group commit). Appends which race
+  // with an in-flight Sync() simply leave the flag set for the next one.
+  std::atomic<bool> pending_sync_;
+  bool closed_;
+};
+
+#if defined(KUDU_HAVE_IO_URING)
+// A WritableFile which writes through a private io_uring instance.
+//
+// Appends are copied into an aligned staging buffer, which is registered with
+// the ring when RLIMIT_MEMLOCK allows it, and are only written out when the
+// buffer fills up, on Flush(), or on Sync(). Sync() submits the write and
+// the fdatasync as linked entries in a single io_uring_enter(2) call. Data
+// appended since the last Flush() or Sync() is therefore not visible to
+// readers of the file until one of those is called.
+//
+// Writes always cover whole kAlignment-sized blocks, so the file may be
+// opened with O_DIRECT to keep its data out of the page cache. The partial
+// block at the end of the file is zero-padded on disk and kept in the staging
+// buffer to be rewritten by the next write. Close() truncates the padding.
+//
+// Like PosixWritableFile, this class is not thread-safe.
+class PosixIoUringWritableFile : public WritableFile {
+ public:
+  // The alignment of the offset and length of every write. This is large
+  // enough for O_DIRECT on both 512-byte and 4KiB logical block devices.
+  static constexpr size_t kAlignment = 4096;
+
+  PosixIoUringWritableFile(string fname, int fd, uint64_t file_size,
+                           uint64_t pre_allocated_size, bool sync_on_close)
+      : filename_(std::move(fname)),
+        fd_(fd),
+        sync_on_close_(sync_on_close),
+        buf_(nullptr),
+        buf_capacity_(0),
+        buf_file_offset_(file_size & ~(kAlignment - 1)),
+        buf_len_(0),
+        buf_registered_(false),
+        buf_dirty_(false),
+        filesize_(file_size),
+        disk_size_(file_size),
+        pre_allocated_size_(pre_allocated_size),
+        pending_sync_(false),
+        closed_(false) {}
+
+  ~PosixIoUringWritableFile() {
+    WARN_NOT_OK(Close(), "Failed to close " + filename_);
+    free(buf_);
+  }
+
+  Status Init() {
+    RETURN_NOT_OK(ring_.Init(kRingEntries));
+    buf_capacity_ = std::max<size_t>(
+        kAlignment, (FLAGS_env_io_uring_buffer_size_kb * 1024L) & ~(kAlignment - 1));
+    if (posix_memalign(reinterpret_cast<void**>(&buf_), kAlignment, buf_capacity_) != 0) {
+      return Status::RuntimeError("could not allocate io_uring staging buffer");
+    }
+    struct iovec iov = { buf_, buf_capacity_ };
+    Status s = ring_.RegisterBuffers(&iov, 1);
+    if (s.ok()) {
+      buf_registered_ = true;
+    } else {
+      KLOG_FIRST_N(WARNING, 1) << "Falling back to unregistered io_uring buffers: "
+                               << s.ToString();
+    }
+
+    // When reopening an existing file whose size is not aligned, the head of
+    // the staging buffer must hold the existing partial block.
+    buf_len_ = filesize_ - buf_file_offset_;
+    if (buf_len_ > 0) {
+      Slice tail(buf_, buf_len_);
+      RETURN_NOT_OK(DoReadV(fd_, filename_, buf_file_offset_, ArrayView<Slice>(&tail, 1)));
+    }
+    return Status::OK();
+  }
+
+  virtual Status Append(const Slice& data) override {
+    return AppendV(ArrayView<const Slice>(&data, 1));
+  }
+
+  virtual Status AppendV(ArrayView<const Slice> data) override {
+    ThreadRestrictions::AssertIOAllowed();
+    DCHECK(!closed_);
+    for (const Slice& slice : data) {
+      const uint8_t* src = slice.data();
+      size_t rem = slice.size();
+      while (rem > 0) {
+        if (buf_len_ == buf_capacity_) {
+          RETURN_NOT_OK(WriteBuffer(false));
+        }
+        size_t n = std::min(rem, buf_capacity_ - buf_len_);
+        memcpy(buf_ + buf_len_, src, n);
+        buf_len_ += n;
+        src += n;
+        rem -= n;
+        buf_dirty_ = true;
+      }
+      filesize_ += slice.size();
+    }
+    return Status::OK();
+  }
+
+  virtual Status PreAllocate(uint64_t size) override {
+    MAYBE_RETURN_EIO(filename_, IOError(Env::kInjectedFailureStatusMsg, EIO));
+
+    TRACE_EVENT1("io", "PosixIoUringWritableFile::PreAllocate", "path", filename_);
+    ThreadRestrictions::AssertIOAllowed();
+    uint64_t offset = std::max(filesize_, pre_allocated_size_);
+    int ret;
+    RETRY_ON_EINTR(ret, fallocate(fd_, 0, offset, size));
+    if (ret != 0) {
+      if (errno == EOPNOTSUPP) {
+        KLOG_FIRST_N(WARNING, 1) << "The filesystem does not support fallocate().";
+      } else if (errno == ENOSYS) {
+        KLOG_FIRST_N(WARNING, 1) << "The kernel does not implement fallocate().";
+      } else {
+        return IOError(filename_, errno);
+      }
+    }
+    pre_allocated_size_ = offset + size;
+    return Status::OK();
+  }
+
+  virtual Status Close() override {
+    if (closed_) {
+      return Status::OK();
+    }
+    TRACE_EVENT1("io", "PosixIoUringWritableFile::Close", "path", filename_);
+    ThreadRestrictions::AssertIOAllowed();
+    MAYBE_RETURN_EIO(filename_, IOError(Env::kInjectedFailureStatusMsg, EIO));
+    Status s = WriteBuffer(false);
+
+    // Drop the zero padding of the last block, as well as any preallocated
+    // space which was never used.
+    if (s.ok() && (filesize_ < disk_size_ || filesize_ < pre_allocated_size_)) {
+      int ret;
+      RETRY_ON_EINTR(ret, ftruncate(fd_, filesize_));
+      if (ret != 0) {
+        s = IOError(filename_, errno);
+      }
+      pending_sync_ = true;
+    }
+
+    if (sync_on_close_ && pending_sync_) {
+      Status sync_status = DoSync(fd_, filename_);
+      if (!sync_status.ok()) {
+        LOG(ERROR) << "Unable to Sync " << filename_ << ": " << sync_status.ToString();
+        if (s.ok()) {
+          s = sync_status;
+        }
+      }
+      pending_sync_ = false;
+    }
+
+    int ret;
+    RETRY_ON_EINTR(ret, close(fd_));
+    if (ret < 0) {
+      if (s.ok()) {
+        s = IOError(filename_, errno);
+      }
+    }
+
+    closed_ = true;
+    return s;
+  }
+
+  virtual Status Flush(FlushMode /* mode */) override {
+    TRACE_EVENT1("io", "PosixIoUringWritableFile::Flush", "path", filename_);
+    MAYBE_RETURN_EIO(filename_, IOError(Env::kInjectedFailureStatusMsg, EIO));
+    ThreadRestrictions::AssertIOAllowed();
+    // Writes are waited on before returning, so both modes are synchronous.
+    return WriteBuffer(false);
+  }
+
+  virtual Status Sync() override {
+    TRACE_EVENT1("io", "PosixIoUringWritableFile::Sync", "path", filename_);
+    ThreadRestrictions::AssertIOAllowed();
+    LOG_SLOW_EXECUTION(WARNING, 1000, Substitute("sync call for $0", filename_)) {
+      RETURN_NOT_OK(WriteBuffer(true));
+    }
+    return Status::OK();
+  }
+
+  virtual uint64_t Size() const override {
+    return filesize_;
+  }
+
+  virtual const string& filename() const override { return filename_; }
+
+ private:
+  // Entries needed by the largest submission: one write and one fsync.
+  static constexpr uint32_t kRingEntries = 2;
+
+  // Writes the dirty part of the staging buffer, zero-padded to a block
+  // boundary, and if 'sync' is true links an fdatasync behind it. Afterwards,
+  // the trailing partial block (if any) is moved to the head of the buffer.
+  Status WriteBuffer(bool sync) {
+    MAYBE_RETURN_EIO(filename_, IOError(Env::kInjectedFailureStatusMsg, EIO));
+    sync &= !FLAGS_never_fsync;
+    bool do_write = buf_dirty_;
+    bool do_sync = sync && (do_write || pending_sync_);
+    if (!do_write && !do_sync) {
+      return Status::OK();
+    }
+
+    size_t padded_len = (buf_len_ + kAlignment - 1) & ~(kAlignment - 1);
+    struct iovec iov = { buf_, padded_len };
+    uint32_t num_sqes = 0;
+    if (do_write) {
+      memset(buf_ + buf_len_, 0, padded_len - buf_len_);
+      struct io_uring_sqe* sqe = ring_.GetSqe();
+      DCHECK(sqe);
+      sqe->fd = fd_;
+      sqe->off = buf_file_offset_;
+      if (buf_registered_) {
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->addr = reinterpret_cast<uint64_t>(buf_);
+        sqe->len = padded_len;
+        sqe->buf_index = 0;
+      } else {
+        sqe->opcode = IORING_OP_WRITEV;
+        sqe->addr = reinterpret_cast<uint64_t>(&iov);
+        sqe->len = 1;
+      }
+      if (do_sync) {
+        sqe->flags |= IOSQE_IO_LINK;
+      }
+      num_sqes++;
+    }
+    if (do_sync) {
+      struct io_uring_sqe* sqe = ring_.GetSqe();
+      DCHECK(sqe);
+      sqe->opcode = IORING_OP_FSYNC;
+      sqe->fd = fd_;
+      sqe->fsync_flags = FLAGS_env_use_fsync ? 0 : IORING_FSYNC_DATASYNC;
+      sqe->user_data = 1;
+      num_sqes++;
+      TRACE_COUNTER_INCREMENT(FLAGS_env_use_fsync ? "fsync" : "fdatasync", 1);
+    }
+
+    RETURN_NOT_OK(ring_.SubmitAndWait(num_sqes));
+    Status s;
+    struct io_uring_cqe cqe;
+    for (uint32_t i = 0; i < num_sqes; i++) {
+      // SubmitAndWait() only returns once all of them have completed.
+      if (PREDICT_FALSE(!ring_.PopCqe(&cqe))) {
+        return Status::IOError(Substitute("missing io_uring completion for $0: got $1 of $2",
+                                          filename_, i, num_sqes));
+      }
+      bool is_sync = cqe.user_data == 1;
+      if (cqe.res < 0) {
+        if (s.ok()) s = IOError(filename_, -cqe.res);
+      } else if (!is_sync && static_cast<size_t>(cqe.res) != padded_len) {
+        if (s.ok()) {
+          s = Status::IOError(Substitute("short write to $0: wrote $1 of $2 bytes",
+                                         filename_, cqe.res, padded_len));
+        }
+      }
+    }
+    RETURN_NOT_OK(s);
+
+    if (do_write) {
+      disk_size_ = std::max<uint64_t>(disk_size_, buf_file_offset_ + padded_len);
+      size_t tail_start = buf_len_ & ~(kAlignment - 1);
+      size_t tail_len = buf_len_ - tail_start;
+      if (tail_start > 0) {
+        memmove(buf_, buf_ + tail_start, tail_len);
+      }
+      buf_file_offset_ += tail_start;
+      buf_len_ = tail_len;
+      buf_dirty_ = false;
+    }
+    pending_sync_ = !do_sync;
+    return Status::OK();
+  }
+
+  const string filename_;
+  const int fd_;
+  const bool sync_on_close_;
+
+  IoUring ring_;
+
+  // The aligned staging buffer, and its size.
+  uint8_t* buf_;
+  size_t buf_capacity_;
+
+  // The block-aligned file offset which corresponds to the start of 'buf_'.
+  uint64_t buf_file_offset_;
+
+  // The number of valid bytes in 'buf_', including a carried-over partial block.
+  size_t buf_len_;
+
+  // Whether 'buf_' has been registered with 'ring_'.
+  bool buf_registered_;
+
+  // Whether 'buf_' has data which has not been written yet.
+  bool buf_dirty_;
+
+  // The logical size of the file, including data still in 'buf_'.
+  uint64_t filesize_;
+
+  // The size of the file on disk, including the zero padding of the last block.
+  uint64_t disk_size_;
+
+  uint64_t pre_allocated_size_;
+
+  // Whether data has been written since the last fsync.
   bool pending_sync_;
   bool closed_;
 };
+#endif // defined(KUDU_HAVE_IO_URING)
 
 class PosixRWFile : public RWFile {
  public:
@@ -1787,13 +2105,56 @@ class PosixEnv : public Env {
                                     const WritableFileOptions& opts,
                                     unique_ptr<WritableFile>* result) {
     uint64_t file_size = 0;
+    uint64_t pre_allocated_size = 0;
     if (opts.mode == OPEN_EXISTING) {
       RETURN_NOT_OK(GetFileSize(fname, &file_size));
+      if (opts.overwrite_existing) {
+        pre_allocated_size = file_size;
+        file_size = 0;
+      }
+    }
+    if (opts.use_io_uring) {
+      return InstantiateNewIoUringWritableFile(fname, fd, file_size, pre_allocated_size,
+                                               opts, result);
     }
-    result->reset(new PosixWritableFile(fname, fd, file_size, opts.sync_on_close));
+    result->reset(new PosixWritableFile(fname, fd, file_size, pre_allocated_size,
+                                        opts.sync_on_close));
     return Status::OK();
   }
 
+  Status InstantiateNewIoUringWritableFile(const string& fname,
+                                           int fd,
+                                           uint64_t file_size,
+                                           uint64_t pre_allocated_size,
+                                           const WritableFileOptions& opts,
+                                           unique_ptr<WritableFile>* result) {
+    // Make sure 'fd' is closed on failure; on success it is owned by the file.
+    auto close_fd = MakeScopedCleanup([&]() {
+      int err;
+      RETRY_ON_EINTR(err, close(fd));
+    });
+#if defined(KUDU_HAVE_IO_URING)
+    close_fd.cancel();
+    unique_ptr<PosixIoUringWritableFile> file(
+        new PosixIoUringWritableFile(fname, fd, file_size, pre_allocated_size,
+                                     opts.sync_on_close));
+    RETURN_NOT_OK_PREPEND(file->Init(), Substitute("could not set up io_uring for $0", fname));
+    // Only switch to O_DIRECT once Init() has read back any existing partial
+    // block, which would otherwise need an aligned read.
+    if (opts.direct_io) {
+      int flags = fcntl(fd, F_GETFL);
+      if (flags < 0 || fcntl(fd, F_SETFL, flags | O_DIRECT) < 0) {
+        return IOError(Substitute("could not enable O_DIRECT on $0", fname), errno);
+      }
+    }
+    result->reset(file.release());
+    return Status::OK();
+#else
+    return Status::NotSupported("io_uring is not supported by this build");
+#endif
+
+  }
+
   Status DeleteRecursivelyCb(FileType type, const string& dirname, const string& basename) {
     string full_path = JoinPathSegments(dirname, basename);
     Status s;
@@ -0,0 +1,243 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include "kudu/util/io_uring.h"
+
+#if defined(KUDU_HAVE_IO_URING)
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <glog/logging.h>
+
+#include "kudu/util/errno.h"
+
+// Older libc headers may not know about the io_uring system calls, even when
+// the kernel headers do. The numbers are the same on every architecture we
+// build for.
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+#ifndef __NR_io_uring_register
+#define __NR_io_uring_register 427
+#endif
+
+namespace kudu {
+
+namespace {
+
+int sys_io_uring_setup(unsigned entries, struct io_uring_params* p) {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+  return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                                  flags, nullptr, 0));
+}
+
+int sys_io_uring_register(int fd, unsigned opcode, const void* arg, unsigned nr_args) {
+  return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+template<class T>
+T* RingPtr(void* ring, uint32_t offset) {
+  return reinterpret_cast<T*>(static_cast<char*>(ring) + offset);
+}
+
+} // anonymous namespace
+
+IoUring::IoUring()
+    : ring_fd_(-1),
+      sq_ring_(MAP_FAILED),
+      sq_ring_size_(0),
+      cq_ring_(MAP_FAILED),
+      cq_ring_size_(0),
+      sqes_(static_cast<struct io_uring_sqe*>(MAP_FAILED)),
+      sqes_size_(0),
+      sq_head_(nullptr),
+      sq_tail_(nullptr),
+      sq_ring_mask_(nullptr),
+      sq_ring_entries_(nullptr),
+      sq_array_(nullptr),
+      cq_head_(nullptr),
+      cq_tail_(nullptr),
+      cq_ring_mask_(nullptr),
+      cqes_(nullptr),
+      sqe_head_(0),
+      sqe_tail_(0) {
+}
+
+IoUring::~IoUring() {
+  Unmap();
+  if (ring_fd_ >= 0) {
+    close(ring_fd_);
+  }
+}
+
+void IoUring::Unmap() {
+  if (sqes_ != MAP_FAILED) {
+    munmap(sqes_, sqes_size_);
+    sqes_ = static_cast<struct io_uring_sqe*>(MAP_FAILED);
+  }
+  if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) {
+    munmap(cq_ring_, cq_ring_size_);
+  }
+  cq_ring_ = MAP_FAILED;
+  if (sq_ring_ != MAP_FAILED) {
+    munmap(sq_ring_, sq_ring_size_);
+    sq_ring_ = MAP_FAILED;
+  }
+}
+
+Status IoUring::Init(uint32_t entries) {
+  DCHECK_LT(ring_fd_, 0) << "Already initialized";
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  int fd = sys_io_uring_setup(entries, &p);
+  if (fd < 0) {
+    int err = errno;
+    return Status::IOError("io_uring_setup failed", ErrnoToString(err), err);
+  }
+  ring_fd_ = fd;
+
+  sq_ring_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cq_ring_size_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap) {
+    sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+  }
+
+  sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  if (sq_ring_ == MAP_FAILED) {
+    int err = errno;
+    return Status::IOError("could not map io_uring submission ring", ErrnoToString(err), err);
+  }
+  if (single_mmap) {
+    cq_ring_ = sq_ring_;
+  } else {
+    cq_ring_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+    if (cq_ring_ == MAP_FAILED) {
+      int err = errno;
+      return Status::IOError("could not map io_uring completion ring", ErrnoToString(err), err);
+    }
+  }
+  sqes_size_ = p.sq_entries * sizeof(struct io_uring_sqe);
+  void* sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    int err = errno;
+    return Status::IOError("could not map io_uring submission entries", ErrnoToString(err), err);
+  }
+  sqes_ = static_cast<struct io_uring_sqe*>(sqes);
+
+  sq_head_ = RingPtr<unsigned>(sq_ring_, p.sq_off.head);
+  sq_tail_ = RingPtr<unsigned>(sq_ring_, p.sq_off.tail);
+  sq_ring_mask_ = RingPtr<unsigned>(sq_ring_, p.sq_off.ring_mask);
+  sq_ring_entries_ = RingPtr<unsigned>(sq_ring_, p.sq_off.ring_entries);
+  sq_array_ = RingPtr<unsigned>(sq_ring_, p.sq_off.array);
+  cq_head_ = RingPtr<unsigned>(cq_ring_, p.cq_off.head);
+  cq_tail_ = RingPtr<unsigned>(cq_ring_, p.cq_off.tail);
+  cq_ring_mask_ = RingPtr<unsigned>(cq_ring_, p.cq_off.ring_mask);
+  cqes_ = RingPtr<struct io_uring_cqe>(cq_ring_, p.cq_off.cqes);
+  return Status::OK();
+}
+
+Status IoUring::RegisterBuffers(const struct iovec* iovs, unsigned nr_iovs) {
+  DCHECK_GE(ring_fd_, 0);
+  if (sys_io_uring_register(ring_fd_, IORING_REGISTER_BUFFERS, iovs, nr_iovs) < 0) {
+    int err = errno;
+    return Status::IOError("could not register io_uring buffers", ErrnoToString(err), err);
+  }
+  return Status::OK();
+}
+
+struct io_uring_sqe* IoUring::GetSqe() {
+  DCHECK_GE(ring_fd_, 0);
+  unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  if (sqe_tail_ - head >= *sq_ring_entries_) {
+    return nullptr;
+  }
+  struct io_uring_sqe* sqe = &sqes_[sqe_tail_ & *sq_ring_mask_];
+  sqe_tail_++;
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+Status IoUring::SubmitAndWait(uint32_t wait_nr) {
+  DCHECK_GE(ring_fd_, 0);
+  // Publish the locally prepared entries to the kernel.
+  unsigned tail = *sq_tail_;
+  unsigned to_submit = sqe_tail_ - sqe_head_;
+  const unsigned mask = *sq_ring_mask_;
+  for (; sqe_head_ != sqe_tail_; sqe_head_++, tail++) {
+    sq_array_[tail & mask] = sqe_head_ & mask;
+  }
+  __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+
+  while (to_submit > 0) {
+    unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+    int ret = sys_io_uring_enter(ring_fd_, to_submit, wait_nr, flags);
+    if (ret < 0) {
+      if (errno == EINTR) continue;
+      int err = errno;
+      return Status::IOError("io_uring_enter failed", ErrnoToString(err), err);
+    }
+    to_submit -= std::min<unsigned>(ret, to_submit);
+  }
+
+  // If the wait is interrupted (e.g. by a signal), io_uring_enter() still
+  // returns the number of entries it submitted, so keep waiting until the
+  // completions are actually there.
+  while (CqReady() < wait_nr) {
+    int ret = sys_io_uring_enter(ring_fd_, 0, wait_nr, IORING_ENTER_GETEVENTS);
+    if (ret < 0) {
+      if (errno == EINTR) continue;
+      int err = errno;
+      return Status::IOError("io_uring_enter failed", ErrnoToString(err), err);
+    }
+  }
+  return Status::OK();
+}
+
+unsigned IoUring::CqReady() const {
+  return __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE) - *cq_head_;
+}
+
+bool IoUring::PopCqe(struct io_uring_cqe* cqe) {
+  DCHECK_GE(ring_fd_, 0);
+  unsigned head = *cq_head_;
+  if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+    return false;
+  }
+  *cqe = cqes_[head & *cq_ring_mask_];
+  __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+} // namespace kudu
+
+#endif // defined(KUDU_HAVE_IO_URING)
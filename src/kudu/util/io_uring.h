@@ -0,0 +1,108 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+#ifndef KUDU_UTIL_IO_URING_H
+#define KUDU_UTIL_IO_URING_H
+
+#if defined(KUDU_HAVE_IO_URING)
+
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "kudu/gutil/macros.h"
+#include "kudu/util/status.h"
+
+namespace kudu {
+
+// A minimal wrapper around a Linux io_uring instance.
+//
+// This talks to the kernel through the raw io_uring system calls rather than
+// liburing, and only implements what is needed to batch a few submissions and
+// wait for their completions from a single thread. It is not thread-safe.
+//
+// Only available when built against kernel headers which provide
+// <linux/io_uring.h> (see KUDU_HAVE_IO_URING).
+class IoUring {
+ public:
+  IoUring();
+  ~IoUring();
+
+  // Sets up the ring with room for at least 'entries' submissions.
+  Status Init(uint32_t entries);
+
+  // Registers 'iovs' as fixed buffers, for use by IORING_OP_WRITE_FIXED and
+  // IORING_OP_READ_FIXED with 'buf_index' set to the position in 'iovs'.
+  //
+  // May fail, e.g. if RLIMIT_MEMLOCK is too low, in which case the caller
+  // should fall back to unregistered buffers.
+  Status RegisterBuffers(const struct iovec* iovs, unsigned nr_iovs);
+
+  // Returns a zeroed submission queue entry to be filled in by the caller, or
+  // nullptr if the submission queue is full. Entries are not visible to the
+  // kernel until SubmitAndWait() is called.
+  struct io_uring_sqe* GetSqe();
+
+  // Submits all entries obtained via GetSqe() since the last call, then
+  // waits until at least 'wait_nr' completions are available.
+  Status SubmitAndWait(uint32_t wait_nr);
+
+  // Pops the next completion into 'cqe'. Returns false if there is none.
+  bool PopCqe(struct io_uring_cqe* cqe);
+
+ private:
+  void Unmap();
+
+  // Returns the number of completions available to PopCqe().
+  unsigned CqReady() const;
+
+  int ring_fd_;
+
+  // The mmapped submission and completion rings. These may be the same
+  // mapping if the kernel supports IORING_FEAT_SINGLE_MMAP.
+  void* sq_ring_;
+  size_t sq_ring_size_;
+  void* cq_ring_;
+  size_t cq_ring_size_;
+
+  // The mmapped array of submission queue entries.
+  struct io_uring_sqe* sqes_;
+  size_t sqes_size_;
+
+  // Pointers into the shared rings.
+  unsigned* sq_head_;
+  unsigned* sq_tail_;
+  unsigned* sq_ring_mask_;
+  unsigned* sq_ring_entries_;
+  unsigned* sq_array_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned* cq_ring_mask_;
+  struct io_uring_cqe* cqes_;
+
+  // Local view of the entries handed out by GetSqe() but not yet submitted.
+  unsigned sqe_head_;
+  unsigned sqe_tail_;
+
+  DISALLOW_COPY_AND_ASSIGN(IoUring);
+};
+
+} // namespace kudu
+
+#endif // defined(KUDU_HAVE_IO_URING)
+#endif // KUDU_UTIL_IO_URING_H
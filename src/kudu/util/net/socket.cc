@@ -18,6 +18,9 @@
 #include "kudu/util/net/socket.h"
 
 #include <fcntl.h>
+#if defined(__linux__)
+#include <linux/errqueue.h>
+#endif
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <sys/socket.h>
@@ -48,6 +51,23 @@
 #include "kudu/util/random_util.h"
 #include "kudu/util/slice.h"
 
+// Older system headers may lack the MSG_ZEROCOPY definitions, which are
+// available since Linux 4.14.
+#if defined(__linux__)
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+#endif // defined(__linux__)
+
 DEFINE_string(local_ip_for_outbound_sockets, "",
               "IP to bind to when making outgoing socket connections. "
               "This must be an IP address of the form A.B.C.D, not a hostname. "
@@ -60,6 +80,12 @@ DEFINE_bool(socket_inject_short_recvs, false,
 TAG_FLAG(socket_inject_short_recvs, hidden);
 TAG_FLAG(socket_inject_short_recvs, unsafe);
 
+DEFINE_double(socket_inject_zerocopy_enobufs_fraction, 0.0,
+              "Fraction of MSG_ZEROCOPY writes which fail with ENOBUFS, as they "
+              "do when the socket's optmem limit is exceeded");
+TAG_FLAG(socket_inject_zerocopy_enobufs_fraction, hidden);
+TAG_FLAG(socket_inject_zerocopy_enobufs_fraction, unsafe);
+
 using std::string;
 using strings::Substitute;
 
@@ -178,6 +204,17 @@ Status Socket::SetTcpCork(bool enabled) {
   return Status::OK();
 }
 
+Status Socket::SetZeroCopy(bool enabled) {
+#if defined(__linux__)
+  int flag = enabled ? 1 : 0;
+  RETURN_NOT_OK_PREPEND(SetSockOpt(SOL_SOCKET, SO_ZEROCOPY, flag),
+                        "failed to set SO_ZEROCOPY");
+  return Status::OK();
+#else
+  return Status::NotSupported("MSG_ZEROCOPY is only supported on Linux");
+#endif // defined(__linux__)
+}
+
 Status Socket::SetNonBlocking(bool enabled) {
   int curflags = ::fcntl(fd_, F_GETFL, 0);
   if (curflags == -1) {
@@ -255,6 +292,15 @@ Status Socket::SetReusePort(bool flag) {
   #endif
 }
 
+Status Socket::SetAbortOnClose() {
+  struct linger linger;
+  linger.l_onoff = 1;
+  linger.l_linger = 0;
+  RETURN_NOT_OK_PREPEND(SetSockOpt(SOL_SOCKET, SO_LINGER, linger),
+                        "failed to set SO_LINGER");
+  return Status::OK();
+}
+
 Status Socket::BindAndListen(const Sockaddr &sockaddr,
                              int listen_queue_size) {
   RETURN_NOT_OK(SetReuseAddr(true));
@@ -428,6 +474,69 @@ Status Socket::Write(const uint8_t *buf, int32_t amt, int32_t *nwritten) {
 
 Status Socket::Writev(const struct ::iovec *iov, int iov_len,
                       int64_t *nwritten) {
+  return SendMsg(iov, iov_len, MSG_NOSIGNAL, nwritten);
+}
+
+Status Socket::WritevZeroCopy(const struct ::iovec *iov, int iov_len,
+                              int64_t *nwritten) {
+#if defined(__linux__)
+  if (PREDICT_FALSE(FLAGS_socket_inject_zerocopy_enobufs_fraction > 0)) {
+    Random r(GetRandomSeed32());
+    if (r.NextDoubleFraction() < FLAGS_socket_inject_zerocopy_enobufs_fraction) {
+      return Status::NetworkError("sendmsg error", ErrnoToString(ENOBUFS), ENOBUFS);
+    }
+  }
+  return SendMsg(iov, iov_len, MSG_NOSIGNAL | MSG_ZEROCOPY, nwritten);
+#else
+  return Status::NotSupported("MSG_ZEROCOPY is only supported on Linux");
+#endif // defined(__linux__)
+}
+
+Status Socket::RecvZeroCopyCompletions(std::vector<std::pair<uint32_t, uint32_t>>* completed,
+                                       bool* copied) {
+#if defined(__linux__)
+  DCHECK_GE(fd_, 0);
+  while (true) {
+    uint8_t control[CMSG_SPACE(sizeof(struct sock_extended_err)) +
+                    CMSG_SPACE(sizeof(struct sockaddr_in6))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(struct msghdr));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t res;
+    RETRY_ON_EINTR(res, ::recvmsg(fd_, &msg, MSG_ERRQUEUE));
+    if (res < 0) {
+      int err = errno;
+      if (err == EAGAIN || err == EWOULDBLOCK) {
+        // The error queue is drained.
+        return Status::OK();
+      }
+      return Status::NetworkError("recvmsg error queue error", ErrnoToString(err), err);
+    }
+    for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != nullptr; cm = CMSG_NXTHDR(&msg, cm)) {
+      if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+          !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+        continue;
+      }
+      const auto* serr = reinterpret_cast<const struct sock_extended_err*>(CMSG_DATA(cm));
+      if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+        continue;
+      }
+      // 'ee_info' and 'ee_data' are the first and last IDs of a range of
+      // consecutive completed writes.
+      completed->emplace_back(serr->ee_info, serr->ee_data);
+      if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+        *copied = true;
+      }
+    }
+  }
+#else
+  return Status::NotSupported("MSG_ZEROCOPY is only supported on Linux");
+#endif // defined(__linux__)
+}
+
+Status Socket::SendMsg(const struct ::iovec *iov, int iov_len, int flags,
+                       int64_t *nwritten) {
   if (PREDICT_FALSE(iov_len <= 0)) {
     return Status::NetworkError(
                 StringPrintf("writev: invalid io vector length of %d",
@@ -441,7 +550,7 @@ Status Socket::Writev(const struct ::iovec *iov, int iov_len,
   msg.msg_iov = const_cast<iovec *>(iov);
   msg.msg_iovlen = iov_len;
   ssize_t res;
-  RETRY_ON_EINTR(res, ::sendmsg(fd_, &msg, MSG_NOSIGNAL));
+  RETRY_ON_EINTR(res, ::sendmsg(fd_, &msg, flags));
   if (PREDICT_FALSE(res < 0)) {
     int err = errno;
     return Status::NetworkError("sendmsg error", ErrnoToString(err), err);
@@ -19,6 +19,8 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <utility>
+#include <vector>
 
 #include "kudu/gutil/macros.h"
 #include "kudu/util/status.h"
@@ -72,6 +74,10 @@ class Socket {
   // Set or clear TCP_CORK
   Status SetTcpCork(bool enabled);
 
+  // Set or clear SO_ZEROCOPY, which WritevZeroCopy() requires. Fails on
+  // kernels without MSG_ZEROCOPY support (before Linux 4.14).
+  Status SetZeroCopy(bool enabled);
+
   // Set or clear O_NONBLOCK
   Status SetNonBlocking(bool enabled);
   Status IsNonBlocking(bool* is_nonblock) const;
@@ -88,6 +94,10 @@ class Socket {
   // Sets SO_REUSEPORT to 'flag'. Should be used prior to Bind().
   Status SetReusePort(bool flag);
 
+  // Sets SO_LINGER with a timeout of 0, so that Close() resets the connection
+  // and discards any data not yet sent, rather than sending it.
+  Status SetAbortOnClose();
+
   // Convenience method to invoke the common sequence:
   // 1) SetReuseAddr(true)
   // 2) Bind()
@@ -136,6 +146,34 @@ class Socket {
   // bytes must be retried. See writev(2) for more information.
   virtual Status Writev(const struct ::iovec *iov, int iov_len, int64_t *nwritten);
 
+  // Returns true if WritevZeroCopy() may be used on this socket, i.e. the
+  // bytes written reach the wire unmodified.
+  virtual bool SupportsZeroCopy() const { return true; }
+
+  // Returns true if the bytes written are encrypted before they reach the wire.
+  virtual bool IsEncrypted() const { return false; }
+
+  // Like Writev(), but with MSG_ZEROCOPY: the kernel may send the data straight
+  // from the memory in 'iov' rather than copying it, so that memory must be
+  // neither modified nor freed until the write is reported as completed by
+  // RecvZeroCopyCompletions(). Requires SetZeroCopy(true).
+  //
+  // Each successful call is assigned the next of the socket's write IDs,
+  // which start at 0 and wrap around at 2^32.
+  //
+  // Fails with ENOBUFS when the socket's optmem limit (net.core.optmem_max)
+  // is exceeded by the writes awaiting completion. The write may then be
+  // retried with Writev().
+  Status WritevZeroCopy(const struct ::iovec *iov, int iov_len, int64_t *nwritten);
+
+  // Reads the pending completion notifications of zero-copy writes from the
+  // socket's error queue, without blocking. Appends the inclusive ranges of
+  // the completed write IDs to 'completed'. Sets 'copied' to true if the
+  // kernel had to copy the data of any of these writes anyway (e.g. on
+  // loopback), in which case zero-copy writes bring no benefit on this socket.
+  Status RecvZeroCopyCompletions(std::vector<std::pair<uint32_t, uint32_t>>* completed,
+                                 bool* copied);
+
   // Blocking Write call, returns IOError unless full buffer is sent.
   // Underlying Socket expected to be in blocking mode. Fails if any Write() sends 0 bytes.
   // Returns OK if buflen bytes were sent, otherwise IOError.
@@ -160,6 +198,9 @@ class Socket {
   // Called internally during socket setup.
   Status SetCloseOnExec();
 
+  // Called internally from Writev() and WritevZeroCopy().
+  Status SendMsg(const struct ::iovec *iov, int iov_len, int flags, int64_t *nwritten);
+
   // Bind the socket to a local address before making an outbound connection,
   // based on the value of FLAGS_local_ip_for_outbound_sockets.
   Status BindForOutgoingConnection();
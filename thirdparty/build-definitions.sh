@@ -534,6 +534,20 @@ build_lz4() {
   popd
 }
 
+build_zstd() {
+  ZSTD_BDIR=$TP_BUILD_DIR/$ZSTD_NAME$MODE_SUFFIX
+  mkdir -p $ZSTD_BDIR
+  pushd $ZSTD_BDIR
+
+  # The makefile builds in the source tree, so copy the sources over to keep
+  # the instrumented and uninstrumented builds apart.
+  rsync -av --delete $ZSTD_SOURCE/ .
+
+  CFLAGS="$EXTRA_CFLAGS -fPIC" \
+    make -C lib -j$PARALLEL $EXTRA_MAKEFLAGS install-static install-includes PREFIX=$PREFIX
+  popd
+}
+
 build_bitshuffle() {
   BITSHUFFLE_BDIR=$TP_BUILD_DIR/$BITSHUFFLE_NAME$MODE_SUFFIX
   mkdir -p $BITSHUFFLE_BDIR
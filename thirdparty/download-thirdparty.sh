@@ -344,6 +344,12 @@ fetch_and_patch \
  $LZ4_PATCHLEVEL \
  "patch -p1 < $TP_DIR/patches/lz4-0001-Fix-cmake-build-to-use-gnu-flags-on-clang.patch"
 
+ZSTD_PATCHLEVEL=0
+fetch_and_patch \
+ zstd-${ZSTD_VERSION}.tar.gz \
+ $ZSTD_SOURCE \
+ $ZSTD_PATCHLEVEL
+
 : '
 BITSHUFFLE_PATCHLEVEL=0
 fetch_and_patch \